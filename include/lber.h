@@ -137,8 +137,12 @@ typedef struct lber_memory_fns {
 /* Only meaningful ifdef LDAP_PF_LOCAL_SENDMSG */
 #define LBER_SB_OPT_UNGET_BUF 15
 
+/* Turn the readahead buffer into a ring of the given size, for
+ * ber_get_next() to decode PDUs in place */
+#define LBER_SB_OPT_SET_READAHEAD_RING 16
+
 /* Largest option used by the library */
-#define LBER_SB_OPT_OPT_MAX 15
+#define LBER_SB_OPT_OPT_MAX 16
 
 /* LBER IO operations stacking levels */
 #define LBER_SBIOD_LEVEL_PROVIDER 10
@@ -434,6 +438,18 @@ ber_sockbuf_remove_io(Sockbuf *sb, Sockbuf_IO *sbio, int layer);
 LBER_F(int)
 ber_sockbuf_ctrl(Sockbuf *sb, int opt, void *arg);
 
+/* Receiving into the readahead ring from outside, for asynchronous I/O:
+ * lend its free space, then account for what was received into it and
+ * give the token back. */
+LBER_F(int)
+ber_sockbuf_ring_lend(Sockbuf *sb, struct berval *space, void **token);
+
+LBER_F(int)
+ber_sockbuf_ring_fill(Sockbuf *sb, void *token, struct berval *data);
+
+LBER_F(void)
+ber_sockbuf_ring_return(void *token);
+
 LBER_V(Sockbuf_IO) ber_sockbuf_io_tcp;
 LBER_V(Sockbuf_IO) ber_sockbuf_io_readahead;
 LBER_V(Sockbuf_IO) ber_sockbuf_io_fd;
@@ -130,13 +130,13 @@ LDAP_SLAPD_V(int) slap_syslog_severity;
     if (ldap_debug_mask & (level))                                             \
       ldap_debug_print(__VA_ARGS__);                                           \
     if (slap_syslog_mask & (level))                                            \
-      syslog(LDAP_LEVEL_MASK((severity)), __VA_ARGS__);                        \
+      ldap_debug_syslog(LDAP_LEVEL_MASK((severity)), __VA_ARGS__);             \
   } while (0)
 #elif !defined(LDAP_DEBUG) && (defined(LDAP_SYSLOG) && defined(SLAP_INSIDE))
 #define Log(level, severity, ...)                                              \
   do {                                                                         \
     if (slap_syslog_mask & (level))                                            \
-      syslog(LDAP_LEVEL_MASK((severity)), __VA_ARGS__);                        \
+      ldap_debug_syslog(LDAP_LEVEL_MASK((severity)), __VA_ARGS__);             \
   } while (0)
 #else
 #define Log(level, severity, ...)                                              \
@@ -162,6 +162,14 @@ ldap_debug_print(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
 
 LDAP_LUTIL_F(void) ldap_debug_va(const char *fmt, va_list args);
 
+LDAP_LUTIL_F(void)
+ldap_debug_syslog(int prio, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+/* size > 0 makes the output asynchronous, using per-thread rings of
+ * the given size and a writer thread; 0 drains the rings and stops it */
+LDAP_LUTIL_F(int) ldap_debug_async(size_t size);
+
 LDAP_LUTIL_F(void) ldap_debug_lock(void);
 LDAP_LUTIL_F(int) ldap_debug_trylock(void);
 LDAP_LUTIL_F(void) ldap_debug_unlock(void);
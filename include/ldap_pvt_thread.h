@@ -229,6 +229,37 @@ ldap_pvt_thread_pool_maxthreads(ldap_pvt_thread_pool_t *pool, int max_threads);
 LDAP_F(int)
 ldap_pvt_thread_pool_queues(ldap_pvt_thread_pool_t *pool, int numqs);
 
+/* ldap_pvt_thread_pool_sched() flags */
+#define LDAP_PVT_THREAD_POOL_STEAL 0x1 /* idle threads take others' tasks */
+#define LDAP_PVT_THREAD_POOL_PIN 0x2   /* bind each queue's threads to a CPU */
+
+LDAP_F(int)
+ldap_pvt_thread_pool_sched(ldap_pvt_thread_pool_t *pool, int flags);
+
+/* Priority classes, 0 is the highest and used by plain submit */
+#define LDAP_PVT_THREAD_POOL_MAX_CLASSES 8
+
+#ifndef LDAP_PVT_THREAD_H_DONE
+typedef struct ldap_pvt_thread_pool_class_s {
+  int ltc_share;    /* percent of the threads the class may occupy */
+  int ltc_pending;  /* max pending tasks, 0 for no limit of its own */
+  int ltc_target;   /* queue delay target in ms, 0 to never shed load */
+  int ltc_interval; /* ms the delay may stay above target */
+} ldap_pvt_thread_pool_class_t;
+#endif /* !LDAP_PVT_THREAD_H_DONE */
+
+LDAP_F(int)
+ldap_pvt_thread_pool_classes(ldap_pvt_thread_pool_t *pool, int nclasses,
+                             const ldap_pvt_thread_pool_class_t *classes);
+
+LDAP_F(int)
+ldap_pvt_thread_pool_admit(ldap_pvt_thread_pool_t *pool, int cls);
+
+LDAP_F(int)
+ldap_pvt_thread_pool_submit_class(ldap_pvt_thread_pool_t *pool, int cls,
+                                  ldap_pvt_thread_start_t *start, void *arg,
+                                  void **cookie);
+
 #ifndef LDAP_PVT_THREAD_H_DONE
 typedef enum {
   LDAP_PVT_THREAD_POOL_PARAM_UNKNOWN = -1,
@@ -270,6 +270,13 @@
       (head)->stqh_last = &(head)->stqh_first;                                 \
   } while (0)
 
+#define LDAP_STAILQ_REMOVE_AFTER(head, elm, field)                             \
+  do {                                                                         \
+    if (((elm)->field.stqe_next = (elm)->field.stqe_next->field.stqe_next) ==  \
+        NULL)                                                                  \
+      (head)->stqh_last = &(elm)->field.stqe_next;                             \
+  } while (0)
+
 #define LDAP_STAILQ_REMOVE_HEAD_UNTIL(head, elm, field)                        \
   do {                                                                         \
     if (((head)->stqh_first = (elm)->field.stqe_next) == NULL)                 \
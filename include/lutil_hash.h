@@ -21,9 +21,11 @@
 LDAP_BEGIN_DECL
 
 #define LUTIL_HASH_BYTES 4
+#define LUTIL_HASH64_BYTES 8
 
 struct lutil_HASHContext {
   ber_uint_t hash;
+  uint64_t hash64;
 };
 
 LDAP_LUTIL_F(void)
@@ -37,6 +39,20 @@ LDAP_LUTIL_F(void)
 lutil_HASHFinal(unsigned char digest[LUTIL_HASH_BYTES],
                 struct lutil_HASHContext *context);
 
+LDAP_LUTIL_F(void)
+lutil_HASH64Init(struct lutil_HASHContext *context);
+
+LDAP_LUTIL_F(void)
+lutil_HASH64Update(struct lutil_HASHContext *context, unsigned char const *buf,
+                   ber_len_t len);
+
+LDAP_LUTIL_F(void)
+lutil_HASH64Final(unsigned char digest[LUTIL_HASH64_BYTES],
+                  struct lutil_HASHContext *context);
+
+LDAP_LUTIL_F(uint64_t)
+lutil_hash64(const void *buf, size_t len, uint64_t seed);
+
 typedef struct lutil_HASHContext lutil_HASH_CTX;
 
 LDAP_END_DECL
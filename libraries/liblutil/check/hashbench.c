@@ -0,0 +1,161 @@
+/* $ReOpenLDAP$ */
+/* Copyright 2017-2018 ReOpenLDAP AUTHORS: please see AUTHORS file.
+ * All rights reserved.
+ *
+ * This file is part of ReOpenLDAP.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+/* Micro-benchmark of the index key hashes.
+ *
+ * usage: hashbench [values]
+ *
+ * The 64-bit hash is checked against the reference xxHash64 vectors,
+ * then both hashes are timed over values of typical attribute lengths
+ * the way the matching rule indexers feed them: a common prefix (the
+ * syntax and rule OIDs) followed by the value. Last, distinct values
+ * are hashed to count those sharing a key with another value; each is
+ * a false positive candidate the backend must fetch and filter out. */
+
+#include "reldap.h"
+
+#include <stdio.h>
+#include <ac/stdlib.h>
+#include <ac/string.h>
+#include <ac/time.h>
+
+#include "lutil_hash.h"
+
+static const struct {
+  const char *s;
+  uint64_t h;
+} vectors[] = {{"", 0xEF46DB3751D8E999ull},
+               {"a", 0xD24EC4F1A98C6E5Bull},
+               {"abc", 0x44BC2CF5AD770999ull},
+               {NULL, 0}};
+
+static const char prefix[] = "1.3.6.1.4.1.1466.115.121.1.15"
+                             "2.5.13.2";
+
+static double now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static uint64_t key32(const unsigned char *val, size_t len) {
+  lutil_HASH_CTX ctx;
+  unsigned char digest[LUTIL_HASH_BYTES];
+
+  lutil_HASHInit(&ctx);
+  lutil_HASHUpdate(&ctx, (const unsigned char *)prefix, sizeof(prefix) - 1);
+  lutil_HASHUpdate(&ctx, val, len);
+  lutil_HASHFinal(digest, &ctx);
+  return digest[0] | digest[1] << 8 | digest[2] << 16 |
+         (uint64_t)digest[3] << 24;
+}
+
+static uint64_t key64(const unsigned char *val, size_t len) {
+  lutil_HASH_CTX ctx;
+  unsigned char digest[LUTIL_HASH64_BYTES];
+  uint64_t h = 0;
+  int i;
+
+  lutil_HASH64Init(&ctx);
+  lutil_HASH64Update(&ctx, (const unsigned char *)prefix, sizeof(prefix) - 1);
+  lutil_HASH64Update(&ctx, val, len);
+  lutil_HASH64Final(digest, &ctx);
+  for (i = LUTIL_HASH64_BYTES; i--;)
+    h = h << 8 | digest[i];
+  return h;
+}
+
+static int cmp64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+/* number of keys shared by more than one value */
+static unsigned long shared(uint64_t *keys, unsigned long n) {
+  unsigned long i, c = 0;
+
+  qsort(keys, n, sizeof(*keys), cmp64);
+  for (i = 1; i < n; i++)
+    if (keys[i] == keys[i - 1])
+      c += (i == 1 || keys[i - 1] != keys[i - 2]) ? 2 : 1;
+  return c;
+}
+
+int main(int argc, char **argv) {
+  static const size_t lens[] = {4, 16, 64, 256, 0};
+  static unsigned char val[256];
+  unsigned long n = 1000000, i, rounds = 2000000;
+  uint64_t *keys, sink = 0;
+  const size_t *lp;
+  double t0, t32, t64;
+  int fail = 0;
+
+  if (argc > 1)
+    n = strtoul(argv[1], NULL, 0);
+  if (n < 2)
+    n = 2;
+
+  for (i = 0; vectors[i].s; i++) {
+    uint64_t h = lutil_hash64(vectors[i].s, strlen(vectors[i].s), 0);
+    if (h != vectors[i].h) {
+      printf("xxh64(\"%s\") = %016llx, expected %016llx\n", vectors[i].s,
+             (unsigned long long)h, (unsigned long long)vectors[i].h);
+      fail = 1;
+    }
+  }
+
+  for (i = 0; i < sizeof(val); i++)
+    val[i] = 'a' + i % 26;
+
+  printf("%-6s %10s %10s\n", "length", "fnv32 ns", "xxh64 ns");
+  for (lp = lens; *lp; lp++) {
+    t0 = now();
+    for (i = 0; i < rounds; i++) {
+      val[0] = i;
+      sink += key32(val, *lp);
+    }
+    t32 = now() - t0;
+    t0 = now();
+    for (i = 0; i < rounds; i++) {
+      val[0] = i;
+      sink += key64(val, *lp);
+    }
+    t64 = now() - t0;
+    printf("%-6zu %10.2f %10.2f\n", *lp, t32 / rounds, t64 / rounds);
+  }
+
+  keys = malloc(n * sizeof(*keys));
+  if (!keys)
+    return EXIT_FAILURE;
+  printf("%lu distinct values, keys shared with another value:\n", n);
+  for (i = 0; i < n; i++) {
+    int len = snprintf((char *)val, sizeof(val), "user%lu", i);
+    keys[i] = key32(val, len);
+  }
+  printf("  fnv32 %lu\n", shared(keys, n));
+  for (i = 0; i < n; i++) {
+    int len = snprintf((char *)val, sizeof(val), "user%lu", i);
+    keys[i] = key64(val, len);
+  }
+  printf("  xxh64 %lu\n", shared(keys, n));
+  free(keys);
+
+  /* keep the timed loops from being optimized away */
+  if (sink == 1)
+    printf("\n");
+  return fail ? EXIT_FAILURE : EXIT_SUCCESS;
+}
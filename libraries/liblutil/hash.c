@@ -16,6 +16,9 @@
 /* This implements the Fowler / Noll / Vo (FNV-1) hash algorithm.
  * A summary of the algorithm can be found at:
  *   http://www.isthe.com/chongo/tech/comp/fnv/index.html
+ *
+ * The 64-bit variant is xxHash64, described at:
+ *   https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md
  */
 
 #include "reldap.h"
@@ -63,3 +66,124 @@ void lutil_HASHFinal(unsigned char *digest, struct lutil_HASHContext *ctx) {
   digest[2] = (h >> 16) & 0xffU;
   digest[3] = (h >> 24) & 0xffU;
 }
+
+/* primes of xxHash64 */
+#define PRIME64_1 0x9E3779B185EBCA87ull
+#define PRIME64_2 0xC2B2AE3D27D4EB4Full
+#define PRIME64_3 0x165667B19E3779F9ull
+#define PRIME64_4 0x85EBCA77C2B2AE63ull
+#define PRIME64_5 0x27D4EB2F165667C5ull
+
+#define ROTL64(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+/* values are read little-endian, so that keys do not depend on the host */
+static __inline uint64_t read64(const unsigned char *p) {
+  uint64_t v;
+
+  __builtin_memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  v = __builtin_bswap64(v);
+#endif
+  return v;
+}
+
+static __inline uint64_t read32(const unsigned char *p) {
+  uint32_t v;
+
+  __builtin_memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  v = __builtin_bswap32(v);
+#endif
+  return v;
+}
+
+static __inline uint64_t xxh64_round(uint64_t acc, uint64_t input) {
+  acc += input * PRIME64_2;
+  acc = ROTL64(acc, 31);
+  return acc * PRIME64_1;
+}
+
+static __inline uint64_t xxh64_merge(uint64_t acc, uint64_t val) {
+  acc ^= xxh64_round(0, val);
+  return acc * PRIME64_1 + PRIME64_4;
+}
+
+/*
+ * One-shot xxHash64 of buf, keyed by seed
+ */
+uint64_t lutil_hash64(const void *buf, size_t len, uint64_t seed) {
+  const unsigned char *p = buf, *e = p + len;
+  uint64_t h;
+
+  if (len >= 32) {
+    uint64_t v1 = seed + PRIME64_1 + PRIME64_2;
+    uint64_t v2 = seed + PRIME64_2;
+    uint64_t v3 = seed;
+    uint64_t v4 = seed - PRIME64_1;
+
+    do {
+      v1 = xxh64_round(v1, read64(p));
+      v2 = xxh64_round(v2, read64(p + 8));
+      v3 = xxh64_round(v3, read64(p + 16));
+      v4 = xxh64_round(v4, read64(p + 24));
+      p += 32;
+    } while (p + 32 <= e);
+
+    h = ROTL64(v1, 1) + ROTL64(v2, 7) + ROTL64(v3, 12) + ROTL64(v4, 18);
+    h = xxh64_merge(h, v1);
+    h = xxh64_merge(h, v2);
+    h = xxh64_merge(h, v3);
+    h = xxh64_merge(h, v4);
+  } else {
+    h = seed + PRIME64_5;
+  }
+
+  h += len;
+  for (; p + 8 <= e; p += 8) {
+    h ^= xxh64_round(0, read64(p));
+    h = ROTL64(h, 27) * PRIME64_1 + PRIME64_4;
+  }
+  if (p + 4 <= e) {
+    h ^= read32(p) * PRIME64_1;
+    h = ROTL64(h, 23) * PRIME64_2 + PRIME64_3;
+    p += 4;
+  }
+  for (; p < e; p++) {
+    h ^= *p * PRIME64_5;
+    h = ROTL64(h, 11) * PRIME64_1;
+  }
+
+  h ^= h >> 33;
+  h *= PRIME64_2;
+  h ^= h >> 29;
+  h *= PRIME64_3;
+  h ^= h >> 32;
+  return h;
+}
+
+/*
+ * Initialize 64-bit context
+ */
+void lutil_HASH64Init(struct lutil_HASHContext *ctx) { ctx->hash64 = 0; }
+
+/*
+ * Update 64-bit hash: each chunk is hashed keyed by the state so far,
+ * so that copying a context after a common prefix stays cheap.
+ */
+void lutil_HASH64Update(struct lutil_HASHContext *ctx, const unsigned char *buf,
+                        ber_len_t len) {
+  ctx->hash64 = lutil_hash64(buf, len, ctx->hash64);
+}
+
+/*
+ * Save 64-bit hash
+ */
+void lutil_HASH64Final(unsigned char *digest, struct lutil_HASHContext *ctx) {
+  uint64_t h = ctx->hash64;
+  int i;
+
+  for (i = 0; i < LUTIL_HASH64_BYTES; i++) {
+    digest[i] = h & 0xffU;
+    h >>= 8;
+  }
+}
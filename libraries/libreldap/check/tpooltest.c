@@ -0,0 +1,130 @@
+/* $ReOpenLDAP$ */
+/* Copyright 1992-2018 ReOpenLDAP AUTHORS: please see AUTHORS file.
+ * All rights reserved.
+ *
+ * This file is part of ReOpenLDAP.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+/* Checks of the thread pool with work stealing.
+ *
+ * usage: tpooltest [threads [queues]]
+ *
+ * Trees of tasks are run twice, without and with stealing: each task
+ * submits two children from its pool thread, which then land in the
+ * worker deques. Every task must run exactly once, and none while a
+ * task of the tree holds the pool paused. */
+
+#include "reldap.h"
+
+#include <stdio.h>
+#include <ac/stdlib.h>
+#include <ac/string.h>
+#include <ac/time.h>
+#include <ac/unistd.h>
+
+#include "ldap_pvt_thread.h"
+
+#define ROOTS 64
+#define DEPTH 10 /* a tree holds 2^(DEPTH+1)-1 tasks */
+#define TREE ((2 << DEPTH) - 1)
+#define PAUSES 8
+
+static ldap_pvt_thread_pool_t pool;
+static volatile long done, leaves, failed, paused, pauses;
+
+static void *run_pause(void *ctx, void *arg) {
+  long before;
+
+  if (ldap_pvt_thread_pool_pause(&pool) != 0) {
+    __sync_fetch_and_add(&failed, 1);
+    return NULL;
+  }
+  paused = 1;
+  before = done;
+  usleep(2000);
+  if (done != before)
+    __sync_fetch_and_add(&failed, 1);
+  paused = 0;
+  ldap_pvt_thread_pool_resume(&pool);
+  __sync_fetch_and_add(&pauses, 1);
+  return NULL;
+}
+
+static void *run_node(void *ctx, void *arg) {
+  long depth = (long)arg;
+
+  if (paused)
+    __sync_fetch_and_add(&failed, 1);
+  if (depth > 0) {
+    if (ldap_pvt_thread_pool_submit(&pool, run_node, (void *)(depth - 1)) ||
+        ldap_pvt_thread_pool_submit(&pool, run_node, (void *)(depth - 1)))
+      __sync_fetch_and_add(&failed, 1);
+  } else if (__sync_add_and_fetch(&leaves, 1) % ((ROOTS << DEPTH) / PAUSES) ==
+             0) {
+    ldap_pvt_thread_pool_submit(&pool, run_pause, NULL);
+  }
+  __sync_fetch_and_add(&done, 1);
+  return NULL;
+}
+
+static int run(int threads, int queues, int sched) {
+  struct timeval start, end;
+  long i, elapsed, deadline;
+  int rc;
+
+  done = leaves = failed = paused = pauses = 0;
+  rc = ldap_pvt_thread_pool_init(&pool, threads, 0);
+  if (rc == 0)
+    rc = ldap_pvt_thread_pool_queues(&pool, queues);
+  if (rc == 0)
+    rc = ldap_pvt_thread_pool_sched(&pool, sched);
+  if (rc) {
+    printf("pool setup: %d\n", rc);
+    return 1;
+  }
+
+  gettimeofday(&start, NULL);
+  for (i = 0; i < ROOTS; i++)
+    if (ldap_pvt_thread_pool_submit(&pool, run_node, (void *)(long)DEPTH))
+      __sync_fetch_and_add(&failed, 1);
+  for (deadline = 60000;
+       (done < ROOTS * TREE || pauses + failed < PAUSES) && deadline > 0;
+       deadline--)
+    usleep(1000);
+  gettimeofday(&end, NULL);
+  ldap_pvt_thread_pool_destroy(&pool, 1);
+
+  elapsed = (end.tv_sec - start.tv_sec) * 1000000 + end.tv_usec - start.tv_usec;
+  printf("%-6s %d threads %d queues: %ld tasks, %ld pauses, %ld us\n",
+         sched ? "steal" : "plain", threads, queues, (long)done, (long)pauses,
+         elapsed);
+  if (done != ROOTS * TREE || pauses != PAUSES || failed) {
+    printf("expected %ld tasks, %ld failures\n", (long)ROOTS * TREE,
+           (long)failed);
+    return 1;
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  int threads = argc > 1 ? atoi(argv[1]) : 8;
+  int queues = argc > 2 ? atoi(argv[2]) : 4;
+  int fail;
+
+  ldap_pvt_thread_initialize();
+
+  fail = run(threads, queues, 0);
+  fail |= run(threads, queues, LDAP_PVT_THREAD_POOL_STEAL);
+
+  ldap_pvt_thread_destroy();
+  printf("%s\n", fail ? "FAILED" : "ok");
+  return fail ? EXIT_FAILURE : EXIT_SUCCESS;
+}
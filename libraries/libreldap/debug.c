@@ -41,10 +41,16 @@
 #define AUTOFLUSH_ENABLED 1
 #define AUTOFLUSH_STUFFED 2
 
+#define DEBUG_LINE_MAX 4096
+#define DEBUG_RING_MIN (DEBUG_LINE_MAX * 4)
+#define DEBUG_BATCH_MAX (DEBUG_LINE_MAX * 16)
+
 static FILE *log_file = NULL;
 static short debug_lockdeep = 0;
 static char debug_lastc = '\n';
 static char debug_autoflush = AUTOFLUSH_ENABLED;
+/* depth of debug_mutex held by the current thread */
+static __thread short debug_held;
 
 static void debug_flush(void) {
   if (log_file != NULL)
@@ -87,6 +93,7 @@ void ldap_debug_lock(void) {
 #endif /* HAVE_PTHREAD_MUTEX_RECURSIVE */
 
   debug_lockdeep += 1;
+  debug_held += 1;
 }
 
 int ldap_debug_trylock(void) {
@@ -97,12 +104,15 @@ int ldap_debug_trylock(void) {
 #endif /* HAVE_PTHREAD_MUTEX_RECURSIVE */
 
   LDAP_ENSURE(rc == 0 || rc == EBUSY);
-  if (rc == 0)
+  if (rc == 0) {
     debug_lockdeep += 1;
+    debug_held += 1;
+  }
   return rc;
 }
 
 void ldap_debug_unlock(void) {
+  debug_held -= 1;
   if (debug_lockdeep > 0) {
     debug_lockdeep -= 1;
     if (debug_lockdeep == 0 &&
@@ -127,6 +137,303 @@ int ldap_debug_file(FILE *file) {
   return 0;
 }
 
+/* Puts the "time_thread " prefix of a line, returns its length. */
+static int debug_stamp(char *buffer, size_t size, long tid) {
+  struct timeval now;
+  struct tm tm;
+  int off;
+
+  gettimeofday(&now, NULL);
+  /* LY: it is important to don't use extra spaces here, to avoid break a
+   * test(s). */
+  gmtime_r(&now.tv_sec, &tm);
+  off = strftime(buffer, size, "%y%m%d-%H:%M:%S", &tm);
+  assert(off > 0);
+  off += snprintf(buffer + off, size - off, ".%06ld_%05ld ", now.tv_usec, tid);
+  assert(off > 0);
+  return off;
+}
+
+/* Asynchronous mode.
+ *
+ * Every thread formats its lines into a ring of its own, without any
+ * locking: the owner only advances dr_head, the writer thread only
+ * advances dr_tail. The writer drains all rings into a batch buffer and
+ * hands it to the stdio by large writes under debug_mutex, so the output
+ * of the threads which still log synchronously (those holding the lock,
+ * e.g. the backtrace) is not torn. A record which doesn't fit into the
+ * ring is dropped and counted, the writer reports the count. */
+
+struct debug_ring {
+  struct debug_ring *dr_next;
+  char *dr_buf;
+  size_t dr_mask;
+  volatile size_t dr_head;
+  volatile size_t dr_tail;
+  volatile unsigned long dr_dropped;
+  unsigned long dr_reported; /* by the writer */
+  volatile int dr_dead;      /* the owner thread has exited */
+  long dr_tid;
+  int dr_line; /* length of the incomplete line */
+  char dr_linebuf[DEBUG_LINE_MAX];
+};
+
+/* Record header, the text follows and is padded up to the header size. */
+typedef struct debug_rec {
+  unsigned dr_len; /* DEBUG_REC_WRAP marks the unused end of the ring */
+  int dr_prio;     /* syslog priority, -1 for the debug output */
+} debug_rec;
+
+#define DEBUG_REC_WRAP (~0u)
+#define DEBUG_REC_SIZE(len)                                                    \
+  (sizeof(debug_rec) +                                                         \
+   (((len) + sizeof(debug_rec) - 1) & ~(sizeof(debug_rec) - 1)))
+
+static pthread_mutex_t debug_async_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t debug_async_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t debug_async_thread;
+static pthread_key_t debug_ring_key;
+static pthread_once_t debug_ring_once = PTHREAD_ONCE_INIT;
+static struct debug_ring *debug_rings;
+static __thread struct debug_ring *debug_ring;
+static volatile size_t debug_async_size;
+static volatile int debug_async_on, debug_async_stop;
+static volatile int debug_async_kick, debug_async_idle;
+static char debug_batch[DEBUG_BATCH_MAX];
+static size_t debug_batch_len;
+
+static void debug_ring_put(struct debug_ring *r, int prio, const char *text,
+                           unsigned len) {
+  size_t size = r->dr_mask + 1, need = DEBUG_REC_SIZE(len), skip = 0;
+  size_t head = r->dr_head, used = head - r->dr_tail;
+  size_t off = head & r->dr_mask;
+  debug_rec *rec;
+
+  if (off + need > size)
+    skip = size - off;
+  if (used + skip + need > size) {
+    r->dr_dropped += 1;
+    return;
+  }
+  if (skip) {
+    ((debug_rec *)(r->dr_buf + off))->dr_len = DEBUG_REC_WRAP;
+    off = 0;
+  }
+  rec = (debug_rec *)(r->dr_buf + off);
+  rec->dr_len = len;
+  rec->dr_prio = prio;
+  memcpy(rec + 1, text, len);
+  __sync_synchronize();
+  r->dr_head = head + skip + need;
+
+  /* wake up the writer when it sleeps long or the ring is half full */
+  if (debug_async_idle || (used + skip + need) * 2 > size) {
+    debug_async_idle = 0;
+    debug_async_kick = 1;
+    pthread_cond_signal(&debug_async_cond);
+  }
+}
+
+static void debug_ring_exit(void *arg) {
+  struct debug_ring *r = arg;
+
+  if (r->dr_line)
+    debug_ring_put(r, -1, r->dr_linebuf, r->dr_line);
+  debug_ring = NULL;
+  __sync_synchronize();
+  r->dr_dead = 1;
+}
+
+static void debug_ring_key_init(void) {
+  LDAP_ENSURE(pthread_key_create(&debug_ring_key, debug_ring_exit) == 0);
+}
+
+static struct debug_ring *debug_ring_create(void) {
+  size_t size = debug_async_size;
+  struct debug_ring *r;
+
+  if (!size || (r = calloc(1, sizeof(*r))) == NULL)
+    return NULL;
+  if ((r->dr_buf = malloc(size)) == NULL) {
+    free(r);
+    return NULL;
+  }
+  r->dr_mask = size - 1;
+  r->dr_tid = syscall(SYS_gettid, NULL, NULL, NULL);
+
+  LDAP_ENSURE(pthread_once(&debug_ring_once, debug_ring_key_init) == 0);
+  LDAP_ENSURE(pthread_setspecific(debug_ring_key, r) == 0);
+  LDAP_ENSURE(pthread_mutex_lock(&debug_async_mutex) == 0);
+  r->dr_next = debug_rings;
+  debug_rings = r;
+  LDAP_ENSURE(pthread_mutex_unlock(&debug_async_mutex) == 0);
+  return debug_ring = r;
+}
+
+static void debug_batch_flush(void) {
+  if (debug_batch_len) {
+    ldap_debug_lock();
+    if (log_file != NULL)
+      fwrite(debug_batch, 1, debug_batch_len, log_file);
+    fwrite(debug_batch, 1, debug_batch_len, stderr);
+    debug_lastc = debug_batch[debug_batch_len - 1];
+    debug_autoflush |= AUTOFLUSH_STUFFED;
+    debug_batch_len = 0;
+    ldap_debug_unlock();
+  }
+}
+
+static void debug_batch_put(const char *text, size_t len) {
+  if (debug_batch_len + len > sizeof(debug_batch))
+    debug_batch_flush();
+  memcpy(debug_batch + debug_batch_len, text, len);
+  debug_batch_len += len;
+}
+
+/* Moves the records of all rings to the output, frees the rings of exited
+ * threads. Called with debug_async_mutex held, returns the records count. */
+static unsigned debug_async_drain(void) {
+  struct debug_ring *r, **prev;
+  unsigned count = 0;
+
+  for (prev = &debug_rings; (r = *prev) != NULL;) {
+    int dead = r->dr_dead;
+    size_t tail = r->dr_tail, head = r->dr_head;
+
+    __sync_synchronize();
+    while (tail != head) {
+      debug_rec *rec = (debug_rec *)(r->dr_buf + (tail & r->dr_mask));
+      if (rec->dr_len == DEBUG_REC_WRAP) {
+        tail += r->dr_mask + 1 - (tail & r->dr_mask);
+        continue;
+      }
+      if (rec->dr_prio < 0)
+        debug_batch_put((const char *)(rec + 1), rec->dr_len);
+#ifdef LDAP_SYSLOG
+      else
+        syslog(rec->dr_prio, "%.*s", (int)rec->dr_len,
+               (const char *)(rec + 1));
+#endif /* LDAP_SYSLOG */
+      tail += DEBUG_REC_SIZE(rec->dr_len);
+      count += 1;
+    }
+    __sync_synchronize();
+    r->dr_tail = tail;
+
+    if (r->dr_dropped != r->dr_reported) {
+      unsigned long n = r->dr_dropped - r->dr_reported;
+      char buffer[128];
+      int len = debug_stamp(buffer, sizeof(buffer), r->dr_tid);
+
+      len += snprintf(buffer + len, sizeof(buffer) - len,
+                      "ldap_debug: %lu log records dropped\n", n);
+      debug_batch_put(buffer, len);
+      r->dr_reported += n;
+    }
+
+    if (dead && tail == r->dr_head) {
+      *prev = r->dr_next;
+      free(r->dr_buf);
+      free(r);
+    } else {
+      prev = &r->dr_next;
+    }
+  }
+  debug_batch_flush();
+  return count;
+}
+
+static void *debug_async_task(void *arg) {
+  LDAP_ENSURE(pthread_mutex_lock(&debug_async_mutex) == 0);
+  while (!debug_async_stop) {
+    if (!debug_async_kick) {
+      struct timespec abstime;
+      /* a few ms of delay when busy, a long sleep when idle */
+      long ns = debug_async_idle ? 1000000000 : 20000000;
+
+      LDAP_ENSURE(clock_gettime(CLOCK_REALTIME, &abstime) == 0);
+      abstime.tv_nsec += ns;
+      if (abstime.tv_nsec >= 1000000000) {
+        abstime.tv_nsec -= 1000000000;
+        abstime.tv_sec += 1;
+      }
+      pthread_cond_timedwait(&debug_async_cond, &debug_async_mutex, &abstime);
+    }
+    debug_async_kick = 0;
+    debug_async_idle = debug_async_drain() == 0;
+  }
+  LDAP_ENSURE(pthread_mutex_unlock(&debug_async_mutex) == 0);
+  return arg;
+}
+
+static int debug_async_va(int prio, const char *fmt, va_list vl) {
+  struct debug_ring *r = debug_ring;
+  int len, off;
+
+  if (!r && (r = debug_ring_create()) == NULL)
+    return -1;
+
+  if (prio >= 0) {
+    char buffer[DEBUG_LINE_MAX];
+    len = vsnprintf(buffer, sizeof(buffer), fmt, vl);
+    if (len > 0)
+      debug_ring_put(r, prio, buffer,
+                     len < sizeof(buffer) ? len : sizeof(buffer) - 1);
+    return 0;
+  }
+
+  off = r->dr_line;
+  if (off == 0)
+    off = debug_stamp(r->dr_linebuf, sizeof(r->dr_linebuf), r->dr_tid);
+  len = vsnprintf(r->dr_linebuf + off, sizeof(r->dr_linebuf) - off, fmt, vl);
+  if (len > 0) {
+    if (len >= sizeof(r->dr_linebuf) - off)
+      len = sizeof(r->dr_linebuf) - off - 1;
+    off += len;
+    if (r->dr_linebuf[off - 1] == '\n' || off == sizeof(r->dr_linebuf) - 1) {
+      debug_ring_put(r, -1, r->dr_linebuf, off);
+      off = 0;
+    }
+  }
+  r->dr_line = off;
+  return 0;
+}
+
+int ldap_debug_async(size_t size) {
+  int rc = 0;
+
+  if (size) {
+    size_t pow2 = DEBUG_RING_MIN;
+    while (pow2 < size)
+      pow2 <<= 1;
+    size = pow2;
+  }
+
+  LDAP_ENSURE(pthread_mutex_lock(&debug_async_mutex) == 0);
+  debug_async_size = size;
+  if (size && !debug_async_on) {
+    debug_async_stop = 0;
+    rc = pthread_create(&debug_async_thread, NULL, debug_async_task, NULL);
+    if (rc == 0)
+      debug_async_on = 1;
+  } else if (!size && debug_async_on) {
+    debug_async_on = 0;
+    debug_async_stop = 1;
+    LDAP_ENSURE(pthread_cond_signal(&debug_async_cond) == 0);
+    LDAP_ENSURE(pthread_mutex_unlock(&debug_async_mutex) == 0);
+    LDAP_ENSURE(pthread_join(debug_async_thread, NULL) == 0);
+    LDAP_ENSURE(pthread_mutex_lock(&debug_async_mutex) == 0);
+    if (debug_ring && debug_ring->dr_line) {
+      debug_ring_put(debug_ring, -1, debug_ring->dr_linebuf,
+                     debug_ring->dr_line);
+      debug_ring->dr_line = 0;
+    }
+    debug_async_drain();
+  }
+  LDAP_ENSURE(pthread_mutex_unlock(&debug_async_mutex) == 0);
+  return rc;
+}
+
 void ldap_debug_print(const char *fmt, ...) {
   va_list vl;
 
@@ -135,7 +442,23 @@ void ldap_debug_print(const char *fmt, ...) {
   va_end(vl);
 }
 
+#ifdef LDAP_SYSLOG
+void ldap_debug_syslog(int prio, const char *fmt, ...) {
+  va_list vl;
+
+  va_start(vl, fmt);
+  if (!debug_async_on || debug_held || debug_async_va(prio, fmt, vl) != 0)
+    vsyslog(prio, fmt, vl);
+  va_end(vl);
+}
+#endif /* LDAP_SYSLOG */
+
 void ldap_debug_flush(void) {
+  if (debug_async_on) {
+    LDAP_ENSURE(pthread_mutex_lock(&debug_async_mutex) == 0);
+    debug_async_drain();
+    LDAP_ENSURE(pthread_mutex_unlock(&debug_async_mutex) == 0);
+  }
   ldap_debug_lock();
   if (debug_autoflush & AUTOFLUSH_STUFFED)
     debug_flush();
@@ -154,27 +477,16 @@ void ldap_debug_set_autoflush(int enable) {
 }
 
 void ldap_debug_va(const char *fmt, va_list vl) {
+  if (debug_async_on && !debug_held && debug_async_va(-1, fmt, vl) == 0)
+    return;
+
   ldap_debug_lock();
 
-  char buffer[4096];
+  char buffer[DEBUG_LINE_MAX];
   int len, off = 0;
-  if (debug_lastc == '\n') {
-    struct timeval now;
-    struct tm tm;
-    long rc;
-
-    gettimeofday(&now, NULL);
-    /* LY: it is important to don't use extra spaces here, to avoid break a
-     * test(s). */
-    gmtime_r(&now.tv_sec, &tm);
-    off += strftime(buffer + off, sizeof(buffer) - off, "%y%m%d-%H:%M:%S", &tm);
-    assert(off > 0);
-    rc = syscall(SYS_gettid, NULL, NULL, NULL);
-    assert(rc > 0);
-    off += snprintf(buffer + off, sizeof(buffer) - off, ".%06ld_%05ld ",
-                    now.tv_usec, rc);
-    assert(off > 0);
-  }
+  if (debug_lastc == '\n')
+    off = debug_stamp(buffer, sizeof(buffer),
+                      syscall(SYS_gettid, NULL, NULL, NULL));
   len = vsnprintf(buffer + off, sizeof(buffer) - off, fmt, vl);
   if (len > 0) {
     if (len > sizeof(buffer) - off)
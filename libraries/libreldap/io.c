@@ -142,9 +142,20 @@ int ber_realloc(BerElement *ber, ber_len_t len) {
   /* if ber_sos_ptr != NULL, it is > ber_buf so that sos_offset > 0 */
   rw_offset = ber->ber_rwptr ? ber->ber_rwptr - buf : 0;
 
-  buf = (char *)ber_memrealloc_x(buf, total, ber->ber_memctx);
-  if (buf == NULL) {
-    return (-1);
+  if (ber->ber_chunk != NULL) {
+    /* a slice of the readahead ring can't grow in place */
+    buf = (char *)ber_memalloc_x(total, ber->ber_memctx);
+    if (buf == NULL) {
+      return (-1);
+    }
+    memcpy(buf, ber->ber_buf, ber_pvt_ber_total(ber));
+    ber_int_chunk_release(ber->ber_chunk);
+    ber->ber_chunk = NULL;
+  } else {
+    buf = (char *)ber_memrealloc_x(buf, total, ber->ber_memctx);
+    if (buf == NULL) {
+      return (-1);
+    }
   }
 
   ber->ber_buf = buf;
@@ -161,7 +172,10 @@ int ber_realloc(BerElement *ber, ber_len_t len) {
 void ber_free_buf(BerElement *ber) {
   assert(LBER_VALID(ber));
 
-  if (ber->ber_buf)
+  if (ber->ber_chunk) {
+    ber_int_chunk_release(ber->ber_chunk);
+    ber->ber_chunk = NULL;
+  } else if (ber->ber_buf)
     ber_memfree_x(ber->ber_buf, ber->ber_memctx);
 
   ber->ber_buf = NULL;
@@ -396,7 +410,133 @@ void ber_reset(BerElement *ber, int was_writing) {
 
 #define LENSIZE 4
 
+/*
+ * ber_get_next() for the readahead ring: the tag and length are parsed
+ * from the ring and the contents are lent to the BerElement in place.
+ * The octet following the contents goes with the slice, for the
+ * decoder to \0-terminate the last element; the ring keeps its value
+ * aside if it is the start of the next PDU.
+ */
+static ber_tag_t ber_get_next_ring(Sockbuf_IO_Desc *sbiod, Sockbuf_Rdahead *p,
+                                   ber_len_t *len, BerElement *ber) {
+  Sockbuf *sb = sbiod->sbiod_sb;
+  Sockbuf_Buf *b = &p->sr_buf;
+  unsigned char hdr[sizeof(ber_tag_t) + LENSIZE + 1];
+  ber_len_t have, n, i, tlen, end;
+  ber_tag_t tag;
+  int filled = 0;
+
+  for (;; filled = 1) {
+    ber_len_t need = 0;
+
+    have = b->buf_end - b->buf_ptr;
+    n = have < sizeof(hdr) ? have : sizeof(hdr);
+    if (n == 0)
+      goto more;
+    memcpy(hdr, b->buf_base + b->buf_ptr, n);
+    if (p->sr_octet >= 0)
+      hdr[0] = p->sr_octet;
+
+    i = 0;
+    tag = hdr[i++];
+    if ((tag & LBER_BIG_TAG_MASK) == LBER_BIG_TAG_MASK) {
+      for (;;) {
+        if (i == n)
+          goto more;
+        tag = (tag << 8) | hdr[i++];
+        if (!(tag & LBER_MORE_TAG_MASK))
+          break;
+        /* Is the tag too big? */
+        if (i == sizeof(ber_tag_t)) {
+          sock_errset(ERANGE);
+          return LBER_DEFAULT;
+        }
+      }
+    }
+
+    if (i == n)
+      goto more;
+    if (hdr[i] & 0x80) { /* multi-byte */
+      ber_len_t llen = hdr[i++] & 0x7f;
+      if (llen > LENSIZE) {
+        sock_errset(ERANGE);
+        return LBER_DEFAULT;
+      }
+      if (n - i < llen)
+        goto more;
+      for (tlen = 0; llen; llen--)
+        tlen = (tlen << 8) | hdr[i++];
+    } else {
+      tlen = hdr[i++];
+    }
+
+    /* make sure length is reasonable */
+    if (tlen == 0) {
+      sock_errset(ERANGE);
+      return LBER_DEFAULT;
+    }
+    if (sb->sb_max_incoming && tlen > sb->sb_max_incoming) {
+      ber_log_printf(LDAP_DEBUG_CONNS, ber->ber_debug,
+                     "ber_get_next: sockbuf_max_incoming exceeded "
+                     "(%ld > %ld)\n",
+                     tlen, sb->sb_max_incoming);
+      sock_errset(ERANGE);
+      return LBER_DEFAULT;
+    }
+    if (have >= i + tlen) {
+      if (b->buf_ptr + i + tlen < b->buf_size)
+        break;
+      /* no room left for the terminator */
+      if (ber_int_sb_ring_reserve(p, i + tlen + 1) < 0)
+        return LBER_DEFAULT;
+      break;
+    }
+    need = i + tlen + 1;
+
+  more:
+    if (filled) {
+      sock_errset(EWOULDBLOCK);
+      return LBER_DEFAULT;
+    }
+    sock_errset(0);
+    if (ber_int_sb_ring_fill(sbiod, need) <= 0)
+      return LBER_DEFAULT;
+  }
+
+  ber->ber_tag = tag;
+  ber->ber_len = tlen;
+  ber->ber_usertag = 0;
+  ber->ber_buf = b->buf_base + b->buf_ptr + i;
+  ber->ber_ptr = ber->ber_buf;
+  ber->ber_end = ber->ber_buf + tlen;
+  ber->ber_chunk = p->sr_chunk;
+  __sync_fetch_and_add(&p->sr_chunk->bc_refs, 1);
+
+  end = b->buf_ptr + i + tlen;
+  if (end < b->buf_end) {
+    p->sr_octet = *(unsigned char *)ber->ber_end;
+    b->buf_ptr = end;
+  } else {
+    /* the ring left room for the terminator */
+    p->sr_octet = -1;
+    b->buf_ptr = b->buf_end = end + 1;
+  }
+  *ber->ber_end = '\0';
+
+  *len = tlen;
+  if (ber->ber_debug) {
+    ber_log_printf(LDAP_DEBUG_TRACE, ber->ber_debug,
+                   "ber_get_next: tag 0x%lx len %ld contents:\n", ber->ber_tag,
+                   ber->ber_len);
+    ber_log_dump(LDAP_DEBUG_BER, ber->ber_debug, ber, 1);
+  }
+  return tag;
+}
+
 ber_tag_t ber_get_next(Sockbuf *sb, ber_len_t *len, BerElement *ber) {
+  Sockbuf_IO_Desc *sbiod;
+  Sockbuf_Rdahead *ring;
+
   assert(sb != NULL);
   assert(len != NULL);
   assert(ber != NULL);
@@ -407,6 +547,9 @@ ber_tag_t ber_get_next(Sockbuf *sb, ber_len_t *len, BerElement *ber) {
     ber_log_printf(LDAP_DEBUG_TRACE, ber->ber_debug, "ber_get_next\n");
   }
 
+  if (ber->ber_rwptr == NULL && (ring = ber_int_sb_ring(sb, &sbiod)) != NULL)
+    return ber_get_next_ring(sbiod, ring, len, ber);
+
   /*
    * Any ber element looks like this: tag length contents.
    * Assuming everything's ok, we return the tag byte (we
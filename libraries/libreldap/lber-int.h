@@ -95,6 +95,9 @@ struct berelement {
 
   char *ber_rwptr;
   void *ber_memctx;
+
+  /* Not NULL if ber_buf is a slice lent by the readahead ring */
+  struct ber_chunk *ber_chunk;
 };
 #define LBER_VALID(ber) ((ber)->ber_valid == LBER_VALID_BERELEMENT)
 
@@ -120,6 +123,20 @@ struct sockbuf {
 
 #define SOCKBUF_VALID(sb) ((sb)->sb_valid == LBER_VALID_SOCKBUF)
 
+/* A receive buffer of the readahead ring. Complete PDUs are decoded in
+ * place, each BerElement holding a reference until it is freed. */
+typedef struct ber_chunk {
+  volatile ber_len_t bc_refs;
+} BerChunk;
+#define BER_CHUNK_DATA(bc) ((char *)((bc) + 1))
+
+typedef struct sockbuf_rdahead {
+  Sockbuf_Buf sr_buf;
+  BerChunk *sr_chunk; /* NULL unless in ring mode */
+  ber_len_t sr_size;  /* size of the next chunk */
+  int sr_octet;       /* octet at buf_ptr replaced by a terminator, or -1 */
+} Sockbuf_Rdahead;
+
 /*
  * decode.c, encode.c
  */
@@ -183,6 +200,18 @@ ber_int_sb_read(Sockbuf *sb, void *buf, ber_len_t len);
 LBER_F(ber_slen_t)
 ber_int_sb_write(Sockbuf *sb, void *buf, ber_len_t len);
 
+LBER_F(Sockbuf_Rdahead *)
+ber_int_sb_ring(Sockbuf *sb, Sockbuf_IO_Desc **sbiod);
+
+LBER_F(int)
+ber_int_sb_ring_reserve(Sockbuf_Rdahead *p, ber_len_t need);
+
+LBER_F(ber_slen_t)
+ber_int_sb_ring_fill(Sockbuf_IO_Desc *sbiod, ber_len_t need);
+
+LBER_F(void)
+ber_int_chunk_release(BerChunk *bc);
+
 LDAP_END_DECL
 
 #endif /* _LBER_INT_H */
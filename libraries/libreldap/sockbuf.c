@@ -481,10 +481,196 @@ Sockbuf_IO ber_sockbuf_io_tcp = {
 
 /*
  * Support for readahead (UDP needs it)
+ *
+ * In the ring mode the buffer is a reference counted chunk, and
+ * ber_get_next() hands the complete PDUs out as slices of it instead of
+ * copying. A chunk still lent to some BerElement is never written over:
+ * the pending data is moved to a fresh chunk when the lent one runs out
+ * of room, and the old one is freed by the last of its borrowers.
  */
 
+static BerChunk *ber_chunk_alloc(ber_len_t size) {
+  BerChunk *bc;
+
+  bc = LBER_MALLOC(sizeof(BerChunk) + size);
+  if (bc != NULL)
+    bc->bc_refs = 1;
+  return bc;
+}
+
+void ber_int_chunk_release(BerChunk *bc) {
+  if (__sync_sub_and_fetch(&bc->bc_refs, 1) == 0)
+    LBER_FREE(bc);
+}
+
+static int ber_chunk_lent(BerChunk *bc) {
+  return __sync_fetch_and_add(&bc->bc_refs, 0) > 1;
+}
+
+/* Make room for need octets in total at buf_ptr, including the pending
+ * data: move it to the front of the chunk unless the chunk is lent, or
+ * to a fresh one otherwise. */
+int ber_int_sb_ring_reserve(Sockbuf_Rdahead *p, ber_len_t need) {
+  Sockbuf_Buf *b = &p->sr_buf;
+  ber_len_t have = b->buf_end - b->buf_ptr;
+  int lent = ber_chunk_lent(p->sr_chunk);
+  BerChunk *bc;
+
+  if (have == 0 && !lent)
+    b->buf_ptr = b->buf_end = 0;
+  if (b->buf_ptr + need <= b->buf_size)
+    return 0;
+
+  if (!lent && need <= b->buf_size) {
+    memmove(b->buf_base, b->buf_base + b->buf_ptr, have);
+  } else {
+    ber_len_t size = need > p->sr_size ? need : p->sr_size;
+
+    bc = ber_chunk_alloc(size);
+    if (bc == NULL) {
+      sock_errset(ENOMEM);
+      return -1;
+    }
+    memcpy(BER_CHUNK_DATA(bc), b->buf_base + b->buf_ptr, have);
+    ber_int_chunk_release(p->sr_chunk);
+    p->sr_chunk = bc;
+    b->buf_base = BER_CHUNK_DATA(bc);
+    b->buf_size = size;
+  }
+  /* the octet the last slice took for its terminator */
+  if (p->sr_octet >= 0) {
+    b->buf_base[0] = p->sr_octet;
+    p->sr_octet = -1;
+  }
+  b->buf_ptr = 0;
+  b->buf_end = have;
+  return 0;
+}
+
+static ber_slen_t sb_ring_copy_out(Sockbuf_Rdahead *p, char *buf,
+                                   ber_len_t len) {
+  Sockbuf_Buf *b = &p->sr_buf;
+  ber_len_t max = b->buf_end - b->buf_ptr;
+
+  if (max > len)
+    max = len;
+  if (max) {
+    memcpy(buf, b->buf_base + b->buf_ptr, max);
+    if (p->sr_octet >= 0) {
+      buf[0] = p->sr_octet;
+      p->sr_octet = -1;
+    }
+    b->buf_ptr += max;
+  }
+  return max;
+}
+
+/* Read from below into the free space of the ring, after making room
+ * for at least need octets including the pending data. */
+ber_slen_t ber_int_sb_ring_fill(Sockbuf_IO_Desc *sbiod, ber_len_t need) {
+  Sockbuf_Rdahead *p = (Sockbuf_Rdahead *)sbiod->sbiod_pvt;
+  Sockbuf_Buf *b = &p->sr_buf;
+  ber_slen_t ret;
+
+  if (need < LBER_MIN_BUFF_SIZE)
+    need = LBER_MIN_BUFF_SIZE;
+  if (ber_int_sb_ring_reserve(p, need) < 0)
+    return -1;
+
+  for (;;) {
+    ret = LBER_SBIOD_READ_NEXT(sbiod, b->buf_base + b->buf_end,
+                               b->buf_size - b->buf_end);
+#ifdef EINTR
+    if ((ret < 0) && (errno == EINTR))
+      continue;
+#endif
+    break;
+  }
+  if (ret > 0)
+    b->buf_end += ret;
+  return ret;
+}
+
+/* The readahead layer in the ring mode, if nothing but the debug layers
+ * is stacked above it. */
+Sockbuf_Rdahead *ber_int_sb_ring(Sockbuf *sb, Sockbuf_IO_Desc **sbiod) {
+  Sockbuf_IO_Desc *d;
+
+  for (d = sb->sb_iod; d != NULL; d = d->sbiod_next) {
+    if (d->sbiod_io == &ber_sockbuf_io_readahead) {
+      Sockbuf_Rdahead *p = (Sockbuf_Rdahead *)d->sbiod_pvt;
+
+      if (p->sr_chunk == NULL)
+        break;
+      *sbiod = d;
+      return p;
+    }
+    if (d->sbiod_io != &ber_sockbuf_io_debug)
+      break;
+  }
+  return NULL;
+}
+
+/* Lend the free space of the ring, at least LBER_MIN_BUFF_SIZE octets
+ * after the pending data, to be filled from outside the Sockbuf. The
+ * token keeps the chunk alive until it is returned; meanwhile nothing
+ * may be read through the Sockbuf. */
+int ber_sockbuf_ring_lend(Sockbuf *sb, struct berval *space, void **token) {
+  Sockbuf_IO_Desc *sbiod;
+  Sockbuf_Rdahead *p;
+  Sockbuf_Buf *b;
+
+  assert(sb != NULL);
+  assert(SOCKBUF_VALID(sb));
+
+  p = ber_int_sb_ring(sb, &sbiod);
+  if (p == NULL)
+    return -1;
+  b = &p->sr_buf;
+  if (ber_int_sb_ring_reserve(p, b->buf_end - b->buf_ptr +
+                                     LBER_MIN_BUFF_SIZE) < 0)
+    return -1;
+
+  space->bv_val = b->buf_base + b->buf_end;
+  space->bv_len = b->buf_size - b->buf_end;
+  __sync_fetch_and_add(&p->sr_chunk->bc_refs, 1);
+  *token = p->sr_chunk;
+  return 0;
+}
+
+/* Account for data received into the space lent under token. Fails if
+ * the ring has moved on, which only happens if it was read from
+ * meanwhile. Stacked layers above the ring may have been added since
+ * the space was lent, they read the data through it as usual. */
+int ber_sockbuf_ring_fill(Sockbuf *sb, void *token, struct berval *data) {
+  Sockbuf_IO_Desc *d;
+  Sockbuf_Rdahead *p;
+  Sockbuf_Buf *b;
+
+  assert(sb != NULL);
+  assert(SOCKBUF_VALID(sb));
+
+  for (d = sb->sb_iod; d != NULL; d = d->sbiod_next) {
+    if (d->sbiod_io == &ber_sockbuf_io_readahead)
+      break;
+  }
+  if (d == NULL)
+    return -1;
+  p = (Sockbuf_Rdahead *)d->sbiod_pvt;
+  b = &p->sr_buf;
+  if (p->sr_chunk != token || data->bv_val != b->buf_base + b->buf_end ||
+      data->bv_len > b->buf_size - b->buf_end)
+    return -1;
+  b->buf_end += data->bv_len;
+  return 0;
+}
+
+void ber_sockbuf_ring_return(void *token) {
+  ber_int_chunk_release((BerChunk *)token);
+}
+
 static int sb_rdahead_setup(Sockbuf_IO_Desc *sbiod, void *arg) {
-  Sockbuf_Buf *p;
+  Sockbuf_Rdahead *p;
 
   assert(sbiod != NULL);
 
@@ -492,29 +678,43 @@ static int sb_rdahead_setup(Sockbuf_IO_Desc *sbiod, void *arg) {
   if (p == NULL)
     return -1;
 
-  ber_pvt_sb_buf_init(p);
+  ber_pvt_sb_buf_init(&p->sr_buf);
+  p->sr_chunk = NULL;
+  p->sr_size = 0;
+  p->sr_octet = -1;
 
   if (arg == NULL) {
-    ber_pvt_sb_grow_buffer(p, LBER_DEFAULT_READAHEAD);
+    ber_pvt_sb_grow_buffer(&p->sr_buf, LBER_DEFAULT_READAHEAD);
   } else {
-    ber_pvt_sb_grow_buffer(p, *((int *)arg));
+    ber_pvt_sb_grow_buffer(&p->sr_buf, *((int *)arg));
   }
 
   sbiod->sbiod_pvt = p;
   return 0;
 }
 
+static void sb_rdahead_erase(Sockbuf_Rdahead *p) {
+  if (p->sr_chunk != NULL) {
+    ber_int_chunk_release(p->sr_chunk);
+    p->sr_chunk = NULL;
+    ber_pvt_sb_buf_init(&p->sr_buf);
+    p->sr_octet = -1;
+  } else {
+    ber_pvt_sb_buf_destroy(&p->sr_buf);
+  }
+}
+
 static int sb_rdahead_remove(Sockbuf_IO_Desc *sbiod) {
-  Sockbuf_Buf *p;
+  Sockbuf_Rdahead *p;
 
   assert(sbiod != NULL);
 
-  p = (Sockbuf_Buf *)sbiod->sbiod_pvt;
+  p = (Sockbuf_Rdahead *)sbiod->sbiod_pvt;
 
-  if (p->buf_ptr != p->buf_end)
+  if (p->sr_buf.buf_ptr != p->sr_buf.buf_end)
     return -1;
 
-  ber_pvt_sb_buf_destroy((Sockbuf_Buf *)(sbiod->sbiod_pvt));
+  sb_rdahead_erase(p);
   LBER_FREE(sbiod->sbiod_pvt);
   sbiod->sbiod_pvt = NULL;
 
@@ -523,6 +723,7 @@ static int sb_rdahead_remove(Sockbuf_IO_Desc *sbiod) {
 
 static ber_slen_t sb_rdahead_read(Sockbuf_IO_Desc *sbiod, void *buf,
                                   ber_len_t len) {
+  Sockbuf_Rdahead *r;
   Sockbuf_Buf *p;
   ber_slen_t bufptr = 0, ret, max;
 
@@ -530,10 +731,22 @@ static ber_slen_t sb_rdahead_read(Sockbuf_IO_Desc *sbiod, void *buf,
   assert(SOCKBUF_VALID(sbiod->sbiod_sb));
   assert(sbiod->sbiod_next != NULL);
 
-  p = (Sockbuf_Buf *)sbiod->sbiod_pvt;
+  r = (Sockbuf_Rdahead *)sbiod->sbiod_pvt;
+  p = &r->sr_buf;
 
   assert(p->buf_size > 0);
 
+  if (r->sr_chunk != NULL) {
+    bufptr = sb_ring_copy_out(r, buf, len);
+    if ((ber_len_t)bufptr == len)
+      return bufptr;
+    ret = ber_int_sb_ring_fill(sbiod, LBER_MIN_BUFF_SIZE);
+    if (ret < 0)
+      return (bufptr ? bufptr : ret);
+    bufptr += sb_ring_copy_out(r, (char *)buf + bufptr, len - bufptr);
+    return bufptr;
+  }
+
   /* Are there anything left in the buffer? */
   ret = ber_pvt_sb_copy_out(p, buf, len);
   bufptr += ret;
@@ -574,14 +787,16 @@ static int sb_rdahead_close(Sockbuf_IO_Desc *sbiod) {
   assert(sbiod != NULL);
 
   /* Just erase the buffer */
-  ber_pvt_sb_buf_destroy((Sockbuf_Buf *)sbiod->sbiod_pvt);
+  sb_rdahead_erase((Sockbuf_Rdahead *)sbiod->sbiod_pvt);
   return 0;
 }
 
 static int sb_rdahead_ctrl(Sockbuf_IO_Desc *sbiod, int opt, void *arg) {
+  Sockbuf_Rdahead *r;
   Sockbuf_Buf *p;
 
-  p = (Sockbuf_Buf *)sbiod->sbiod_pvt;
+  r = (Sockbuf_Rdahead *)sbiod->sbiod_pvt;
+  p = &r->sr_buf;
 
   if (opt == LBER_SB_OPT_DATA_READY) {
     if (p->buf_ptr != p->buf_end) {
@@ -589,10 +804,37 @@ static int sb_rdahead_ctrl(Sockbuf_IO_Desc *sbiod, int opt, void *arg) {
     }
 
   } else if (opt == LBER_SB_OPT_SET_READAHEAD) {
+    if (r->sr_chunk != NULL) {
+      if (r->sr_size < *((ber_len_t *)arg))
+        r->sr_size = *((ber_len_t *)arg);
+      return 1;
+    }
     if (p->buf_size >= *((ber_len_t *)arg)) {
       return 0;
     }
     return (ber_pvt_sb_grow_buffer(p, *((int *)arg)) ? -1 : 1);
+
+  } else if (opt == LBER_SB_OPT_SET_READAHEAD_RING) {
+    ber_len_t size = *((ber_len_t *)arg);
+
+    if (size < LBER_MIN_BUFF_SIZE)
+      size = LBER_MIN_BUFF_SIZE;
+    if (r->sr_chunk == NULL) {
+      ber_len_t have = p->buf_end - p->buf_ptr;
+      BerChunk *bc;
+
+      bc = ber_chunk_alloc(size > have ? size : have);
+      if (bc == NULL)
+        return -1;
+      memcpy(BER_CHUNK_DATA(bc), p->buf_base + p->buf_ptr, have);
+      ber_pvt_sb_buf_destroy(p);
+      r->sr_chunk = bc;
+      p->buf_base = BER_CHUNK_DATA(bc);
+      p->buf_size = size > have ? size : have;
+      p->buf_end = have;
+    }
+    r->sr_size = size;
+    return 1;
   }
 
   return LBER_SBIOD_CTRL_NEXT(sbiod, opt, arg);
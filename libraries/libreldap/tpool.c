@@ -24,6 +24,10 @@
 #include <ac/time.h>
 #include <ac/errno.h>
 
+#ifdef __linux__
+#include <sched.h>
+#endif
+
 #include "ldap-int.h"
 #include "ldap_pvt_thread.h" /* Get the thread interface */
 #include "ldap_queue.h"
@@ -58,6 +62,7 @@ enum { NOT_PAUSED = 0, WANT_PAUSE = 1, PAUSED = 2 };
 /* Context: thread ID and thread-specific key/data pairs */
 typedef struct ldap_int_thread_userctx_s {
   struct ldap_int_thread_poolq_s *ltu_pq;
+  struct ldap_int_tpool_deque_s *ltu_deque; /* NULL until first used */
   ldap_pvt_thread_t ltu_id;
   ldap_int_tpool_key_t ltu_key[MAXKEYS];
 } ldap_int_thread_userctx_t;
@@ -88,15 +93,43 @@ typedef struct ldap_int_thread_task_s {
   ldap_pvt_thread_start_t *ltt_start_routine;
   void *ltt_arg;
   struct ldap_int_thread_poolq_s *ltt_queue;
+  int ltt_class;
+  uint64_t ltt_stamp; /* when queued, if its class has a delay target */
 } ldap_int_thread_task_t;
 
 typedef LDAP_STAILQ_HEAD(tcq, ldap_int_thread_task_s) ldap_int_tpool_plist_t;
 
+/* Tasks a worker submits itself while tasks may be stolen go to a
+ * deque of its own (Chase and Lev). Only the owner pushes and pops at
+ * the bottom, without any lock; idle threads steal the oldest task at
+ * the top with a CAS, so a busy queue's mutex is taken by neither.
+ * The ring does not grow: a full deque sends tasks to the pending
+ * lists. Deques outlive their threads and are handed to new ones, so
+ * a thief never reads freed memory and top/bottom only move forward.
+ */
+#define DEQUE_SIZE 256 /* must be a power of 2 */
+
+typedef struct ldap_int_tpool_deque_s {
+  void *ltd_free;
+  volatile long ltd_top; /* next task to steal */
+  char ltd_pad[CACHELINE - sizeof(void *) - sizeof(long)];
+  volatile long ltd_bottom; /* next free slot */
+  /* a thread owns it, protected by ldap_pvt_thread_pool_mutex */
+  int ltd_owned;
+  /* unused task objects, owner only */
+  int ltd_nspare;
+  LDAP_SLIST_HEAD(tds, ldap_int_thread_task_s) ltd_spare;
+  ldap_int_thread_task_t *volatile ltd_tasks[DEQUE_SIZE];
+} ldap_int_tpool_deque_t;
+
 struct ldap_int_thread_poolq_s {
   void *ltp_free;
 
   struct ldap_int_thread_pool_s *ltp_pool;
 
+  /* index in ltp_pool->ltp_wqs */
+  int ltp_id;
+
   /* protect members below */
   ldap_pvt_thread_mutex_t ltp_mutex;
 
@@ -116,6 +149,13 @@ struct ldap_int_thread_poolq_s {
   ldap_int_tpool_plist_t ltp_pending_list;
   LDAP_SLIST_HEAD(tcl, ldap_int_thread_task_s) ltp_free_list;
 
+  /* Pending tasks are ordered by class. Per class: its last pending
+   * task, the threads it may occupy, pending and running tasks */
+  ldap_int_thread_task_t *ltp_class_last[LDAP_PVT_THREAD_POOL_MAX_CLASSES];
+  int ltp_class_max[LDAP_PVT_THREAD_POOL_MAX_CLASSES];
+  int ltp_class_pending[LDAP_PVT_THREAD_POOL_MAX_CLASSES];
+  int ltp_class_active[LDAP_PVT_THREAD_POOL_MAX_CLASSES];
+
   /* Max number of threads in this queue */
   int ltp_max_count;
 
@@ -126,8 +166,23 @@ struct ldap_int_thread_poolq_s {
   int ltp_active_count;  /* Active, not paused/idle tasks */
   int ltp_open_count;    /* Number of threads */
   int ltp_starting;      /* Currently starting threads */
+
+  /* counted in pool->ltp_active_queues by a pending pause */
+  int ltp_pause_active;
 };
 
+/* Priority class settings and load shedding state */
+typedef struct ldap_int_tpool_class_s {
+  ldap_pvt_thread_pool_class_t ltc_conf;
+  uint64_t ltc_target_ns;
+  uint64_t ltc_interval_ns;
+  /* The queue delay of the class has been above target since this
+   * deadline minus ltc_interval_ns, 0 if it is not */
+  volatile uint64_t ltc_above;
+  /* New tasks of the class are rejected until then */
+  volatile uint64_t ltc_shed_until;
+} ldap_int_tpool_class_t;
+
 struct ldap_int_thread_pool_s {
   LDAP_STAILQ_ENTRY(ldap_int_thread_pool_s) ltp_next;
 
@@ -136,6 +191,22 @@ struct ldap_int_thread_pool_s {
   /* number of poolqs */
   int ltp_numqs;
 
+  /* LDAP_PVT_THREAD_POOL_STEAL, LDAP_PVT_THREAD_POOL_PIN */
+  int ltp_sched;
+
+  /* CPUs the threads of each queue are bound to, round robin */
+  int *ltp_cpus;
+  int ltp_ncpus;
+
+  /* deques of the workers, LDAP_MAXTHR slots of which ltp_ndeques
+   * are set; grown under ldap_pvt_thread_pool_mutex, read without */
+  ldap_int_tpool_deque_t **ltp_deques;
+  volatile int ltp_ndeques;
+
+  /* priority classes, none configured when 0 */
+  int ltp_nclasses;
+  ldap_int_tpool_class_t ltp_classes[LDAP_PVT_THREAD_POOL_MAX_CLASSES];
+
   /* protect members below */
   ldap_pvt_thread_mutex_t ltp_mutex;
 
@@ -183,6 +254,168 @@ static ldap_pvt_thread_mutex_t ldap_pvt_thread_pool_mutex;
 
 static void *ldap_int_thread_pool_wrapper(void *pool);
 
+/* Spread the thread shares of the classes over the queues */
+static void set_class_limits(struct ldap_int_thread_pool_s *pool) {
+  struct ldap_int_thread_poolq_s *pq;
+  int i, c, share, max;
+
+  for (i = 0; i < pool->ltp_numqs; i++) {
+    pq = pool->ltp_wqs[i];
+    for (c = 0; c < LDAP_PVT_THREAD_POOL_MAX_CLASSES; c++) {
+      share = c < pool->ltp_nclasses ? pool->ltp_classes[c].ltc_conf.ltc_share
+                                     : 100;
+      max = INT_MAX;
+      if (share < 100) {
+        max = pq->ltp_max_count * share / 100;
+        if (max < 1)
+          max = 1;
+      }
+      pq->ltp_class_max[c] = max;
+    }
+  }
+}
+
+/* Queue a task behind those of its own and higher priority classes.
+ * Called with pq->ltp_mutex held. */
+static void enqueue_task(struct ldap_int_thread_poolq_s *pq,
+                         ldap_int_thread_task_t *task) {
+  ldap_int_thread_task_t *prev = NULL;
+  int c;
+
+  for (c = task->ltt_class; c >= 0 && !prev; c--)
+    prev = pq->ltp_class_last[c];
+  if (prev)
+    LDAP_STAILQ_INSERT_AFTER(&pq->ltp_pending_list, prev, task, ltt_next.q);
+  else
+    LDAP_STAILQ_INSERT_HEAD(&pq->ltp_pending_list, task, ltt_next.q);
+  pq->ltp_class_last[task->ltt_class] = task;
+  pq->ltp_class_pending[task->ltt_class]++;
+  pq->ltp_pending_count++;
+}
+
+/* Take a task, which follows prev or is the first, off the pending
+ * list. Called with pq->ltp_mutex held. */
+static void dequeue_task(struct ldap_int_thread_poolq_s *pq,
+                         ldap_int_thread_task_t *prev,
+                         ldap_int_thread_task_t *task) {
+  int c = task->ltt_class;
+
+  if (prev)
+    LDAP_STAILQ_REMOVE_AFTER(&pq->ltp_pending_list, prev, ltt_next.q);
+  else
+    LDAP_STAILQ_REMOVE_HEAD(&pq->ltp_pending_list, ltt_next.q);
+  if (pq->ltp_class_last[c] == task)
+    pq->ltp_class_last[c] = (prev && prev->ltt_class == c) ? prev : NULL;
+  pq->ltp_class_pending[c]--;
+  pq->ltp_pending_count--;
+}
+
+/* The first task of the work list whose class has a thread to spare,
+ * NULL if none. The task before it is returned in *prevp. */
+static ldap_int_thread_task_t *next_task(struct ldap_int_thread_poolq_s *pq,
+                                         ldap_int_tpool_plist_t *work_list,
+                                         ldap_int_thread_task_t **prevp) {
+  ldap_int_thread_task_t *task = LDAP_STAILQ_FIRST(work_list), *prev = NULL;
+  int c;
+
+  /* tasks of a class are adjacent, skip them all at once */
+  while (task &&
+         pq->ltp_class_active[c = task->ltt_class] >= pq->ltp_class_max[c]) {
+    prev = pq->ltp_class_last[c];
+    task = LDAP_STAILQ_NEXT(prev, ltt_next.q);
+  }
+  *prevp = prev;
+  return task;
+}
+
+/* Track how long tasks of a class wait, CoDel style: once the delay
+ * stayed above target for an interval, shed new tasks of the class
+ * for another interval, renewed as long as the delay stays high. */
+static void class_delay(struct ldap_int_thread_pool_s *pool,
+                        ldap_int_thread_task_t *task) {
+  ldap_int_tpool_class_t *cl = &pool->ltp_classes[task->ltt_class];
+  uint64_t now;
+
+  if (!task->ltt_stamp)
+    return;
+  now = ldap_now_steady_ns();
+  if (now - task->ltt_stamp < cl->ltc_target_ns) {
+    cl->ltc_above = 0;
+    cl->ltc_shed_until = 0;
+  } else if (!cl->ltc_above) {
+    cl->ltc_above = now + cl->ltc_interval_ns;
+  } else if (now >= cl->ltc_above) {
+    cl->ltc_shed_until = now + cl->ltc_interval_ns;
+  }
+}
+
+/* Owner only: add a task at the bottom, -1 if the deque is full */
+static int deque_push(ldap_int_tpool_deque_t *dq,
+                      ldap_int_thread_task_t *task) {
+  long b = dq->ltd_bottom, t = dq->ltd_top;
+
+  if (b - t >= DEQUE_SIZE)
+    return -1;
+  dq->ltd_tasks[b & (DEQUE_SIZE - 1)] = task;
+  /* the task must be visible before a thief can see the slot */
+  __sync_synchronize();
+  dq->ltd_bottom = b + 1;
+  return 0;
+}
+
+/* Owner only: take the newest task, NULL if none is left */
+static ldap_int_thread_task_t *deque_pop(ldap_int_tpool_deque_t *dq) {
+  ldap_int_thread_task_t *task = NULL;
+  long b = dq->ltd_bottom - 1, t;
+
+  dq->ltd_bottom = b;
+  /* publish the claim on slot b before looking at the thieves */
+  __sync_synchronize();
+  t = dq->ltd_top;
+  if (t <= b) {
+    task = dq->ltd_tasks[b & (DEQUE_SIZE - 1)];
+    if (t == b) {
+      /* the last one, race the thieves for it */
+      if (!__sync_bool_compare_and_swap(&dq->ltd_top, t, t + 1))
+        task = NULL;
+      dq->ltd_bottom = b + 1;
+    }
+  } else {
+    dq->ltd_bottom = b + 1;
+  }
+  return task;
+}
+
+/* Any thread: take the oldest task, NULL if none or lost a race */
+static ldap_int_thread_task_t *deque_steal(ldap_int_tpool_deque_t *dq) {
+  ldap_int_thread_task_t *task;
+  long t = dq->ltd_top, b;
+
+  __sync_synchronize();
+  b = dq->ltd_bottom;
+  if (t >= b)
+    return NULL;
+  task = dq->ltd_tasks[t & (DEQUE_SIZE - 1)];
+  if (!__sync_bool_compare_and_swap(&dq->ltd_top, t, t + 1))
+    return NULL;
+  return task;
+}
+
+/* Tasks waiting in the deques, a snapshot */
+static int deque_count(struct ldap_int_thread_pool_s *pool) {
+  ldap_int_tpool_deque_t *dq;
+  long n;
+  int i, count = 0;
+
+  for (i = 0; i < pool->ltp_ndeques; i++) {
+    dq = pool->ltp_deques[i];
+    n = dq->ltd_bottom - dq->ltd_top;
+    if (n > 0)
+      count += n;
+  }
+  return count;
+}
+
 static ldap_pvt_thread_key_t ldap_tpool_key;
 
 /* Context of the main thread */
@@ -233,12 +466,20 @@ int ldap_pvt_thread_pool_init_q(ldap_pvt_thread_pool_t *tpool, int max_threads,
     return (-1);
   }
 
+  pool->ltp_deques = LDAP_CALLOC(LDAP_MAXTHR, sizeof(ldap_int_tpool_deque_t *));
+  if (pool->ltp_deques == NULL) {
+    LDAP_FREE(pool->ltp_wqs);
+    LDAP_FREE(pool);
+    return (-1);
+  }
+
   for (i = 0; i < numqs; i++) {
     char *ptr =
         LDAP_CALLOC(1, sizeof(struct ldap_int_thread_poolq_s) + CACHELINE - 1);
     if (ptr == NULL) {
       for (--i; i >= 0; i--)
         LDAP_FREE(pool->ltp_wqs[i]->ltp_free);
+      LDAP_FREE(pool->ltp_deques);
       LDAP_FREE(pool->ltp_wqs);
       LDAP_FREE(pool);
       return (-1);
@@ -271,6 +512,7 @@ int ldap_pvt_thread_pool_init_q(ldap_pvt_thread_pool_t *tpool, int max_threads,
   for (i = 0; i < numqs; i++) {
     pq = pool->ltp_wqs[i];
     pq->ltp_pool = pool;
+    pq->ltp_id = i;
     rc = ldap_pvt_thread_mutex_init(&pq->ltp_mutex);
     if (rc != 0)
       goto cleanup4;
@@ -295,6 +537,7 @@ int ldap_pvt_thread_pool_init_q(ldap_pvt_thread_pool_t *tpool, int max_threads,
 
   pool->ltp_max_count = max_threads;
   pool->ltp_max_pending = max_pending;
+  set_class_limits(pool);
 
   ldap_pvt_thread_mutex_lock(&ldap_pvt_thread_pool_mutex);
   LDAP_STAILQ_INSERT_TAIL(&ldap_int_thread_pool_list, pool, ltp_next);
@@ -326,6 +569,7 @@ cleanup2:
 cleanup1:
   for (i = 0; i < numqs; i++)
     LDAP_FREE(pool->ltp_wqs[i]->ltp_free);
+  LDAP_FREE(pool->ltp_deques);
   LDAP_FREE(pool->ltp_wqs);
   LDAP_FREE(pool);
   return rc;
@@ -343,15 +587,258 @@ int ldap_pvt_thread_pool_submit(ldap_pvt_thread_pool_t *tpool,
   return ldap_pvt_thread_pool_submit2(tpool, start_routine, arg, NULL);
 }
 
+/* The queue of the calling thread, if it is a worker of this pool
+ * and tasks may be stolen. Otherwise -1. */
+static int own_queue(struct ldap_int_thread_pool_s *pool) {
+  ldap_int_thread_userctx_t *ctx;
+
+  if (!(pool->ltp_sched & LDAP_PVT_THREAD_POOL_STEAL))
+    return -1;
+  ctx = ldap_pvt_thread_pool_context();
+  if (ctx->ltu_pq == NULL || ctx->ltu_pq->ltp_pool != pool ||
+      ctx->ltu_pq->ltp_id >= pool->ltp_numqs)
+    return -1;
+  return ctx->ltu_pq->ltp_id;
+}
+
+/* Wake an idle thread of another queue, or with first 0 of pq itself,
+ * to steal from pq. Returns whether one was woken. */
+static int wake_thief(struct ldap_int_thread_pool_s *pool,
+                      struct ldap_int_thread_poolq_s *pq, int first) {
+  struct ldap_int_thread_poolq_s *tq;
+  int i, woken = 0, n = pool->ltp_numqs;
+
+  for (i = first; i < n && !woken; i++) {
+    tq = pool->ltp_wqs[(pq->ltp_id + i) % n];
+    /* unlocked peek, checked again below */
+    if (tq->ltp_open_count - tq->ltp_starting <= tq->ltp_active_count)
+      continue;
+    ldap_pvt_thread_mutex_lock(&tq->ltp_mutex);
+    if (tq->ltp_open_count - tq->ltp_starting > tq->ltp_active_count &&
+        LDAP_STAILQ_EMPTY(tq->ltp_work_list)) {
+      ldap_pvt_thread_cond_signal(&tq->ltp_cond);
+      woken = 1;
+    }
+    ldap_pvt_thread_mutex_unlock(&tq->ltp_mutex);
+  }
+  return woken;
+}
+
+/* Whether some thread of the pool looks idle, unlocked */
+static int idle_thread(struct ldap_int_thread_pool_s *pool) {
+  struct ldap_int_thread_poolq_s *tq;
+  int i;
+
+  for (i = 0; i < pool->ltp_numqs; i++) {
+    tq = pool->ltp_wqs[i];
+    if (tq->ltp_open_count - tq->ltp_starting > tq->ltp_active_count)
+      return 1;
+  }
+  return 0;
+}
+
+/* Give the calling worker a deque, reusing one a finished thread left */
+static ldap_int_tpool_deque_t *deque_attach(struct ldap_int_thread_pool_s *pool,
+                                            ldap_int_thread_userctx_t *ctx) {
+  ldap_int_tpool_deque_t *dq = NULL;
+  char *ptr;
+  int i;
+
+  ldap_pvt_thread_mutex_lock(&ldap_pvt_thread_pool_mutex);
+  for (i = 0; i < pool->ltp_ndeques; i++) {
+    if (!pool->ltp_deques[i]->ltd_owned) {
+      dq = pool->ltp_deques[i];
+      break;
+    }
+  }
+  if (dq == NULL && i < LDAP_MAXTHR &&
+      (ptr = LDAP_CALLOC(1, sizeof(*dq) + CACHELINE - 1)) != NULL) {
+    dq = (ldap_int_tpool_deque_t *)(((size_t)ptr + CACHELINE - 1) &
+                                    ~(CACHELINE - 1));
+    dq->ltd_free = ptr;
+    LDAP_SLIST_INIT(&dq->ltd_spare);
+    pool->ltp_deques[i] = dq;
+    /* thieves read ltp_ndeques without the lock */
+    __sync_synchronize();
+    pool->ltp_ndeques = i + 1;
+  }
+  if (dq)
+    dq->ltd_owned = 1;
+  ldap_pvt_thread_mutex_unlock(&ldap_pvt_thread_pool_mutex);
+  ctx->ltu_deque = dq;
+  return dq;
+}
+
+/* A thread is leaving the pool: hand what is left in its deque to pq,
+ * and its spare tasks too. Called with pq->ltp_mutex held. */
+static void deque_detach(struct ldap_int_thread_poolq_s *pq,
+                         ldap_int_thread_userctx_t *ctx) {
+  ldap_int_tpool_deque_t *dq = ctx->ltu_deque;
+  ldap_int_thread_task_t *task;
+
+  while ((task = deque_pop(dq)) != NULL) {
+    task->ltt_queue = pq;
+    enqueue_task(pq, task);
+  }
+  while ((task = LDAP_SLIST_FIRST(&dq->ltd_spare)) != NULL) {
+    LDAP_SLIST_REMOVE_HEAD(&dq->ltd_spare, ltt_next.l);
+    LDAP_SLIST_INSERT_HEAD(&pq->ltp_free_list, task, ltt_next.l);
+  }
+  dq->ltd_nspare = 0;
+
+  ldap_pvt_thread_mutex_lock(&ldap_pvt_thread_pool_mutex);
+  dq->ltd_owned = 0;
+  ldap_pvt_thread_mutex_unlock(&ldap_pvt_thread_pool_mutex);
+  ctx->ltu_deque = NULL;
+}
+
+/* A task submitted by a worker of the pool, when tasks may be stolen,
+ * goes to the worker's deque if an idle thread can be woken to take
+ * it. Tasks with a cookie stay on the pending lists, where
+ * pool_retract() can find them, and so do those of classes that are
+ * accounted for. Returns -1 to use the pending lists instead. */
+static int submit_local(struct ldap_int_thread_pool_s *pool,
+                        ldap_pvt_thread_start_t *start_routine, void *arg) {
+  ldap_int_thread_userctx_t *ctx;
+  ldap_int_tpool_deque_t *dq;
+  ldap_int_thread_task_t *task;
+
+  if (own_queue(pool) < 0 || pool->ltp_pause || pool->ltp_finishing ||
+      pool->ltp_classes[0].ltc_target_ns || !idle_thread(pool))
+    return -1;
+  ctx = ldap_pvt_thread_pool_context();
+  dq = ctx->ltu_deque;
+  if (dq == NULL && (dq = deque_attach(pool, ctx)) == NULL)
+    return -1;
+
+  task = LDAP_SLIST_FIRST(&dq->ltd_spare);
+  if (task) {
+    LDAP_SLIST_REMOVE_HEAD(&dq->ltd_spare, ltt_next.l);
+    dq->ltd_nspare--;
+  } else {
+    task = (ldap_int_thread_task_t *)LDAP_MALLOC(sizeof(*task));
+    if (task == NULL)
+      return -1;
+  }
+  task->ltt_start_routine = start_routine;
+  task->ltt_arg = arg;
+  task->ltt_queue = ctx->ltu_pq;
+  task->ltt_class = 0;
+  task->ltt_stamp = 0;
+
+  if (deque_push(dq, task)) {
+    LDAP_SLIST_INSERT_HEAD(&dq->ltd_spare, task, ltt_next.l);
+    dq->ltd_nspare++;
+    return -1;
+  }
+  /* if nobody could be woken after all, we pop it ourselves once the
+   * current task is done */
+  wake_thief(pool, ctx->ltu_pq, 0);
+  return 0;
+}
+
+/* Move the first pending task of another queue which our own class
+ * limits let run to our own pending list. Called with pq->ltp_mutex
+ * held. Other queues are only tried, never waited for, so two thieves
+ * cannot deadlock. */
+static ldap_int_thread_task_t *steal_task(struct ldap_int_thread_poolq_s *pq) {
+  struct ldap_int_thread_pool_s *pool = pq->ltp_pool;
+  struct ldap_int_thread_poolq_s *vq;
+  ldap_int_thread_task_t *task = NULL, *prev = NULL;
+  int i, c, n = pool->ltp_numqs;
+
+  /* nothing moves while a pause is pending, see handle_pause(), and
+   * no more is taken while tasks our class limits hold back wait */
+  if (pool->ltp_pause || pq->ltp_work_list != &pq->ltp_pending_list ||
+      !LDAP_STAILQ_EMPTY(&pq->ltp_pending_list) || pq->ltp_id >= n)
+    return NULL;
+
+  for (i = 1; i < n && !task; i++) {
+    vq = pool->ltp_wqs[(pq->ltp_id + i) % n];
+    if (LDAP_STAILQ_EMPTY(&vq->ltp_pending_list) ||
+        ldap_pvt_thread_mutex_trylock(&vq->ltp_mutex))
+      continue;
+    if (vq->ltp_work_list == &vq->ltp_pending_list) {
+      /* as next_task() would pick it, class_last of vq skips the
+       * tasks of a class at its limit here */
+      task = LDAP_STAILQ_FIRST(&vq->ltp_pending_list);
+      while (task && pq->ltp_class_active[c = task->ltt_class] >=
+                         pq->ltp_class_max[c]) {
+        prev = vq->ltp_class_last[c];
+        task = LDAP_STAILQ_NEXT(prev, ltt_next.q);
+      }
+    }
+    if (task) {
+      dequeue_task(vq, prev, task);
+      /* under both locks, for pool_retract() */
+      task->ltt_queue = pq;
+    }
+    ldap_pvt_thread_mutex_unlock(&vq->ltp_mutex);
+  }
+
+  if (task)
+    enqueue_task(pq, task);
+  return task;
+}
+
+/* The next task for a thread of pq: the newest one of its own deque,
+ * the first runnable one of the pending list, the oldest one of any
+ * other deque, or one taken from another queue's pending list. *prevp
+ * is for dequeue_task(), *localp is set for a task from a deque.
+ * Called with pq->ltp_mutex held; deques are left alone while a pause
+ * is pending, the work list then is empty_pending_list. */
+static ldap_int_thread_task_t *find_task(struct ldap_int_thread_poolq_s *pq,
+                                         ldap_int_thread_userctx_t *ctx,
+                                         ldap_int_thread_task_t **prevp,
+                                         int *localp) {
+  struct ldap_int_thread_pool_s *pool = pq->ltp_pool;
+  ldap_int_tpool_plist_t *work_list = pq->ltp_work_list;
+  ldap_int_thread_task_t *task;
+  int i, n;
+
+  /* the deques are emptied even after stealing was turned off */
+  *prevp = NULL;
+  *localp = 1;
+  if (work_list == &pq->ltp_pending_list && ctx->ltu_deque &&
+      (task = deque_pop(ctx->ltu_deque)) != NULL)
+    return task;
+
+  *localp = 0;
+  task = next_task(pq, work_list, prevp);
+  if (task || work_list != &pq->ltp_pending_list)
+    return task;
+
+  n = pool->ltp_ndeques;
+  for (i = 0; i < n; i++) {
+    ldap_int_tpool_deque_t *dq = pool->ltp_deques[(pq->ltp_id + i) % n];
+    if (dq != ctx->ltu_deque && (task = deque_steal(dq)) != NULL) {
+      *localp = 1;
+      return task;
+    }
+  }
+
+  if ((pool->ltp_sched & LDAP_PVT_THREAD_POOL_STEAL) && steal_task(pq))
+    task = next_task(pq, work_list, prevp);
+  return task;
+}
+
 /* Submit a task to be performed by the thread pool */
 int ldap_pvt_thread_pool_submit2(ldap_pvt_thread_pool_t *tpool,
                                  ldap_pvt_thread_start_t *start_routine,
                                  void *arg, void **cookie) {
+  return ldap_pvt_thread_pool_submit_class(tpool, 0, start_routine, arg,
+                                           cookie);
+}
+
+/* Submit a task of the given priority class */
+int ldap_pvt_thread_pool_submit_class(ldap_pvt_thread_pool_t *tpool, int cls,
+                                      ldap_pvt_thread_start_t *start_routine,
+                                      void *arg, void **cookie) {
   struct ldap_int_thread_pool_s *pool;
   struct ldap_int_thread_poolq_s *pq;
   ldap_int_thread_task_t *task;
   ldap_pvt_thread_t thr;
-  int i, j;
+  int i, j, thief = 0;
 
   if (tpool == NULL)
     return (-1);
@@ -361,7 +848,22 @@ int ldap_pvt_thread_pool_submit2(ldap_pvt_thread_pool_t *tpool,
   if (pool == NULL)
     return (-1);
 
-  if (pool->ltp_numqs > 1) {
+  if (cls < 0 || cls >= LDAP_PVT_THREAD_POOL_MAX_CLASSES)
+    return (-1);
+  if (cls == 0 && cookie == NULL &&
+      (pool->ltp_sched & LDAP_PVT_THREAD_POOL_STEAL) &&
+      submit_local(pool, start_routine, arg) == 0)
+    return (0);
+  if (cls && pool->ltp_classes[cls].ltc_conf.ltc_pending) {
+    int pending = 0;
+    for (i = 0; i < pool->ltp_numqs; i++)
+      pending += pool->ltp_wqs[i]->ltp_class_pending[cls];
+    if (pending >= pool->ltp_classes[cls].ltc_conf.ltc_pending)
+      return (-1);
+  }
+
+  i = 0;
+  if (pool->ltp_numqs > 1 && (i = own_queue(pool)) < 0) {
     int min =
         pool->ltp_wqs[0]->ltp_max_pending + pool->ltp_wqs[0]->ltp_max_count;
     int min_x = 0, cnt;
@@ -379,8 +881,7 @@ int ldap_pvt_thread_pool_submit2(ldap_pvt_thread_pool_t *tpool,
       }
     }
     i = min_x;
-  } else
-    i = 0;
+  }
 
   j = i;
   while (1) {
@@ -409,11 +910,13 @@ int ldap_pvt_thread_pool_submit2(ldap_pvt_thread_pool_t *tpool,
   task->ltt_start_routine = start_routine;
   task->ltt_arg = arg;
   task->ltt_queue = pq;
+  task->ltt_class = cls;
+  task->ltt_stamp =
+      pool->ltp_classes[cls].ltc_target_ns ? ldap_now_steady_ns() : 0;
   if (cookie)
     *cookie = task;
 
-  pq->ltp_pending_count++;
-  LDAP_STAILQ_INSERT_TAIL(&pq->ltp_pending_list, task, ltt_next.q);
+  enqueue_task(pq, task);
 
   if (pool->ltp_pause)
     goto done;
@@ -435,22 +938,22 @@ int ldap_pvt_thread_pool_submit2(ldap_pvt_thread_pool_t *tpool,
       if (pq->ltp_open_count == 0) {
         /* no open threads at all?!?
          */
-        ldap_int_thread_task_t *ptr;
+        ldap_int_thread_task_t *ptr, *prev = NULL;
 
         /* let pool_destroy know there are no more threads */
         ldap_pvt_thread_cond_signal(&pq->ltp_cond);
 
-        LDAP_STAILQ_FOREACH(ptr, &pq->ltp_pending_list, ltt_next.q)
-        if (ptr == task)
-          break;
+        LDAP_STAILQ_FOREACH(ptr, &pq->ltp_pending_list, ltt_next.q) {
+          if (ptr == task)
+            break;
+          prev = ptr;
+        }
         if (ptr == task) {
           /* no open threads, task not handled, so
            * back out of ltp_pending_count, free the task,
            * report the error.
            */
-          pq->ltp_pending_count--;
-          LDAP_STAILQ_REMOVE(&pq->ltp_pending_list, task,
-                             ldap_int_thread_task_s, ltt_next.q);
+          dequeue_task(pq, prev, task);
           LDAP_SLIST_INSERT_HEAD(&pq->ltp_free_list, task, ltt_next.l);
           goto failed;
         }
@@ -462,8 +965,15 @@ int ldap_pvt_thread_pool_submit2(ldap_pvt_thread_pool_t *tpool,
   }
   ldap_pvt_thread_cond_signal(&pq->ltp_cond);
 
+  /* more tasks than idle threads here, let a sibling help */
+  if ((pool->ltp_sched & LDAP_PVT_THREAD_POOL_STEAL) && pool->ltp_numqs > 1 &&
+      pq->ltp_pending_count > pq->ltp_open_count - pq->ltp_active_count)
+    thief = 1;
+
 done:
   ldap_pvt_thread_mutex_unlock(&pq->ltp_mutex);
+  if (thief)
+    wake_thief(pool, pq, 1);
   return (0);
 
 failed:
@@ -490,6 +1000,12 @@ int ldap_pvt_thread_pool_retract(void *cookie) {
     return (-1);
 
   ldap_pvt_thread_mutex_lock(&pq->ltp_mutex);
+  /* follow the task if another queue stole it meanwhile */
+  while (ttmp->ltt_queue != pq) {
+    ldap_pvt_thread_mutex_unlock(&pq->ltp_mutex);
+    pq = ttmp->ltt_queue;
+    ldap_pvt_thread_mutex_lock(&pq->ltp_mutex);
+  }
   LDAP_STAILQ_FOREACH(task, &pq->ltp_pending_list, ltt_next.q)
   if (task == ttmp) {
     /* Could LDAP_STAILQ_REMOVE the task, but that
@@ -541,6 +1057,7 @@ int ldap_pvt_thread_pool_queues(ldap_pvt_thread_pool_t *tpool, int numqs) {
       pq->ltp_free = ptr;
       pool->ltp_wqs[i] = pq;
       pq->ltp_pool = pool;
+      pq->ltp_id = i;
       rc = ldap_pvt_thread_mutex_init(&pq->ltp_mutex);
       if (rc != 0)
         return (rc);
@@ -568,9 +1085,109 @@ int ldap_pvt_thread_pool_queues(ldap_pvt_thread_pool_t *tpool, int numqs) {
     }
   }
   pool->ltp_numqs = numqs;
+  set_class_limits(pool);
   return 0;
 }
 
+/* Select how tasks are spread over the work queues.
+ *
+ * With LDAP_PVT_THREAD_POOL_STEAL a thread that finds its own queue
+ * empty takes the oldest pending task of another queue before going
+ * idle, and tasks submitted by a thread of the pool are kept on its
+ * own deque, or else its own queue, where they are likely to find warm
+ * caches. With LDAP_PVT_THREAD_POOL_PIN the threads of queue N started
+ * from now on are bound to the Nth CPU the process may run on. */
+int ldap_pvt_thread_pool_sched(ldap_pvt_thread_pool_t *tpool, int flags) {
+  struct ldap_int_thread_pool_s *pool;
+
+  if (tpool == NULL)
+    return (-1);
+
+  pool = *tpool;
+
+  if (pool == NULL)
+    return (-1);
+
+  if ((flags & LDAP_PVT_THREAD_POOL_PIN) && pool->ltp_cpus == NULL) {
+#if defined(__linux__) && defined(CPU_SET)
+    cpu_set_t set;
+    int cpu, n = 0;
+
+    if (sched_getaffinity(0, sizeof(set), &set) != 0)
+      return (-1);
+    pool->ltp_cpus = LDAP_MALLOC(CPU_COUNT(&set) * sizeof(int));
+    if (pool->ltp_cpus == NULL)
+      return (-1);
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+      if (CPU_ISSET(cpu, &set))
+        pool->ltp_cpus[n++] = cpu;
+    pool->ltp_ncpus = n;
+#else
+    return (-1);
+#endif
+  }
+  pool->ltp_sched = flags;
+  return (0);
+}
+
+/* Set up priority classes, nclasses 0 drops them. Class 0 comes
+ * first, the ones after it only get threads when no task of a higher
+ * class is waiting, and no more than their share. Should be called
+ * while the pool is paused or idle. */
+int ldap_pvt_thread_pool_classes(ldap_pvt_thread_pool_t *tpool, int nclasses,
+                                 const ldap_pvt_thread_pool_class_t *classes) {
+  struct ldap_int_thread_pool_s *pool;
+  ldap_int_tpool_class_t *cl;
+  int c;
+
+  if (tpool == NULL || nclasses < 0 ||
+      nclasses > LDAP_PVT_THREAD_POOL_MAX_CLASSES)
+    return (-1);
+
+  pool = *tpool;
+
+  if (pool == NULL)
+    return (-1);
+
+  for (c = 0; c < LDAP_PVT_THREAD_POOL_MAX_CLASSES; c++) {
+    cl = &pool->ltp_classes[c];
+    memset(cl, 0, sizeof(*cl));
+    if (c < nclasses) {
+      cl->ltc_conf = classes[c];
+      cl->ltc_target_ns = classes[c].ltc_target * 1000000ull;
+      cl->ltc_interval_ns = classes[c].ltc_interval * 1000000ull;
+    }
+  }
+  pool->ltp_nclasses = nclasses;
+  set_class_limits(pool);
+  return (0);
+}
+
+/* Whether a new task of the class would be taken now: 0 if so, -1
+ * if its queue delay or its pending tasks are over their limits */
+int ldap_pvt_thread_pool_admit(ldap_pvt_thread_pool_t *tpool, int cls) {
+  struct ldap_int_thread_pool_s *pool;
+  ldap_int_tpool_class_t *cl;
+  uint64_t until;
+  int i, pending = 0;
+
+  if (tpool == NULL || (pool = *tpool) == NULL || cls <= 0 ||
+      cls >= pool->ltp_nclasses)
+    return (0);
+
+  cl = &pool->ltp_classes[cls];
+  until = cl->ltc_shed_until;
+  if (until && ldap_now_steady_ns() < until)
+    return (-1);
+  if (cl->ltc_conf.ltc_pending) {
+    for (i = 0; i < pool->ltp_numqs; i++)
+      pending += pool->ltp_wqs[i]->ltp_class_pending[cls];
+    if (pending >= cl->ltc_conf.ltc_pending)
+      return (-1);
+  }
+  return (0);
+}
+
 /* Set max #threads.  value <= 0 means max supported #threads (LDAP_MAXTHR) */
 int ldap_pvt_thread_pool_maxthreads(ldap_pvt_thread_pool_t *tpool,
                                     int max_threads) {
@@ -605,6 +1222,7 @@ int ldap_pvt_thread_pool_maxthreads(ldap_pvt_thread_pool_t *tpool,
       remthr--;
     }
   }
+  set_class_limits(pool);
   return (0);
 }
 
@@ -674,6 +1292,9 @@ int ldap_pvt_thread_pool_query(ldap_pvt_thread_pool_t *tpool,
       }
       ldap_pvt_thread_mutex_unlock(&pq->ltp_mutex);
     }
+    if (param == LDAP_PVT_THREAD_POOL_PARAM_PENDING ||
+        param == LDAP_PVT_THREAD_POOL_PARAM_BACKLOAD)
+      count += deque_count(pool);
     if (count < 0)
       count = -count;
   } break;
@@ -797,7 +1418,7 @@ int ldap_pvt_thread_pool_destroy(ldap_pvt_thread_pool_t *tpool,
       pq->ltp_max_pending = -pq->ltp_max_pending;
     if (!run_pending) {
       while ((task = LDAP_STAILQ_FIRST(&pq->ltp_pending_list)) != NULL) {
-        LDAP_STAILQ_REMOVE_HEAD(&pq->ltp_pending_list, ltt_next.q);
+        dequeue_task(pq, NULL, task);
         LDAP_FREE(task);
       }
       pq->ltp_pending_count = 0;
@@ -808,6 +1429,11 @@ int ldap_pvt_thread_pool_destroy(ldap_pvt_thread_pool_t *tpool,
       ldap_pvt_thread_cond_wait(&pq->ltp_cond, &pq->ltp_mutex);
     }
 
+    /* left by threads that quit while paused */
+    while ((task = LDAP_STAILQ_FIRST(&pq->ltp_pending_list)) != NULL) {
+      dequeue_task(pq, NULL, task);
+      LDAP_FREE(task);
+    }
     while ((task = LDAP_SLIST_FIRST(&pq->ltp_free_list)) != NULL) {
       LDAP_SLIST_REMOVE_HEAD(&pq->ltp_free_list, ltt_next.l);
       LDAP_FREE(task);
@@ -826,6 +1452,19 @@ int ldap_pvt_thread_pool_destroy(ldap_pvt_thread_pool_t *tpool,
       LDAP_FREE(pq->ltp_free);
     }
   }
+  /* every thread is gone, nothing moves in the deques anymore */
+  for (i = 0; i < pool->ltp_ndeques; i++) {
+    ldap_int_tpool_deque_t *dq = pool->ltp_deques[i];
+    while ((task = deque_steal(dq)) != NULL)
+      LDAP_FREE(task);
+    while ((task = LDAP_SLIST_FIRST(&dq->ltd_spare)) != NULL) {
+      LDAP_SLIST_REMOVE_HEAD(&dq->ltd_spare, ltt_next.l);
+      LDAP_FREE(task);
+    }
+    LDAP_FREE(dq->ltd_free);
+  }
+  LDAP_FREE(pool->ltp_deques);
+  LDAP_FREE(pool->ltp_cpus);
   LDAP_FREE(pool->ltp_wqs);
   LDAP_FREE(pool);
   *tpool = NULL;
@@ -833,15 +1472,28 @@ int ldap_pvt_thread_pool_destroy(ldap_pvt_thread_pool_t *tpool,
   return (0);
 }
 
+/* Bind the calling thread to the CPU of its queue */
+static void pin_thread(struct ldap_int_thread_poolq_s *pq) {
+#if defined(__linux__) && defined(CPU_SET)
+  struct ldap_int_thread_pool_s *pool = pq->ltp_pool;
+  cpu_set_t set;
+
+  if (pool->ltp_ncpus < 1)
+    return;
+  CPU_ZERO(&set);
+  CPU_SET(pool->ltp_cpus[pq->ltp_id % pool->ltp_ncpus], &set);
+  sched_setaffinity(0, sizeof(set), &set);
+#endif
+}
+
 /* Thread loop.  Accept and handle submitted tasks. */
 static void *ldap_int_thread_pool_wrapper(void *xpool) {
   struct ldap_int_thread_poolq_s *pq = xpool;
   struct ldap_int_thread_pool_s *pool = pq->ltp_pool;
-  ldap_int_thread_task_t *task;
-  ldap_int_tpool_plist_t *work_list;
+  ldap_int_thread_task_t *task, *prev;
   ldap_int_thread_userctx_t ctx, *kctx;
   unsigned i, keyslot, hash;
-  int pool_lock = 0, freeme = 0;
+  int pool_lock = 0, freeme = 0, local;
 
   assert(pool != NULL);
 
@@ -850,11 +1502,15 @@ static void *ldap_int_thread_pool_wrapper(void *xpool) {
   }
 
   ctx.ltu_pq = pq;
+  ctx.ltu_deque = NULL;
   ctx.ltu_id = ldap_pvt_thread_self();
   TID_HASH(ctx.ltu_id, hash);
 
   ldap_pvt_thread_key_setdata(ldap_tpool_key, &ctx);
 
+  if (pool->ltp_sched & LDAP_PVT_THREAD_POOL_PIN)
+    pin_thread(pq);
+
   if (pool->ltp_pause) {
     ldap_pvt_thread_mutex_lock(&pool->ltp_mutex);
     /* thread_keys[] is read-only when paused */
@@ -880,11 +1536,14 @@ static void *ldap_int_thread_pool_wrapper(void *xpool) {
   pq->ltp_active_count++;
 
   for (;;) {
-    work_list = pq->ltp_work_list; /* help the compiler a bit */
-    task = LDAP_STAILQ_FIRST(work_list);
+    task = find_task(pq, &ctx, &prev, &local);
     if (task == NULL) { /* paused or no pending tasks */
       if (--(pq->ltp_active_count) < 1) {
-        if (pool->ltp_pause) {
+        /* Only a queue the pausing thread counted as active reports
+         * back, once; threads that went idle before it looked, or
+         * started after, are not waited for. */
+        if (pq->ltp_pause_active) {
+          pq->ltp_pause_active = 0;
           ldap_pvt_thread_mutex_unlock(&pq->ltp_mutex);
           ldap_pvt_thread_mutex_lock(&pool->ltp_mutex);
           pool_lock = 1;
@@ -925,8 +1584,11 @@ static void *ldap_int_thread_pool_wrapper(void *xpool) {
         } else
           ldap_pvt_thread_cond_wait(&pq->ltp_cond, &pq->ltp_mutex);
 
-        work_list = pq->ltp_work_list;
-        task = LDAP_STAILQ_FIRST(work_list);
+        if (pool_lock) {
+          local = 0;
+          task = next_task(pq, pq->ltp_work_list, &prev);
+        } else
+          task = find_task(pq, &ctx, &prev, &local);
       } while (task == NULL);
 
       if (pool_lock) {
@@ -937,17 +1599,34 @@ static void *ldap_int_thread_pool_wrapper(void *xpool) {
       pq->ltp_active_count++;
     }
 
-    LDAP_STAILQ_REMOVE_HEAD(work_list, ltt_next.q);
-    pq->ltp_pending_count--;
+    if (!local)
+      dequeue_task(pq, prev, task);
+    pq->ltp_class_active[task->ltt_class]++;
     ldap_pvt_thread_mutex_unlock(&pq->ltp_mutex);
 
+    class_delay(pool, task);
     task->ltt_start_routine(&ctx, task->ltt_arg);
 
     ldap_pvt_thread_mutex_lock(&pq->ltp_mutex);
-    LDAP_SLIST_INSERT_HEAD(&pq->ltp_free_list, task, ltt_next.l);
+    pq->ltp_class_active[task->ltt_class]--;
+    if (local && ctx.ltu_deque && ctx.ltu_deque->ltd_nspare < DEQUE_SIZE) {
+      /* keep it for the next task we submit ourselves */
+      LDAP_SLIST_INSERT_HEAD(&ctx.ltu_deque->ltd_spare, task, ltt_next.l);
+      ctx.ltu_deque->ltd_nspare++;
+    } else {
+      LDAP_SLIST_INSERT_HEAD(&pq->ltp_free_list, task, ltt_next.l);
+    }
   }
 done:
 
+  if (ctx.ltu_deque) {
+    if (pool_lock)
+      ldap_pvt_thread_mutex_lock(&pq->ltp_mutex);
+    deque_detach(pq, &ctx);
+    if (pool_lock)
+      ldap_pvt_thread_mutex_unlock(&pq->ltp_mutex);
+  }
+
   ldap_pvt_thread_mutex_lock(&ldap_pvt_thread_pool_mutex);
 
   /* The pool_mutex lock protects ctx->ltu_key from pool_purgekey()
@@ -1032,7 +1711,8 @@ static int handle_pause(ldap_pvt_thread_pool_t *tpool, int pause_type) {
     ldap_pvt_thread_mutex_lock(&pq->ltp_mutex);
     pq->ltp_pending_count++;
     pq->ltp_active_count--;
-    if (pause && pq->ltp_active_count < 1) {
+    if (pq->ltp_pause_active && pq->ltp_active_count < 1) {
+      pq->ltp_pause_active = 0;
       do_pool = 1;
     }
     ldap_pvt_thread_mutex_unlock(&pq->ltp_mutex);
@@ -1083,8 +1763,10 @@ static int handle_pause(ldap_pvt_thread_pool_t *tpool, int pause_type) {
       /* Hide pending tasks from ldap_pvt_thread_pool_wrapper() */
       pq->ltp_work_list = &empty_pending_list;
 
-      if (pq->ltp_active_count > 0)
+      if (pq->ltp_active_count > 0) {
         pool->ltp_active_queues++;
+        pq->ltp_pause_active = 1;
+      }
 
       ldap_pvt_thread_mutex_unlock(&pq->ltp_mutex);
       if (pool->ltp_numqs > 1) {
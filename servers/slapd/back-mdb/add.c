@@ -384,6 +384,8 @@ int mdb_add(Operation *op, SlapReply *rs) {
     mc = NULL;
   }
 
+  mdb_slog_hook(op, mdb, txn);
+
   if (moi == &opinfo) {
     LDAP_SLIST_REMOVE(&op->o_extra, &opinfo.moi_oe, OpExtra, oe_next);
     opinfo.moi_oe.oe_key = NULL;
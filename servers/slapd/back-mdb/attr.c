@@ -24,6 +24,7 @@
 #include "back-mdb.h"
 #include "slapconfig.h"
 #include "lutil.h"
+#include "lutil_hash.h"
 
 /* Find the ad, return -1 if not found,
  * set point for insertion if ins is non-NULL
@@ -568,3 +569,92 @@ int mdb_ad_get(struct mdb_info *mdb, MDB_txn *txn, AttributeDescription *ad) {
   ldap_pvt_thread_mutex_unlock(&mdb->mi_ads_mutex);
   return rc;
 }
+
+/* Record 0 of ad2id, which mdb_ad_read() never visits, tells how the
+ * hashed index keys of this database were built. Databases without it
+ * were indexed with 32-bit FNV keys. */
+#define MDB_IXHASH_VERSION 1
+
+typedef struct mdb_ixhash {
+  uint32_t ih_version;
+  uint32_t ih_bytes;
+} mdb_ixhash;
+
+static unsigned mdb_ixhash_bytes(void) {
+  return slap_hash64(-1) ? LUTIL_HASH64_BYTES : LUTIL_HASH_BYTES;
+}
+
+int mdb_ixhash_put(struct mdb_info *mdb, MDB_txn *txn) {
+  mdb_ixhash ih;
+  MDB_val key, data;
+  int i = 0, rc;
+
+  ih.ih_version = MDB_IXHASH_VERSION;
+  ih.ih_bytes = mdb_ixhash_bytes();
+  key.mv_size = sizeof(int);
+  key.mv_data = &i;
+  data.mv_size = sizeof(ih);
+  data.mv_data = &ih;
+
+  rc = mdb_put(txn, mdb->mi_ad2id, &key, &data, 0);
+  if (rc)
+    Debug(LDAP_DEBUG_ANY, "mdb_ixhash_put: mdb_put failed %s(%d)\n",
+          mdb_strerror(rc), rc);
+  return rc;
+}
+
+/* Compare the hash of the index keys on disk with index_hash64.
+ * A mismatch is fatal except for slapindex, which rebuilds the
+ * indices and records the new hash when it is done. */
+int mdb_ixhash_check(BackendDB *be, MDB_txn *txn, struct config_reply_s *cr) {
+  struct mdb_info *mdb = (struct mdb_info *)be->be_private;
+  unsigned bytes = LUTIL_HASH_BYTES, want = mdb_ixhash_bytes();
+  mdb_ixhash ih;
+  MDB_val key, data;
+  MDB_stat st;
+  int i = 0, rc;
+
+  key.mv_size = sizeof(int);
+  key.mv_data = &i;
+  rc = mdb_get(txn, mdb->mi_ad2id, &key, &data);
+  if (rc == MDB_SUCCESS) {
+    memset(&ih, 0, sizeof(ih));
+    memcpy(&ih, data.mv_data,
+           data.mv_size < sizeof(ih) ? data.mv_size : sizeof(ih));
+    if (data.mv_size < sizeof(ih) || ih.ih_version > MDB_IXHASH_VERSION) {
+      snprintf(cr->msg, sizeof(cr->msg),
+               "database \"%s\": index keys use an unknown hash "
+               "(version %u).",
+               be->be_suffix[0].bv_val, ih.ih_version);
+      Debug(LDAP_DEBUG_ANY, "mdb_ixhash_check: %s\n", cr->msg);
+      return LDAP_OTHER;
+    }
+    bytes = ih.ih_bytes;
+  } else if (rc != MDB_NOTFOUND) {
+    return rc;
+  }
+
+  if (slapMode & SLAP_TOOL_READONLY)
+    return 0;
+
+  if (bytes != want) {
+    rc = mdb_stat(txn, mdb->mi_id2entry, &st);
+    if (rc)
+      return rc;
+    if (st.ms_entries) {
+      snprintf(cr->msg, sizeof(cr->msg),
+               "database \"%s\": index keys are %u-byte hashes, "
+               "\"index_hash64 %s\" needs them rebuilt, run \"slapindex\".",
+               be->be_suffix[0].bv_val, bytes, want > bytes ? "on" : "off");
+      Debug(LDAP_DEBUG_ANY, "mdb_ixhash_check: %s\n", cr->msg);
+      if (!(slapMode & SLAP_TOOL_READMAIN))
+        return LDAP_OTHER;
+      mdb->mi_flags |= MDB_IXHASH_CHANGE;
+      return 0;
+    }
+  } else if (rc == MDB_SUCCESS) {
+    return 0;
+  }
+
+  return mdb_ixhash_put(mdb, txn);
+}
@@ -85,6 +85,12 @@ struct mdb_info {
   int mi_readers;
 
   uint32_t mi_rtxn_size;
+  uint32_t mi_idl_range_limit;
+  uint32_t mi_search_threads;
+  volatile int mi_search_helpers;
+  uint32_t mi_sortvals_min;
+  uint32_t mi_ecache_size;
+  struct mdb_ecache *mi_ecache;
   int mi_txn_cp;
   uint32_t mi_txn_cp_period;
   uint32_t mi_txn_cp_kbyte;
@@ -112,6 +118,7 @@ struct mdb_info {
 #define MDB_DEL_INDEX 0x08
 #define MDB_RE_OPEN 0x10
 #define MDB_NEED_UPGRADE 0x20
+#define MDB_IXHASH_CHANGE 0x40 /* index keys need a rehash */
 
   ldap_pvt_thread_mutex_t mi_ads_mutex;
   int mi_numads;
@@ -137,10 +144,22 @@ typedef struct mdb_op_info {
   OpExtra moi_oe;
   MDB_txn *moi_txn;
   int moi_ref;
+  int moi_numads; /* mi_numads when a kept txn began, see mdb_txn() */
   char moi_flag;
 } mdb_op_info;
 #define MOI_READER 0x01
 #define MOI_FREEIT 0x02
+#define MOI_KEEPER 0x04 /* held open by mdb_txn() */
+
+/* The stored attributes a search needs from its candidates,
+ * see mdb_attr_view_get() */
+typedef struct mdb_attr_view {
+  AttributeName *av_attrs;         /* requested attributes */
+  AttributeDescription **av_descs; /* tested by the filter or ACLs */
+  int av_ndescs;
+  int av_nads;            /* attribute indexes decided in av_keep */
+  unsigned char *av_keep; /* materialize attribute index i? */
+} mdb_attr_view;
 
 /* Copy an ID "src" to pointer "dst" in big-endian byte order */
 #define MDB_ID2DISK(src, dst)                                                  \
@@ -231,6 +250,7 @@ typedef struct IndexRec {
 
 #define MAXRDNS SLAP_LDAPDN_MAXLEN / 4
 
+#include "slog.h"
 #include "proto-mdb.h"
 
 #endif /* _BACK_MDB_H_ */
@@ -0,0 +1,300 @@
+/* $ReOpenLDAP$ */
+/* Copyright 2011-2018 ReOpenLDAP AUTHORS: please see AUTHORS file.
+ * All rights reserved.
+ *
+ * This file is part of ReOpenLDAP.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+/* Checks of the candidate streams across a renewed read txn.
+ *
+ * usage: cstreamtest [dir]
+ *
+ * Two presence streams are opened on index keys of a scratch database
+ * (in dir, a new temporary directory by default) and read part way.
+ * With the read txn reset, a writer collapses the first key into a
+ * range and deletes the second; after mdb_cstream_renew() the streams
+ * must go on with what the keys hold now. */
+
+#include "reldap.h"
+
+#include <stdio.h>
+#include <ac/stdlib.h>
+#include <ac/string.h>
+#include <ac/unistd.h>
+
+#include "back-mdb.h"
+#include "idl.h"
+
+/* the pieces of slapd filterindex.c and idl.c rely on */
+int slap_debug_mask, slap_syslog_mask, slap_syslog_severity;
+struct slap_internal_schema slap_schema;
+
+void *ch_malloc(ber_len_t size) {
+  void *p = ber_memalloc_x(size, NULL);
+  if (!p)
+    abort();
+  return p;
+}
+
+#ifdef __SANITIZE_THREAD__
+ID mdb_read_nextid(struct mdb_info *mdb) { return mdb->_mi_nextid; }
+#endif
+
+int dnIsSuffix(const struct berval *dn, const struct berval *suffix) {
+  abort();
+}
+
+int dnRelativeMatch(int *matchp, slap_mask_t flags, Syntax *syntax,
+                    MatchingRule *mr, struct berval *value,
+                    void *assertedValue) {
+  abort();
+}
+
+int mdb_dn2id(Operation *op, MDB_txn *txn, MDB_cursor *mc, struct berval *in,
+              ID *id, ID *nsubs, struct berval *matched,
+              struct berval *nmatched) {
+  abort();
+}
+
+int mdb_dn2sups(Operation *op, MDB_txn *txn, struct berval *in, ID *ids) {
+  abort();
+}
+
+int mdb_key_read(Backend *be, MDB_txn *txn, MDB_dbi dbi, struct berval *k,
+                 ID *ids, MDB_cursor **saved_cursor, int get_flag) {
+  abort();
+}
+
+/* every attribute is presence indexed, its key is its name */
+static MDB_dbi index_dbi;
+
+int mdb_index_param(Backend *be, AttributeDescription *desc, int ftype,
+                    MDB_dbi *dbip, slap_mask_t *maskp, struct berval *prefixp) {
+  *dbip = index_dbi;
+  *maskp = SLAP_INDEX_PRESENT;
+  *prefixp = desc->ad_cname;
+  return LDAP_SUCCESS;
+}
+
+static void *tmp_malloc(ber_len_t size, void *ctx) {
+  return ber_memalloc_x(size, ctx);
+}
+
+static void *tmp_calloc(ber_len_t n, ber_len_t size, void *ctx) {
+  return ber_memcalloc_x(n, size, ctx);
+}
+
+static void *tmp_realloc(void *p, ber_len_t size, void *ctx) {
+  return ber_memrealloc_x(p, size, ctx);
+}
+
+static void tmp_free(void *p, void *ctx) { ber_memfree_x(p, ctx); }
+
+static BerMemoryFunctions tmp_mfuncs = {tmp_malloc, tmp_calloc, tmp_realloc,
+                                        tmp_free};
+
+/* more entries than a key may hold before it collapses */
+#define ENTRIES (MDB_IDL_DB_MAX + 5000)
+#define READ_AHEAD 10
+
+static int fail;
+
+#define CHECK(cond, ...)                                                       \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      printf(__VA_ARGS__);                                                     \
+      fail = 1;                                                                \
+    }                                                                          \
+  } while (0)
+
+/* IDs first, first + step, ... up to ENTRIES go in or out of the key */
+static int put_key(BackendDB *be, MDB_txn *txn, struct berval *kb, ID first,
+                   ID step, int del) {
+  struct berval keys[2];
+  MDB_cursor *mc;
+  ID id;
+  int rc;
+
+  keys[0] = *kb;
+  BER_BVZERO(&keys[1]);
+  rc = mdb_cursor_open(txn, index_dbi, &mc);
+  for (id = first; rc == 0 && id <= ENTRIES; id += step)
+    rc = del ? mdb_idl_delete_keys(be, mc, keys, id)
+             : mdb_idl_insert_keys(be, mc, keys, id);
+  if (rc == 0)
+    mdb_cursor_close(mc);
+  return rc;
+}
+
+static int setup(BackendDB *be, MDB_env *env, AttributeDescription *ad) {
+  struct mdb_info *mdb = (struct mdb_info *)be->be_private;
+  MDB_txn *txn;
+  MDB_val key, data;
+  ID id;
+  int rc;
+
+  rc = mdb_txn_begin(env, NULL, 0, &txn);
+  if (rc == 0)
+    rc = mdb_dbi_open(txn, "id2entry", MDB_CREATE | MDB_INTEGERKEY,
+                      &mdb->mi_id2entry);
+  if (rc == 0)
+    rc = mdb_dbi_open(txn, "idx", MDB_CREATE | MDB_DUPSORT | MDB_DUPFIXED |
+                                      MDB_INTEGERDUP,
+                      &index_dbi);
+  key.mv_size = sizeof(ID);
+  key.mv_data = &id;
+  data.mv_size = 1;
+  data.mv_data = "e";
+  for (id = 1; rc == 0 && id <= ENTRIES; id++)
+    rc = mdb_put(txn, mdb->mi_id2entry, &key, &data, MDB_APPEND);
+  /* odd IDs keep the first key exact, the second is small */
+  if (rc == 0)
+    rc = put_key(be, txn, &ad[0].ad_cname, 1, 2, 0);
+  if (rc == 0)
+    rc = put_key(be, txn, &ad[1].ad_cname, 1, ENTRIES / 100, 0);
+  if (rc == 0)
+    rc = mdb_txn_commit(txn);
+  return rc;
+}
+
+static void test_renew(const char *dir) {
+  struct mdb_info mdb;
+  BackendDB be;
+  Operation op;
+  Opheader oh;
+  AttributeDescription ad[2];
+  Filter f[2];
+  struct mdb_cstream *cs[2] = {NULL, NULL};
+  MDB_env *env;
+  MDB_txn *rtxn = NULL, *txn;
+  ID id, prev, n, est;
+  int i, rc;
+
+  memset(&mdb, 0, sizeof(mdb));
+  memset(&be, 0, sizeof(be));
+  memset(&op, 0, sizeof(op));
+  memset(&oh, 0, sizeof(oh));
+  memset(ad, 0, sizeof(ad));
+  memset(f, 0, sizeof(f));
+  be.be_private = &mdb;
+  mdb.mi_idl_range_limit = MDB_IDL_DB_MAX;
+  op.o_hdr = &oh;
+  op.o_bd = &be;
+  oh.oh_tmpmfuncs = &tmp_mfuncs;
+  /* whole IDs, so no padding is needed for the keys */
+  ber_str2bv("collapse", 0, 0, &ad[0].ad_cname);
+  ber_str2bv("vanishes", 0, 0, &ad[1].ad_cname);
+  for (i = 0; i < 2; i++) {
+    f[i].f_choice = LDAP_FILTER_PRESENT;
+    f[i].f_desc = &ad[i];
+  }
+
+  rc = mdb_env_create(&env);
+  if (rc == 0)
+    rc = mdb_env_set_mapsize(env, (size_t)1 << 30);
+  if (rc == 0)
+    rc = mdb_env_set_maxdbs(env, 2);
+  if (rc == 0)
+    rc = mdb_env_open(env, dir, MDB_NOSYNC, 0600);
+  if (rc == 0)
+    rc = setup(&be, env, ad);
+  if (rc) {
+    CHECK(0, "database setup: %s\n", mdb_strerror(rc));
+    return;
+  }
+
+  rc = mdb_txn_begin(env, NULL, MDB_RDONLY, &rtxn);
+  for (i = 0; rc == 0 && i < 2; i++) {
+    rc = mdb_filter_stream(&op, rtxn, &f[i], &cs[i], &est);
+    CHECK(rc == 0 && cs[i], "stream %d: rc %d\n", i, rc);
+  }
+  if (rc)
+    goto done;
+
+  for (n = 0, id = 0; n < READ_AHEAD; n++) {
+    id = mdb_cstream_next(cs[0], id + 1);
+    CHECK(id == 2 * n + 1, "exact key: got %ld, expected %ld\n", (long)id,
+          (long)(2 * n + 1));
+  }
+  prev = id;
+  id = mdb_cstream_next(cs[1], 1);
+  CHECK(id == 1, "small key: got %ld, expected 1\n", (long)id);
+
+  /* the writer runs while the reader is parked */
+  mdb_txn_reset(rtxn);
+  rc = mdb_txn_begin(env, NULL, 0, &txn);
+  if (rc == 0)
+    rc = put_key(&be, txn, &ad[0].ad_cname, 2, 2, 0);
+  if (rc == 0)
+    rc = put_key(&be, txn, &ad[1].ad_cname, 1, ENTRIES / 100, 1);
+  if (rc == 0)
+    rc = mdb_txn_commit(txn);
+  CHECK(rc == 0, "writer: %s\n", mdb_strerror(rc));
+  if (rc == 0)
+    rc = mdb_txn_renew(rtxn);
+  for (i = 0; rc == 0 && i < 2; i++)
+    rc = mdb_cstream_renew(cs[i], rtxn);
+  CHECK(rc == 0, "renew: %s\n", mdb_strerror(rc));
+  if (rc)
+    goto done;
+
+  /* the collapsed key now yields every entry past the last one read */
+  for (n = 0, id = prev; (id = mdb_cstream_next(cs[0], id + 1)) != NOID;
+       n++, prev = id) {
+    if (id != prev + 1) {
+      CHECK(0, "collapsed key: got %ld after %ld\n", (long)id, (long)prev);
+      break;
+    }
+  }
+  CHECK(mdb_cstream_error(cs[0]) == 0, "collapsed key: %s\n",
+        mdb_strerror(mdb_cstream_error(cs[0])));
+  CHECK(prev == ENTRIES, "collapsed key: stopped at %ld of %ld\n", (long)prev,
+        (long)ENTRIES);
+  CHECK(n == ENTRIES - 2 * READ_AHEAD + 1,
+        "collapsed key: %ld IDs after the renew, expected %ld\n", (long)n,
+        (long)(ENTRIES - 2 * READ_AHEAD + 1));
+
+  id = mdb_cstream_next(cs[1], 2);
+  CHECK(id == NOID && mdb_cstream_error(cs[1]) == 0,
+        "deleted key: got %ld, rc %d\n", (long)id, mdb_cstream_error(cs[1]));
+
+done:
+  for (i = 0; i < 2; i++)
+    if (cs[i])
+      mdb_cstream_free(&op, cs[i]);
+  if (rtxn)
+    mdb_txn_abort(rtxn);
+  mdb_env_close(env);
+}
+
+int main(int argc, char **argv) {
+  char tmpl[] = "/tmp/cstreamtest.XXXXXX";
+  const char *dir = argc > 1 ? argv[1] : NULL;
+
+  ldap_pvt_thread_initialize();
+
+  if (!dir && !(dir = mkdtemp(tmpl))) {
+    perror("mkdtemp");
+    return EXIT_FAILURE;
+  }
+  test_renew(dir);
+  if (dir == tmpl) {
+    char path[sizeof(tmpl) + 16];
+    snprintf(path, sizeof(path), "%s/data.mdb", dir);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/lock.mdb", dir);
+    unlink(path);
+    rmdir(dir);
+  }
+
+  printf("%s\n", fail ? "FAILED" : "ok");
+  return fail ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,130 @@
+/* $ReOpenLDAP$ */
+/* Copyright 2011-2018 ReOpenLDAP AUTHORS: please see AUTHORS file.
+ * All rights reserved.
+ *
+ * This file is part of ReOpenLDAP.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+/* Micro-benchmark of the IDL intersection and union kernels.
+ *
+ * usage: idlbench [rounds]
+ *
+ * A full index slot (MDB_IDL_DB_MAX IDs) is combined with lists from
+ * the same size down to a few dozen IDs, the ratios an AND of a common
+ * objectClass with rarer attribute values produces. Every intersection
+ * kernel the CPU supports is checked against the scalar one, the union
+ * is timed once per ratio. */
+
+#include "reldap.h"
+
+#include <stdio.h>
+#include <ac/stdlib.h>
+#include <ac/string.h>
+#include <ac/time.h>
+
+#include "back-mdb.h"
+#include "idl.h"
+
+#define SPAN (MDB_IDL_DB_MAX * 8)
+
+static ID big[MDB_IDL_UM_SIZE], small[MDB_IDL_UM_SIZE];
+static ID work[MDB_IDL_UM_SIZE], ref[MDB_IDL_UM_SIZE];
+static ID out[MDB_IDL_UM_SIZE * 2];
+
+static uint64_t rnd_state = 0x2545F4914F6CDD1Dull;
+
+static uint64_t rnd(void) {
+  rnd_state ^= rnd_state << 13;
+  rnd_state ^= rnd_state >> 7;
+  rnd_state ^= rnd_state << 17;
+  return rnd_state;
+}
+
+/* sorted random subset of [1, SPAN] holding about n IDs */
+static ID fill(ID *ids, ID n) {
+  ID id, k = 0;
+
+  for (id = 1; id <= SPAN && k < MDB_IDL_DB_MAX; id++)
+    if (rnd() % SPAN < n)
+      ids[k++] = id;
+  return k;
+}
+
+static double now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int main(int argc, char **argv) {
+  static const char *kernels[] = {"scalar", "sse4.2", "avx2", NULL};
+  static const int ratios[] = {1, 4, 16, 64, 256, 1024, 0};
+  ID nb, ns, n, nref;
+  const char **kp;
+  const int *rp;
+  int rounds = 200, r, fail = 0;
+  double t0, t;
+
+  if (argc > 1)
+    rounds = atoi(argv[1]);
+  if (rounds < 1)
+    rounds = 1;
+
+  nb = fill(big, MDB_IDL_DB_MAX);
+  printf("%-6s %-7s %8s %10s\n", "ratio", "kernel", "result", "ns/id");
+
+  for (rp = ratios; *rp; rp++) {
+    ns = fill(small, nb / *rp);
+
+    mdb_idl_kernel("scalar");
+    memcpy(ref, small, ns * sizeof(ID));
+    nref = mdb_idl_isect(ref, ns, big, nb);
+
+    for (kp = kernels; *kp; kp++) {
+      if (!mdb_idl_kernel(*kp))
+        continue;
+
+      t = 0;
+      for (r = 0; r < rounds; r++) {
+        memcpy(work, small, ns * sizeof(ID));
+        t0 = now();
+        n = mdb_idl_isect(work, ns, big, nb);
+        t += now() - t0;
+      }
+      if (n != nref || memcmp(work, ref, n * sizeof(ID))) {
+        printf("%s: intersection mismatch at 1:%d\n", *kp, *rp);
+        fail = 1;
+      }
+      printf("1:%-4d %-7s %8lu %10.3f\n", *rp, *kp, n,
+             t / rounds / (nb + ns));
+    }
+
+    t0 = now();
+    for (r = 0; r < rounds; r++)
+      n = mdb_idl_merge(big, nb, small, ns, out);
+    t = now() - t0;
+    if (n != nb + ns - nref) {
+      printf("union size mismatch at 1:%d\n", *rp);
+      fail = 1;
+    }
+    for (r = 1; r < (int)n; r++)
+      if (out[r - 1] >= out[r]) {
+        printf("union out of order at 1:%d\n", *rp);
+        fail = 1;
+        break;
+      }
+    printf("1:%-4d %-7s %8lu %10.3f\n", *rp, "union", n,
+           t / rounds / (nb + ns));
+  }
+
+  return fail ? EXIT_FAILURE : EXIT_SUCCESS;
+}
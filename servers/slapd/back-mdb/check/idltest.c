@@ -0,0 +1,342 @@
+/* $ReOpenLDAP$ */
+/* Copyright 2011-2018 ReOpenLDAP AUTHORS: please see AUTHORS file.
+ * All rights reserved.
+ *
+ * This file is part of ReOpenLDAP.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+/* Checks of the compressed bitmap IDLs.
+ *
+ * usage: idltest [dir]
+ *
+ * Sets made of array, bitmap and run containers are encoded, read back
+ * member by member, grown, trimmed and combined in memory. The same
+ * kind of set is then stored under an index key in a scratch database
+ * (in dir, a new temporary directory by default) through
+ * mdb_idl_insert_keys() and mdb_idl_delete_keys(), and fetched back with
+ * mdb_idl_fetch_key(), with and without a collapse into a range. */
+
+#include "reldap.h"
+
+#include <stdio.h>
+#include <ac/stdlib.h>
+#include <ac/string.h>
+#include <ac/unistd.h>
+
+#include "back-mdb.h"
+#include "idl.h"
+
+/* the pieces of slapd idl.c relies on */
+int slap_debug_mask, slap_syslog_mask, slap_syslog_severity;
+
+void *ch_malloc(ber_len_t size) {
+  void *p = ber_memalloc_x(size, NULL);
+  if (!p)
+    abort();
+  return p;
+}
+
+#ifdef __SANITIZE_THREAD__
+ID mdb_read_nextid(struct mdb_info *mdb) { return mdb->_mi_nextid; }
+#endif
+
+#define BLOCKS 48 /* containers per set */
+#define WORDS (1024 * BLOCKS)
+#define SPAN ((ID)BLOCKS << MDB_IDL_BMAP_SHIFT)
+
+static uint64_t ref[WORDS], ref2[WORDS];
+static ID ids[MDB_IDL_UM_SIZE], ids2[MDB_IDL_UM_SIZE], out[MDB_IDL_UM_SIZE];
+
+static uint64_t rnd_state = 0x2545F4914F6CDD1Dull;
+static int fail;
+
+#define CHECK(cond, ...)                                                       \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      printf(__VA_ARGS__);                                                     \
+      fail = 1;                                                                \
+    }                                                                          \
+  } while (0)
+
+static uint64_t rnd(void) {
+  rnd_state ^= rnd_state << 13;
+  rnd_state ^= rnd_state >> 7;
+  rnd_state ^= rnd_state << 17;
+  return rnd_state;
+}
+
+static int has_id(const uint64_t *w, ID id) {
+  return id < SPAN && (w[id >> 6] >> (id & 63)) & 1;
+}
+
+static void set_id(uint64_t *w, ID id, int on) {
+  if (on)
+    w[id >> 6] |= (uint64_t)1 << (id & 63);
+  else
+    w[id >> 6] &= ~((uint64_t)1 << (id & 63));
+}
+
+/* every third container sparse, dense or made of runs; ID 0 is never used */
+static void fill(uint64_t *w) {
+  ID id, len;
+  int b;
+
+  memset(w, 0, WORDS * sizeof(uint64_t));
+  for (b = 0; b < BLOCKS; b++) {
+    ID lo = (ID)b << MDB_IDL_BMAP_SHIFT, hi = lo + (1 << MDB_IDL_BMAP_SHIFT);
+    switch (b % 3) {
+    case 0:
+      for (id = lo; id < hi; id++)
+        if (rnd() % 20 == 0)
+          set_id(w, id, 1);
+      break;
+    case 1:
+      for (id = lo; id < hi; id++)
+        if (rnd() % 2)
+          set_id(w, id, 1);
+      break;
+    default:
+      for (id = lo + rnd() % 64; id < hi; id += len + rnd() % 512) {
+        for (len = 1 + rnd() % 256; len && id < hi; len--, id++)
+          set_id(w, id, 1);
+      }
+    }
+  }
+  set_id(w, 0, 0);
+}
+
+static ID count(const uint64_t *w) {
+  ID i, n = 0;
+  for (i = 0; i < WORDS; i++)
+    n += __builtin_popcountll(w[i]);
+  return n;
+}
+
+/* ids must hold exactly the members of w */
+static void verify(const char *what, ID *l, const uint64_t *w) {
+  ID id, cursor = 0, expect = 0, n = count(w);
+
+  CHECK(MDB_IDL_N(l) == n, "%s: %lu IDs, expected %lu\n", what,
+        (unsigned long)MDB_IDL_N(l), (unsigned long)n);
+  for (id = mdb_idl_first(l, &cursor); id != NOID;
+       id = mdb_idl_next(l, &cursor)) {
+    while (expect < SPAN && !has_id(w, expect))
+      expect++;
+    if (id != expect) {
+      CHECK(0, "%s: got %lu, expected %lu\n", what, (unsigned long)id,
+            (unsigned long)expect);
+      return;
+    }
+    expect++;
+  }
+  while (expect < SPAN && !has_id(w, expect))
+    expect++;
+  CHECK(expect == SPAN, "%s: stopped before %lu\n", what,
+        (unsigned long)expect);
+  for (id = 1; id < SPAN + 2; id += 1 + rnd() % 7)
+    if (mdb_idl_contains(l, id) != has_id(w, id)) {
+      CHECK(0, "%s: contains(%lu) wrong\n", what, (unsigned long)id);
+      return;
+    }
+}
+
+static void test_memory(void) {
+  ID i, n;
+
+  fill(ref);
+  CHECK(mdb_idl_from_bits(ids, 0, ref, BLOCKS) == 0, "from_bits failed\n");
+  CHECK(MDB_IDL_IS_BMAP(ids), "not encoded as a bitmap\n");
+  verify("encode", ids, ref);
+
+  /* grow existing containers, and add one past the last */
+  for (n = 0; n < 500; n++) {
+    i = 1 + rnd() % (SPAN - 1);
+    if (n == 0)
+      i = SPAN - 1;
+    CHECK(mdb_idl_insert(ids, i) == (has_id(ref, i) ? -1 : 0),
+          "insert(%lu) result\n", (unsigned long)i);
+    set_id(ref, i, 1);
+  }
+  verify("insert", ids, ref);
+
+  /* trim a plain list of members off */
+  for (i = 1, n = 0; i < SPAN && n < MDB_IDL_DB_MAX; i += 1 + rnd() % 64)
+    if (has_id(ref, i)) {
+      out[++n] = i;
+      set_id(ref, i, 0);
+    }
+  out[0] = n;
+  mdb_idl_notin(ids, out, ids2);
+  verify("delete", ids2, ref);
+
+  /* combine with a second set */
+  fill(ref2);
+  CHECK(mdb_idl_from_bits(out, 0, ref2, BLOCKS) == 0, "from_bits failed\n");
+  MDB_IDL_CPY(ids, ids2);
+  mdb_idl_intersection(ids, out);
+  for (i = 0; i < WORDS; i++)
+    ref2[i] &= ref[i];
+  verify("intersection", ids, ref2);
+
+  fill(ref2);
+  CHECK(mdb_idl_from_bits(out, 0, ref2, BLOCKS) == 0, "from_bits failed\n");
+  MDB_IDL_CPY(ids, ids2);
+  if (mdb_idl_union(ids, out) == 0 && MDB_IDL_IS_BMAP(ids)) {
+    for (i = 0; i < WORDS; i++)
+      ref2[i] |= ref[i];
+    verify("union", ids, ref2);
+  }
+}
+
+static int put_keys(BackendDB *be, MDB_env *env, MDB_dbi dbi,
+                    struct berval *keys, const uint64_t *w, int del) {
+  MDB_txn *txn;
+  MDB_cursor *mc;
+  ID id;
+  int rc;
+
+  rc = mdb_txn_begin(env, NULL, 0, &txn);
+  if (rc == 0)
+    rc = mdb_cursor_open(txn, dbi, &mc);
+  for (id = 1; rc == 0 && id < SPAN; id++) {
+    if (has_id(w, id))
+      rc = del ? mdb_idl_delete_keys(be, mc, keys, id)
+               : mdb_idl_insert_keys(be, mc, keys, id);
+  }
+  if (rc == 0) {
+    mdb_cursor_close(mc);
+    rc = mdb_txn_commit(txn);
+  }
+  return rc;
+}
+
+static int fetch(BackendDB *be, MDB_env *env, MDB_dbi dbi,
+                 struct berval *kb, ID *l) {
+  MDB_txn *txn;
+  MDB_val key;
+  int rc;
+
+  key.mv_size = kb->bv_len;
+  key.mv_data = kb->bv_val;
+  rc = mdb_txn_begin(env, NULL, MDB_RDONLY, &txn);
+  if (rc == 0) {
+    rc = mdb_idl_fetch_key(be, txn, dbi, &key, l, NULL, 0);
+    mdb_txn_abort(txn);
+  }
+  return rc;
+}
+
+static void test_disk(const char *dir) {
+  struct mdb_info mdb;
+  BackendDB be;
+  MDB_env *env;
+  MDB_txn *txn;
+  MDB_dbi dbi;
+  struct berval keys[2];
+  ID i;
+  int rc;
+
+  memset(&mdb, 0, sizeof(mdb));
+  memset(&be, 0, sizeof(be));
+  be.be_private = &mdb;
+  mdb.mi_idl_range_limit = MDB_IDL_RANGE_LIMIT;
+  keys[0].bv_val = "keyA";
+  keys[0].bv_len = 4;
+  BER_BVZERO(&keys[1]);
+
+  rc = mdb_env_create(&env);
+  if (rc == 0)
+    rc = mdb_env_set_mapsize(env, (size_t)1 << 30);
+  if (rc == 0)
+    rc = mdb_env_set_maxdbs(env, 2);
+  if (rc == 0)
+    rc = mdb_env_open(env, dir, MDB_NOSYNC, 0600);
+  if (rc == 0)
+    rc = mdb_txn_begin(env, NULL, 0, &txn);
+  if (rc == 0)
+    rc = mdb_dbi_open(txn, "idx", MDB_CREATE | MDB_DUPSORT | MDB_DUPFIXED |
+                                      MDB_INTEGERDUP,
+                      &dbi);
+  if (rc == 0)
+    rc = mdb_txn_commit(txn);
+  if (rc) {
+    CHECK(0, "database setup: %s\n", mdb_strerror(rc));
+    return;
+  }
+
+  /* below the range limit the key stays exact, read back as a bitmap;
+   * three containers of each kind keep it there */
+  fill(ref);
+  memset(ref + 9 * 1024, 0, (BLOCKS - 9) * 1024 * sizeof(uint64_t));
+  CHECK(count(ref) < MDB_IDL_RANGE_LIMIT, "set too large for the test\n");
+  rc = put_keys(&be, env, dbi, keys, ref, 0);
+  CHECK(rc == 0, "insert_keys: %s\n", mdb_strerror(rc));
+  rc = fetch(&be, env, dbi, keys, ids);
+  CHECK(rc == 0 && MDB_IDL_IS_BMAP(ids), "fetch: rc %d, not a bitmap\n", rc);
+  verify("stored", ids, ref);
+
+  /* take every other member of the dense containers out again */
+  memset(ref2, 0, sizeof(ref2));
+  for (i = 1; i < SPAN; i += 2)
+    if (has_id(ref, i) && (i >> MDB_IDL_BMAP_SHIFT) % 3 == 1) {
+      set_id(ref2, i, 1);
+      set_id(ref, i, 0);
+    }
+  rc = put_keys(&be, env, dbi, keys, ref2, 1);
+  CHECK(rc == 0, "delete_keys: %s\n", mdb_strerror(rc));
+  rc = fetch(&be, env, dbi, keys, ids);
+  CHECK(rc == 0, "fetch after delete: rc %d\n", rc);
+  verify("trimmed", ids, ref);
+
+  /* past the limit the key collapses into a range */
+  mdb.mi_idl_range_limit = MDB_IDL_DB_MAX;
+  keys[0].bv_val = "keyB";
+  rc = put_keys(&be, env, dbi, keys, ref, 0);
+  CHECK(rc == 0, "insert_keys: %s\n", mdb_strerror(rc));
+  rc = fetch(&be, env, dbi, keys, ids);
+  CHECK(rc == 0 && MDB_IDL_IS_RANGE(ids), "fetch: rc %d, not a range\n", rc);
+  for (i = 1; !has_id(ref, i); i++)
+    ;
+  CHECK(MDB_IDL_RANGE_FIRST(ids) == i, "range starts at %lu, not %lu\n",
+        (unsigned long)MDB_IDL_RANGE_FIRST(ids), (unsigned long)i);
+  for (i = SPAN - 1; !has_id(ref, i); i--)
+    ;
+  CHECK(MDB_IDL_RANGE_LAST(ids) == i, "range ends at %lu, not %lu\n",
+        (unsigned long)MDB_IDL_RANGE_LAST(ids), (unsigned long)i);
+
+  mdb_env_close(env);
+}
+
+int main(int argc, char **argv) {
+  char tmpl[] = "/tmp/idltest.XXXXXX";
+  const char *dir = argc > 1 ? argv[1] : NULL;
+
+  ldap_pvt_thread_initialize();
+
+  test_memory();
+
+  if (!dir && !(dir = mkdtemp(tmpl))) {
+    perror("mkdtemp");
+    return EXIT_FAILURE;
+  }
+  test_disk(dir);
+  if (dir == tmpl) {
+    char path[sizeof(tmpl) + 16];
+    snprintf(path, sizeof(path), "%s/data.mdb", dir);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/lock.mdb", dir);
+    unlink(path);
+    rmdir(dir);
+  }
+
+  printf("%s\n", fail ? "FAILED" : "ok");
+  return fail ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -21,6 +21,7 @@
 #include <ac/errno.h>
 
 #include "back-mdb.h"
+#include "idl.h"
 
 #include "slapconfig.h"
 
@@ -34,6 +35,7 @@ enum {
   MDB_DIRECTORY,
   MDB_DBNOSYNC,
   MDB_ENVFLAGS,
+  MDB_IDLRANGE,
   MDB_INDEX,
   MDB_MAXREADERS,
   MDB_MAXSIZE,
@@ -65,12 +67,24 @@ static ConfigTable mdbcfg[] = {
      "DESC 'Disable synchronous database writes' "
      "SYNTAX OMsBoolean SINGLE-VALUE )",
      NULL, NULL},
+    {"entrycache", "entries", 2, 2, 0, ARG_UINT | ARG_OFFSET,
+     (void *)offsetof(struct mdb_info, mi_ecache_size),
+     "( OLcfgDbAt:12.47 NAME 'olcDbEntryCache' "
+     "DESC 'Number of decoded entries shared between read operations' "
+     "SYNTAX OMsInteger SINGLE-VALUE )",
+     NULL, NULL},
     {"envflags", "flags", 2, 0, 0, ARG_MAGIC | MDB_ENVFLAGS, mdb_cf_gen,
      "( OLcfgDbAt:12.3 NAME 'olcDbEnvFlags' "
      "DESC 'Database environment flags' "
      "EQUALITY caseIgnoreMatch "
      "SYNTAX OMsDirectoryString )",
      NULL, NULL},
+    {"idlrangelimit", "ids", 2, 2, 0, ARG_UINT | ARG_MAGIC | MDB_IDLRANGE,
+     mdb_cf_gen,
+     "( OLcfgDbAt:12.44 NAME 'olcDbIdlRangeLimit' "
+     "DESC 'Number of IDs an index key may hold before it becomes a range' "
+     "SYNTAX OMsInteger SINGLE-VALUE )",
+     NULL, NULL},
     {"index", "attr> <[pres,eq,approx,sub]", 2, 3, 0, ARG_MAGIC | MDB_INDEX,
      mdb_cf_gen,
      "( OLcfgDbAt:0.2 NAME 'olcDbIndex' "
@@ -107,6 +121,18 @@ static ConfigTable mdbcfg[] = {
      "DESC 'Depth of search stack in IDLs' "
      "SYNTAX OMsInteger SINGLE-VALUE )",
      NULL, NULL},
+    {"searchthreads", "num", 2, 2, 0, ARG_UINT | ARG_OFFSET,
+     (void *)offsetof(struct mdb_info, mi_search_threads),
+     "( OLcfgDbAt:12.45 NAME 'olcDbSearchThreads' "
+     "DESC 'Number of helper threads large searches may use' "
+     "SYNTAX OMsInteger SINGLE-VALUE )",
+     NULL, NULL},
+    {"sortvalsmin", "num", 2, 2, 0, ARG_UINT | ARG_OFFSET,
+     (void *)offsetof(struct mdb_info, mi_sortvals_min),
+     "( OLcfgDbAt:12.46 NAME 'olcDbSortValsMin' "
+     "DESC 'Store attributes with at least this many values sorted' "
+     "SYNTAX OMsInteger SINGLE-VALUE )",
+     NULL, NULL},
 
 #ifdef MDBX_LIFORECLAIM
     {"dreamcatcher", "lag> <percentage", 3, 3, 0, ARG_MAGIC | MDBX_DREAMCATCHER,
@@ -136,7 +162,9 @@ static ConfigOCs mdbocs[] = {
 #ifdef MDBX_LIFORECLAIM
      "olcDbDreamcatcher $ olcDbOomFlags $ "
 #endif /* MDBX_LIFORECLAIM */
-     "olcDbMode $ olcDbSearchStack $ olcDbRtxnSize ) )",
+     "olcDbMode $ olcDbSearchStack $ olcDbRtxnSize $ "
+     "olcDbIdlRangeLimit $ olcDbSearchThreads $ olcDbSortValsMin $ "
+     "olcDbEntryCache ) )",
      Cft_Database, mdbcfg},
     {NULL, 0, NULL}};
 
@@ -424,6 +452,10 @@ static int mdb_cf_gen(ConfigArgs *c) {
       c->value_int = mdb->mi_search_stack_depth;
       break;
 
+    case MDB_IDLRANGE:
+      c->value_uint = mdb->mi_idl_range_limit;
+      break;
+
     case MDB_MAXREADERS:
       c->value_int = mdb->mi_readers;
       break;
@@ -450,6 +482,10 @@ static int mdb_cf_gen(ConfigArgs *c) {
     case MDB_MAXSIZE:
       break;
 
+    case MDB_IDLRANGE:
+      mdb->mi_idl_range_limit = MDB_IDL_RANGE_LIMIT;
+      break;
+
     case MDB_CHKPT:
       if (mdb->mi_txn_cp_task) {
         struct re_s *re = mdb->mi_txn_cp_task;
@@ -835,6 +871,15 @@ static int mdb_cf_gen(ConfigArgs *c) {
     mdb->mi_search_stack_depth = c->value_int;
     break;
 
+  case MDB_IDLRANGE:
+    if (c->value_uint < MDB_IDL_DB_MAX) {
+      fprintf(stderr, "%s: limit %u too small, using %u\n", c->log,
+              c->value_uint, (unsigned)MDB_IDL_DB_MAX);
+      c->value_uint = MDB_IDL_DB_MAX;
+    }
+    mdb->mi_idl_range_limit = c->value_uint;
+    break;
+
   case MDB_MAXREADERS:
     mdb->mi_readers = c->value_int;
     if (mdb->mi_flags & MDB_IS_OPEN) {
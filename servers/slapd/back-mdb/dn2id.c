@@ -601,8 +601,8 @@ int mdb_idscope(Operation *op, MDB_txn *txn, ID base, ID *ids, ID *res) {
 
   ida = mdb_idl_first(ids, &cid);
 
-  /* Don't bother moving out of ids if it's a range */
-  if (!MDB_IDL_IS_RANGE(ids)) {
+  /* Don't bother moving out of ids if it's a range or a bitmap */
+  if (MDB_IDL_IS_LIST(ids)) {
     idc = ids[0];
     ci0 = cid;
   }
@@ -645,7 +645,7 @@ int mdb_idscope(Operation *op, MDB_txn *txn, ID base, ID *ids, ID *res) {
     }
     ida = mdb_idl_next(ids, &cid);
   }
-  if (!MDB_IDL_IS_RANGE(ids))
+  if (MDB_IDL_IS_LIST(ids))
     ids[0] = idc;
 
 leave:
@@ -0,0 +1,381 @@
+/* $ReOpenLDAP$ */
+/* Copyright 2011-2018 ReOpenLDAP AUTHORS: please see AUTHORS file.
+ * All rights reserved.
+ *
+ * This file is part of ReOpenLDAP.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+/* Shared cache of decoded entries.
+ *
+ * Hot entries (the suffix, groups, policy and bind entries) are
+ * otherwise fetched and decoded into op memory by every operation that
+ * touches them. With "entrycache" set, read-only lookups through
+ * mdb_id2entry() are served from a direct-mapped table of entries that
+ * were decoded once into the heap. A hit costs no lock: the reader
+ * takes a reference on the cache node and gets private copies of the
+ * Entry and Attribute headers, which it may flag and relink as it would
+ * a decoded entry of its own. Only the value arrays are shared; like the
+ * map pages a plain decode points into, they are never written.
+ *
+ * Validity is tracked by MDB txn ids. A node records the snapshot it
+ * was decoded from, and each slot records the last write txn that
+ * stored or deleted an entry hashing to it. A node serves a reader
+ * only if the reader's snapshot is not older than the node's and no
+ * write touched the slot since the node was decoded, so a reader never
+ * sees data from outside its own snapshot, and writers never wait.
+ *
+ * Nodes stay allocated while the database is open. A reader may still
+ * pick up a node that is being replaced, so the reference is taken only
+ * while the count is non-zero and the slot is checked again after.
+ *
+ * Hit and miss counts are kept per thread, so that the hit path does
+ * not bounce a shared cache line between CPUs. A thread's counts are
+ * folded into the totals when it exits or the cache is closed. */
+
+#include "reldap.h"
+
+#include <ac/string.h>
+
+#include "back-mdb.h"
+
+typedef struct ecache_stat {
+  unsigned long es_hits;
+  unsigned long es_misses;
+  struct mdb_ecache *es_ec; /* NULL once the cache is gone */
+  struct ecache_stat *es_next;
+} ecache_stat;
+
+typedef struct ecache_node {
+  volatile int en_ref; /* zero while on the free list */
+  ID en_id;
+  size_t en_txnid; /* snapshot the entry was decoded from */
+  Entry *en_entry;
+  int en_nattrs;
+  void *en_data; /* copy of the record the entry points into */
+  struct ecache_node *en_next;
+} ecache_node;
+
+struct mdb_ecache {
+  unsigned ec_mask;
+  ecache_node *volatile *ec_slots;
+  volatile size_t *ec_wtxn; /* last write txn per slot */
+  ecache_node *ec_nodes;
+  ecache_node *ec_free;
+  ldap_pvt_thread_mutex_t ec_mutex;
+  ecache_stat *ec_stats; /* of the threads using the cache */
+  /* counts of gone threads, and of those that got no key */
+  volatile unsigned long ec_hits;
+  volatile unsigned long ec_misses;
+};
+
+int mdb_ecache_open(struct mdb_info *mdb) {
+  struct mdb_ecache *ec;
+  unsigned i, n;
+
+  if (!mdb->mi_ecache_size || (slapMode & SLAP_TOOL_MODE))
+    return 0;
+
+  for (n = 1; n < mdb->mi_ecache_size; n <<= 1)
+    ;
+  ec = ch_calloc(1, sizeof(struct mdb_ecache));
+  ec->ec_mask = n - 1;
+  ec->ec_slots = ch_calloc(n, sizeof(ecache_node *));
+  ec->ec_wtxn = ch_calloc(n, sizeof(size_t));
+  /* twice the slots, so that replaced nodes still held by
+   * readers rarely leave none free */
+  ec->ec_nodes = ch_calloc(2 * n, sizeof(ecache_node));
+  for (i = 0; i < 2 * n; i++) {
+    ec->ec_nodes[i].en_next = ec->ec_free;
+    ec->ec_free = &ec->ec_nodes[i];
+  }
+  ldap_pvt_thread_mutex_init(&ec->ec_mutex);
+  mdb->mi_ecache = ec;
+
+  Debug(LDAP_DEBUG_TRACE, "mdb_ecache_open: %u slots\n", n);
+  return 0;
+}
+
+static void ecache_unref(struct mdb_ecache *ec, ecache_node *en) {
+  if (__sync_sub_and_fetch(&en->en_ref, 1) == 0) {
+    ch_free(en->en_entry);
+    ch_free(en->en_data);
+    en->en_entry = NULL;
+    en->en_data = NULL;
+    ldap_pvt_thread_mutex_lock(&ec->ec_mutex);
+    en->en_next = ec->ec_free;
+    ec->ec_free = en;
+    ldap_pvt_thread_mutex_unlock(&ec->ec_mutex);
+  }
+}
+
+static void ecache_stat_free(void *key, void *data) {
+  ecache_stat *es = data, **prev;
+  struct mdb_ecache *ec = es->es_ec;
+
+  if (ec) {
+    ldap_pvt_thread_mutex_lock(&ec->ec_mutex);
+    for (prev = &ec->ec_stats; *prev != es; prev = &(*prev)->es_next)
+      ;
+    *prev = es->es_next;
+    __sync_fetch_and_add(&ec->ec_hits, es->es_hits);
+    __sync_fetch_and_add(&ec->ec_misses, es->es_misses);
+    ldap_pvt_thread_mutex_unlock(&ec->ec_mutex);
+  }
+  ch_free(es);
+}
+
+static ecache_stat *ecache_stat_get(Operation *op, struct mdb_ecache *ec) {
+  void *data = NULL;
+  ecache_stat *es;
+
+  if (!op->o_threadctx)
+    return NULL;
+  if (ldap_pvt_thread_pool_getkey(op->o_threadctx, ec, &data, NULL) == 0) {
+    es = data;
+    if (es->es_ec == ec)
+      return es;
+    /* left over from a closed cache at the same address */
+    es->es_hits = es->es_misses = 0;
+  } else {
+    es = ch_calloc(1, sizeof(ecache_stat));
+    if (ldap_pvt_thread_pool_setkey(op->o_threadctx, ec, es, ecache_stat_free,
+                                    NULL, NULL)) {
+      ch_free(es);
+      return NULL;
+    }
+  }
+  es->es_ec = ec;
+  ldap_pvt_thread_mutex_lock(&ec->ec_mutex);
+  es->es_next = ec->ec_stats;
+  ec->ec_stats = es;
+  ldap_pvt_thread_mutex_unlock(&ec->ec_mutex);
+  return es;
+}
+
+void mdb_ecache_close(struct mdb_info *mdb) {
+  struct mdb_ecache *ec = mdb->mi_ecache;
+  ecache_stat *es;
+  unsigned i;
+
+  if (!ec)
+    return;
+
+  /* the pool is paused or gone by now. purgekey() does not reach the
+   * main thread, whose counts are left behind detached from the cache */
+  ldap_pvt_thread_pool_purgekey(ec);
+  for (es = ec->ec_stats; es; es = es->es_next)
+    es->es_ec = NULL;
+  mdb->mi_ecache = NULL;
+  for (i = 0; i <= ec->ec_mask; i++) {
+    if (ec->ec_slots[i])
+      ecache_unref(ec, ec->ec_slots[i]);
+  }
+  ldap_pvt_thread_mutex_destroy(&ec->ec_mutex);
+  ch_free(ec->ec_nodes);
+  ch_free((void *)ec->ec_wtxn);
+  ch_free((void *)ec->ec_slots);
+  ch_free(ec);
+}
+
+/* Only plain readers use the cache: a write txn sees its own
+ * uncommitted changes, and tool mode has no cache at all. */
+int mdb_ecache_usable(Operation *op, MDB_txn *txn) {
+  struct mdb_info *mdb = (struct mdb_info *)op->o_bd->be_private;
+  OpExtra *oex;
+
+#ifdef LDAP_COMP_MATCH
+  /* component filters hang their data off the attributes */
+  return 0;
+#endif
+  if (!mdb->mi_ecache)
+    return 0;
+  LDAP_SLIST_FOREACH(oex, &op->o_extra, oe_next) {
+    if (oex->oe_key == mdb) {
+      mdb_op_info *moi = (mdb_op_info *)oex;
+      return (moi->moi_flag & MOI_READER) && moi->moi_txn == txn;
+    }
+  }
+  return 0;
+}
+
+static Entry *ecache_view(Operation *op, ecache_node *en) {
+  Entry *e = op->o_tmpalloc(sizeof(Entry) + en->en_nattrs * sizeof(Attribute),
+                            op->o_tmpmemctx);
+  Attribute *a, *b = (Attribute *)(e + 1), **next = &e->e_attrs;
+
+  *e = *en->en_entry;
+  for (a = en->en_entry->e_attrs; a; a = a->a_next) {
+    *b = *a;
+    *next = b;
+    next = &b++->a_next;
+  }
+  *next = NULL;
+  e->e_private = en;
+  return e;
+}
+
+int mdb_ecache_get(Operation *op, MDB_txn *txn, ID id, Entry **e) {
+  struct mdb_info *mdb = (struct mdb_info *)op->o_bd->be_private;
+  struct mdb_ecache *ec = mdb->mi_ecache;
+  unsigned slot = id & ec->ec_mask;
+  size_t txnid = mdb_txn_id(txn);
+  ecache_node *en = ec->ec_slots[slot];
+  ecache_stat *es = ecache_stat_get(op, ec);
+  int ref = 0;
+
+  if (en) {
+    do {
+      ref = en->en_ref;
+    } while (ref && !__sync_bool_compare_and_swap(&en->en_ref, ref, ref + 1));
+  }
+  if (ref) {
+    if (en == ec->ec_slots[slot] && en->en_id == id &&
+        en->en_txnid <= txnid && ec->ec_wtxn[slot] <= en->en_txnid) {
+      if (es)
+        es->es_hits++;
+      else
+        __sync_fetch_and_add(&ec->ec_hits, 1);
+      *e = ecache_view(op, en);
+      return 0;
+    }
+    ecache_unref(ec, en);
+  }
+  if (es)
+    es->es_misses++;
+  else
+    __sync_fetch_and_add(&ec->ec_misses, 1);
+  return MDB_NOTFOUND;
+}
+
+/* Decode a record into the heap, publish it and return a view of it.
+ * Returns MDB_NOTFOUND when the entry is not worth caching or no node
+ * is free, the caller then decodes it the usual way. */
+int mdb_ecache_put(Operation *op, MDB_txn *txn, ID id, MDB_val *data,
+                   Entry **e) {
+  struct mdb_info *mdb = (struct mdb_info *)op->o_bd->be_private;
+  struct mdb_ecache *ec = mdb->mi_ecache;
+  unsigned slot = id & ec->ec_mask;
+  size_t txnid = mdb_txn_id(txn);
+  ecache_node *en, *old;
+  Attribute *a;
+  Operation op2 = *op;
+  Opheader oh = *op->o_hdr;
+  MDB_val copy;
+  int rc;
+
+  /* a newer write already made this snapshot useless to others */
+  if (ec->ec_wtxn[slot] > txnid)
+    return MDB_NOTFOUND;
+
+  ldap_pvt_thread_mutex_lock(&ec->ec_mutex);
+  en = ec->ec_free;
+  if (en)
+    ec->ec_free = en->en_next;
+  ldap_pvt_thread_mutex_unlock(&ec->ec_mutex);
+  if (!en)
+    return MDB_NOTFOUND;
+
+  en->en_data = ch_malloc(data->mv_size);
+  memcpy(en->en_data, data->mv_data, data->mv_size);
+  copy.mv_data = en->en_data;
+  copy.mv_size = data->mv_size;
+
+  op2.o_hdr = &oh;
+  op2.o_tmpmemctx = NULL;
+  op2.o_tmpmfuncs = &ch_mfuncs;
+  rc = mdb_entry_decode(&op2, txn, &copy, &en->en_entry);
+  if (rc) {
+    ch_free(en->en_data);
+    en->en_data = NULL;
+    ldap_pvt_thread_mutex_lock(&ec->ec_mutex);
+    en->en_next = ec->ec_free;
+    ec->ec_free = en;
+    ldap_pvt_thread_mutex_unlock(&ec->ec_mutex);
+    return rc;
+  }
+  en->en_entry->e_id = id;
+  en->en_nattrs = 0;
+  for (a = en->en_entry->e_attrs; a; a = a->a_next)
+    en->en_nattrs++;
+  BER_BVZERO(&en->en_entry->e_name);
+  BER_BVZERO(&en->en_entry->e_nname);
+  en->en_id = id;
+  en->en_txnid = txnid;
+  /* one reference for the table, one for the caller */
+  __sync_fetch_and_add(&en->en_ref, 2);
+
+  ldap_pvt_thread_mutex_lock(&ec->ec_mutex);
+  old = ec->ec_slots[slot];
+  ec->ec_slots[slot] = en;
+  ldap_pvt_thread_mutex_unlock(&ec->ec_mutex);
+  if (old)
+    ecache_unref(ec, old);
+
+  *e = ecache_view(op, en);
+  return 0;
+}
+
+/* Drop a view handed out by mdb_ecache_get() or mdb_ecache_put() */
+void mdb_ecache_release(Operation *op, Entry *e) {
+  struct mdb_info *mdb = (struct mdb_info *)op->o_bd->be_private;
+  ecache_node *en = e->e_private;
+
+  if (op->o_hdr && op->o_tmpmfuncs) {
+    op->o_tmpfree(e->e_nname.bv_val, op->o_tmpmemctx);
+    op->o_tmpfree(e->e_name.bv_val, op->o_tmpmemctx);
+    op->o_tmpfree(e, op->o_tmpmemctx);
+  } else {
+    ch_free(e->e_nname.bv_val);
+    ch_free(e->e_name.bv_val);
+    ch_free(e);
+  }
+  ecache_unref(mdb->mi_ecache, en);
+}
+
+/* Called by the writer for every entry it stores or deletes, before
+ * the txn commits. */
+void mdb_ecache_invalidate(struct mdb_info *mdb, MDB_txn *txn, ID id) {
+  struct mdb_ecache *ec = mdb->mi_ecache;
+  unsigned slot = id & ec->ec_mask;
+  size_t txnid = mdb_txn_id(txn);
+  ecache_node *en;
+
+  if (ec->ec_wtxn[slot] < txnid) {
+    ec->ec_wtxn[slot] = txnid;
+    __sync_synchronize();
+  }
+  if (!ec->ec_slots[slot])
+    return;
+  ldap_pvt_thread_mutex_lock(&ec->ec_mutex);
+  en = ec->ec_slots[slot];
+  ec->ec_slots[slot] = NULL;
+  ldap_pvt_thread_mutex_unlock(&ec->ec_mutex);
+  if (en)
+    ecache_unref(ec, en);
+}
+
+void mdb_ecache_stats(struct mdb_info *mdb, unsigned long *hits,
+                      unsigned long *misses) {
+  struct mdb_ecache *ec = mdb->mi_ecache;
+  ecache_stat *es;
+
+  *hits = *misses = 0;
+  if (!ec)
+    return;
+  ldap_pvt_thread_mutex_lock(&ec->ec_mutex);
+  *hits = ec->ec_hits;
+  *misses = ec->ec_misses;
+  for (es = ec->ec_stats; es; es = es->es_next) {
+    *hits += es->es_hits;
+    *misses += es->es_misses;
+  }
+  ldap_pvt_thread_mutex_unlock(&ec->ec_mutex);
+}
@@ -987,3 +987,497 @@ static int inequality_candidates(Operation *op, MDB_txn *rtxn,
         (long)ids[0], (long)MDB_IDL_FIRST(ids), (long)MDB_IDL_LAST(ids));
   return (rc);
 }
+
+/* Candidate streams.
+ *
+ * For filters built only from indexed equality and presence assertions
+ * joined by AND/OR, the candidates can be produced one ID at a time
+ * straight from the index cursors: a key leaf seeks its duplicates
+ * with MDB_GET_BOTH_RANGE, AND leapfrogs its children and OR takes the
+ * lowest of them. Nothing is materialized, so a search can send its
+ * first entry before the whole IDL would have been read.
+ *
+ * Requests for the next ID must never go backwards; every node caches
+ * its current ID and only moves its cursor when asked for a larger one.
+ *
+ * A writer may collapse a key into a range, or delete it, while the
+ * read txn is reset; a renewed key leaf looks at its key again before
+ * the next read and turns into what cstream_key() would open now.
+ */
+
+enum { CS_EMPTY, CS_RANGE, CS_KEY, CS_AND, CS_OR };
+
+struct mdb_cstream {
+  int cs_type;
+  int cs_rc;     /* sticky error of the whole stream, kept at the root */
+  int cs_valid;  /* cs_mc is positioned at cs_cur */
+  int cs_stale;  /* CS_KEY renewed, recheck the key before reading */
+  ID cs_cur;     /* smallest ID >= the last lower bound, 0 if none yet */
+  ID cs_lo;      /* CS_RANGE bounds */
+  ID cs_hi;
+  MDB_cursor *cs_mc; /* index cursor, id2entry for CS_RANGE */
+  MDB_dbi cs_id2entry; /* CS_KEY, for a collapse seen after a renew */
+  MDB_val cs_key;
+  struct mdb_cstream *cs_kids;
+  struct mdb_cstream *cs_next;
+};
+
+/* filter is not streamable, or matches everything */
+#define CS_UNWILLING LDAP_UNWILLING_TO_PERFORM
+
+static struct mdb_cstream *cstream_new(Operation *op, int type, size_t extra) {
+  struct mdb_cstream *cs;
+
+  cs = op->o_tmpcalloc(1, sizeof(*cs) + extra, op->o_tmpmemctx);
+  cs->cs_type = type;
+  return cs;
+}
+
+void mdb_cstream_free(Operation *op, struct mdb_cstream *cs) {
+  struct mdb_cstream *next;
+
+  for (; cs; cs = next) {
+    next = cs->cs_next;
+    mdb_cstream_free(op, cs->cs_kids);
+    if (cs->cs_mc)
+      mdb_cursor_close(cs->cs_mc);
+    op->o_tmpfree(cs, op->o_tmpmemctx);
+  }
+}
+
+/* IDs lo..hi that still have an entry in id2entry */
+static int cstream_range(Operation *op, MDB_txn *rtxn, ID lo, ID hi,
+                         struct mdb_cstream **csp) {
+  struct mdb_info *mdb = (struct mdb_info *)op->o_bd->be_private;
+  struct mdb_cstream *cs;
+  int rc;
+
+  cs = cstream_new(op, CS_RANGE, 0);
+  cs->cs_lo = lo;
+  cs->cs_hi = hi;
+  rc = mdb_cursor_open(rtxn, mdb->mi_id2entry, &cs->cs_mc);
+  if (rc) {
+    mdb_cstream_free(op, cs);
+    return rc;
+  }
+  *csp = cs;
+  return 0;
+}
+
+/* With the cursor on the first duplicate of a key, fetch the bounds
+ * of the range it was collapsed into; both are 0 for an exact key. */
+static int cstream_lohi(MDB_cursor *mc, MDB_val *key, MDB_val *data,
+                        ID *lohi) {
+  ID first;
+  int rc;
+
+  lohi[0] = lohi[1] = 0;
+  memcpy(&first, data->mv_data, sizeof(ID));
+  if (first != 0)
+    return 0;
+  rc = mdb_cursor_get(mc, key, data, MDB_NEXT_DUP);
+  if (!rc) {
+    memcpy(&lohi[0], data->mv_data, sizeof(ID));
+    rc = mdb_cursor_get(mc, key, data, MDB_NEXT_DUP);
+  }
+  if (!rc)
+    memcpy(&lohi[1], data->mv_data, sizeof(ID));
+  return rc;
+}
+
+static int cstream_key(Operation *op, MDB_txn *rtxn, MDB_dbi dbi,
+                       struct berval *k, struct mdb_cstream **csp, ID *est) {
+  struct mdb_info *mdb = (struct mdb_info *)op->o_bd->be_private;
+  struct mdb_cstream *cs;
+  MDB_val key, data;
+  ID lohi[2];
+  size_t count;
+  int rc;
+
+  cs = cstream_new(op, CS_KEY, k->bv_len + sizeof(size_t));
+  key.mv_data = cs + 1;
+  key.mv_size = k->bv_len;
+  memcpy(key.mv_data, k->bv_val, k->bv_len);
+#ifndef MISALIGNED_OK
+  if (key.mv_size & ALIGNER)
+    key.mv_size = (key.mv_size + ALIGNER) & ~ALIGNER;
+#endif
+  cs->cs_key = key;
+  cs->cs_id2entry = mdb->mi_id2entry;
+
+  rc = mdb_cursor_open(rtxn, dbi, &cs->cs_mc);
+  if (!rc)
+    rc = mdb_cursor_get(cs->cs_mc, &key, &data, MDB_SET);
+  if (rc == MDB_NOTFOUND) {
+    mdb_cstream_free(op, cs);
+    *csp = NULL;
+    *est = 0;
+    return 0;
+  }
+  if (!rc)
+    rc = cstream_lohi(cs->cs_mc, &key, &data, lohi);
+  if (!rc && lohi[0] == 0) {
+    rc = mdb_cursor_count(cs->cs_mc, &count);
+    *est = count;
+    *csp = cs;
+    return rc;
+  }
+  if (!rc) {
+    /* the key was collapsed into a range */
+    mdb_cstream_free(op, cs);
+    *est = lohi[1] - lohi[0] + 1;
+    return cstream_range(op, rtxn, lohi[0], lohi[1], csp);
+  }
+  mdb_cstream_free(op, cs);
+  return rc;
+}
+
+static int cstream_filter(Operation *op, MDB_txn *rtxn, Filter *f,
+                          struct mdb_cstream **csp, ID *est);
+
+/* *csp is NULL with *est of NOID when a filter does not narrow the
+ * candidates at all, and NULL with 0 when it matches nothing */
+static int cstream_list(Operation *op, MDB_txn *rtxn, Filter *flist,
+                        int ftype, struct mdb_cstream **csp, ID *est) {
+  struct mdb_cstream *cs = NULL, *kid, **tail = &cs;
+  Filter *f;
+  ID n, total = (ftype == LDAP_FILTER_AND) ? NOID : 0;
+  int rc = 0;
+
+  for (f = flist; f; f = f->f_next) {
+    rc = cstream_filter(op, rtxn, f, &kid, &n);
+    if (rc)
+      break;
+    if (!kid) {
+      if (ftype == LDAP_FILTER_AND ? n == 0 : n == NOID) {
+        /* decides the whole list */
+        mdb_cstream_free(op, cs);
+        cs = NULL;
+        total = n;
+        break;
+      }
+      continue;
+    }
+    *tail = kid;
+    tail = &kid->cs_next;
+    if (ftype == LDAP_FILTER_AND)
+      total = (n < total) ? n : total;
+    else
+      total = (total + n < total) ? NOID : total + n;
+  }
+
+  if (rc) {
+    mdb_cstream_free(op, cs);
+    return rc;
+  }
+  if (cs && cs->cs_next) {
+    kid = cstream_new(op, ftype == LDAP_FILTER_AND ? CS_AND : CS_OR, 0);
+    kid->cs_kids = cs;
+    cs = kid;
+  }
+  *csp = cs;
+  *est = total;
+  return 0;
+}
+
+static int cstream_equality(Operation *op, MDB_txn *rtxn,
+                            AttributeAssertion *ava, struct mdb_cstream **csp,
+                            ID *est) {
+  struct mdb_cstream *cs = NULL, *kid, **tail = &cs;
+  MDB_dbi dbi;
+  slap_mask_t mask;
+  struct berval prefix = {0, NULL};
+  struct berval *keys = NULL;
+  MatchingRule *mr;
+  ID id, n;
+  int i, rc;
+
+  *csp = NULL;
+  *est = NOID;
+
+#ifdef LDAP_COMP_MATCH
+  if (is_aliased_attribute && is_aliased_attribute(ava->aa_desc))
+    return CS_UNWILLING;
+#endif
+
+  if (ava->aa_desc == slap_schema.si_ad_entryDN) {
+    rc = mdb_dn2id(op, rtxn, NULL, &ava->aa_value, &id, NULL, NULL, NULL);
+    if (rc == MDB_NOTFOUND) {
+      *est = 0;
+      return 0;
+    }
+    if (rc == LDAP_SUCCESS) {
+      *est = 1;
+      rc = cstream_range(op, rtxn, id, id, csp);
+    }
+    return rc;
+  }
+
+  rc = mdb_index_param(op->o_bd, ava->aa_desc, LDAP_FILTER_EQUALITY, &dbi,
+                       &mask, &prefix);
+  if (rc != LDAP_SUCCESS)
+    return 0;
+
+  mr = ava->aa_desc->ad_type->sat_equality;
+  if (!mr || !mr->smr_filter)
+    return 0;
+
+  rc = (mr->smr_filter)(LDAP_FILTER_EQUALITY, mask,
+                        ava->aa_desc->ad_type->sat_syntax, mr, &prefix,
+                        &ava->aa_value, &keys, op->o_tmpmemctx);
+  if (rc != LDAP_SUCCESS || keys == NULL)
+    return 0;
+
+  /* every key must be present, so they are joined with AND */
+  for (i = 0; keys[i].bv_val != NULL; i++) {
+    rc = cstream_key(op, rtxn, dbi, &keys[i], &kid, &n);
+    if (rc || !kid) {
+      mdb_cstream_free(op, cs);
+      cs = NULL;
+      *est = 0;
+      break;
+    }
+    *tail = kid;
+    tail = &kid->cs_next;
+    if (n < *est)
+      *est = n;
+  }
+  ber_bvarray_free_x(keys, op->o_tmpmemctx);
+
+  if (cs && cs->cs_next) {
+    kid = cstream_new(op, CS_AND, 0);
+    kid->cs_kids = cs;
+    cs = kid;
+  }
+  *csp = cs;
+  return rc;
+}
+
+static int cstream_filter(Operation *op, MDB_txn *rtxn, Filter *f,
+                          struct mdb_cstream **csp, ID *est) {
+  MDB_dbi dbi;
+  slap_mask_t mask;
+  struct berval prefix = {0, NULL};
+  int rc;
+
+  *csp = NULL;
+  *est = NOID;
+
+  if (f->f_choice & SLAPD_FILTER_UNDEFINED) {
+    *est = 0;
+    return 0;
+  }
+
+  switch (f->f_choice) {
+  case SLAPD_FILTER_COMPUTED:
+    /* a pre-computed scope (LDAP_SUCCESS) is left alone as well */
+    if (f->f_result == LDAP_COMPARE_FALSE ||
+        f->f_result == SLAPD_COMPARE_UNDEFINED)
+      *est = 0;
+    return 0;
+
+  case LDAP_FILTER_PRESENT:
+    if (f->f_desc == slap_schema.si_ad_objectClass)
+      return 0;
+    rc = mdb_index_param(op->o_bd, f->f_desc, LDAP_FILTER_PRESENT, &dbi,
+                         &mask, &prefix);
+    if (rc != LDAP_SUCCESS)
+      return 0;
+    if (prefix.bv_val == NULL)
+      return CS_UNWILLING;
+    return cstream_key(op, rtxn, dbi, &prefix, csp, est);
+
+  case LDAP_FILTER_EQUALITY:
+    return cstream_equality(op, rtxn, f->f_ava, csp, est);
+
+  case LDAP_FILTER_NOT:
+    /* no indexing to support NOT filters */
+    return 0;
+
+  case LDAP_FILTER_AND:
+  case LDAP_FILTER_OR:
+    return cstream_list(op, rtxn, f->f_list, f->f_choice, csp, est);
+
+  default:
+    /* substrings, ranges and friends read many keys, leave them to
+     * mdb_filter_candidates() */
+    return CS_UNWILLING;
+  }
+}
+
+/* Look at the key of a renewed CS_KEY leaf again, it may have been
+ * deleted or collapsed into a range since the stream was opened */
+static int cstream_rekey(struct mdb_cstream *cs) {
+  MDB_txn *rtxn = mdb_cursor_txn(cs->cs_mc);
+  MDB_val key = cs->cs_key, data;
+  ID lohi[2];
+  int rc;
+
+  cs->cs_stale = 0;
+  rc = mdb_cursor_get(cs->cs_mc, &key, &data, MDB_SET);
+  if (rc == MDB_NOTFOUND) {
+    cs->cs_type = CS_EMPTY;
+    return 0;
+  }
+  if (!rc)
+    rc = cstream_lohi(cs->cs_mc, &key, &data, lohi);
+  if (rc || lohi[0] == 0)
+    return rc;
+
+  mdb_cursor_close(cs->cs_mc);
+  cs->cs_mc = NULL;
+  cs->cs_type = CS_RANGE;
+  cs->cs_lo = lohi[0];
+  cs->cs_hi = lohi[1];
+  return mdb_cursor_open(rtxn, cs->cs_id2entry, &cs->cs_mc);
+}
+
+static int cstream_next(struct mdb_cstream *cs, ID from, ID *idp) {
+  struct mdb_cstream *kid;
+  MDB_val key, data;
+  ID id;
+  int rc = 0, agree;
+
+  if (cs->cs_cur && (cs->cs_cur == NOID || from <= cs->cs_cur)) {
+    *idp = cs->cs_cur;
+    return 0;
+  }
+
+  if (cs->cs_stale) {
+    rc = cstream_rekey(cs);
+    if (rc)
+      return rc;
+  }
+
+  switch (cs->cs_type) {
+  case CS_EMPTY:
+    id = NOID;
+    break;
+
+  case CS_RANGE:
+    if (from < cs->cs_lo)
+      from = cs->cs_lo;
+    if (cs->cs_valid && from == cs->cs_cur + 1) {
+      rc = mdb_cursor_get(cs->cs_mc, &key, NULL, MDB_NEXT);
+    } else {
+      key.mv_data = &from;
+      key.mv_size = sizeof(ID);
+      rc = mdb_cursor_get(cs->cs_mc, &key, NULL, MDB_SET_RANGE);
+    }
+    id = NOID;
+    if (!rc) {
+      memcpy(&id, key.mv_data, sizeof(ID));
+      if (id > cs->cs_hi)
+        id = NOID;
+    }
+    break;
+
+  case CS_KEY:
+    key = cs->cs_key;
+    if (cs->cs_valid && from == cs->cs_cur + 1) {
+      rc = mdb_cursor_get(cs->cs_mc, &key, &data, MDB_NEXT_DUP);
+    } else {
+      data.mv_data = &from;
+      data.mv_size = sizeof(ID);
+      rc = mdb_cursor_get(cs->cs_mc, &key, &data, MDB_GET_BOTH_RANGE);
+    }
+    id = NOID;
+    if (!rc)
+      memcpy(&id, data.mv_data, sizeof(ID));
+    break;
+
+  case CS_AND:
+    /* leapfrog until every child lands on the same ID */
+    id = from;
+    do {
+      agree = 1;
+      for (kid = cs->cs_kids; kid && id != NOID; kid = kid->cs_next) {
+        ID x;
+        rc = cstream_next(kid, id, &x);
+        if (rc)
+          return rc;
+        if (x != id) {
+          id = x;
+          agree = 0;
+        }
+      }
+    } while (!agree && id != NOID);
+    break;
+
+  default: /* CS_OR */
+    id = NOID;
+    for (kid = cs->cs_kids; kid; kid = kid->cs_next) {
+      ID x;
+      rc = cstream_next(kid, from, &x);
+      if (rc)
+        return rc;
+      if (x < id)
+        id = x;
+    }
+    break;
+  }
+
+  if (rc == MDB_NOTFOUND)
+    rc = 0;
+  cs->cs_valid = !rc && cs->cs_mc;
+  cs->cs_cur = id;
+  *idp = id;
+  return rc;
+}
+
+/* Open a candidate stream for the filter. Returns LDAP_SUCCESS with
+ * the stream and an estimate of its size (an upper bound for AND, a
+ * sum for OR), or an error if the filter has to be evaluated by
+ * mdb_filter_candidates() instead. */
+int mdb_filter_stream(Operation *op, MDB_txn *rtxn, Filter *f,
+                      struct mdb_cstream **csp, ID *est) {
+  struct mdb_cstream *cs;
+  int rc;
+
+  Debug(LDAP_DEBUG_FILTER, "=> mdb_filter_stream\n");
+
+  rc = cstream_filter(op, rtxn, f, &cs, est);
+  if (rc == LDAP_SUCCESS && !cs) {
+    if (*est == 0)
+      cs = cstream_new(op, CS_EMPTY, 0);
+    else
+      rc = CS_UNWILLING; /* all entries, let the caller walk them */
+  }
+  *csp = cs;
+
+  Debug(LDAP_DEBUG_FILTER, "<= mdb_filter_stream: rc=%d estimate=%ld\n", rc,
+        (long)*est);
+  return rc;
+}
+
+/* The next candidate >= from, or NOID at the end or on error */
+ID mdb_cstream_next(struct mdb_cstream *cs, ID from) {
+  ID id;
+
+  if (cs->cs_rc)
+    return NOID;
+  cs->cs_rc = cstream_next(cs, from, &id);
+  if (cs->cs_rc) {
+    Debug(LDAP_DEBUG_ANY, "mdb_cstream_next: %s (%d)\n",
+          mdb_strerror(cs->cs_rc), cs->cs_rc);
+    return NOID;
+  }
+  return id;
+}
+
+int mdb_cstream_error(struct mdb_cstream *cs) { return cs->cs_rc; }
+
+/* Rebind the cursors after the read txn was reset and renewed */
+int mdb_cstream_renew(struct mdb_cstream *cs, MDB_txn *rtxn) {
+  int rc = 0;
+
+  for (; cs && !rc; cs = cs->cs_next) {
+    cs->cs_valid = 0;
+    cs->cs_stale = (cs->cs_type == CS_KEY);
+    if (cs->cs_mc)
+      rc = mdb_cursor_renew(rtxn, cs->cs_mc);
+    if (!rc)
+      rc = mdb_cstream_renew(cs->cs_kids, rtxn);
+  }
+  return rc;
+}
@@ -44,6 +44,9 @@ static int mdb_id2entry_put(Operation *op, MDB_txn *txn, MDB_cursor *mc,
 
   /* We only store rdns, and they go in the dn2id database. */
 
+  if (mdb->mi_ecache)
+    mdb_ecache_invalidate(mdb, txn, e->e_id);
+
   key.mv_data = &e->e_id;
   key.mv_size = sizeof(ID);
 
@@ -111,10 +114,14 @@ int mdb_id2edata(Operation *op, MDB_cursor *mc, ID id, MDB_val *data) {
 
 int mdb_id2entry(Operation *op, MDB_cursor *mc, ID id, Entry **e) {
   MDB_val key, data;
-  int rc = 0;
+  int rc = 0, cached;
 
   *e = NULL;
 
+  cached = mdb_ecache_usable(op, mdb_cursor_txn(mc));
+  if (cached && mdb_ecache_get(op, mdb_cursor_txn(mc), id, e) == 0)
+    goto done;
+
   key.mv_data = &id;
   key.mv_size = sizeof(ID);
 
@@ -158,10 +165,13 @@ int mdb_id2entry(Operation *op, MDB_cursor *mc, ID id, Entry **e) {
   if (rc)
     return rc;
 
-  rc = mdb_entry_decode(op, mdb_cursor_txn(mc), &data, e);
-  if (rc)
-    return rc;
+  if (!cached || mdb_ecache_put(op, mdb_cursor_txn(mc), id, &data, e)) {
+    rc = mdb_entry_decode(op, mdb_cursor_txn(mc), &data, e);
+    if (rc)
+      return rc;
+  }
 
+done:
   (*e)->e_id = id;
   (*e)->e_name.bv_val = NULL;
   (*e)->e_nname.bv_val = NULL;
@@ -178,6 +188,9 @@ int mdb_id2entry_delete(BackendDB *be, MDB_txn *tid, Entry *e) {
   key.mv_data = &e->e_id;
   key.mv_size = sizeof(ID);
 
+  if (mdb->mi_ecache)
+    mdb_ecache_invalidate(mdb, tid, e->e_id);
+
   /* delete from database */
   rc = mdb_del(tid, dbi, &key, NULL);
 
@@ -203,7 +216,10 @@ static Entry *mdb_entry_alloc(Operation *op, int nattrs, int nvals) {
 int mdb_entry_return(Operation *op, Entry *e) {
   if (!e)
     return 0;
-  if (e->e_private) {
+  if (e->e_private && e->e_private != e) {
+    /* a view of a shared cached entry */
+    mdb_ecache_release(op, e);
+  } else if (e->e_private) {
     if (op->o_hdr && op->o_tmpmfuncs) {
       op->o_tmpfree(e->e_nname.bv_val, op->o_tmpmemctx);
       op->o_tmpfree(e->e_name.bv_val, op->o_tmpmemctx);
@@ -235,7 +251,7 @@ int mdb_entry_release(Operation *op, Entry *e, int rw) {
         moi = (mdb_op_info *)oex;
         /* If it was setup by entry_get we should probably free it */
         assert(moi->moi_ref > 0);
-        if (moi->moi_flag & MOI_FREEIT) {
+        if ((moi->moi_flag & (MOI_FREEIT | MOI_KEEPER)) == MOI_FREEIT) {
           if (--moi->moi_ref < 1) {
             int __maybe_unused rc2 = mdb_txn_reset(moi->moi_txn);
             assert(rc2 == MDB_SUCCESS);
@@ -466,6 +482,61 @@ ok:
   return 0;
 }
 
+/* Keep a write txn open across the ops of a group, which join it through
+ * mdb_opinfo_get() and leave the commit to the SLAP_TXN_COMMIT call.
+ * The reference taken here keeps them from ending it. Entries released
+ * with be_entry_release_rw() don't always come from mdb_entry_get(), so
+ * MOI_KEEPER keeps mdb_entry_release() from dropping references. */
+int mdb_txn(Operation *op, int txnop, OpExtra **ptr) {
+  struct mdb_info *mdb = (struct mdb_info *)op->o_bd->be_private;
+  mdb_op_info *moi = (mdb_op_info *)*ptr;
+  OpExtra *oex;
+  int rc;
+
+  switch (txnop) {
+  case SLAP_TXN_BEGIN:
+    LDAP_SLIST_FOREACH(oex, &op->o_extra, oe_next) {
+      /* the op is already in a txn of its own */
+      if (oex->oe_key == mdb)
+        return LDAP_BUSY;
+    }
+    moi = NULL;
+    rc = mdb_opinfo_get(op, mdb, 0, &moi);
+    if (rc) {
+      if (moi) {
+        LDAP_SLIST_REMOVE(&op->o_extra, &moi->moi_oe, OpExtra, oe_next);
+        op->o_tmpfree(moi, op->o_tmpmemctx);
+      }
+      return LDAP_OTHER;
+    }
+    moi->moi_flag |= MOI_KEEPER;
+    moi->moi_numads = mdb->mi_numads;
+    *ptr = &moi->moi_oe;
+    return LDAP_SUCCESS;
+
+  case SLAP_TXN_COMMIT:
+  case SLAP_TXN_ABORT:
+    assert(moi->moi_ref > 0);
+    LDAP_SLIST_REMOVE(&op->o_extra, &moi->moi_oe, OpExtra, oe_next);
+    if (txnop == SLAP_TXN_COMMIT) {
+      rc = mdb_txn_commit(moi->moi_txn);
+      if (rc) {
+        Debug(LDAP_DEBUG_ANY, "mdb_txn: txn_commit failed: %s (%d)\n",
+              mdb_strerror(rc), rc);
+        mdb->mi_numads = moi->moi_numads;
+      }
+    } else {
+      mdb_txn_abort(moi->moi_txn);
+      mdb->mi_numads = moi->moi_numads;
+      rc = 0;
+    }
+    op->o_tmpfree(moi, op->o_tmpmemctx);
+    *ptr = NULL;
+    return rc ? LDAP_OTHER : LDAP_SUCCESS;
+  }
+  return LDAP_OTHER;
+}
+
 /* Count up the sizes of the components of an entry */
 static int mdb_entry_partsize(struct mdb_info *mdb, MDB_txn *txn, Entry *e,
                               Ecount *eh) {
@@ -520,13 +591,73 @@ static int mdb_entry_partsize(struct mdb_info *mdb, MDB_txn *txn, Entry *e,
 
 #define HIGH_BIT (1 << (sizeof(unsigned int) * CHAR_BIT - 1))
 
+#define VALS_CMP(a, x, y, match)                                              \
+  value_match(&(match), (a)->a_desc, (a)->a_desc->ad_type->sat_equality,       \
+              SLAP_MR_EQUALITY | SLAP_MR_VALUE_OF_ASSERTION_SYNTAX |           \
+                  SLAP_MR_ASSERTED_VALUE_NORMALIZED_MATCH |                    \
+                  SLAP_MR_ATTRIBUTE_VALUE_NORMALIZED_MATCH,                    \
+              &(a)->a_nvals[x], &(a)->a_nvals[y], &text)
+
+/* Order the values of a wide attribute for storing them sorted, so that
+ * attr_valfind() can binary search them once decoded. Only equality rules
+ * that totally order the normalized values qualify. Returns the value
+ * indexes in sorted order, or NULL if the attribute is kept as it is.
+ */
+static unsigned *mdb_vals_sort(Operation *op, Attribute *a) {
+  MatchingRule *mr = a->a_desc->ad_type->sat_equality;
+  unsigned *ix, *tmp, *src, *dst, *t;
+  unsigned n = a->a_numvals, w, lo, mid, hi, i, j, k;
+  const char *text;
+  int match;
+
+  if (!mr || (mr->smr_match != dnMatch && mr->smr_match != octetStringMatch) ||
+      (a->a_desc->ad_type->sat_flags & SLAP_AT_ORDERED) ||
+      a->a_desc == slap_schema.si_ad_objectClass)
+    return NULL;
+
+  ix = op->o_tmpalloc(2 * n * sizeof(unsigned), op->o_tmpmemctx);
+  tmp = ix + n;
+  for (i = 0; i < n; i++)
+    ix[i] = i;
+
+  /* bottom-up merge sort, stable and without recursion */
+  src = ix;
+  dst = tmp;
+  for (w = 1; w < n; w <<= 1) {
+    for (lo = 0; lo < n; lo += 2 * w) {
+      mid = lo + w < n ? lo + w : n;
+      hi = lo + 2 * w < n ? lo + 2 * w : n;
+      for (i = lo, j = mid, k = lo; i < mid && j < hi;) {
+        if (VALS_CMP(a, src[i], src[j], match) != LDAP_SUCCESS ||
+            match == 0) {
+          /* duplicates can't be stored sorted */
+          op->o_tmpfree(ix, op->o_tmpmemctx);
+          return NULL;
+        }
+        dst[k++] = match < 0 ? src[i++] : src[j++];
+      }
+      while (i < mid)
+        dst[k++] = src[i++];
+      while (j < hi)
+        dst[k++] = src[j++];
+    }
+    t = src;
+    src = dst;
+    dst = t;
+  }
+  if (src != ix)
+    memcpy(ix, src, n * sizeof(unsigned));
+  return ix;
+}
+
 /* Flatten an Entry into a buffer. The buffer starts with the count of the
  * number of attributes in the entry, the total number of values in the
  * entry, and the e_ocflags. It then contains a list of integers for each
  * attribute. For each attribute the first integer gives the index of the
  * matching AttributeDescription, followed by the number of values in the
  * attribute. If the high bit of the attr index is set, the attribute's
- * values are already sorted.
+ * values are stored sorted; attributes with at least "sortvalsmin"
+ * values are sorted here if they weren't already.
  * If the high bit of numvals is set, the attribute also has normalized
  * values present. (Note - a_numvals is an unsigned int, so this means
  * it's possible to receive an attribute that we can't encode due to size
@@ -541,10 +672,10 @@ static int mdb_entry_partsize(struct mdb_info *mdb, MDB_txn *txn, Entry *e,
 static int mdb_entry_encode(Operation *op, Entry *e, MDB_val *data,
                             Ecount *eh) {
   struct mdb_info *mdb = (struct mdb_info *)op->o_bd->be_private;
-  ber_len_t i;
+  ber_len_t i, k;
   Attribute *a;
   unsigned char *ptr;
-  unsigned int *lp, l;
+  unsigned int *lp, l, *ix;
 
   Debug(LDAP_DEBUG_TRACE, "=> mdb_entry_encode(0x%08lx): %s\n", (long)e->e_id,
         e->e_dn);
@@ -564,8 +695,14 @@ static int mdb_entry_encode(Operation *op, Entry *e, MDB_val *data,
     if (!a->a_desc->ad_index)
       return LDAP_UNDEFINED_TYPE;
     l = mdb->mi_adxs[a->a_desc->ad_index];
-    if (a->a_flags & SLAP_ATTR_SORTED_VALS)
+    ix = NULL;
+    if (a->a_flags & SLAP_ATTR_SORTED_VALS) {
       l |= HIGH_BIT;
+    } else if (mdb->mi_sortvals_min && a->a_numvals >= mdb->mi_sortvals_min) {
+      ix = mdb_vals_sort(op, a);
+      if (ix)
+        l |= HIGH_BIT;
+    }
     *lp++ = l;
 
     i = 0;
@@ -590,20 +727,24 @@ static int mdb_entry_encode(Operation *op, Entry *e, MDB_val *data,
     *lp++ = l;
     if (l) {
       for (i = 0; i < a->a_numvals; i++) {
-        *lp++ = a->a_vals[i].bv_len;
-        memcpy(ptr, a->a_vals[i].bv_val, a->a_vals[i].bv_len);
-        ptr += a->a_vals[i].bv_len;
+        k = ix ? ix[i] : i;
+        *lp++ = a->a_vals[k].bv_len;
+        memcpy(ptr, a->a_vals[k].bv_val, a->a_vals[k].bv_len);
+        ptr += a->a_vals[k].bv_len;
         *ptr++ = '\0';
       }
       if (l & HIGH_BIT) {
         for (i = 0; i < a->a_numvals; i++) {
-          *lp++ = a->a_nvals[i].bv_len;
-          memcpy(ptr, a->a_nvals[i].bv_val, a->a_nvals[i].bv_len);
-          ptr += a->a_nvals[i].bv_len;
+          k = ix ? ix[i] : i;
+          *lp++ = a->a_nvals[k].bv_len;
+          memcpy(ptr, a->a_nvals[k].bv_val, a->a_nvals[k].bv_len);
+          ptr += a->a_nvals[k].bv_len;
           *ptr++ = '\0';
         }
       }
     }
+    if (ix)
+      op->o_tmpfree(ix, op->o_tmpmemctx);
   }
 
   Debug(LDAP_DEBUG_TRACE, "<= mdb_entry_encode(0x%08lx): %s\n", (long)e->e_id,
@@ -612,6 +753,147 @@ static int mdb_entry_encode(Operation *op, Entry *e, MDB_val *data,
   return 0;
 }
 
+static void view_add(Operation *op, mdb_attr_view *av,
+                     AttributeDescription *ad) {
+  int i;
+
+  for (i = 0; i < av->av_ndescs; i++)
+    if (av->av_descs[i] == ad)
+      return;
+  if (!(av->av_ndescs & 7))
+    av->av_descs = op->o_tmprealloc(
+        av->av_descs, (av->av_ndescs + 8) * sizeof(AttributeDescription *),
+        op->o_tmpmemctx);
+  av->av_descs[av->av_ndescs++] = ad;
+}
+
+/* Collect the attributes a filter tests, -1 if it may test any */
+static int view_filter(Operation *op, mdb_attr_view *av, Filter *f) {
+  switch (f->f_choice) {
+  case LDAP_FILTER_AND:
+  case LDAP_FILTER_OR:
+    for (f = f->f_list; f; f = f->f_next)
+      if (view_filter(op, av, f))
+        return -1;
+    return 0;
+  case LDAP_FILTER_NOT:
+    return view_filter(op, av, f->f_not);
+  case LDAP_FILTER_EQUALITY:
+  case LDAP_FILTER_GE:
+  case LDAP_FILTER_LE:
+  case LDAP_FILTER_APPROX:
+    view_add(op, av, f->f_av_desc);
+    return 0;
+  case LDAP_FILTER_SUBSTRINGS:
+    view_add(op, av, f->f_sub_desc);
+    return 0;
+  case LDAP_FILTER_PRESENT:
+    view_add(op, av, f->f_desc);
+    return 0;
+  case LDAP_FILTER_EXT:
+    if (!f->f_mr_desc)
+      return -1;
+    view_add(op, av, f->f_mr_desc);
+    return 0;
+  case SLAPD_FILTER_COMPUTED:
+    return 0;
+  default:
+    return -1;
+  }
+}
+
+/* Collect the attributes of the target entry ACLs may look at */
+static int view_acls(Operation *op, mdb_attr_view *av, AccessControl *a) {
+  Access *b;
+
+  for (; a; a = a->acl_next) {
+    if (a->acl_filter && view_filter(op, av, a->acl_filter))
+      return -1;
+    for (b = a->acl_access; b; b = b->a_next) {
+      /* sets and dynamic ACLs can reach anything */
+      if (!BER_BVISEMPTY(&b->a_set_pat))
+        return -1;
+#ifdef SLAP_DYNACL
+      if (b->a_dynacl)
+        return -1;
+#endif /* SLAP_DYNACL */
+      if (b->a_dn_at)
+        view_add(op, av, b->a_dn_at);
+      if (b->a_realdn_at)
+        view_add(op, av, b->a_realdn_at);
+      /* the entry may be the group itself */
+      if (b->a_group_at)
+        view_add(op, av, b->a_group_at);
+    }
+  }
+  return 0;
+}
+
+static int view_keep(mdb_attr_view *av, AttributeDescription *ad) {
+  int i;
+
+  if (ad_inlist(ad, av->av_attrs))
+    return 1;
+  for (i = 0; i < av->av_ndescs; i++)
+    if (is_ad_subtype(ad, av->av_descs[i]))
+      return 1;
+  return 0;
+}
+
+static int view_kept(struct mdb_info *mdb, mdb_attr_view *av, int i) {
+  /* attributes added since the view was made are decided on the fly */
+  return i <= av->av_nads ? av->av_keep[i] : view_keep(av, mdb->mi_ads[i]);
+}
+
+/* Decide which stored attributes a search has to materialize: those it
+ * returns, those its filter tests, those the ACLs look at on the entry,
+ * and the few the search loop itself checks. Anything with a response
+ * callback, such as an overlay, may look at any attribute of the entries
+ * sent, so no view is used then. Returns NULL when the whole entry is
+ * needed, av otherwise.
+ */
+mdb_attr_view *mdb_attr_view_get(Operation *op, mdb_attr_view *av) {
+  struct mdb_info *mdb = (struct mdb_info *)op->o_bd->be_private;
+  slap_callback *sc;
+  int i, skip = 0;
+
+  for (sc = op->o_callback; sc; sc = sc->sc_next)
+    if (sc->sc_response)
+      return NULL;
+
+  memset(av, 0, sizeof(*av));
+  av->av_attrs =
+      op->ors_attrs ? op->ors_attrs : slap_anlist_all_user_attributes;
+  view_add(op, av, slap_schema.si_ad_objectClass);
+  view_add(op, av, slap_schema.si_ad_structuralObjectClass);
+  view_add(op, av, slap_schema.si_ad_ref);
+  view_add(op, av, slap_schema.si_ad_aliasedObjectName);
+  if (view_filter(op, av, op->ors_filter) ||
+      view_acls(op, av, op->o_bd->be_acl) ||
+      view_acls(op, av, frontendDB->be_acl))
+    goto full;
+
+  av->av_nads = slap_tsan__read_int(&mdb->mi_numads);
+  av->av_keep = op->o_tmpalloc(av->av_nads + 1, op->o_tmpmemctx);
+  for (i = 1; i <= av->av_nads; i++) {
+    av->av_keep[i] = view_keep(av, mdb->mi_ads[i]);
+    skip |= !av->av_keep[i];
+  }
+  if (skip)
+    return av;
+
+full:
+  mdb_attr_view_free(op, av);
+  return NULL;
+}
+
+void mdb_attr_view_free(Operation *op, mdb_attr_view *av) {
+  op->o_tmpfree(av->av_descs, op->o_tmpmemctx);
+  op->o_tmpfree(av->av_keep, op->o_tmpmemctx);
+  av->av_descs = NULL;
+  av->av_keep = NULL;
+}
+
 /* Retrieve an Entry that was stored using entry_encode above.
  *
  * Note: everything is stored in a single contiguous block, so
@@ -619,13 +901,22 @@ static int mdb_entry_encode(Operation *op, Entry *e, MDB_val *data,
  * structure. Attempting to do so will likely corrupt memory.
  */
 int mdb_entry_decode(Operation *op, MDB_txn *txn, MDB_val *data, Entry **e) {
+  return mdb_entry_decode_view(op, txn, data, NULL, e);
+}
+
+/* As above, but with a view only the attributes it keeps are
+ * materialized; the values of the others are not even looked at.
+ */
+int mdb_entry_decode_view(Operation *op, MDB_txn *txn, MDB_val *data,
+                          mdb_attr_view *av, Entry **e) {
   struct mdb_info *mdb = (struct mdb_info *)op->o_bd->be_private;
-  int i, j, nattrs, nvals;
+  int i, j, n, nattrs, nvals;
   int rc;
   Attribute *a;
   Entry *x;
   const char *text;
   unsigned int *lp = (unsigned int *)data->mv_data;
+  unsigned int *attrs;
   unsigned char *ptr;
   BerVarray bptr;
 
@@ -633,44 +924,67 @@ int mdb_entry_decode(Operation *op, MDB_txn *txn, MDB_val *data, Entry **e) {
 
   nattrs = *lp++;
   nvals = *lp++;
+  attrs = lp + 2;
+  /* check the attribute indexes, and with a view
+   * count what it keeps */
+  for (lp = attrs, j = nattrs; j > 0; j--) {
+    i = *lp++ & ~HIGH_BIT;
+    if (i > slap_tsan__read_int(&mdb->mi_numads)) {
+      rc = mdb_ad_read(mdb, txn);
+      if (rc)
+        return rc;
+      if (i > slap_tsan__read_int(&mdb->mi_numads)) {
+        Debug(LDAP_DEBUG_ANY,
+              "mdb_entry_decode: attribute index %d not recognized\n", i);
+        return LDAP_OTHER;
+      }
+    }
+    n = *lp++;
+    lp += (n & HIGH_BIT) ? 2 * (n ^ HIGH_BIT) : n;
+    if (av && !view_kept(mdb, av, i)) {
+      nattrs--;
+      nvals -= (n & HIGH_BIT) ? 2 * ((n ^ HIGH_BIT) + 1) : n + 1;
+    }
+  }
+
+  lp = (unsigned int *)data->mv_data;
+  j = *lp++;
   x = mdb_entry_alloc(op, nattrs, nvals);
+  lp++;
   x->e_ocflags = *lp++;
-  if (!nvals) {
+  if (!nattrs)
     goto done;
-  }
   a = x->e_attrs;
   bptr = a->a_vals;
   i = *lp++;
   ptr = (unsigned char *)(lp + i);
 
-  for (; nattrs > 0; nattrs--) {
+  for (; j > 0; j--) {
+    unsigned int numvals;
     int have_nval = 0;
-    a->a_flags = SLAP_ATTR_DONT_FREE_DATA | SLAP_ATTR_DONT_FREE_VALS;
+
     i = *lp++;
+    numvals = *lp++;
+    if (numvals & HIGH_BIT) {
+      numvals ^= HIGH_BIT;
+      have_nval = 1;
+    }
+    if (av && !view_kept(mdb, av, i & ~HIGH_BIT)) {
+      /* just step over the values */
+      for (n = numvals << have_nval; n > 0; n--)
+        ptr += *lp++ + 1;
+      continue;
+    }
+    a->a_flags = SLAP_ATTR_DONT_FREE_DATA | SLAP_ATTR_DONT_FREE_VALS;
     if (i & HIGH_BIT) {
       i ^= HIGH_BIT;
       a->a_flags |= SLAP_ATTR_SORTED_VALS;
     }
-    if (i > slap_tsan__read_int(&mdb->mi_numads)) {
-      rc = mdb_ad_read(mdb, txn);
-      if (rc)
-        return rc;
-      if (i > slap_tsan__read_int(&mdb->mi_numads)) {
-        Debug(LDAP_DEBUG_ANY,
-              "mdb_entry_decode: attribute index %d not recognized\n", i);
-        return LDAP_OTHER;
-      }
-    }
     a->a_desc = mdb->mi_ads[i];
-    a->a_numvals = *lp++;
-    if (a->a_numvals & HIGH_BIT) {
-      a->a_numvals ^= HIGH_BIT;
-      have_nval = 1;
-    }
+    a->a_numvals = numvals;
     a->a_vals = bptr;
     for (i = 0; i < a->a_numvals; i++) {
       bptr->bv_len = *lp++;
-      ;
       bptr->bv_val = (char *)ptr;
       ptr += bptr->bv_len + 1;
       bptr++;
@@ -696,7 +1010,7 @@ int mdb_entry_decode(Operation *op, MDB_txn *txn, MDB_val *data, Entry **e) {
     /* FIXME: This is redundant once a sorted entry is saved into the DB */
     if ((a->a_desc->ad_type->sat_flags & SLAP_AT_SORTED_VAL) &&
         !(a->a_flags & SLAP_ATTR_SORTED_VALS)) {
-      rc = slap_sort_vals((Modifications *)a, &text, &j, NULL);
+      rc = slap_sort_vals((Modifications *)a, &text, &i, NULL);
       if (rc == LDAP_SUCCESS) {
         a->a_flags |= SLAP_ATTR_SORTED_VALS;
       } else if (rc == LDAP_TYPE_OR_VALUE_EXISTS) {
@@ -704,7 +1018,7 @@ int mdb_entry_decode(Operation *op, MDB_txn *txn, MDB_val *data, Entry **e) {
         Debug(LDAP_DEBUG_ANY,
               "mdb_entry_decode: attributeType %s value #%d provided more than "
               "once\n",
-              a->a_desc->ad_cname.bv_val, j);
+              a->a_desc->ad_cname.bv_val, i);
         return rc;
       }
     }
@@ -28,6 +28,10 @@
 static void idl_check(ID *ids) {
   if (MDB_IDL_IS_RANGE(ids)) {
     assert(MDB_IDL_RANGE_FIRST(ids) <= MDB_IDL_RANGE_LAST(ids));
+  } else if (MDB_IDL_IS_BMAP(ids)) {
+    assert(ids[1] <= ids[2]);
+    assert(MDB_IDL_BMAP_CARD(ids) > MDB_IDL_DB_MAX);
+    assert(MDB_IDL_BMAP_SIZE(ids) <= MDB_IDL_DB_SIZE);
   } else {
     ID i;
     for (i = 1; i < ids[0]; i++) {
@@ -60,6 +64,474 @@ static void idl_dump(ID *ids) {
 }
 #endif /* IDL_DEBUG */
 
+/* Compressed bitmap IDLs, see idl.h for the layout.
+ *
+ * Each container is a header ID followed by its payload. The header
+ * holds (card - 1) in the low 16 bits, the container type in the next
+ * two bits and the number of runs for a run container above that.
+ * Set operations decode containers to a plain 2^16-bit bitmap, combine
+ * them a word at a time and re-encode the result in the most compact form.
+ */
+
+#define BMAP_SHIFT MDB_IDL_BMAP_SHIFT
+#define BMAP_KEY(id) ((id) >> BMAP_SHIFT)
+#define BMAP_LOW(id) ((unsigned)(id) & 0xffff)
+#define BMAP_WORDS 1024 /* 64-bit words per container */
+#define BMAP_ARRAY_MAX 4096
+#define BMAP_NOBIT 0x10000
+
+#define BMC_ARRAY 0
+#define BMC_BITMAP 1
+#define BMC_RUN 2
+
+#define BMC_CARD(hdr) (((unsigned)(hdr)&0xffff) + 1)
+#define BMC_TYPE(hdr) (((unsigned)(hdr) >> 16) & 3)
+#define BMC_NRUNS(hdr) (((unsigned)(hdr) >> 18) & 0xfff)
+#define BMC_HDR(card, type, nruns)                                             \
+  ((ID)(((card)-1) | ((type) << 16) | ((nruns) << 18)))
+
+#define BMC_BYTES2IDS(n) (((n) + sizeof(ID) - 1) / sizeof(ID))
+
+/* Scratch space to build a bitmap in: containers go to the first
+ * MDB_IDL_DB_SIZE IDs, the directory to the second half.
+ */
+#define BMAP_SCRATCH_SIZE (MDB_IDL_DB_SIZE * 2)
+
+typedef struct bmap_build {
+  ID *bb_cont;
+  ID *bb_dir;
+  ID bb_ncont, bb_used, bb_card, bb_first, bb_last;
+  ID bb_key; /* key of the container accumulated in bb_bits, or NOID */
+  int bb_overflow;
+  uint64_t bb_bits[BMAP_WORDS];
+} bmap_build;
+
+enum { IDL_OP_AND, IDL_OP_OR, IDL_OP_NOTIN };
+
+static void bmap_scratch_free(void *key, void *data) {
+  ber_memfree_x(data, NULL);
+}
+
+static ID *bmap_scratch(void) {
+  void *ctx = ldap_pvt_thread_pool_context();
+  void *ret = NULL;
+
+  ldap_pvt_thread_pool_getkey(ctx, (void *)bmap_scratch, &ret, NULL);
+  if (!ret) {
+    ret = ch_malloc(BMAP_SCRATCH_SIZE * sizeof(ID));
+    ldap_pvt_thread_pool_setkey(ctx, (void *)bmap_scratch, ret,
+                                bmap_scratch_free, NULL, NULL);
+  }
+  return ret;
+}
+
+static __inline uint64_t bmc_word(const ID *c, unsigned i) {
+  uint64_t w;
+  memcpy(&w, (const char *)(c + 1) + i * sizeof(w), sizeof(w));
+  return w;
+}
+
+static __inline const uint16_t *bmc_u16(const ID *c) {
+  return (const uint16_t *)(c + 1);
+}
+
+static ID bmc_size(ID hdr) {
+  switch (BMC_TYPE(hdr)) {
+  case BMC_ARRAY:
+    return 1 + BMC_BYTES2IDS(BMC_CARD(hdr) * sizeof(uint16_t));
+  case BMC_RUN:
+    return 1 + BMC_BYTES2IDS(BMC_NRUNS(hdr) * 2 * sizeof(uint16_t));
+  default:
+    return 1 + BMC_BYTES2IDS(BMAP_WORDS * sizeof(uint64_t));
+  }
+}
+
+/* set bits lo..hi inclusive */
+static void bits_set_range(uint64_t *w, unsigned lo, unsigned hi) {
+  unsigned i = lo >> 6, j = hi >> 6;
+  uint64_t mlo = ~(uint64_t)0 << (lo & 63);
+  uint64_t mhi = ~(uint64_t)0 >> (63 - (hi & 63));
+
+  if (i == j) {
+    w[i] |= mlo & mhi;
+    return;
+  }
+  w[i++] |= mlo;
+  while (i < j)
+    w[i++] = ~(uint64_t)0;
+  w[j] |= mhi;
+}
+
+/* position of the next set (or clear) bit at or after pos */
+static unsigned bits_next(const uint64_t *w, unsigned pos, int set) {
+  unsigned i = pos >> 6;
+  uint64_t x;
+
+  if (pos >= BMAP_NOBIT)
+    return BMAP_NOBIT;
+  x = (set ? w[i] : ~w[i]) & (~(uint64_t)0 << (pos & 63));
+  while (!x) {
+    if (++i == BMAP_WORDS)
+      return BMAP_NOBIT;
+    x = set ? w[i] : ~w[i];
+  }
+  return (i << 6) + __builtin_ctzll(x);
+}
+
+/* expand a container into a plain bitmap */
+static void bmc_decode(const ID *c, uint64_t *w) {
+  unsigned i, n;
+  const uint16_t *v;
+
+  switch (BMC_TYPE(*c)) {
+  case BMC_ARRAY:
+    memset(w, 0, BMAP_WORDS * sizeof(uint64_t));
+    v = bmc_u16(c);
+    for (i = 0, n = BMC_CARD(*c); i < n; i++)
+      w[v[i] >> 6] |= (uint64_t)1 << (v[i] & 63);
+    break;
+  case BMC_RUN:
+    memset(w, 0, BMAP_WORDS * sizeof(uint64_t));
+    v = bmc_u16(c);
+    for (i = 0, n = BMC_NRUNS(*c); i < n; i++)
+      bits_set_range(w, v[2 * i], v[2 * i] + v[2 * i + 1]);
+    break;
+  default:
+    memcpy(w, c + 1, BMAP_WORDS * sizeof(uint64_t));
+  }
+}
+
+/* first member of the container which is >= low, or BMAP_NOBIT */
+static unsigned bmc_lower_bound(const ID *c, unsigned low) {
+  const uint16_t *v;
+  unsigned i, n, base, pivot;
+  uint64_t w;
+
+  switch (BMC_TYPE(*c)) {
+  case BMC_ARRAY:
+    v = bmc_u16(c);
+    base = 0;
+    n = BMC_CARD(*c);
+    while (n) {
+      pivot = n >> 1;
+      if (v[base + pivot] < low) {
+        base += pivot + 1;
+        n -= pivot + 1;
+      } else {
+        n = pivot;
+      }
+    }
+    return (base < BMC_CARD(*c)) ? v[base] : BMAP_NOBIT;
+  case BMC_RUN:
+    v = bmc_u16(c);
+    for (i = 0, n = BMC_NRUNS(*c); i < n; i++) {
+      if ((unsigned)v[2 * i] + v[2 * i + 1] >= low)
+        return (v[2 * i] > low) ? v[2 * i] : low;
+    }
+    return BMAP_NOBIT;
+  default:
+    i = low >> 6;
+    w = bmc_word(c, i) & (~(uint64_t)0 << (low & 63));
+    while (!w) {
+      if (++i == BMAP_WORDS)
+        return BMAP_NOBIT;
+      w = bmc_word(c, i);
+    }
+    return (i << 6) + __builtin_ctzll(w);
+  }
+}
+
+/* index of the first directory entry whose key is >= key */
+static ID bmap_dir_search(ID *ids, ID key) {
+  ID *dir = MDB_IDL_BMAP_DIR(ids);
+  ID base = 0, n = MDB_IDL_BMAP_NCONT(ids), pivot;
+
+  while (n) {
+    pivot = n >> 1;
+    if (dir[2 * (base + pivot)] < key) {
+      base += pivot + 1;
+      n -= pivot + 1;
+    } else {
+      n = pivot;
+    }
+  }
+  return base;
+}
+
+/* first member of the bitmap which is >= id, or NOID */
+static ID bmap_lower_bound(ID *ids, ID id) {
+  ID *dir = MDB_IDL_BMAP_DIR(ids);
+  ID i, n = MDB_IDL_BMAP_NCONT(ids), key = BMAP_KEY(id);
+  unsigned low;
+
+  for (i = bmap_dir_search(ids, key); i < n; i++) {
+    low = bmc_lower_bound(ids + dir[2 * i + 1],
+                          (dir[2 * i] == key) ? BMAP_LOW(id) : 0);
+    if (low != BMAP_NOBIT)
+      return (dir[2 * i] << BMAP_SHIFT) | low;
+  }
+  return NOID;
+}
+
+/* binary search of a plain list without the consistency check,
+ * returns the first position whose ID is >= id */
+static unsigned idl_lower_bound(ID *ids, ID id) {
+  unsigned base = 0, n = ids[0], pivot;
+
+  while (n) {
+    pivot = n >> 1;
+    if (ids[base + pivot + 1] < id) {
+      base += pivot + 1;
+      n -= pivot + 1;
+    } else {
+      n = pivot;
+    }
+  }
+  return base + 1;
+}
+
+/* smallest container key >= key which may hold members of ids */
+static ID idl_next_key(ID *ids, ID key) {
+  unsigned x;
+
+  if (MDB_IDL_IS_ZERO(ids))
+    return NOID;
+  if (MDB_IDL_IS_RANGE(ids)) {
+    if (key > BMAP_KEY(ids[2]))
+      return NOID;
+    return (key > BMAP_KEY(ids[1])) ? key : BMAP_KEY(ids[1]);
+  }
+  if (MDB_IDL_IS_BMAP(ids)) {
+    x = bmap_dir_search(ids, key);
+    return (x < MDB_IDL_BMAP_NCONT(ids)) ? MDB_IDL_BMAP_DIR(ids)[2 * x]
+                                         : NOID;
+  }
+  if (key > BMAP_KEY(ids[ids[0]]))
+    return NOID;
+  x = idl_lower_bound(ids, key << BMAP_SHIFT);
+  return BMAP_KEY(ids[x]);
+}
+
+/* expand the members of ids within the given container key */
+static void idl_chunk(ID *ids, ID key, uint64_t *w) {
+  ID lo = key << BMAP_SHIFT, hi = lo | 0xffff;
+  unsigned x;
+
+  if (MDB_IDL_IS_BMAP(ids)) {
+    x = bmap_dir_search(ids, key);
+    if (x < MDB_IDL_BMAP_NCONT(ids) && MDB_IDL_BMAP_DIR(ids)[2 * x] == key) {
+      bmc_decode(ids + MDB_IDL_BMAP_DIR(ids)[2 * x + 1], w);
+      return;
+    }
+  }
+
+  memset(w, 0, BMAP_WORDS * sizeof(uint64_t));
+  if (MDB_IDL_IS_RANGE(ids)) {
+    if (ids[1] > lo)
+      lo = ids[1];
+    if (ids[2] < hi)
+      hi = ids[2];
+    if (lo <= hi)
+      bits_set_range(w, BMAP_LOW(lo), BMAP_LOW(hi));
+  } else if (MDB_IDL_IS_LIST(ids)) {
+    for (x = idl_lower_bound(ids, lo); x <= ids[0] && ids[x] <= hi; x++)
+      w[BMAP_LOW(ids[x]) >> 6] |= (uint64_t)1 << (ids[x] & 63);
+  }
+}
+
+static void bmap_build_init(bmap_build *bb) {
+  bb->bb_cont = bmap_scratch();
+  bb->bb_dir = bb->bb_cont + MDB_IDL_DB_SIZE;
+  bb->bb_ncont = bb->bb_used = bb->bb_card = 0;
+  bb->bb_first = bb->bb_last = NOID;
+  bb->bb_key = NOID;
+  bb->bb_overflow = 0;
+}
+
+/* encode a plain bitmap as the next container */
+static void bmap_build_put(bmap_build *bb, ID key, const uint64_t *w) {
+  unsigned i, card = 0, nruns = 0, type, lo = BMAP_NOBIT, hi = 0;
+  uint64_t carry = 0, x;
+  size_t abytes, rbytes, bbytes;
+  ID *c, size;
+
+  for (i = 0; i < BMAP_WORDS; i++) {
+    x = w[i];
+    if (!x) {
+      carry = 0;
+      continue;
+    }
+    if (lo == BMAP_NOBIT)
+      lo = (i << 6) + __builtin_ctzll(x);
+    hi = (i << 6) + 63 - __builtin_clzll(x);
+    card += __builtin_popcountll(x);
+    nruns += __builtin_popcountll(x & ~((x << 1) | carry));
+    carry = x >> 63;
+  }
+  if (!card)
+    return;
+
+  /* pick the smallest representation */
+  bbytes = BMAP_WORDS * sizeof(uint64_t);
+  abytes = (card <= BMAP_ARRAY_MAX) ? card * sizeof(uint16_t) : bbytes;
+  rbytes = nruns * 2 * sizeof(uint16_t);
+  if (rbytes < abytes && rbytes < bbytes)
+    type = BMC_RUN;
+  else if (abytes < bbytes)
+    type = BMC_ARRAY;
+  else
+    type = BMC_BITMAP;
+  if (type != BMC_RUN)
+    nruns = 0;
+
+  size = bmc_size(BMC_HDR(card, type, nruns));
+  if (MDB_IDL_BMAP_HDR + bb->bb_used + size + 2 * (bb->bb_ncont + 1) >
+      MDB_IDL_DB_SIZE) {
+    bb->bb_overflow = 1;
+    return;
+  }
+
+  c = bb->bb_cont + bb->bb_used;
+  c[size - 1] = 0; /* keep the padding clean */
+  c[0] = BMC_HDR(card, type, nruns);
+  if (type == BMC_BITMAP) {
+    memcpy(c + 1, w, bbytes);
+  } else {
+    uint16_t *v = (uint16_t *)(c + 1);
+    unsigned pos = 0, end;
+
+    while ((pos = bits_next(w, pos, 1)) != BMAP_NOBIT) {
+      if (type == BMC_ARRAY) {
+        *v++ = pos++;
+      } else {
+        end = bits_next(w, pos, 0);
+        *v++ = pos;
+        *v++ = end - 1 - pos;
+        pos = end;
+      }
+    }
+  }
+
+  bb->bb_dir[2 * bb->bb_ncont] = key;
+  bb->bb_dir[2 * bb->bb_ncont + 1] = bb->bb_used;
+  bb->bb_ncont++;
+  bb->bb_used += size;
+  bb->bb_card += card;
+  if (bb->bb_first == NOID)
+    bb->bb_first = (key << BMAP_SHIFT) | lo;
+  bb->bb_last = (key << BMAP_SHIFT) | hi;
+}
+
+/* add one ID, the IDs must come in ascending order */
+static void bmap_build_add(bmap_build *bb, ID id) {
+  ID key = BMAP_KEY(id);
+
+  if (key != bb->bb_key) {
+    assert(bb->bb_key == NOID || key > bb->bb_key);
+    if (bb->bb_key != NOID)
+      bmap_build_put(bb, bb->bb_key, bb->bb_bits);
+    memset(bb->bb_bits, 0, sizeof(bb->bb_bits));
+    bb->bb_key = key;
+  }
+  bb->bb_bits[BMAP_LOW(id) >> 6] |= (uint64_t)1 << (id & 63);
+}
+
+/* store the result into ids: as a plain list if it is small enough,
+ * otherwise as a bitmap. Returns -1 if it didn't fit at all.
+ */
+static int bmap_build_finish(bmap_build *bb, ID *ids) {
+  ID i, *dir;
+
+  if (bb->bb_key != NOID) {
+    bmap_build_put(bb, bb->bb_key, bb->bb_bits);
+    bb->bb_key = NOID;
+  }
+  if (bb->bb_overflow)
+    return -1;
+
+  if (bb->bb_card <= MDB_IDL_DB_MAX) {
+    ID n = 0;
+    for (i = 0; i < bb->bb_ncont; i++) {
+      ID *c = bb->bb_cont + bb->bb_dir[2 * i + 1];
+      ID base = bb->bb_dir[2 * i] << BMAP_SHIFT;
+      unsigned low = bmc_lower_bound(c, 0);
+      while (low != BMAP_NOBIT) {
+        ids[++n] = base | low;
+        low = (low < 0xffff) ? bmc_lower_bound(c, low + 1) : BMAP_NOBIT;
+      }
+    }
+    ids[0] = n;
+    return 0;
+  }
+
+  ids[0] = MDB_IDL_BMAP_MARK;
+  ids[1] = bb->bb_first;
+  ids[2] = bb->bb_last;
+  MDB_IDL_BMAP_CARD(ids) = bb->bb_card;
+  MDB_IDL_BMAP_NCONT(ids) = bb->bb_ncont;
+  MDB_IDL_BMAP_SIZE(ids) = MDB_IDL_BMAP_HDR + bb->bb_used + 2 * bb->bb_ncont;
+  memcpy(ids + MDB_IDL_BMAP_HDR, bb->bb_cont, bb->bb_used * sizeof(ID));
+  dir = MDB_IDL_BMAP_DIR(ids);
+  for (i = 0; i < bb->bb_ncont; i++) {
+    dir[2 * i] = bb->bb_dir[2 * i];
+    dir[2 * i + 1] = bb->bb_dir[2 * i + 1] + MDB_IDL_BMAP_HDR;
+  }
+  return 0;
+}
+
+/* out = a op b, container by container; out may be the same as a.
+ * Open-ended ranges are only allowed with IDL_OP_AND, the callers
+ * handle the other cases. Returns -1 if the result didn't fit.
+ */
+static int idl_combine(ID *a, ID *b, ID *out, int op) {
+  bmap_build bb;
+  uint64_t w[BMAP_WORDS];
+  ID key = 0, ka, kb;
+  unsigned i;
+
+  bmap_build_init(&bb);
+  for (;;) {
+    ka = idl_next_key(a, key);
+    if (op == IDL_OP_OR) {
+      kb = idl_next_key(b, key);
+      if (kb < ka)
+        ka = kb;
+    } else if (op == IDL_OP_AND && ka != NOID) {
+      kb = idl_next_key(b, ka);
+      if (kb != ka) {
+        /* leapfrog to the next key both sides may have */
+        if (kb == NOID)
+          break;
+        key = kb;
+        continue;
+      }
+    }
+    if (ka == NOID)
+      break;
+
+    idl_chunk(a, ka, bb.bb_bits);
+    idl_chunk(b, ka, w);
+    switch (op) {
+    case IDL_OP_AND:
+      for (i = 0; i < BMAP_WORDS; i++)
+        bb.bb_bits[i] &= w[i];
+      break;
+    case IDL_OP_OR:
+      for (i = 0; i < BMAP_WORDS; i++)
+        bb.bb_bits[i] |= w[i];
+      break;
+    default:
+      for (i = 0; i < BMAP_WORDS; i++)
+        bb.bb_bits[i] &= ~w[i];
+    }
+    bmap_build_put(&bb, ka, bb.bb_bits);
+    if (bb.bb_overflow)
+      return -1;
+    key = ka + 1;
+  }
+  return bmap_build_finish(&bb, out);
+}
+
 unsigned mdb_idl_search(ID *ids, ID id) {
 #define IDL_BINARY_SEARCH 1
 #ifdef IDL_BINARY_SEARCH
@@ -115,6 +587,19 @@ unsigned mdb_idl_search(ID *ids, ID id) {
 #endif /* IDL_BINARY_SEARCH */
 }
 
+/* Check whether id is a member of ids, whatever form ids has. */
+int mdb_idl_contains(ID *ids, ID id) {
+  unsigned x;
+
+  if (MDB_IDL_IS_RANGE(ids))
+    return id >= MDB_IDL_RANGE_FIRST(ids) && id <= MDB_IDL_RANGE_LAST(ids);
+  if (MDB_IDL_IS_BMAP(ids))
+    return id >= ids[1] && id <= ids[2] && bmap_lower_bound(ids, id) == id;
+
+  x = mdb_idl_search(ids, id);
+  return x <= ids[0] && ids[x] == id;
+}
+
 int mdb_idl_insert(ID *ids, ID id) {
   unsigned x;
 
@@ -137,6 +622,16 @@ int mdb_idl_insert(ID *ids, ID id) {
     return 0;
   }
 
+  if (MDB_IDL_IS_BMAP(ids)) {
+    ID one[2];
+
+    if (mdb_idl_contains(ids, id))
+      return -1;
+    one[0] = 1;
+    one[1] = id;
+    return mdb_idl_union(ids, one);
+  }
+
   x = mdb_idl_search(ids, id);
   assert(x > 0);
 
@@ -243,6 +738,11 @@ static char *mdb_show_key(char *buf, void *val, size_t len) {
     unsigned char *c = val;
     sprintf(buf, "[%02x%02x%02x%02x]", c[0], c[1], c[2], c[3]);
     return buf;
+  } else if (len == 8 /* LUTIL_HASH64_BYTES */) {
+    unsigned char *c = val;
+    sprintf(buf, "[%02x%02x%02x%02x%02x%02x%02x%02x]", c[0], c[1], c[2], c[3],
+            c[4], c[5], c[6], c[7]);
+    return buf;
   } else {
     return val;
   }
@@ -257,7 +757,7 @@ int mdb_idl_fetch_key(BackendDB *be, MDB_txn *txn, MDB_dbi dbi, MDB_val *key,
   int rc;
   MDB_cursor_op opflag;
 
-  char keybuf[16];
+  char keybuf[24];
 
   Debug(LDAP_DEBUG_ARGS, "mdb_idl_fetch_key: %s\n",
         mdb_show_key(keybuf, key->mv_data, key->mv_size));
@@ -315,18 +815,49 @@ int mdb_idl_fetch_key(BackendDB *be, MDB_txn *txn, MDB_dbi dbi, MDB_val *key,
     rc = MDB_NOTFOUND;
   }
   if (rc == 0) {
+    bmap_build bb;
+    int bitmap = 0;
+    ID lo = NOID, hi = 0;
+
     i = ids + 1;
     rc = mdb_cursor_get(cursor, key, &data, MDB_GET_MULTIPLE);
     while (rc == 0) {
-      memcpy(i, data.mv_data, data.mv_size);
-      i += data.mv_size / sizeof(ID);
+      size_t n = data.mv_size / sizeof(ID);
+      if (!bitmap && (i - &ids[1]) + n > MDB_IDL_DB_MAX) {
+        /* Too many IDs for a list, switch over to a bitmap */
+        ID *j;
+        bmap_build_init(&bb);
+        for (j = ids + 1; j < i; j++)
+          bmap_build_add(&bb, *j);
+        if (i > ids + 1)
+          lo = ids[1];
+        bitmap = 1;
+      }
+      if (bitmap) {
+        const char *ptr = data.mv_data;
+        for (; n; n--, ptr += sizeof(ID)) {
+          memcpy(&hi, ptr, sizeof(ID));
+          if (lo == NOID)
+            lo = hi;
+          bmap_build_add(&bb, hi);
+        }
+      } else {
+        memcpy(i, data.mv_data, data.mv_size);
+        i += n;
+      }
       rc = mdb_cursor_get(cursor, key, &data, MDB_NEXT_MULTIPLE);
     }
     if (rc == MDB_NOTFOUND)
       rc = 0;
-    ids[0] = i - &ids[1];
+    if (bitmap) {
+      /* Too scattered to fit, fallback to range */
+      if (bmap_build_finish(&bb, ids))
+        MDB_IDL_RANGE(ids, lo, hi);
+    } else {
+      ids[0] = i - &ids[1];
+    }
     /* On disk, a range is denoted by 0 in the first element */
-    if (ids[1] == 0) {
+    if (!bitmap && ids[1] == 0) {
       if (ids[0] != MDB_IDL_RANGE_SIZE) {
         Debug(LDAP_DEBUG_ANY,
               "=> mdb_idl_fetch_key: "
@@ -384,7 +915,7 @@ int mdb_idl_fetch_key(BackendDB *be, MDB_txn *txn, MDB_dbi dbi, MDB_val *key,
 int mdb_idl_insert_keys(BackendDB *be, MDB_cursor *cursor, struct berval *keys,
                         ID id) {
   struct mdb_info *mdb = be->be_private;
-  MDB_val key, data;
+  MDB_val key, kcur, data;
   ID lo, hi, *i;
   char *err;
   int rc = 0, k;
@@ -394,7 +925,7 @@ int mdb_idl_insert_keys(BackendDB *be, MDB_cursor *cursor, struct berval *keys,
 #endif
 
   {
-    char buf[16];
+    char buf[24];
     Debug(LDAP_DEBUG_ARGS, "mdb_idl_insert_keys: %lx %s\n", (long)id,
           mdb_show_key(buf, keys->bv_val, keys->bv_len));
   }
@@ -433,10 +964,12 @@ int mdb_idl_insert_keys(BackendDB *be, MDB_cursor *cursor, struct berval *keys,
           err = "c_count";
           goto fail;
         }
-        if (count >= MDB_IDL_DB_MAX) {
+        if (count >= mdb->mi_idl_range_limit) {
           /* No room, convert to a range */
           lo = *i;
-          rc = mdb_cursor_get(cursor, &key, &data, MDB_LAST_DUP);
+          /* positioning may point the key into the page, which
+           * the following del/put reshuffles, so keep it aside */
+          rc = mdb_cursor_get(cursor, &kcur, &data, MDB_LAST_DUP);
           if (rc != 0 && rc != MDB_NOTFOUND) {
             err = "c_get last_dup";
             goto fail;
@@ -490,14 +1023,14 @@ int mdb_idl_insert_keys(BackendDB *be, MDB_cursor *cursor, struct berval *keys,
         hi = i[2];
         if (id < lo || id > hi) {
           /* position on lo */
-          rc = mdb_cursor_get(cursor, &key, &data, MDB_NEXT_DUP);
+          rc = mdb_cursor_get(cursor, &kcur, &data, MDB_NEXT_DUP);
           if (rc != 0) {
             err = "c_get lo";
             goto fail;
           }
           if (id > hi) {
             /* position on hi */
-            rc = mdb_cursor_get(cursor, &key, &data, MDB_NEXT_DUP);
+            rc = mdb_cursor_get(cursor, &kcur, &data, MDB_NEXT_DUP);
             if (rc != 0) {
               err = "c_get hi";
               goto fail;
@@ -542,7 +1075,7 @@ int mdb_idl_insert_keys(BackendDB *be, MDB_cursor *cursor, struct berval *keys,
 int mdb_idl_delete_keys(BackendDB *be, MDB_cursor *cursor, struct berval *keys,
                         ID id) {
   int rc = 0, k;
-  MDB_val key, data;
+  MDB_val key, kcur, data;
   ID lo, hi, tmp, *i;
   char *err;
 #ifndef MISALIGNED_OK
@@ -550,7 +1083,7 @@ int mdb_idl_delete_keys(BackendDB *be, MDB_cursor *cursor, struct berval *keys,
 #endif
 
   {
-    char buf[16];
+    char buf[24];
     Debug(LDAP_DEBUG_ARGS, "mdb_idl_delete_keys: %lx %s\n", (long)id,
           mdb_show_key(buf, keys->bv_val, keys->bv_len));
   }
@@ -614,13 +1147,13 @@ int mdb_idl_delete_keys(BackendDB *be, MDB_cursor *cursor, struct berval *keys,
               goto fail;
             }
           } else {
-            /* position on lo */
-            rc = mdb_cursor_get(cursor, &key, &data, MDB_NEXT_DUP);
+            /* position on lo, keeping the key out of the page */
+            rc = mdb_cursor_get(cursor, &kcur, &data, MDB_NEXT_DUP);
             if (id == lo)
               data.mv_data = &lo2;
             else {
               /* position on hi */
-              rc = mdb_cursor_get(cursor, &key, &data, MDB_NEXT_DUP);
+              rc = mdb_cursor_get(cursor, &kcur, &data, MDB_NEXT_DUP);
               data.mv_data = &hi2;
             }
             /* Replace the current lo/hi */
@@ -656,7 +1189,7 @@ int mdb_idl_delete_keys(BackendDB *be, MDB_cursor *cursor, struct berval *keys,
 int mdb_idl_intersection(ID *a, ID *b) {
   ID ida, idb;
   ID idmax, idmin;
-  ID cursora = 0, cursorb = 0, cursorc;
+  ID cursora = 0, cursorb = 0;
   int swap = 0;
 
   if (MDB_IDL_IS_ZERO(a) || MDB_IDL_IS_ZERO(b)) {
@@ -675,6 +1208,14 @@ int mdb_idl_intersection(ID *a, ID *b) {
     return 0;
   }
 
+  if (MDB_IDL_IS_BMAP(a) || MDB_IDL_IS_BMAP(b)) {
+    /* Word-parallel intersection, leaving a range if the result
+     * somehow doesn't fit. */
+    if (idl_combine(a, b, a, IDL_OP_AND))
+      MDB_IDL_RANGE(a, idmin, idmax);
+    return 0;
+  }
+
   if (MDB_IDL_IS_RANGE(a)) {
     if (MDB_IDL_IS_RANGE(b)) {
       /* If both are ranges, just shrink the boundaries */
@@ -698,26 +1239,24 @@ int mdb_idl_intersection(ID *a, ID *b) {
     goto done;
   }
 
-  /* Fine, do the intersection one element at a time.
-   * First advance to idmin in both IDLs.
-   */
-  cursora = cursorb = idmin;
-  ida = mdb_idl_first(a, &cursora);
-  idb = mdb_idl_first(b, &cursorb);
-  cursorc = 0;
-
-  while (ida <= idmax || idb <= idmax) {
-    if (ida == idb) {
-      a[++cursorc] = ida;
-      ida = mdb_idl_next(a, &cursora);
-      idb = mdb_idl_next(b, &cursorb);
-    } else if (ida < idb) {
-      ida = mdb_idl_next(a, &cursora);
-    } else {
-      idb = mdb_idl_next(b, &cursorb);
-    }
+  if (MDB_IDL_IS_RANGE(b)) {
+    /* Keep the slice of the list inside the range */
+    cursora = idl_lower_bound(a, idmin);
+    cursorb = idl_lower_bound(a, idmax + 1);
+    a[0] = cursorb - cursora;
+    if (cursora > 1)
+      memmove(a + 1, a + cursora, a[0] * sizeof(ID));
+    goto done;
   }
-  a[0] = cursorc;
+
+  /* Both are lists, skip to idmin and run the kernel on the overlap */
+  cursora = idl_lower_bound(a, idmin);
+  cursorb = idl_lower_bound(b, idmin);
+  ida = idl_lower_bound(a, idmax + 1) - cursora;
+  idb = idl_lower_bound(b, idmax + 1) - cursorb;
+  if (cursora > 1)
+    memmove(a + 1, a + cursora, ida * sizeof(ID));
+  a[0] = mdb_idl_isect(a + 1, ida, b + cursorb, idb);
 done:
   if (swap)
     MDB_IDL_CPY(b, a);
@@ -729,8 +1268,7 @@ done:
  * idl_union - return a = a union b
  */
 int mdb_idl_union(ID *a, ID *b) {
-  ID ida, idb;
-  ID cursora = 0, cursorb = 0, cursorc;
+  ID ida, idb, *tmp;
 
   if (MDB_IDL_IS_ZERO(b)) {
     return 0;
@@ -751,101 +1289,71 @@ int mdb_idl_union(ID *a, ID *b) {
     return 0;
   }
 
-  ida = mdb_idl_first(a, &cursora);
-  idb = mdb_idl_first(b, &cursorb);
-
-  cursorc = b[0];
-
-  /* The distinct elements of a are cat'd to b */
-  while (ida != NOID || idb != NOID) {
-    if (ida < idb) {
-      if (++cursorc > MDB_IDL_UM_MAX) {
-        goto over;
-      }
-      b[cursorc] = ida;
-      ida = mdb_idl_next(a, &cursora);
-
-    } else {
-      if (ida == idb)
-        ida = mdb_idl_next(a, &cursora);
-      idb = mdb_idl_next(b, &cursorb);
-    }
+  if (MDB_IDL_IS_BMAP(a) || MDB_IDL_IS_BMAP(b) ||
+      a[0] + b[0] > MDB_IDL_UM_MAX) {
+    /* Too big for a list, keep it exact as a bitmap */
+    if (idl_combine(a, b, a, IDL_OP_OR))
+      goto over;
+    return 0;
   }
 
-  /* b is copied back to a in sorted order */
-  a[0] = cursorc;
-  cursora = 1;
-  cursorb = 1;
-  cursorc = b[0] + 1;
-  while (cursorb <= b[0] || cursorc <= a[0]) {
-    if (cursorc > a[0])
-      idb = NOID;
-    else
-      idb = b[cursorc];
-    if (cursorb <= b[0] && b[cursorb] < idb)
-      a[cursora++] = b[cursorb++];
-    else {
-      a[cursora++] = idb;
-      cursorc++;
-    }
-  }
+  /* Both lists fit together, merge them through the scratch buffer */
+  tmp = bmap_scratch();
+  tmp[0] = mdb_idl_merge(a + 1, a[0], b + 1, b[0], tmp + 1);
+  MDB_IDL_CPY(a, tmp);
 
   return 0;
 }
 
-#if 0
 /*
  * mdb_idl_notin - return a intersection ~b (or a minus b)
  */
-int
-mdb_idl_notin(
-	ID	*a,
-	ID	*b,
-	ID *ids )
-{
-	ID ida, idb;
-	ID cursora = 0, cursorb = 0;
-
-	if( MDB_IDL_IS_ZERO( a ) ||
-		MDB_IDL_IS_ZERO( b ) ||
-		MDB_IDL_IS_RANGE( b ) )
-	{
-		MDB_IDL_CPY( ids, a );
-		return 0;
-	}
+int mdb_idl_notin(ID *a, ID *b, ID *ids) {
+  ID ida, idb;
+  ID cursora = 0, cursorb = 0;
 
-	if( MDB_IDL_IS_RANGE( a ) ) {
-		MDB_IDL_CPY( ids, a );
-		return 0;
-	}
+  if (MDB_IDL_IS_ZERO(a) || MDB_IDL_IS_ZERO(b) || MDB_IDL_IS_RANGE(b)) {
+    MDB_IDL_CPY(ids, a);
+    return 0;
+  }
 
-	ida = mdb_idl_first( a, &cursora ),
-	idb = mdb_idl_first( b, &cursorb );
+  if (MDB_IDL_IS_RANGE(a)) {
+    MDB_IDL_CPY(ids, a);
+    return 0;
+  }
 
-	ids[0] = 0;
+  if (MDB_IDL_IS_BMAP(a) || MDB_IDL_IS_BMAP(b)) {
+    if (idl_combine(a, b, ids, IDL_OP_NOTIN))
+      MDB_IDL_CPY(ids, a);
+    return 0;
+  }
 
-	while( ida != NOID ) {
-		if ( idb == NOID ) {
-			/* we could shortcut this */
-			ids[++ids[0]] = ida;
-			ida = mdb_idl_next( a, &cursora );
+  ida = mdb_idl_first(a, &cursora);
+  idb = mdb_idl_first(b, &cursorb);
 
-		} else if ( ida < idb ) {
-			ids[++ids[0]] = ida;
-			ida = mdb_idl_next( a, &cursora );
+  ids[0] = 0;
 
-		} else if ( ida > idb ) {
-			idb = mdb_idl_next( b, &cursorb );
+  while (ida != NOID) {
+    if (idb == NOID) {
+      /* we could shortcut this */
+      ids[++ids[0]] = ida;
+      ida = mdb_idl_next(a, &cursora);
 
-		} else {
-			ida = mdb_idl_next( a, &cursora );
-			idb = mdb_idl_next( b, &cursorb );
-		}
-	}
+    } else if (ida < idb) {
+      ids[++ids[0]] = ida;
+      ida = mdb_idl_next(a, &cursora);
 
-	return 0;
+    } else if (ida > idb) {
+      idb = mdb_idl_next(b, &cursorb);
+
+    } else {
+      ida = mdb_idl_next(a, &cursora);
+      idb = mdb_idl_next(b, &cursorb);
+    }
+  }
+
+  return 0;
 }
-#endif
 
 ID mdb_idl_first(ID *ids, ID *cursor) {
   ID pos;
@@ -862,6 +1370,12 @@ ID mdb_idl_first(ID *ids, ID *cursor) {
     return *cursor;
   }
 
+  /* for a bitmap the cursor is the current ID, as for a range */
+  if (MDB_IDL_IS_BMAP(ids)) {
+    *cursor = bmap_lower_bound(ids, (*cursor < ids[1]) ? ids[1] : *cursor);
+    return *cursor;
+  }
+
   if (*cursor == 0)
     pos = 1;
   else
@@ -883,6 +1397,13 @@ ID mdb_idl_next(ID *ids, ID *cursor) {
     return *cursor;
   }
 
+  if (MDB_IDL_IS_BMAP(ids)) {
+    if (*cursor >= ids[2])
+      return NOID;
+    *cursor = bmap_lower_bound(ids, *cursor + 1);
+    return *cursor;
+  }
+
   if (++(*cursor) <= ids[0]) {
     return ids[*cursor];
   }
@@ -890,6 +1411,33 @@ ID mdb_idl_next(ID *ids, ID *cursor) {
   return NOID;
 }
 
+/* Load ids from a plain bitset of nblocks blocks of BMAP_WORDS words,
+ * the first block starting at ID key << BMAP_SHIFT. The result is a list
+ * if it fits one, a bitmap otherwise. Returns -1 if it didn't fit at all.
+ */
+int mdb_idl_from_bits(ID *ids, ID key, const uint64_t *bits, ID nblocks) {
+  bmap_build bb;
+  uint64_t x;
+  ID i, n = 0;
+
+  for (i = 0; i < nblocks * BMAP_WORDS; i++)
+    n += __builtin_popcountll(bits[i]);
+
+  if (n <= MDB_IDL_UM_MAX) {
+    ids[0] = n;
+    for (i = 0, n = 1; i < nblocks * BMAP_WORDS; i++) {
+      for (x = bits[i]; x; x &= x - 1)
+        ids[n++] = (key << BMAP_SHIFT) + (i << 6) + __builtin_ctzll(x);
+    }
+    return 0;
+  }
+
+  bmap_build_init(&bb);
+  for (i = 0; i < nblocks; i++)
+    bmap_build_put(&bb, key + i, bits + i * BMAP_WORDS);
+  return bmap_build_finish(&bb, ids);
+}
+
 /* Add one ID to an unsorted list. We ensure that the first element is the
  * minimum and the last element is the maximum, for fast range compaction.
  *   this means IDLs up to length 3 are always sorted...
@@ -28,11 +28,47 @@
 
 #define MDB_IDL_UM_MAX (MDB_IDL_UM_SIZE - 1)
 
+/* default number of IDs a key may hold on disk before it is stored as
+ * a range; up to it, larger keys are read into a compressed bitmap */
+#define MDB_IDL_RANGE_LIMIT (MDB_IDL_DB_SIZE << 2)
+
 #define MDB_IDL_IS_RANGE(ids) ((ids)[0] == NOID)
 #define MDB_IDL_RANGE_SIZE (3)
 #define MDB_IDL_RANGE_SIZEOF (MDB_IDL_RANGE_SIZE * sizeof(ID))
+
+/* Compressed bitmap IDL, roaring-style.
+ *
+ * Candidate sets too large for a plain list are kept exact as a set of
+ * containers, each covering 2^16 IDs and stored either as a sorted array
+ * of low 16-bit halves, as a plain bitmap, or as a list of runs, whichever
+ * is smaller. The whole thing lives in an ordinary IDL buffer and never
+ * exceeds MDB_IDL_DB_SIZE, otherwise it degrades to a range as before:
+ *   ids[0]      MDB_IDL_BMAP_MARK
+ *   ids[1..2]   first and last ID, as for a range
+ *   ids[3]      number of IDs
+ *   ids[4]      number of containers
+ *   ids[5]      total size in IDs, header included
+ * followed by the containers, and then by a directory of
+ * (key, offset) pairs sorted by key at the very end.
+ */
+#define MDB_IDL_BMAP_MARK (NOID - 1)
+#define MDB_IDL_BMAP_HDR (6)
+#define MDB_IDL_IS_BMAP(ids) ((ids)[0] == MDB_IDL_BMAP_MARK)
+#define MDB_IDL_IS_LIST(ids) ((ids)[0] < MDB_IDL_BMAP_MARK)
+#define MDB_IDL_BMAP_CARD(ids) ((ids)[3])
+#define MDB_IDL_BMAP_NCONT(ids) ((ids)[4])
+#define MDB_IDL_BMAP_SIZE(ids) ((ids)[5])
+#define MDB_IDL_BMAP_DIR(ids) ((ids) + (ids)[5] - 2 * (ids)[4])
+
+/* each container, and each block of the plain bitsets passed to
+ * mdb_idl_from_bits(), covers 1 << MDB_IDL_BMAP_SHIFT IDs */
+#define MDB_IDL_BMAP_SHIFT 16
+
 #define MDB_IDL_SIZEOF(ids)                                                    \
-  ((MDB_IDL_IS_RANGE(ids) ? MDB_IDL_RANGE_SIZE : ((ids)[0] + 1)) * sizeof(ID))
+  ((MDB_IDL_IS_RANGE(ids)                                                      \
+        ? MDB_IDL_RANGE_SIZE                                                   \
+        : MDB_IDL_IS_BMAP(ids) ? MDB_IDL_BMAP_SIZE(ids) : ((ids)[0] + 1)) *    \
+   sizeof(ID))
 
 #define MDB_IDL_RANGE_FIRST(ids) ((ids)[1])
 #define MDB_IDL_RANGE_LAST(ids) ((ids)[2])
@@ -62,10 +98,12 @@
 
 #define MDB_IDL_FIRST(ids) ((ids)[1])
 #define MDB_IDL_LLAST(ids) ((ids)[(ids)[0]])
-#define MDB_IDL_LAST(ids) (MDB_IDL_IS_RANGE(ids) ? (ids)[2] : (ids)[(ids)[0]])
+#define MDB_IDL_LAST(ids) (MDB_IDL_IS_LIST(ids) ? (ids)[(ids)[0]] : (ids)[2])
 
 #define MDB_IDL_N(ids)                                                         \
-  (MDB_IDL_IS_RANGE(ids) ? ((ids)[2] - (ids)[1]) + 1 : (ids)[0])
+  (MDB_IDL_IS_RANGE(ids)                                                       \
+       ? ((ids)[2] - (ids)[1]) + 1                                             \
+       : MDB_IDL_IS_BMAP(ids) ? MDB_IDL_BMAP_CARD(ids) : (ids)[0])
 
 /** An ID2 is an ID/value pair.
  */
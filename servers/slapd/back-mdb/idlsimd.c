@@ -0,0 +1,297 @@
+/* $ReOpenLDAP$ */
+/* Copyright 2011-2018 ReOpenLDAP AUTHORS: please see AUTHORS file.
+ * All rights reserved.
+ *
+ * This file is part of ReOpenLDAP.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+/* Intersection and union kernels for plain sorted ID lists.
+ *
+ * These work on bare arrays (no count word) so that idl.c can run them
+ * over any slice of an IDL. Lists of similar length are merged, and
+ * intersections use SSE4.2 or AVX2 block compares where the CPU has
+ * them; when one list is much shorter it drives a galloping search
+ * through the other. The kernel is chosen once at runtime, see
+ * mdb_idl_kernel(). */
+
+#include "reldap.h"
+
+#include <ac/string.h>
+
+#include "back-mdb.h"
+#include "idl.h"
+
+#if defined(__x86_64__) && (defined(__clang__) || __GNUC__ >= 5)
+#define IDL_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+/* Past this length ratio the short list drives a galloping search in
+ * the long one instead of merging both. */
+#define IDL_GALLOP_RATIO 32
+
+#define IDL_SKEWED(na, nb)                                                     \
+  ((na) > (nb)*IDL_GALLOP_RATIO || (nb) > (na)*IDL_GALLOP_RATIO)
+
+typedef ID(idl_isect_func)(ID *a, ID na, const ID *b, ID nb);
+
+/* first position in ids[0..n) whose ID is >= id, probing ahead
+ * exponentially from the start */
+static ID idl_gallop(const ID *ids, ID n, ID id) {
+  ID lo = 0, hi = 1, mid;
+
+  if (!n || ids[0] >= id)
+    return 0;
+  while (hi < n && ids[hi] < id) {
+    lo = hi;
+    hi <<= 1;
+  }
+  if (hi > n)
+    hi = n;
+  /* ids[lo] < id, and hi == n or ids[hi] >= id */
+  while (hi - lo > 1) {
+    mid = lo + ((hi - lo) >> 1);
+    if (ids[mid] < id)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  return hi;
+}
+
+/* All intersection kernels write their result over a. Every ID is
+ * stored at or below the position it was read from, and whatever a
+ * block compare overwrites is already behind the current block of b,
+ * so re-reading a after a store never produces a false match. */
+
+static ID isect_gallop(ID *a, ID na, const ID *b, ID nb) {
+  ID i = 0, j = 0, k = 0;
+
+  if (na <= nb) {
+    for (; i < na && j < nb; i++) {
+      j += idl_gallop(b + j, nb - j, a[i]);
+      if (j < nb && b[j] == a[i])
+        a[k++] = a[i];
+    }
+  } else {
+    for (; j < nb && i < na; j++) {
+      i += idl_gallop(a + i, na - i, b[j]);
+      if (i < na && a[i] == b[j])
+        a[k++] = b[j];
+    }
+  }
+  return k;
+}
+
+static ID isect_tail(ID *a, ID i, ID na, const ID *b, ID j, ID nb, ID k) {
+  while (i < na && j < nb) {
+    if (a[i] < b[j]) {
+      i++;
+    } else if (a[i] > b[j]) {
+      j++;
+    } else {
+      a[k++] = a[i++];
+      j++;
+    }
+  }
+  return k;
+}
+
+static ID isect_scalar(ID *a, ID na, const ID *b, ID nb) {
+  if (IDL_SKEWED(na, nb))
+    return isect_gallop(a, na, b, nb);
+  return isect_tail(a, 0, na, b, 0, nb, 0);
+}
+
+/* Union writes to a separate out[], dropping IDs present in both lists.
+ * It stays scalar: with only two or four 64-bit lanes a vector merge
+ * network is bound by its own latency and loses to the branch-free
+ * loop below, while the skewed case is dominated by memcpy anyway. */
+
+static ID merge_tail(const ID *a, ID i, ID na, const ID *b, ID j, ID nb,
+                     ID *out, ID k) {
+  ID x, y;
+
+  while (i < na && j < nb) {
+    x = a[i];
+    y = b[j];
+    out[k++] = x < y ? x : y;
+    i += x <= y;
+    j += y <= x;
+  }
+  if (i < na) {
+    memcpy(out + k, a + i, (na - i) * sizeof(ID));
+    k += na - i;
+  }
+  if (j < nb) {
+    memcpy(out + k, b + j, (nb - j) * sizeof(ID));
+    k += nb - j;
+  }
+  return k;
+}
+
+static ID merge_gallop(const ID *a, ID na, const ID *b, ID nb, ID *out) {
+  ID i = 0, j, k = 0, n;
+
+  if (na < nb) {
+    const ID *t = a;
+    a = b;
+    b = t;
+    n = na;
+    na = nb;
+    nb = n;
+  }
+  /* copy runs of the long list between members of the short one */
+  for (j = 0; j < nb; j++) {
+    n = idl_gallop(a + i, na - i, b[j]);
+    memcpy(out + k, a + i, n * sizeof(ID));
+    k += n;
+    i += n;
+    out[k++] = b[j];
+    if (i < na && a[i] == b[j])
+      i++;
+  }
+  return merge_tail(a, i, na, b, nb, nb, out, k);
+}
+
+#ifdef IDL_SIMD_X86
+
+__attribute__((target("sse4.2"))) static ID isect_sse42(ID *a, ID na,
+                                                         const ID *b, ID nb) {
+  ID i = 0, j = 0, k = 0, amax, bmax, blk[2];
+  __m128i va, vb0, vb1, eq;
+  unsigned m;
+
+  if (IDL_SKEWED(na, nb))
+    return isect_gallop(a, na, b, nb);
+
+  /* two IDs of a against four of b per step */
+  while (i + 2 <= na && j + 4 <= nb) {
+    va = _mm_loadu_si128((const __m128i *)(a + i));
+    vb0 = _mm_loadu_si128((const __m128i *)(b + j));
+    vb1 = _mm_loadu_si128((const __m128i *)(b + j + 2));
+    eq = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi64(va, vb0),
+                     _mm_cmpeq_epi64(va, _mm_shuffle_epi32(vb0, 0x4e))),
+        _mm_or_si128(_mm_cmpeq_epi64(va, vb1),
+                     _mm_cmpeq_epi64(va, _mm_shuffle_epi32(vb1, 0x4e))));
+    amax = a[i + 1];
+    bmax = b[j + 3];
+    m = _mm_movemask_pd(_mm_castsi128_pd(eq));
+    if (m) {
+      _mm_storeu_si128((__m128i *)blk, va);
+      if (m & 1)
+        a[k++] = blk[0];
+      if (m & 2)
+        a[k++] = blk[1];
+    }
+    i += (amax <= bmax) << 1;
+    j += (bmax <= amax) << 2;
+  }
+  return isect_tail(a, i, na, b, j, nb, k);
+}
+
+__attribute__((target("avx2"))) static ID isect_avx2(ID *a, ID na,
+                                                      const ID *b, ID nb) {
+  ID i = 0, j = 0, k = 0, amax, bmax, blk[4];
+  __m256i va, vb, eq;
+  unsigned m;
+
+  if (IDL_SKEWED(na, nb))
+    return isect_gallop(a, na, b, nb);
+
+  /* four IDs of a against all rotations of four IDs of b per step */
+  while (i + 4 <= na && j + 4 <= nb) {
+    va = _mm256_loadu_si256((const __m256i *)(a + i));
+    vb = _mm256_loadu_si256((const __m256i *)(b + j));
+    eq = _mm256_or_si256(
+        _mm256_or_si256(
+            _mm256_cmpeq_epi64(va, vb),
+            _mm256_cmpeq_epi64(va, _mm256_permute4x64_epi64(vb, 0x39))),
+        _mm256_or_si256(
+            _mm256_cmpeq_epi64(va, _mm256_permute4x64_epi64(vb, 0x4e)),
+            _mm256_cmpeq_epi64(va, _mm256_permute4x64_epi64(vb, 0x93))));
+    amax = a[i + 3];
+    bmax = b[j + 3];
+    m = _mm256_movemask_pd(_mm256_castsi256_pd(eq));
+    if (m) {
+      _mm256_storeu_si256((__m256i *)blk, va);
+      do {
+        a[k++] = blk[__builtin_ctz(m)];
+        m &= m - 1;
+      } while (m);
+    }
+    i += (amax <= bmax) << 2;
+    j += (bmax <= amax) << 2;
+  }
+  return isect_tail(a, i, na, b, j, nb, k);
+}
+
+#endif /* IDL_SIMD_X86 */
+
+static const struct idl_kernel {
+  const char *name;
+  idl_isect_func *isect;
+} idl_kernels[] = {
+#ifdef IDL_SIMD_X86
+    {"avx2", isect_avx2},
+    {"sse4.2", isect_sse42},
+#endif /* IDL_SIMD_X86 */
+    {"scalar", isect_scalar},
+    {NULL, NULL}};
+
+static const struct idl_kernel *idl_kernel;
+
+static int idl_kernel_usable(const struct idl_kernel *kp) {
+#ifdef IDL_SIMD_X86
+  __builtin_cpu_init();
+  if (kp->isect == isect_avx2)
+    return __builtin_cpu_supports("avx2");
+  if (kp->isect == isect_sse42)
+    return __builtin_cpu_supports("sse4.2");
+#endif /* IDL_SIMD_X86 */
+  return 1;
+}
+
+/* Select the kernel by name, or the best one the CPU supports when
+ * name is NULL and none was chosen yet. Returns the name of the kernel
+ * in use, or NULL if the requested one is not available. */
+const char *mdb_idl_kernel(const char *name) {
+  const struct idl_kernel *kp;
+
+  if (!name && idl_kernel)
+    return idl_kernel->name;
+  for (kp = idl_kernels; kp->name; kp++) {
+    if (name && strcasecmp(name, kp->name))
+      continue;
+    if (idl_kernel_usable(kp)) {
+      idl_kernel = kp;
+      return kp->name;
+    }
+    if (name)
+      break;
+  }
+  return NULL;
+}
+
+/* a[0..na) = a[0..na) intersection b[0..nb), returns the new length */
+ID mdb_idl_isect(ID *a, ID na, const ID *b, ID nb) {
+  if (unlikely(!idl_kernel))
+    mdb_idl_kernel(NULL);
+  return idl_kernel->isect(a, na, b, nb);
+}
+
+/* out = a[0..na) union b[0..nb), returns the length of out */
+ID mdb_idl_merge(const ID *a, ID na, const ID *b, ID nb, ID *out) {
+  if (IDL_SKEWED(na, nb))
+    return merge_gallop(a, na, b, nb, out);
+  return merge_tail(a, 0, na, b, 0, nb, out, 0);
+}
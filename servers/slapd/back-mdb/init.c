@@ -22,6 +22,7 @@
 #include <ac/errno.h>
 #include <sys/stat.h>
 #include "back-mdb.h"
+#include "idl.h"
 #include <lutil.h>
 #include <ldap_rq.h>
 #include "slapconfig.h"
@@ -158,6 +159,7 @@ static int mdb_db_init(BackendDB *be, ConfigReply *cr) {
 
   mdb->mi_mapsize = DEFAULT_MAPSIZE;
   mdb->mi_rtxn_size = DEFAULT_RTXN_SIZE;
+  mdb->mi_idl_range_limit = MDB_IDL_RANGE_LIMIT;
 
   be->be_private = mdb;
   be->be_cf_ocs = be->bd_info->bi_cf_ocs;
@@ -387,6 +389,12 @@ static int mdb_db_open(BackendDB *be, ConfigReply *cr) {
     goto fail;
   }
 
+  rc = mdb_ixhash_check(be, txn, cr);
+  if (rc) {
+    mdb_txn_abort(txn);
+    goto fail;
+  }
+
   /* slapcat doesn't need indexes. avoid a failure if
    * a configured index wasn't created yet.
    */
@@ -407,6 +415,11 @@ static int mdb_db_open(BackendDB *be, ConfigReply *cr) {
     goto fail;
   }
 
+  rc = mdb_ecache_open(mdb);
+  if (rc != 0) {
+    goto fail;
+  }
+
   /* monitor setup */
   rc = mdb_monitor_db_open(be);
   if (rc != 0) {
@@ -466,6 +479,8 @@ static int mdb_db_close(BackendDB *be, ConfigReply *cr) {
     mdb->mi_search_stack = NULL;
   }
 
+  mdb_ecache_close(mdb);
+
   return 0;
 }
 
@@ -522,6 +537,7 @@ int mdb_back_initialize(BackendInfo *bi) {
                   SLAP_BFLAG_ALIASES | SLAP_BFLAG_REFERRALS;
 
   bi->bi_controls = controls;
+  bi->bi_extra = (void *)&mdb_extra;
 
   { /* version check */
     int major, minor, patch, ver;
@@ -565,6 +581,7 @@ int mdb_back_initialize(BackendInfo *bi) {
   bi->bi_op_unbind = 0;
 
   bi->bi_extended = mdb_extended;
+  bi->bi_op_txn = mdb_txn;
 
   bi->bi_chk_referrals = 0;
   bi->bi_operational = mdb_operational;
@@ -640,6 +640,8 @@ int mdb_modify(Operation *op, SlapReply *rs) {
   /* Only free attrs if they were dup'd.  */
   if (dummy.e_attrs == e->e_attrs)
     dummy.e_attrs = NULL;
+  mdb_slog_hook(op, mdb, txn);
+
   if (moi == &opinfo) {
     LDAP_SLIST_REMOVE(&op->o_extra, &opinfo.moi_oe, OpExtra, oe_next);
     opinfo.moi_oe.oe_key = NULL;
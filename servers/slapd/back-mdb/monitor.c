@@ -31,6 +31,8 @@
 static ObjectClass *oc_olmMDBDatabase;
 
 static AttributeDescription *ad_olmDbDirectory;
+static AttributeDescription *ad_olmDbEntryCacheHits;
+static AttributeDescription *ad_olmDbEntryCacheMisses;
 
 #ifdef MDB_MONITOR_IDX
 static int mdb_monitor_idx_entry_add(struct mdb_info *mdb, Entry *e);
@@ -71,6 +73,22 @@ static struct {
              "USAGE dSAOperation )",
              &ad_olmDbDirectory},
 
+            {"( olmDatabaseAttributes:3 "
+             "NAME ( 'olmDbEntryCacheHits' ) "
+             "DESC 'Number of lookups served by the entry cache' "
+             "SUP monitorCounter "
+             "NO-USER-MODIFICATION "
+             "USAGE dSAOperation )",
+             &ad_olmDbEntryCacheHits},
+
+            {"( olmDatabaseAttributes:4 "
+             "NAME ( 'olmDbEntryCacheMisses' ) "
+             "DESC 'Number of lookups the entry cache could not serve' "
+             "SUP monitorCounter "
+             "NO-USER-MODIFICATION "
+             "USAGE dSAOperation )",
+             &ad_olmDbEntryCacheMisses},
+
 #ifdef MDB_MONITOR_IDX
             {"( olmDatabaseAttributes:2 "
              "NAME ( 'olmDbNotIndexed' ) "
@@ -94,6 +112,8 @@ static struct {
      "SUP top AUXILIARY "
      "MAY ( "
      "olmDbDirectory "
+     "$ olmDbEntryCacheHits "
+     "$ olmDbEntryCacheMisses "
 #ifdef MDB_MONITOR_IDX
      "$ olmDbNotIndexed "
 #endif /* MDB_MONITOR_IDX */
@@ -102,10 +122,32 @@ static struct {
 
     {NULL}};
 
+static void mdb_monitor_counter(Entry *e, AttributeDescription *ad,
+                                unsigned long n) {
+  Attribute *a = attr_find(e->e_attrs, ad);
+  char buf[LDAP_PVT_INTTYPE_CHARS(unsigned long)];
+  ber_len_t len;
+
+  if (a == NULL)
+    return;
+
+  len = snprintf(buf, sizeof(buf), "%lu", n);
+  if (len > a->a_vals[0].bv_len)
+    a->a_vals[0].bv_val = ber_memrealloc(a->a_vals[0].bv_val, len + 1);
+  memcpy(a->a_vals[0].bv_val, buf, len + 1);
+  a->a_vals[0].bv_len = len;
+}
+
 static int mdb_monitor_update(Operation *op, SlapReply *rs, Entry *e,
                               void *priv) {
-#ifdef MDB_MONITOR_IDX
   struct mdb_info *mdb = (struct mdb_info *)priv;
+  unsigned long hits, misses;
+
+  mdb_ecache_stats(mdb, &hits, &misses);
+  mdb_monitor_counter(e, ad_olmDbEntryCacheHits, hits);
+  mdb_monitor_counter(e, ad_olmDbEntryCacheMisses, misses);
+
+#ifdef MDB_MONITOR_IDX
   mdb_monitor_idx_entry_add(mdb, e);
 #endif /* MDB_MONITOR_IDX */
 
@@ -289,7 +331,7 @@ int mdb_monitor_db_open(BackendDB *be) {
   }
 
   /* alloc as many as required (plus 1 for objectClass) */
-  a = attrs_alloc(1 + 1);
+  a = attrs_alloc(1 + 1 + (mdb->mi_ecache ? 2 : 0));
   if (a == NULL) {
     rc = 1;
     goto cleanup;
@@ -351,6 +393,18 @@ int mdb_monitor_db_open(BackendDB *be) {
     next = next->a_next;
   }
 
+  if (mdb->mi_ecache) {
+    struct berval bv = BER_BVC("0");
+
+    next->a_desc = ad_olmDbEntryCacheHits;
+    attr_valadd(next, &bv, NULL, 1);
+    next = next->a_next;
+
+    next->a_desc = ad_olmDbEntryCacheMisses;
+    attr_valadd(next, &bv, NULL, 1);
+    next = next->a_next;
+  }
+
   cb = ch_calloc(sizeof(monitor_callback_t), 1);
   cb->mc_update = mdb_monitor_update;
 #if 0 /* uncomment if required */
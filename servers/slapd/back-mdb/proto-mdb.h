@@ -46,6 +46,9 @@ void mdb_attr_info_free(AttrInfo *ai);
 int mdb_ad_read(struct mdb_info *mdb, MDB_txn *txn);
 int mdb_ad_get(struct mdb_info *mdb, MDB_txn *txn, AttributeDescription *ad);
 
+int mdb_ixhash_put(struct mdb_info *mdb, MDB_txn *txn);
+int mdb_ixhash_check(BackendDB *be, MDB_txn *txn, struct config_reply_s *cr);
+
 /*
  * config.c
  */
@@ -98,6 +101,21 @@ void mdb_dn2id_wrestore(Operation *op, struct IdScopes *isc);
 
 MDB_cmp_func mdb_dup_compare;
 
+/*
+ * ecache.c
+ */
+
+int mdb_ecache_open(struct mdb_info *mdb);
+void mdb_ecache_close(struct mdb_info *mdb);
+int mdb_ecache_usable(Operation *op, MDB_txn *txn);
+int mdb_ecache_get(Operation *op, MDB_txn *txn, ID id, Entry **e);
+int mdb_ecache_put(Operation *op, MDB_txn *txn, ID id, MDB_val *data,
+                   Entry **e);
+void mdb_ecache_release(Operation *op, Entry *e);
+void mdb_ecache_invalidate(struct mdb_info *mdb, MDB_txn *txn, ID id);
+void mdb_ecache_stats(struct mdb_info *mdb, unsigned long *hits,
+                      unsigned long *misses);
+
 /*
  * filterentry.c
  */
@@ -105,6 +123,14 @@ MDB_cmp_func mdb_dup_compare;
 int mdb_filter_candidates(Operation *op, MDB_txn *txn, Filter *f, ID *ids,
                           ID *tmp, ID *stack);
 
+struct mdb_cstream;
+int mdb_filter_stream(Operation *op, MDB_txn *txn, Filter *f,
+                      struct mdb_cstream **csp, ID *est);
+ID mdb_cstream_next(struct mdb_cstream *cs, ID from);
+int mdb_cstream_error(struct mdb_cstream *cs);
+int mdb_cstream_renew(struct mdb_cstream *cs, MDB_txn *txn);
+void mdb_cstream_free(Operation *op, struct mdb_cstream *cs);
+
 /*
  * id2entry.c
  */
@@ -124,16 +150,22 @@ BI_entry_release_rw mdb_entry_release;
 BI_entry_get_rw mdb_entry_get;
 
 int mdb_entry_decode(Operation *op, MDB_txn *txn, MDB_val *data, Entry **e);
+int mdb_entry_decode_view(Operation *op, MDB_txn *txn, MDB_val *data,
+                          mdb_attr_view *av, Entry **e);
+mdb_attr_view *mdb_attr_view_get(Operation *op, mdb_attr_view *av);
+void mdb_attr_view_free(Operation *op, mdb_attr_view *av);
 
 void mdb_reader_flush(MDB_env *env);
 int mdb_opinfo_get(Operation *op, struct mdb_info *mdb, int rdonly,
                    mdb_op_info **moi);
+BI_op_txn mdb_txn;
 
 /*
  * idl.c
  */
 
 unsigned mdb_idl_search(ID *ids, ID id);
+int mdb_idl_contains(ID *ids, ID id);
 
 int mdb_idl_fetch_key(BackendDB *be, MDB_txn *txn, MDB_dbi dbi, MDB_val *key,
                       ID *ids, MDB_cursor **saved_cursor, int get_flag);
@@ -150,13 +182,24 @@ int mdb_idl_intersection(ID *a, ID *b);
 
 int mdb_idl_union(ID *a, ID *b);
 
+int mdb_idl_notin(ID *a, ID *b, ID *ids);
+
 ID mdb_idl_first(ID *ids, ID *cursor);
 ID mdb_idl_next(ID *ids, ID *cursor);
+int mdb_idl_from_bits(ID *ids, ID key, const uint64_t *bits, ID nblocks);
 
 void mdb_idl_sort(ID *ids, ID *tmp);
 int mdb_idl_append(ID *a, ID *b);
 int mdb_idl_append_one(ID *ids, ID id);
 
+/*
+ * idlsimd.c
+ */
+
+const char *mdb_idl_kernel(const char *name);
+ID mdb_idl_isect(ID *a, ID na, const ID *b, ID nb);
+ID mdb_idl_merge(const ID *a, ID na, const ID *b, ID nb, ID *out);
+
 /*
  * index.c
  */
@@ -222,6 +265,13 @@ int mdb_monitor_idx_add(struct mdb_info *mdb, AttributeDescription *desc,
                         slap_mask_t type);
 #endif /* MDB_MONITOR_IDX */
 
+/*
+ * slog.c
+ */
+
+extern const mdb_extra_t mdb_extra;
+void mdb_slog_hook(Operation *op, struct mdb_info *mdb, MDB_txn *txn);
+
 /*
  * former external.h
  */
@@ -25,7 +25,8 @@ static int base_candidate(BackendDB *be, Entry *e, ID *ids);
 
 static int search_candidates(Operation *op, SlapReply *rs, Entry *e,
                              IdScopes *isc, MDB_cursor *mci, ID *ids,
-                             ID *stack);
+                             ID *stack, ID nsubs, struct mdb_cstream **csp,
+                             ID *ncand);
 
 static int parse_paged_cookie(Operation *op, SlapReply *rs);
 
@@ -288,6 +289,372 @@ static void scope_chunk_ret(Operation *op, ID2 *scopes) {
                               (void *)scopes, scope_chunk_free, NULL, NULL);
 }
 
+/* Candidate IDLs are too big for the thread stack and the slab, so
+ * like the scope chunks they are kept on a per-thread free list. */
+typedef struct cand_chunk {
+  struct cand_chunk *cc_next;
+  ID cc_ids[MDB_IDL_UM_SIZE];
+} cand_chunk;
+
+static void cand_chunk_free(void *key, void *data) {
+  cand_chunk *p1, *p2;
+  for (p1 = data; p1; p1 = p2) {
+    p2 = p1->cc_next;
+    ber_memfree_x(p1, NULL);
+  }
+}
+
+static ID *cand_chunk_get(Operation *op) {
+  cand_chunk *ret = NULL;
+
+  ldap_pvt_thread_pool_getkey(op->o_threadctx, (void *)cand_chunk_get,
+                              (void *)&ret, NULL);
+  if (!ret) {
+    ret = ch_malloc(sizeof(cand_chunk));
+  } else {
+    ldap_pvt_thread_pool_setkey(op->o_threadctx, (void *)cand_chunk_get,
+                                ret->cc_next, cand_chunk_free, NULL, NULL);
+  }
+  return ret->cc_ids;
+}
+
+static void cand_chunk_ret(Operation *op, ID *ids) {
+  cand_chunk *cc = (cand_chunk *)((char *)ids - offsetof(cand_chunk, cc_ids));
+  void *ret = NULL;
+
+  ldap_pvt_thread_pool_getkey(op->o_threadctx, (void *)cand_chunk_get, &ret,
+                              NULL);
+  cc->cc_next = ret;
+  ldap_pvt_thread_pool_setkey(op->o_threadctx, (void *)cand_chunk_get,
+                              (void *)cc, cand_chunk_free, NULL, NULL);
+}
+
+/* Candidates come either from a materialized IDL or, if the filter
+ * allowed it, from a stream; for the latter the cursor is the last
+ * ID returned. */
+static ID search_first(ID *ids, struct mdb_cstream *cs, ID *cursor) {
+  if (cs)
+    return *cursor = mdb_cstream_next(cs, *cursor);
+  return mdb_idl_first(ids, cursor);
+}
+
+static ID search_next(ID *ids, struct mdb_cstream *cs, ID *cursor) {
+  if (cs)
+    return *cursor = mdb_cstream_next(cs, *cursor + 1);
+  return mdb_idl_next(ids, cursor);
+}
+
+/* Parallel filtering of large candidate sets.
+ *
+ * An unindexed subtree search leaves candidates spanning most of the
+ * database, and the main loop below would decode and test every one of
+ * them on a single thread. With "searchthreads" set, such a set is first
+ * narrowed down: the ID space is cut into slices of one bitmap container
+ * each, which the searching thread and up to searchthreads helper tasks
+ * in connection_pool claim in turn, keeping the IDs that may still be
+ * returned. Helpers only work if their read txn sees the same snapshot as
+ * the search, and a slice that could not be filtered is kept whole.
+ *
+ * Entries the filter was tested on are also marked as matching, and the
+ * main loop takes that mark instead of testing the filter once more; it
+ * still decodes them, checks scope and sends them in order, so results
+ * do not change. The marks are dropped once the main loop renews its read
+ * txn, since from then on it may see entries the helpers did not.
+ *
+ * Survivors are decoded a second time by the main loop rather than kept.
+ * A helper's decoded view points into the pages of its own read txn,
+ * which is reset when the helper detaches and may then be reused by a
+ * writer; and keeping them would hold every surviving entry in memory at
+ * once, where the main loop sends and frees them one by one.
+ */
+
+#define PSCAN_SHIFT MDB_IDL_BMAP_SHIFT
+#define PSCAN_WORDS ((1 << PSCAN_SHIFT) / 64)
+
+/* don't bother for fewer candidates than this */
+#define PSCAN_MIN (2 << PSCAN_SHIFT)
+
+typedef struct pscan {
+  ldap_pvt_thread_mutex_t ps_mutex;
+  ldap_pvt_thread_cond_t ps_cond;
+  Operation *ps_op;
+  struct mdb_info *ps_mdb;
+  Entry *ps_base;
+  mdb_attr_view *ps_av;
+  ID *ps_ids;
+  uint64_t *ps_bits;  /* IDs to keep, one bit per ID */
+  uint64_t *ps_match; /* IDs known to match the filter */
+  ID ps_key;         /* container key of the first slice */
+  ID ps_nslices;
+  ID ps_next;   /* next slice to hand out */
+  int ps_busy;  /* threads working on slices */
+  int ps_refs;  /* searching thread and helper tasks not yet done */
+  size_t ps_txnid;
+  time_t ps_stoptime;
+} pscan;
+
+static int pscan_attach(pscan *ps) {
+  int rc;
+
+  ldap_pvt_thread_mutex_lock(&ps->ps_mutex);
+  rc = ps->ps_next < ps->ps_nslices;
+  if (rc)
+    ps->ps_busy++;
+  ldap_pvt_thread_mutex_unlock(&ps->ps_mutex);
+  return rc;
+}
+
+static int pscan_claim(pscan *ps, ID *slice) {
+  int rc;
+
+  ldap_pvt_thread_mutex_lock(&ps->ps_mutex);
+  rc = ps->ps_next < ps->ps_nslices;
+  if (rc)
+    *slice = ps->ps_next++;
+  ldap_pvt_thread_mutex_unlock(&ps->ps_mutex);
+  return rc;
+}
+
+static void pscan_detach(pscan *ps) {
+  ldap_pvt_thread_mutex_lock(&ps->ps_mutex);
+  if (--ps->ps_busy == 0)
+    ldap_pvt_thread_cond_signal(&ps->ps_cond);
+  ldap_pvt_thread_mutex_unlock(&ps->ps_mutex);
+}
+
+static void pscan_release(pscan *ps) {
+  int last;
+
+  ldap_pvt_thread_mutex_lock(&ps->ps_mutex);
+  last = --ps->ps_refs == 0;
+  ldap_pvt_thread_mutex_unlock(&ps->ps_mutex);
+  if (last) {
+    ldap_pvt_thread_cond_destroy(&ps->ps_cond);
+    ldap_pvt_thread_mutex_destroy(&ps->ps_mutex);
+    ch_free(ps->ps_bits);
+    ch_free(ps->ps_match);
+    ch_free(ps);
+  }
+}
+
+#define PSCAN_DROP 0
+#define PSCAN_LOOK 1  /* the main loop has to check it */
+#define PSCAN_MATCH 2 /* matches the filter and is in scope */
+
+static int pscan_keep(Operation *op, pscan *ps, MDB_txn *txn,
+                      MDB_cursor **mcd, Entry *e) {
+  struct berval pdn;
+
+  if (e->e_id == ps->ps_base->e_id)
+    return PSCAN_LOOK;
+  if (mdb_id2name(op, txn, mcd, e->e_id, &e->e_name, &e->e_nname))
+    return PSCAN_LOOK;
+
+  if (op->ors_scope == LDAP_SCOPE_ONELEVEL) {
+    dnParent(&e->e_nname, &pdn);
+    if (!dn_match(&pdn, &ps->ps_base->e_nname))
+      return PSCAN_DROP;
+  } else if (!dnIsSuffix(&e->e_nname, &ps->ps_base->e_nname)) {
+    return PSCAN_DROP;
+  }
+
+  /* referrals are returned regardless of the filter */
+  if (!get_manageDSAit(op) && is_entry_referral(e))
+    return PSCAN_LOOK;
+  return test_filter(op, e, op->ors_filter) == LDAP_COMPARE_TRUE ? PSCAN_MATCH
+                                                                   : PSCAN_DROP;
+}
+
+static void pscan_slice(Operation *op, pscan *ps, MDB_txn *txn,
+                        MDB_cursor *mci, MDB_cursor **mcd, ID slice) {
+  uint64_t *w = ps->ps_bits + slice * PSCAN_WORDS;
+  uint64_t *m = ps->ps_match + slice * PSCAN_WORDS;
+  ID lo = (ps->ps_key + slice) << PSCAN_SHIFT;
+  ID hi = lo + (1 << PSCAN_SHIFT) - 1;
+  ID id, cursor = lo;
+  MDB_val edata;
+  Entry *e;
+  unsigned bit;
+  int rc, keep;
+
+  for (id = mdb_idl_first(ps->ps_ids, &cursor); id != NOID && id <= hi;
+       id = mdb_idl_next(ps->ps_ids, &cursor)) {
+    bit = id - lo;
+    if (slap_get_op_abandon(ps->ps_op) ||
+        (op->ors_tlimit != SLAP_NO_LIMIT &&
+         ldap_time_steady() > ps->ps_stoptime)) {
+      /* leave the rest to the main loop */
+      memset(w + (bit >> 6), 0xff,
+             (PSCAN_WORDS - (bit >> 6)) * sizeof(uint64_t));
+      break;
+    }
+    rc = mdb_id2edata(op, mci, id, &edata);
+    if (rc == MDB_NOTFOUND)
+      continue;
+    /* on any other error the main loop reads the entry again and
+     * reports it */
+    if (rc || mdb_entry_decode_view(op, txn, &edata, ps->ps_av, &e)) {
+      w[bit >> 6] |= (uint64_t)1 << (bit & 63);
+      continue;
+    }
+    e->e_id = id;
+    BER_BVZERO(&e->e_name);
+    BER_BVZERO(&e->e_nname);
+    keep = pscan_keep(op, ps, txn, mcd, e);
+    if (keep != PSCAN_DROP)
+      w[bit >> 6] |= (uint64_t)1 << (bit & 63);
+    if (keep == PSCAN_MATCH)
+      m[bit >> 6] |= (uint64_t)1 << (bit & 63);
+    mdb_entry_return(op, e);
+  }
+}
+
+static void *pscan_task(void *ctx, void *arg) {
+  pscan *ps = arg;
+  struct mdb_info *mdb = ps->ps_mdb;
+  mdb_op_info opinfo = {{{0}}}, *moi = &opinfo;
+  MDB_cursor *mci = NULL, *mcd = NULL;
+  Operation op2;
+  Opheader oh;
+  ID slice;
+
+  if (!pscan_attach(ps))
+    goto out;
+
+  /* a copy of the search with our own thread and memory context,
+   * it may not touch the original once we detach */
+  op2 = *ps->ps_op;
+  oh = *ps->ps_op->o_hdr;
+  oh.oh_threadctx = ctx;
+  oh.oh_tid = ldap_pvt_thread_pool_tid(ctx);
+  oh.oh_tmpmemctx =
+      slap_sl_mem_create(SLAP_SLAB_SIZE, SLAP_SLAB_STACK, ctx, 1);
+  oh.oh_tmpmfuncs = &slap_sl_mfuncs;
+  op2.o_hdr = &oh;
+  op2.o_groups = NULL;
+  op2.o_callback = NULL;
+  LDAP_SLIST_INIT(&op2.o_extra);
+
+  if (mdb_opinfo_get(&op2, mdb, 1, &moi) == 0) {
+    if (mdb_txn_id(moi->moi_txn) == ps->ps_txnid &&
+        mdb_cursor_open(moi->moi_txn, mdb->mi_id2entry, &mci) == 0) {
+      while (pscan_claim(ps, &slice))
+        pscan_slice(&op2, ps, moi->moi_txn, mci, &mcd, slice);
+      mdb_cursor_close(mci);
+    }
+    if (mcd)
+      mdb_cursor_close(mcd);
+    mdb_txn_reset(moi->moi_txn);
+    if (moi->moi_oe.oe_key)
+      LDAP_SLIST_REMOVE(&op2.o_extra, &moi->moi_oe, OpExtra, oe_next);
+  }
+  slap_op_groups_free(&op2);
+  pscan_detach(ps);
+
+out:
+  __sync_fetch_and_sub(&mdb->mi_search_helpers, 1);
+  pscan_release(ps);
+  return NULL;
+}
+
+typedef struct pscan_hits {
+  uint64_t *ph_bits;
+  ID ph_key;
+  ID ph_nslices;
+} pscan_hits;
+
+static int pscan_matched(pscan_hits *ph, ID id) {
+  ID off;
+
+  if (!ph->ph_bits || (id >> PSCAN_SHIFT) < ph->ph_key)
+    return 0;
+  off = id - (ph->ph_key << PSCAN_SHIFT);
+  if (off >= ph->ph_nslices << PSCAN_SHIFT)
+    return 0;
+  return (ph->ph_bits[off >> 6] >> (off & 63)) & 1;
+}
+
+static void pscan_hits_free(pscan_hits *ph) {
+  ch_free(ph->ph_bits);
+  ph->ph_bits = NULL;
+}
+
+/* Narrow down ids with the help of other threads, leaving it untouched
+ * if the result does not fit. The IDs found to match are left in ph. */
+static void search_pscan(Operation *op, Entry *base, mdb_attr_view *av,
+                         MDB_txn *txn, MDB_cursor *mci, ID *ids,
+                         time_t stoptime, pscan_hits *ph) {
+  struct mdb_info *mdb = (struct mdb_info *)op->o_bd->be_private;
+  MDB_cursor *mcd = NULL;
+  pscan *ps;
+  ID slice;
+  int i, nhelpers;
+
+  ps = ch_calloc(1, sizeof(pscan));
+  ps->ps_op = op;
+  ps->ps_mdb = mdb;
+  ps->ps_base = base;
+  ps->ps_av = av;
+  ps->ps_ids = ids;
+  ps->ps_key = MDB_IDL_FIRST(ids) >> PSCAN_SHIFT;
+  ps->ps_nslices = (MDB_IDL_LAST(ids) >> PSCAN_SHIFT) - ps->ps_key + 1;
+  ps->ps_bits = ch_calloc(ps->ps_nslices * PSCAN_WORDS, sizeof(uint64_t));
+  ps->ps_match = ch_calloc(ps->ps_nslices * PSCAN_WORDS, sizeof(uint64_t));
+  ps->ps_txnid = mdb_txn_id(txn);
+  ps->ps_stoptime = stoptime;
+  ps->ps_busy = 1;
+  ps->ps_refs = 1;
+  ldap_pvt_thread_mutex_init(&ps->ps_mutex);
+  ldap_pvt_thread_cond_init(&ps->ps_cond);
+
+  /* take what is left of the budget, we do a share ourselves */
+  nhelpers = ps->ps_nslices - 1;
+  if (nhelpers > (int)mdb->mi_search_threads)
+    nhelpers = mdb->mi_search_threads;
+  i = __sync_fetch_and_add(&mdb->mi_search_helpers, nhelpers);
+  if (i + nhelpers > (int)mdb->mi_search_threads) {
+    i = i + nhelpers - (int)mdb->mi_search_threads;
+    if (i > nhelpers)
+      i = nhelpers;
+    __sync_fetch_and_sub(&mdb->mi_search_helpers, i);
+    nhelpers -= i;
+  }
+  ps->ps_refs += nhelpers;
+  for (i = 0; i < nhelpers; i++) {
+    if (ldap_pvt_thread_pool_submit(&connection_pool, pscan_task, ps)) {
+      __sync_fetch_and_sub(&mdb->mi_search_helpers, nhelpers - i);
+      ps->ps_refs -= nhelpers - i;
+      break;
+    }
+  }
+  Debug(LDAP_DEBUG_TRACE,
+        LDAP_XSTRING(mdb_search) ": filtering %ld slices with %d helpers\n",
+        (long)ps->ps_nslices, i);
+
+  while (pscan_claim(ps, &slice))
+    pscan_slice(op, ps, txn, mci, &mcd, slice);
+  if (mcd)
+    mdb_cursor_close(mcd);
+
+  /* wait for the helpers still working on their slices */
+  ldap_pvt_thread_mutex_lock(&ps->ps_mutex);
+  ps->ps_busy--;
+  while (ps->ps_busy)
+    ldap_pvt_thread_cond_wait(&ps->ps_cond, &ps->ps_mutex);
+  ldap_pvt_thread_mutex_unlock(&ps->ps_mutex);
+
+  if (mdb_idl_from_bits(ids, ps->ps_key, ps->ps_bits, ps->ps_nslices))
+    Debug(LDAP_DEBUG_TRACE,
+          LDAP_XSTRING(mdb_search) ": filtered candidates don't fit\n");
+
+  /* the helpers are done with it, whoever releases ps last */
+  ph->ph_bits = ps->ps_match;
+  ph->ph_key = ps->ps_key;
+  ph->ph_nslices = ps->ps_nslices;
+  ps->ps_match = NULL;
+  pscan_release(ps);
+}
+
 static void *search_stack(Operation *op);
 
 typedef struct ww_ctx {
@@ -397,8 +764,8 @@ int mdb_search(Operation *op, SlapReply *rs) {
   struct mdb_info *mdb = (struct mdb_info *)op->o_bd->be_private;
   ID id, cursor, nsubs, ncand, cscope = -1;
   ID lastid = NOID;
-  ID candidates[MDB_IDL_UM_SIZE];
-  ID iscopes[MDB_IDL_DB_SIZE];
+  ID *candidates, *iscopes = NULL;
+  struct mdb_cstream *cs = NULL;
   ID2 *scopes;
   void *stack;
   Entry *e = NULL, *base = NULL;
@@ -410,10 +777,12 @@ int mdb_search(Operation *op, SlapReply *rs) {
   IdScopes isc;
   MDB_cursor *mci, *mcd;
   ww_ctx wwctx = {0};
+  pscan_hits hits = {0};
   slap_callback cb = {0};
 
   mdb_op_info opinfo = {{{0}}}, *moi = &opinfo;
   MDB_txn *ltid = NULL;
+  mdb_attr_view avbuf, *av = NULL;
 
   Debug(LDAP_DEBUG_TRACE, "=> " LDAP_XSTRING(mdb_search) "\n");
 
@@ -444,6 +813,7 @@ int mdb_search(Operation *op, SlapReply *rs) {
   }
 
   scopes = scope_chunk_get(op);
+  candidates = cand_chunk_get(op);
   stack = search_stack(op);
   isc.mt = ltid;
   isc.mc = mcd;
@@ -622,8 +992,8 @@ dn2entry_retry:
     scopes[0].mid = 1;
     scopes[1].mid = base->e_id;
     scopes[1].mval.mv_data = NULL;
-    rs->sr_err = search_candidates(op, rs, base, &isc, mci, candidates, stack);
-    ncand = MDB_IDL_N(candidates);
+    rs->sr_err = search_candidates(op, rs, base, &isc, mci, candidates, stack,
+                                   nsubs, &cs, &ncand);
     if (!base->e_id || ncand == NOID) {
       /* grab entry count from id2entry stat
        */
@@ -640,7 +1010,7 @@ dn2entry_retry:
    */
   cursor = 0;
 
-  if (candidates[0] == 0) {
+  if (cs ? ncand == 0 : candidates[0] == 0) {
     Debug(LDAP_DEBUG_TRACE, LDAP_XSTRING(mdb_search) ": no candidates\n");
 
     goto nochange;
@@ -656,6 +1026,23 @@ dn2entry_retry:
     goto done;
   }
 
+  /* decode only what the filter, the ACLs and the response need */
+  av = mdb_attr_view_get(op, &avbuf);
+
+  /* spread the filtering of a large candidate set over other threads,
+   * unless results are wanted only in part or from elsewhere */
+  if (mdb->mi_search_threads && !cs && nsubs >= ncand &&
+      ncand >= PSCAN_MIN && op->ors_slimit == SLAP_NO_LIMIT &&
+      !(op->ors_deref & LDAP_DEREF_SEARCHING) &&
+      get_pagedresults(op) <= SLAP_CONTROL_IGNORED) {
+    search_pscan(op, base, av, ltid, mci, candidates, stoptime, &hits);
+    ncand = MDB_IDL_N(candidates);
+    if (!ncand) {
+      Debug(LDAP_DEBUG_TRACE, LDAP_XSTRING(mdb_search) ": no candidates\n");
+      goto nochange;
+    }
+  }
+
   if (op->ors_limit == NULL /* isroot == TRUE */ ||
       !op->ors_limit->lms_s_pr_hide) {
     tentries = ncand;
@@ -686,17 +1073,19 @@ dn2entry_retry:
       send_ldap_result(op, rs);
       goto done;
     }
-    id = mdb_idl_first(candidates, &cursor);
+    id = search_first(candidates, cs, &cursor);
     if (id == NOID) {
       Debug(LDAP_DEBUG_TRACE,
             LDAP_XSTRING(mdb_search) ": no paged results candidates\n");
-      send_paged_response(op, rs, &lastid, 0);
+      /* a stream only had an estimate, it may turn out empty
+       * right away; don't hand out a cookie to resume from */
+      send_paged_response(op, rs, cs ? NULL : &lastid, 0);
 
       rs->sr_err = LDAP_OTHER;
       goto done;
     }
     if (id == (ID)ps->ps_cookie)
-      id = mdb_idl_next(candidates, &cursor);
+      id = search_next(candidates, cs, &cursor);
     nsubs = ncand; /* always bypass scope'd search */
     goto loop_begin;
   }
@@ -706,6 +1095,7 @@ dn2entry_retry:
 
     /* if any alias scopes were set, save them */
     if (scopes[0].mid > 1) {
+      iscopes = cand_chunk_get(op);
       cursor = 1;
       for (cscope = 1; cscope <= scopes[0].mid; cscope++) {
         /* Ignore the original base */
@@ -714,8 +1104,6 @@ dn2entry_retry:
         iscopes[cursor++] = scopes[cscope].mid;
       }
       iscopes[0] = scopes[0].mid - 1;
-    } else {
-      iscopes[0] = 0;
     }
 
     wwctx.mcd = mcd;
@@ -728,7 +1116,7 @@ dn2entry_retry:
       id = isc.id;
     cscope = 0;
   } else {
-    id = mdb_idl_first(candidates, &cursor);
+    id = search_first(candidates, cs, &cursor);
   }
 
   while (id != NOID) {
@@ -763,19 +1151,8 @@ dn2entry_retry:
     }
 
     if (nsubs < ncand) {
-      unsigned i;
       /* Is this entry in the candidate list? */
-      scopeok = 0;
-      if (MDB_IDL_IS_RANGE(candidates)) {
-        if (id >= MDB_IDL_RANGE_FIRST(candidates) &&
-            id <= MDB_IDL_RANGE_LAST(candidates))
-          scopeok = 1;
-      } else {
-        i = mdb_idl_search(candidates, id);
-        if (i <= candidates[0] && candidates[i] == id)
-          scopeok = 1;
-      }
-      if (scopeok)
+      if (mdb_idl_contains(candidates, id))
         goto scopeok;
       goto loop_continue;
     }
@@ -838,7 +1215,7 @@ dn2entry_retry:
         if (nsubs < ncand)
           goto loop_continue;
 
-        if (!MDB_IDL_IS_RANGE(candidates)) {
+        if (cs || !MDB_IDL_IS_RANGE(candidates)) {
           /* only complain for non-range IDLs */
           Debug(LDAP_DEBUG_TRACE,
                 LDAP_XSTRING(mdb_search) ": candidate %ld not found\n",
@@ -866,7 +1243,7 @@ dn2entry_retry:
         goto done;
       }
 
-      rs->sr_err = mdb_entry_decode(op, ltid, &edata, &e);
+      rs->sr_err = mdb_entry_decode_view(op, ltid, &edata, av, &e);
       if (rs->sr_err) {
         rs->sr_err = LDAP_OTHER;
         rs->sr_text = "internal error in mdb_entry_decode";
@@ -997,7 +1374,10 @@ dn2entry_retry:
     }
 
     /* if it matches the filter and scope, send it */
-    rs->sr_err = test_filter(op, e, op->oq_search.rs_filter);
+    if (pscan_matched(&hits, id))
+      rs->sr_err = LDAP_COMPARE_TRUE;
+    else
+      rs->sr_err = test_filter(op, e, op->oq_search.rs_filter);
 
     if (rs->sr_err == LDAP_COMPARE_TRUE) {
       /* check size limit */
@@ -1093,7 +1473,10 @@ dn2entry_retry:
     }
 
     if (wwctx.flag) {
+      pscan_hits_free(&hits);
       rs->sr_err = mdb_waitfixup(op, &wwctx, mci, mcd, &isc);
+      if (!rs->sr_err && cs)
+        rs->sr_err = mdb_cstream_renew(cs, ltid);
       if (rs->sr_err) {
         send_ldap_result(op, rs);
         goto done;
@@ -1115,7 +1498,7 @@ dn2entry_retry:
         /* We got to the end of a subtree. If there are any
          * alias scopes left, search them too.
          */
-        while (iscopes[0] && cscope < iscopes[0]) {
+        while (iscopes && cscope < iscopes[0]) {
           cscope++;
           isc.id = iscopes[cscope];
           if (base)
@@ -1137,10 +1520,17 @@ dn2entry_retry:
       } else
         id = isc.id;
     } else {
-      id = mdb_idl_next(candidates, &cursor);
+      id = search_next(candidates, cs, &cursor);
     }
   }
 
+  if (cs && mdb_cstream_error(cs)) {
+    rs->sr_err = LDAP_OTHER;
+    rs->sr_text = "internal error in candidate stream";
+    send_ldap_result(op, rs);
+    goto done;
+  }
+
 nochange:
   rs->sr_ctrls = NULL;
   rs->sr_ref = rs->sr_v2ref;
@@ -1175,6 +1565,14 @@ done:
   }
   if (base)
     mdb_entry_return(op, base);
+  if (cs)
+    mdb_cstream_free(op, cs);
+  if (av)
+    mdb_attr_view_free(op, av);
+  pscan_hits_free(&hits);
+  if (iscopes)
+    cand_chunk_ret(op, iscopes);
+  cand_chunk_ret(op, candidates);
   scope_chunk_ret(op, scopes);
 
 bailout:
@@ -1264,7 +1662,8 @@ static void *search_stack(Operation *op) {
 
 static int search_candidates(Operation *op, SlapReply *rs, Entry *e,
                              IdScopes *isc, MDB_cursor *mci, ID *ids,
-                             ID *stack) {
+                             ID *stack, ID nsubs, struct mdb_cstream **csp,
+                             ID *ncand) {
   struct mdb_info *mdb = (struct mdb_info *)op->o_bd->be_private;
   int rc, depth = 1;
   Filter *f, rf, xf, nf, sf;
@@ -1318,6 +1717,25 @@ static int search_candidates(Operation *op, SlapReply *rs, Entry *e,
     depth++;
   }
 
+  /* Without aliases to chase, a stream is enough as long as it is
+   * expected to yield fewer IDs than a subtree walk would visit;
+   * otherwise the walk needs a materialized IDL to test against.
+   * The estimate is only an upper bound, so let an exact count
+   * decide about the unchecked limit. */
+  if (!(op->ors_deref & LDAP_DEREF_SEARCHING) &&
+      mdb_filter_stream(op, isc->mt, f, csp, ncand) == LDAP_SUCCESS) {
+    if (*ncand <= nsubs &&
+        (!op->ors_limit || op->ors_limit->lms_s_unchecked == -1 ||
+         *ncand <= (unsigned)op->ors_limit->lms_s_unchecked)) {
+      Debug(LDAP_DEBUG_TRACE,
+            "mdb_search_candidates: streaming about %ld candidates\n",
+            (long)*ncand);
+      return LDAP_SUCCESS;
+    }
+    mdb_cstream_free(op, *csp);
+    *csp = NULL;
+  }
+
   /* Allocate IDL stack, plus 1 more for former tmp */
   if (depth + 1 > mdb->mi_search_stack_depth) {
     stack = ch_malloc((depth + 1) * MDB_IDL_UM_SIZE * sizeof(ID));
@@ -1347,6 +1765,7 @@ static int search_candidates(Operation *op, SlapReply *rs, Entry *e,
           (long)MDB_IDL_FIRST(ids), (long)MDB_IDL_LAST(ids));
   }
 
+  *ncand = MDB_IDL_N(ids);
   return rc;
 }
 
@@ -0,0 +1,245 @@
+/* $ReOpenLDAP$ */
+/* Copyright 2011-2018 ReOpenLDAP AUTHORS: please see AUTHORS file.
+ * All rights reserved.
+ *
+ * This file is part of ReOpenLDAP.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+/* Session logs kept by overlays in sub-databases of the backend.
+ *
+ * Records are keyed by CSN, so they come back in CSN order whatever
+ * order they were stored in, and a reader seeks straight to the
+ * position of a cookie. A record is written in the write txn of the
+ * change it describes, through the slog_hook_t the overlay put on the
+ * op, so the change and its record are committed together. Clearing
+ * the log is done in a txn of its own that is not synced, and the
+ * in-memory state of the overlay is not, so an open log is not
+ * trusted: slog_close() saves a state record which slog_open() takes
+ * back, and a log found without it is emptied. */
+
+#include "reldap.h"
+
+#include <ac/string.h>
+
+#include "back-mdb.h"
+
+/* Sorts before any CSN */
+#define SLOG_STATE_KEY "#"
+
+static void mdb_slog_state_key(MDB_val *key) {
+  key->mv_size = STRLENOF(SLOG_STATE_KEY);
+  key->mv_data = SLOG_STATE_KEY;
+}
+
+static int mdb_slog_open(BackendDB *be, const char *name, unsigned *dbi,
+                         size_t *num, struct berval *state) {
+  struct mdb_info *mdb = (struct mdb_info *)be->be_private;
+  MDB_txn *txn;
+  MDB_val key, data;
+  MDB_stat st;
+  int rc;
+
+  *num = 0;
+  BER_BVZERO(state);
+  if (!(mdb->mi_flags & MDB_IS_OPEN))
+    return LDAP_UNAVAILABLE;
+
+  rc = mdb_txn_begin(mdb->mi_dbenv, NULL, 0, &txn);
+  if (rc)
+    goto fail;
+  rc = mdb_dbi_open(txn, name, MDB_CREATE, dbi);
+  if (rc)
+    goto abort;
+
+  mdb_slog_state_key(&key);
+  rc = mdb_get(txn, *dbi, &key, &data);
+  if (rc == 0) {
+    state->bv_len = data.mv_size;
+    state->bv_val = ch_malloc(data.mv_size + 1);
+    memcpy(state->bv_val, data.mv_data, data.mv_size);
+    state->bv_val[data.mv_size] = '\0';
+    rc = mdb_del(txn, *dbi, &key, NULL);
+  } else if (rc == MDB_NOTFOUND) {
+    rc = mdb_drop(txn, *dbi, 0);
+  }
+  if (rc == 0)
+    rc = mdb_stat(txn, *dbi, &st);
+  if (rc)
+    goto abort;
+
+  rc = mdb_txn_commit(txn);
+  if (rc)
+    goto fail;
+  *num = st.ms_entries;
+  return 0;
+
+abort:
+  mdb_txn_abort(txn);
+fail:
+  Debug(LDAP_DEBUG_ANY, "mdb_slog_open: %s: %s (%d)\n", name, mdb_strerror(rc),
+        rc);
+  if (!BER_BVISNULL(state)) {
+    ch_free(state->bv_val);
+    BER_BVZERO(state);
+  }
+  return rc;
+}
+
+static int mdb_slog_close(BackendDB *be, unsigned dbi, struct berval *state) {
+  struct mdb_info *mdb = (struct mdb_info *)be->be_private;
+  MDB_txn *txn;
+  MDB_val key, data;
+  int rc;
+
+  mdb_slog_state_key(&key);
+  data.mv_size = state->bv_len;
+  data.mv_data = state->bv_val;
+  rc = mdb_txn_begin(mdb->mi_dbenv, NULL, 0, &txn);
+  if (rc == 0) {
+    rc = mdb_put(txn, dbi, &key, &data, 0);
+    if (rc == 0)
+      rc = mdb_txn_commit(txn);
+    else
+      mdb_txn_abort(txn);
+  }
+  if (rc)
+    Debug(LDAP_DEBUG_ANY, "mdb_slog_close: %s (%d)\n", mdb_strerror(rc), rc);
+  return rc;
+}
+
+static int mdb_slog_put(BackendDB *be, void *txn, unsigned dbi,
+                        struct berval *csn, struct berval *data, size_t max,
+                        mdb_slog_func *func, void *arg, size_t *num) {
+  MDB_cursor *mc = NULL;
+  MDB_val key, val;
+  MDB_stat st;
+  int rc;
+
+  key.mv_size = csn->bv_len;
+  key.mv_data = csn->bv_val;
+  val.mv_size = data->bv_len;
+  val.mv_data = data->bv_val;
+  rc = mdb_put(txn, dbi, &key, &val, 0);
+  if (rc == 0)
+    rc = mdb_stat(txn, dbi, &st);
+  if (rc == 0 && st.ms_entries > max) {
+    rc = mdb_cursor_open(txn, dbi, &mc);
+    while (rc == 0 && st.ms_entries > max) {
+      rc = mdb_cursor_get(mc, &key, &val, MDB_FIRST);
+      if (rc == 0) {
+        struct berval bk, bv;
+        bk.bv_len = key.mv_size;
+        bk.bv_val = key.mv_data;
+        bv.bv_len = val.mv_size;
+        bv.bv_val = val.mv_data;
+        func(arg, &bk, &bv);
+        rc = mdb_cursor_del(mc, 0);
+        st.ms_entries--;
+      }
+    }
+    if (mc)
+      mdb_cursor_close(mc);
+  }
+
+  if (rc == 0) {
+    *num = st.ms_entries;
+    return 0;
+  }
+  Debug(LDAP_DEBUG_ANY, "mdb_slog_put: %s (%d)\n", mdb_strerror(rc), rc);
+  return rc;
+}
+
+/* Let the overlays of an update store their records in its txn, called
+ * by the write ops once the update is done and before it is committed */
+void mdb_slog_hook(Operation *op, struct mdb_info *mdb, MDB_txn *txn) {
+  OpExtra *oex;
+
+  if (op->o_noop)
+    return;
+  LDAP_SLIST_FOREACH(oex, &op->o_extra, oe_next) {
+    slog_hook_t *sh = (slog_hook_t *)oex;
+    if (oex->oe_key == &mdb_extra && sh->sh_be->be_private == mdb)
+      sh->sh_func(op, sh, txn);
+  }
+}
+
+static int mdb_slog_scan(Operation *op, BackendDB *be, unsigned dbi,
+                         struct berval *from, mdb_slog_func *func, void *arg) {
+  struct mdb_info *mdb = (struct mdb_info *)be->be_private;
+  mdb_op_info opinfo = {{{0}}}, *moi = &opinfo;
+  MDB_cursor *mc;
+  MDB_val key, val;
+  int rc;
+
+  rc = mdb_opinfo_get(op, mdb, 1, &moi);
+  if (rc)
+    goto fail;
+
+  rc = mdb_cursor_open(moi->moi_txn, dbi, &mc);
+  if (rc == 0) {
+    if (from) {
+      key.mv_size = from->bv_len;
+      key.mv_data = from->bv_val;
+      rc = mdb_cursor_get(mc, &key, &val, MDB_SET_RANGE);
+    } else {
+      rc = mdb_cursor_get(mc, &key, &val, MDB_FIRST);
+    }
+    while (rc == 0) {
+      struct berval bk, bv;
+      bk.bv_len = key.mv_size;
+      bk.bv_val = key.mv_data;
+      bv.bv_len = val.mv_size;
+      bv.bv_val = val.mv_data;
+      if (func(arg, &bk, &bv))
+        break;
+      rc = mdb_cursor_get(mc, &key, &val, MDB_NEXT);
+    }
+    if (rc == MDB_NOTFOUND)
+      rc = 0;
+    mdb_cursor_close(mc);
+  }
+
+  if (moi == &opinfo || --moi->moi_ref < 1) {
+    int __maybe_unused rc2 = mdb_txn_reset(moi->moi_txn);
+    assert(rc2 == MDB_SUCCESS);
+    if (moi->moi_oe.oe_key)
+      LDAP_SLIST_REMOVE(&op->o_extra, &moi->moi_oe, OpExtra, oe_next);
+    if (moi->moi_flag & MOI_FREEIT)
+      op->o_tmpfree(moi, op->o_tmpmemctx);
+  }
+  if (rc == 0)
+    return 0;
+
+fail:
+  Debug(LDAP_DEBUG_ANY, "mdb_slog_scan: %s (%d)\n", mdb_strerror(rc), rc);
+  return rc;
+}
+
+static int mdb_slog_clear(BackendDB *be, unsigned dbi) {
+  struct mdb_info *mdb = (struct mdb_info *)be->be_private;
+  MDB_txn *txn;
+  int rc;
+
+  rc = mdb_txn_begin(mdb->mi_dbenv, NULL, MDB_NOSYNC, &txn);
+  if (rc == 0) {
+    rc = mdb_drop(txn, dbi, 0);
+    if (rc == 0)
+      rc = mdb_txn_commit(txn);
+    else
+      mdb_txn_abort(txn);
+  }
+  if (rc)
+    Debug(LDAP_DEBUG_ANY, "mdb_slog_clear: %s (%d)\n", mdb_strerror(rc), rc);
+  return rc;
+}
+
+const mdb_extra_t mdb_extra = {mdb_slog_open, mdb_slog_close, mdb_slog_put,
+                               mdb_slog_scan, mdb_slog_clear};
@@ -83,6 +83,7 @@ static ldap_pvt_thread_cond_t mdb_tool_index_cond_work;
 static void *mdb_tool_index_task(void *ctx, void *ptr);
 
 static int mdb_writes, mdb_writes_per_commit;
+static int mdb_tool_ixhash_fail;
 
 /* Number of ops per commit in Quick mode.
  * Batching speeds writes overall, but too large a
@@ -95,6 +96,13 @@ static int mdb_writes, mdb_writes_per_commit;
 static int mdb_tool_entry_get_int(BackendDB *be, ID id, Entry **ep);
 
 int mdb_tool_entry_open(BackendDB *be, int mode) {
+  struct mdb_info *mi = (struct mdb_info *)be->be_private;
+
+  /* Rehashed index keys can't coexist with the old ones */
+  mdb_tool_ixhash_fail = 0;
+  if (mi->mi_flags & MDB_IXHASH_CHANGE)
+    slapMode |= SLAP_TRUNCATE_MODE;
+
   /* In Quick mode, commit once per 500 entries */
   mdb_writes = 0;
   if (slapMode & SLAP_TOOL_QUICK)
@@ -179,6 +187,41 @@ static int mdb_tool_terminate_txn(BackendDB *be, MDB_txn *txn, int abort) {
 
 #define mdb_tool_txn_abort(be, txn) (void)mdb_tool_terminate_txn(be, txn, 1)
 
+/* Once every entry was reindexed, record the hash of the new keys */
+static int mdb_tool_ixhash_done(BackendDB *be) {
+  struct mdb_info *mi = (struct mdb_info *)be->be_private;
+  MDB_txn *txn;
+  int rc;
+
+  if (!mi || !(mi->mi_flags & MDB_IXHASH_CHANGE))
+    return 0;
+  mi->mi_flags ^= MDB_IXHASH_CHANGE;
+  if (mdb_tool_ixhash_fail) {
+    Debug(LDAP_DEBUG_ANY,
+          "mdb_tool_entry_close: database %s: reindex incomplete, "
+          "index keys still need a rehash\n",
+          be->be_suffix[0].bv_val);
+    return -1;
+  }
+
+  rc = mdb_txn_begin(mi->mi_dbenv, NULL, 0, &txn);
+  if (rc == 0) {
+    rc = mdb_ixhash_put(mi, txn);
+    if (rc == 0)
+      rc = mdb_txn_commit(txn);
+    else
+      mdb_txn_abort(txn);
+  }
+  if (rc) {
+    Debug(LDAP_DEBUG_ANY,
+          "mdb_tool_entry_close: database %s: "
+          "index hash not recorded: %s (%d)\n",
+          be->be_suffix[0].bv_val, mdb_strerror(rc), rc);
+    return -1;
+  }
+  return 0;
+}
+
 int mdb_tool_entry_close(BackendDB *be) {
   if (mdb_tool_info) {
     set_shutdown(1);
@@ -244,6 +287,9 @@ int mdb_tool_entry_close(BackendDB *be) {
     }
   }
 
+  if (mdb_tool_ixhash_done(be))
+    return -1;
+
   if (nholes) {
     unsigned i;
     fprintf(stderr, "Error, entries missing!\n");
@@ -751,6 +797,16 @@ int mdb_tool_entry_reindex(BackendDB *be, ID id, AttributeDescription **adv) {
   assert(tool_base == NULL);
   assert(tool_filter == NULL);
 
+  /* Rehashing index keys needs all indices rebuilt at once */
+  if ((mi->mi_flags & MDB_IXHASH_CHANGE) && adv) {
+    Debug(LDAP_DEBUG_ANY,
+          LDAP_XSTRING(mdb_tool_entry_reindex) ": index keys need a rehash, "
+                                               "all attributes must be "
+                                               "reindexed\n");
+    mdb_tool_ixhash_fail = 1;
+    return -1;
+  }
+
   /* Special: do a dn2id upgrade */
   if (adv && adv[0] == slap_schema.si_ad_entryDN) {
     /* short-circuit tool_entry_next() */
@@ -814,6 +870,7 @@ int mdb_tool_entry_reindex(BackendDB *be, ID id, AttributeDescription **adv) {
     Debug(LDAP_DEBUG_ANY,
           LDAP_XSTRING(mdb_tool_entry_reindex) ": could not locate id=%ld\n",
           (long)id);
+    mdb_tool_ixhash_fail = 1;
     return -1;
   }
 
@@ -894,6 +951,7 @@ done:
 
   } else {
     mdb_writes = 0;
+    mdb_tool_ixhash_fail = 1;
     mdb_tool_txn_abort(be, txi);
     Debug(LDAP_DEBUG_ANY,
           "=> " LDAP_XSTRING(mdb_tool_entry_reindex) ": txn_aborted! err=%d\n",
@@ -131,6 +131,11 @@ typedef struct monitor_info_t {
   AttributeDescription *mi_ad_monitorUpdateRef;
   AttributeDescription *mi_ad_monitorRuntimeConfig;
   AttributeDescription *mi_ad_monitorSuperiorDN;
+  AttributeDescription *mi_ad_monitorListenerAccepted;
+  AttributeDescription *mi_ad_monitorListenerAcceptRate;
+  AttributeDescription *mi_ad_monitorOpQueueTime;
+  AttributeDescription *mi_ad_monitorOpExecTime;
+  AttributeDescription *mi_ad_monitorOpSendTime;
 
   /*
    * Generic description attribute
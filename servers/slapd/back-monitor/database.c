@@ -35,6 +35,9 @@ static int monitor_back_add_plugin(monitor_info_t *mi, Backend *be, Entry *e);
 static int monitor_subsys_database_modify(Operation *op, SlapReply *rs,
                                           Entry *e);
 
+static int monitor_subsys_database_update(Operation *op, SlapReply *rs,
+                                          Entry *e);
+
 static struct restricted_ops_t {
   struct berval op;
   unsigned int tag;
@@ -256,6 +259,7 @@ static int monitor_subsys_database_init_one(monitor_info_t *mi, BackendDB *be,
 
   (void)init_readOnly(mi, e, be->be_restrictops);
   (void)init_restrictedOperation(mi, e, be->be_restrictops);
+  (void)monitor_latency_init(mi, e);
 
   if (SLAP_SHADOW(be) && be->be_update_refs) {
     attr_merge_normalize(e, mi->mi_ad_monitorUpdateRef, be->be_update_refs,
@@ -502,6 +506,7 @@ int monitor_subsys_database_init(BackendDB *be, monitor_subsys_t *ms) {
   assert(be != NULL);
 
   ms->mss_modify = monitor_subsys_database_modify;
+  ms->mss_update = monitor_subsys_database_update;
 
   mi = (monitor_info_t *)be->be_private;
 
@@ -614,6 +619,67 @@ static int value_mask(BerVarray v, slap_mask_t cur, slap_mask_t *delta) {
   return LDAP_SUCCESS;
 }
 
+/* The database an entry of the subsystem is about, overlays aside */
+static BackendDB *monitor_database_be(Entry *e) {
+  BackendDB *be;
+  int n;
+
+  if (sscanf(e->e_nname.bv_val, "cn=database %d,", &n) == 1) {
+    LDAP_STAILQ_FOREACH(be, &backendDB, be_next) {
+      if (n-- == 0)
+        return be;
+    }
+  } else if (!strncmp(e->e_nname.bv_val, "cn=frontend,",
+                      STRLENOF("cn=frontend,"))) {
+    return frontendDB;
+  }
+  return NULL;
+}
+
+static int monitor_subsys_database_update(Operation *op, SlapReply *rs,
+                                          Entry *e) {
+  monitor_info_t *mi = (monitor_info_t *)op->o_bd->be_private;
+  slap_histo_t latency[SLAP_LAT_LAST];
+  BackendDB *be;
+
+  be = monitor_database_be(e);
+  if (be == NULL)
+    return SLAP_CB_CONTINUE;
+
+  if (be->be_latency)
+    memcpy(latency, be->be_latency, sizeof(latency));
+  else
+    memset(latency, 0, sizeof(latency));
+  monitor_latency_update(mi, e, latency);
+
+  return SLAP_CB_CONTINUE;
+}
+
+/* The frontend only takes resets of its latency histograms */
+static int monitor_frontend_modify(Operation *op, SlapReply *rs) {
+  monitor_info_t *mi = (monitor_info_t *)op->o_bd->be_private;
+  Modifications *ml;
+  int phase, rc;
+
+  for (ml = op->orm_modlist; ml; ml = ml->sml_next) {
+    rc = monitor_latency_mod(mi, &ml->sml_mod, &phase);
+    if (rc != LDAP_SUCCESS) {
+      rs->sr_text = "latency attributes can only be deleted";
+      return (rs->sr_err = rc);
+    }
+    if (phase < 0 && !is_at_operational(ml->sml_desc->ad_type))
+      return (rs->sr_err = LDAP_UNWILLING_TO_PERFORM);
+  }
+
+  for (ml = op->orm_modlist; ml; ml = ml->sml_next) {
+    monitor_latency_mod(mi, &ml->sml_mod, &phase);
+    if (phase >= 0 && frontendDB->be_latency)
+      slap_histo_reset(&frontendDB->be_latency[phase]);
+  }
+
+  return SLAP_CB_CONTINUE;
+}
+
 static int monitor_subsys_database_modify(Operation *op, SlapReply *rs,
                                           Entry *e) {
   monitor_info_t *mi = (monitor_info_t *)op->o_bd->be_private;
@@ -621,12 +687,14 @@ static int monitor_subsys_database_modify(Operation *op, SlapReply *rs,
   Attribute *save_attrs, *a;
   Modifications *ml;
   Backend *be;
-  int ro_gotval = 1, i, n;
+  int ro_gotval = 1, i, n, phase;
   slap_mask_t rp_add = 0, rp_delete = 0, rp_cur;
   struct berval *tf;
 
   i = sscanf(e->e_nname.bv_val, "cn=database %d,", &n);
   if (i != 1) {
+    if (monitor_database_be(e) == frontendDB)
+      return monitor_frontend_modify(op, rs);
     return SLAP_CB_CONTINUE;
   }
 
@@ -778,6 +846,16 @@ static int monitor_subsys_database_modify(Operation *op, SlapReply *rs,
         goto done;
       }
 
+    } else if (monitor_latency_mod(mi, mod, &phase) != LDAP_SUCCESS) {
+      rs->sr_text = "latency attributes can only be deleted";
+      rc = rs->sr_err = LDAP_CONSTRAINT_VIOLATION;
+      goto done;
+
+    } else if (phase >= 0) {
+      if (be->be_latency)
+        slap_histo_reset(&be->be_latency[phase]);
+      rc = LDAP_SUCCESS;
+
     } else if (is_at_operational(mod->sm_desc->ad_type)) {
       /* accept all operational attributes */
       attr_delete(&e->e_attrs, mod->sm_desc);
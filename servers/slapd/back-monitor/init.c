@@ -1886,6 +1886,46 @@ int monitor_back_initialize(BackendInfo *bi) {
          "USAGE dSAOperation )",
          SLAP_AT_FINAL | SLAP_AT_HIDE,
          offsetof(monitor_info_t, mi_ad_monitorSuperiorDN)},
+        {"( 1.3.6.1.4.1.4203.666.1.55.31 "
+         "NAME 'monitorListenerAccepted' "
+         "DESC 'monitor connections accepted by a listener' "
+         "SUP monitorCounter "
+         "NO-USER-MODIFICATION "
+         "USAGE dSAOperation )",
+         SLAP_AT_FINAL | SLAP_AT_HIDE,
+         offsetof(monitor_info_t, mi_ad_monitorListenerAccepted)},
+        {"( 1.3.6.1.4.1.4203.666.1.55.32 "
+         "NAME 'monitorListenerAcceptRate' "
+         "DESC 'monitor connections accepted by a listener per second' "
+         "SUP monitorCounter "
+         "NO-USER-MODIFICATION "
+         "USAGE dSAOperation )",
+         SLAP_AT_FINAL | SLAP_AT_HIDE,
+         offsetof(monitor_info_t, mi_ad_monitorListenerAcceptRate)},
+        {"( 1.3.6.1.4.1.4203.666.1.55.33 "
+         "NAME 'monitorOpQueueTime' "
+         "DESC 'microseconds operations waited for a thread' "
+         "SUP monitoredInfo "
+         "SINGLE-VALUE "
+         "USAGE dSAOperation )",
+         SLAP_AT_FINAL | SLAP_AT_HIDE,
+         offsetof(monitor_info_t, mi_ad_monitorOpQueueTime)},
+        {"( 1.3.6.1.4.1.4203.666.1.55.34 "
+         "NAME 'monitorOpExecTime' "
+         "DESC 'microseconds operations took to execute' "
+         "SUP monitoredInfo "
+         "SINGLE-VALUE "
+         "USAGE dSAOperation )",
+         SLAP_AT_FINAL | SLAP_AT_HIDE,
+         offsetof(monitor_info_t, mi_ad_monitorOpExecTime)},
+        {"( 1.3.6.1.4.1.4203.666.1.55.35 "
+         "NAME 'monitorOpSendTime' "
+         "DESC 'microseconds operations took to send responses' "
+         "SUP monitoredInfo "
+         "SINGLE-VALUE "
+         "USAGE dSAOperation )",
+         SLAP_AT_FINAL | SLAP_AT_HIDE,
+         offsetof(monitor_info_t, mi_ad_monitorOpSendTime)},
         {NULL, 0, -1}};
 
   static struct {
@@ -26,11 +26,24 @@
 #include "slap.h"
 #include "back-monitor.h"
 
+/* accept rate of a listener, sampled over at least a second */
+typedef struct monitor_listener_t {
+  unsigned long ml_accepted;
+  uint64_t ml_ns;
+  unsigned long ml_rate;
+} monitor_listener_t;
+
+static int monitor_subsys_listener_destroy(BackendDB *be, monitor_subsys_t *ms);
+
+static int monitor_subsys_listener_update(Operation *op, SlapReply *rs,
+                                          Entry *e);
+
 int monitor_subsys_listener_init(BackendDB *be, monitor_subsys_t *ms) {
   monitor_info_t *mi;
   Entry *e_listener = NULL, **ep;
   int i;
   monitor_entry_t *mp;
+  monitor_listener_t *ml;
   Listener **l;
 
   assert(be != NULL);
@@ -45,6 +58,16 @@ int monitor_subsys_listener_init(BackendDB *be, monitor_subsys_t *ms) {
     return (-1);
   }
 
+  for (i = 0; l[i]; i++)
+    ;
+  ml = ch_calloc(i + 1, sizeof(monitor_listener_t));
+  ml[0].ml_ns = ldap_now_steady_ns();
+  for (i = 1; l[i]; i++)
+    ml[i].ml_ns = ml[0].ml_ns;
+  ms->mss_private = ml;
+  ms->mss_destroy = monitor_subsys_listener_destroy;
+  ms->mss_update = monitor_subsys_listener_update;
+
   mi = (monitor_info_t *)be->be_private;
 
   if (monitor_cache_get(mi, &ms->mss_ndn, &e_listener)) {
@@ -101,6 +124,18 @@ int monitor_subsys_listener_init(BackendDB *be, monitor_subsys_t *ms) {
     }
 #endif /* WITH_TLS */
 
+    if (l[i]->sl_shards > 1) {
+      bv.bv_len = snprintf(buf, sizeof(buf), "shard %d of %d, thread %d",
+                           l[i]->sl_shard + 1, l[i]->sl_shards,
+                           l[i]->sl_shard % slapd_daemon_threads);
+      bv.bv_val = buf;
+      attr_merge_normalize_one(e, mi->mi_ad_monitoredInfo, &bv, NULL);
+    }
+
+    BER_BVSTR(&bv, "0");
+    attr_merge_one(e, mi->mi_ad_monitorListenerAccepted, &bv, NULL);
+    attr_merge_one(e, mi->mi_ad_monitorListenerAcceptRate, &bv, NULL);
+
     mp = monitor_entrypriv_create();
     if (mp == NULL) {
       goto bailout;
@@ -127,3 +162,63 @@ bailout:
   monitor_cache_release(mi, e_listener);
   return rc;
 }
+
+static int monitor_subsys_listener_destroy(BackendDB *be,
+                                           monitor_subsys_t *ms) {
+  ch_free(ms->mss_private);
+  ms->mss_private = NULL;
+
+  return 0;
+}
+
+static int monitor_subsys_listener_update(Operation *op, SlapReply *rs,
+                                          Entry *e) {
+  monitor_info_t *mi = (monitor_info_t *)op->o_bd->be_private;
+  monitor_entry_t *mp = (monitor_entry_t *)e->e_private;
+  monitor_listener_t *ml = mp->mp_info->mss_private;
+  Listener **l = slapd_get_listeners();
+  unsigned long accepted;
+  uint64_t now;
+  ldap_pvt_mp_t n;
+  Attribute *a;
+  int i, j;
+
+  assert(mi != NULL);
+
+  /* the entry is locked, so is its sample */
+  if (sscanf(e->e_nname.bv_val, "cn=listener %d,", &i) != 1 || i < 0 ||
+      l == NULL)
+    return SLAP_CB_CONTINUE;
+  for (j = 0; j < i && l[j]; j++)
+    ;
+  if (l[j] == NULL)
+    return SLAP_CB_CONTINUE;
+  ml += i;
+
+  accepted = l[i]->sl_accepted;
+  now = ldap_now_steady_ns();
+  if (now - ml->ml_ns >= 1000000000ull) {
+    ml->ml_rate =
+        (accepted - ml->ml_accepted) * 1000000000ull / (now - ml->ml_ns);
+    ml->ml_accepted = accepted;
+    ml->ml_ns = now;
+  }
+
+  a = attr_find(e->e_attrs, mi->mi_ad_monitorListenerAccepted);
+  if (a != NULL) {
+    ldap_pvt_mp_init(n);
+    ldap_pvt_mp_add_ulong(n, accepted);
+    UI2BV(&a->a_vals[0], n);
+    ldap_pvt_mp_clear(n);
+  }
+
+  a = attr_find(e->e_attrs, mi->mi_ad_monitorListenerAcceptRate);
+  if (a != NULL) {
+    ldap_pvt_mp_init(n);
+    ldap_pvt_mp_add_ulong(n, ml->ml_rate);
+    UI2BV(&a->a_vals[0], n);
+    ldap_pvt_mp_clear(n);
+  }
+
+  return SLAP_CB_CONTINUE;
+}
@@ -46,6 +46,80 @@ static int monitor_subsys_ops_destroy(BackendDB *be, monitor_subsys_t *ms);
 
 static int monitor_subsys_ops_update(Operation *op, SlapReply *rs, Entry *e);
 
+static int monitor_subsys_ops_modify(Operation *op, SlapReply *rs, Entry *e);
+
+static AttributeDescription **monitor_latency_ad(monitor_info_t *mi,
+                                                 AttributeDescription **ad) {
+  ad[SLAP_LAT_QUEUE] = mi->mi_ad_monitorOpQueueTime;
+  ad[SLAP_LAT_EXEC] = mi->mi_ad_monitorOpExecTime;
+  ad[SLAP_LAT_SEND] = mi->mi_ad_monitorOpSendTime;
+  return ad;
+}
+
+static void monitor_latency2bv(slap_histo_t *h, struct berval *bv) {
+  char buf[BACKMONITOR_BUFSIZE];
+
+  bv->bv_len = snprintf(
+      buf, sizeof(buf),
+      "count=%" PRIu64 " mean=%" PRIu64 " p50=%" PRIu64 " p90=%" PRIu64
+      " p99=%" PRIu64 " p999=%" PRIu64 " max=%" PRIu64,
+      h->sh_count, h->sh_count ? h->sh_sum / h->sh_count : 0,
+      slap_histo_quantile(h, 500), slap_histo_quantile(h, 900),
+      slap_histo_quantile(h, 990), slap_histo_quantile(h, 999), h->sh_max);
+  bv->bv_val = ch_strdup(buf);
+}
+
+/* Add the latency attributes, with no samples yet, to an entry */
+int monitor_latency_init(monitor_info_t *mi, Entry *e) {
+  AttributeDescription *ad[SLAP_LAT_LAST];
+  slap_histo_t h;
+  struct berval bv;
+  int i, rc = 0;
+
+  memset(&h, 0, sizeof(h));
+  monitor_latency2bv(&h, &bv);
+  monitor_latency_ad(mi, ad);
+  for (i = 0; i < SLAP_LAT_LAST && !rc; i++)
+    rc = attr_merge_one(e, ad[i], &bv, NULL);
+  ch_free(bv.bv_val);
+  return rc;
+}
+
+/* Show the histograms of the phases h[SLAP_LAT_LAST] in an entry */
+void monitor_latency_update(monitor_info_t *mi, Entry *e, slap_histo_t *h) {
+  AttributeDescription *ad[SLAP_LAT_LAST];
+  Attribute *a;
+  int i;
+
+  monitor_latency_ad(mi, ad);
+  for (i = 0; i < SLAP_LAT_LAST; i++) {
+    a = attr_find(e->e_attrs, ad[i]);
+    if (a == NULL)
+      continue;
+    ch_free(a->a_vals[0].bv_val);
+    monitor_latency2bv(&h[i], &a->a_vals[0]);
+  }
+}
+
+/* Find the phase whose latency attribute a modification resets, or -1.
+ * Only deleting the attribute, or replacing it with nothing, is allowed. */
+int monitor_latency_mod(monitor_info_t *mi, Modification *mod, int *phase) {
+  AttributeDescription *ad[SLAP_LAT_LAST];
+
+  monitor_latency_ad(mi, ad);
+  for (*phase = 0; *phase < SLAP_LAT_LAST; ++*phase)
+    if (mod->sm_desc == ad[*phase])
+      break;
+  if (*phase == SLAP_LAT_LAST) {
+    *phase = -1;
+    return LDAP_SUCCESS;
+  }
+  if ((mod->sm_op != LDAP_MOD_DELETE && mod->sm_op != LDAP_MOD_REPLACE) ||
+      mod->sm_values != NULL)
+    return LDAP_CONSTRAINT_VIOLATION;
+  return LDAP_SUCCESS;
+}
+
 int monitor_subsys_ops_init(BackendDB *be, monitor_subsys_t *ms) {
   monitor_info_t *mi;
 
@@ -58,6 +132,7 @@ int monitor_subsys_ops_init(BackendDB *be, monitor_subsys_t *ms) {
 
   ms->mss_destroy = monitor_subsys_ops_destroy;
   ms->mss_update = monitor_subsys_ops_update;
+  ms->mss_modify = monitor_subsys_ops_modify;
 
   mi = (monitor_info_t *)be->be_private;
 
@@ -71,6 +146,7 @@ int monitor_subsys_ops_init(BackendDB *be, monitor_subsys_t *ms) {
 
   attr_merge_one(e_op, mi->mi_ad_monitorOpInitiated, &bv_zero, NULL);
   attr_merge_one(e_op, mi->mi_ad_monitorOpCompleted, &bv_zero, NULL);
+  monitor_latency_init(mi, e_op);
 
   mp = (monitor_entry_t *)e_op->e_private;
   mp->mp_children = NULL;
@@ -99,6 +175,7 @@ int monitor_subsys_ops_init(BackendDB *be, monitor_subsys_t *ms) {
     BER_BVSTR(&bv, "0");
     attr_merge_one(e, mi->mi_ad_monitorOpInitiated, &bv, NULL);
     attr_merge_one(e, mi->mi_ad_monitorOpCompleted, &bv, NULL);
+    monitor_latency_init(mi, e);
 
     /* steal normalized RDN */
     dnRdn(&e->e_nname, &rdn);
@@ -150,7 +227,9 @@ static int monitor_subsys_ops_update(Operation *op, SlapReply *rs, Entry *e) {
   struct berval rdn;
   int i;
   Attribute *a;
-  slap_counters_t *sc;
+  slap_counters_t sum;
+  slap_histo_t latency[SLAP_LAT_LAST];
+  slap_lat_t phase;
   static struct berval bv_ops = BER_BVC("cn=operations");
 
   assert(mi != NULL);
@@ -162,34 +241,20 @@ static int monitor_subsys_ops_update(Operation *op, SlapReply *rs, Entry *e) {
     ldap_pvt_mp_init(nInitiated);
     ldap_pvt_mp_init(nCompleted);
 
-    ldap_pvt_thread_mutex_lock(&slap_counters.sc_mutex);
+    slap_counters_sum(&sum);
     for (i = 0; i < SLAP_OP_LAST; i++) {
-      ldap_pvt_mp_add(nInitiated, slap_counters.sc_ops_initiated_[i]);
-      ldap_pvt_mp_add(nCompleted, slap_counters.sc_ops_completed_[i]);
-    }
-    for (sc = slap_counters.sc_next; sc; sc = sc->sc_next) {
-      ldap_pvt_thread_mutex_lock(&sc->sc_mutex);
-      for (i = 0; i < SLAP_OP_LAST; i++) {
-        ldap_pvt_mp_add(nInitiated, sc->sc_ops_initiated_[i]);
-        ldap_pvt_mp_add(nCompleted, sc->sc_ops_completed_[i]);
-      }
-      ldap_pvt_thread_mutex_unlock(&sc->sc_mutex);
+      ldap_pvt_mp_add_ulong(nInitiated, sum.sc_ops_initiated_[i]);
+      ldap_pvt_mp_add_ulong(nCompleted, sum.sc_ops_completed_[i]);
     }
-    ldap_pvt_thread_mutex_unlock(&slap_counters.sc_mutex);
 
   } else {
     for (i = 0; i < SLAP_OP_LAST; i++) {
       if (dn_match(&rdn, &monitor_op[i].nrdn)) {
-        ldap_pvt_thread_mutex_lock(&slap_counters.sc_mutex);
-        ldap_pvt_mp_init_set(nInitiated, slap_counters.sc_ops_initiated_[i]);
-        ldap_pvt_mp_init_set(nCompleted, slap_counters.sc_ops_completed_[i]);
-        for (sc = slap_counters.sc_next; sc; sc = sc->sc_next) {
-          ldap_pvt_thread_mutex_lock(&sc->sc_mutex);
-          ldap_pvt_mp_add(nInitiated, sc->sc_ops_initiated_[i]);
-          ldap_pvt_mp_add(nCompleted, sc->sc_ops_completed_[i]);
-          ldap_pvt_thread_mutex_unlock(&sc->sc_mutex);
-        }
-        ldap_pvt_thread_mutex_unlock(&slap_counters.sc_mutex);
+        slap_counters_sum(&sum);
+        ldap_pvt_mp_init(nInitiated);
+        ldap_pvt_mp_init(nCompleted);
+        ldap_pvt_mp_add_ulong(nInitiated, sum.sc_ops_initiated_[i]);
+        ldap_pvt_mp_add_ulong(nCompleted, sum.sc_ops_completed_[i]);
         break;
       }
     }
@@ -214,7 +279,49 @@ static int monitor_subsys_ops_update(Operation *op, SlapReply *rs, Entry *e) {
   UI2BV(&a->a_vals[0], nCompleted);
   ldap_pvt_mp_clear(nCompleted);
 
+  for (phase = 0; phase < SLAP_LAT_LAST; phase++)
+    slap_latency_sum(i, phase, &latency[phase]);
+  monitor_latency_update(mi, e, latency);
+
   /* FIXME: touch modifyTimestamp? */
 
   return SLAP_CB_CONTINUE;
 }
+
+/* Deleting a latency attribute resets the histograms behind it */
+static int monitor_subsys_ops_modify(Operation *op, SlapReply *rs, Entry *e) {
+  monitor_info_t *mi = (monitor_info_t *)op->o_bd->be_private;
+  Modifications *ml;
+  struct berval rdn;
+  static struct berval bv_ops = BER_BVC("cn=operations");
+  int i, phase, rc;
+
+  dnRdn(&e->e_nname, &rdn);
+  if (dn_match(&rdn, &bv_ops)) {
+    i = SLAP_OP_LAST;
+  } else {
+    for (i = 0; i < SLAP_OP_LAST; i++)
+      if (dn_match(&rdn, &monitor_op[i].nrdn))
+        break;
+    if (i == SLAP_OP_LAST)
+      return SLAP_CB_CONTINUE;
+  }
+
+  for (ml = op->orm_modlist; ml; ml = ml->sml_next) {
+    rc = monitor_latency_mod(mi, &ml->sml_mod, &phase);
+    if (rc != LDAP_SUCCESS) {
+      rs->sr_text = "latency attributes can only be deleted";
+      return (rs->sr_err = rc);
+    }
+    if (phase < 0 && !is_at_operational(ml->sml_desc->ad_type))
+      return (rs->sr_err = LDAP_UNWILLING_TO_PERFORM);
+  }
+
+  for (ml = op->orm_modlist; ml; ml = ml->sml_next) {
+    monitor_latency_mod(mi, &ml->sml_mod, &phase);
+    if (phase >= 0)
+      slap_latency_reset(i, phase);
+  }
+
+  return SLAP_CB_CONTINUE;
+}
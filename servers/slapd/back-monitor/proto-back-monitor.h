@@ -148,6 +148,11 @@ extern int monitor_subsys_log_init(BackendDB *be, monitor_subsys_t *ms);
  * operations
  */
 extern int monitor_subsys_ops_init(BackendDB *be, monitor_subsys_t *ms);
+extern int monitor_latency_init(monitor_info_t *mi, Entry *e);
+extern void monitor_latency_update(monitor_info_t *mi, Entry *e,
+                                   slap_histo_t *h);
+extern int monitor_latency_mod(monitor_info_t *mi, Modification *mod,
+                               int *phase);
 
 /*
  * overlay
@@ -142,7 +142,7 @@ static int monitor_subsys_sent_update(Operation *op, SlapReply *rs, Entry *e) {
   struct berval nrdn;
   ldap_pvt_mp_t n;
   Attribute *a;
-  slap_counters_t *sc;
+  slap_counters_t sum;
   int i;
 
   assert(mi != NULL);
@@ -160,48 +160,28 @@ static int monitor_subsys_sent_update(Operation *op, SlapReply *rs, Entry *e) {
     return SLAP_CB_CONTINUE;
   }
 
-  ldap_pvt_thread_mutex_lock(&slap_counters.sc_mutex);
+  slap_counters_sum(&sum);
+  ldap_pvt_mp_init(n);
   switch (i) {
   case MONITOR_SENT_ENTRIES:
-    ldap_pvt_mp_init_set(n, slap_counters.sc_entries);
-    for (sc = slap_counters.sc_next; sc; sc = sc->sc_next) {
-      ldap_pvt_thread_mutex_lock(&sc->sc_mutex);
-      ldap_pvt_mp_add(n, sc->sc_entries);
-      ldap_pvt_thread_mutex_unlock(&sc->sc_mutex);
-    }
+    ldap_pvt_mp_add_ulong(n, sum.sc_entries);
     break;
 
   case MONITOR_SENT_REFERRALS:
-    ldap_pvt_mp_init_set(n, slap_counters.sc_refs);
-    for (sc = slap_counters.sc_next; sc; sc = sc->sc_next) {
-      ldap_pvt_thread_mutex_lock(&sc->sc_mutex);
-      ldap_pvt_mp_add(n, sc->sc_refs);
-      ldap_pvt_thread_mutex_unlock(&sc->sc_mutex);
-    }
+    ldap_pvt_mp_add_ulong(n, sum.sc_refs);
     break;
 
   case MONITOR_SENT_PDU:
-    ldap_pvt_mp_init_set(n, slap_counters.sc_pdu);
-    for (sc = slap_counters.sc_next; sc; sc = sc->sc_next) {
-      ldap_pvt_thread_mutex_lock(&sc->sc_mutex);
-      ldap_pvt_mp_add(n, sc->sc_pdu);
-      ldap_pvt_thread_mutex_unlock(&sc->sc_mutex);
-    }
+    ldap_pvt_mp_add_ulong(n, sum.sc_pdu);
     break;
 
   case MONITOR_SENT_BYTES:
-    ldap_pvt_mp_init_set(n, slap_counters.sc_bytes);
-    for (sc = slap_counters.sc_next; sc; sc = sc->sc_next) {
-      ldap_pvt_thread_mutex_lock(&sc->sc_mutex);
-      ldap_pvt_mp_add(n, sc->sc_bytes);
-      ldap_pvt_thread_mutex_unlock(&sc->sc_mutex);
-    }
+    ldap_pvt_mp_add_ulong(n, sum.sc_bytes);
     break;
 
   default:
     LDAP_BUG();
   }
-  ldap_pvt_thread_mutex_unlock(&slap_counters.sc_mutex);
 
   a = attr_find(e->e_attrs, mi->mi_ad_monitorCounter);
   assert(a != NULL);
@@ -428,6 +428,7 @@ void backend_destroy_one(BackendDB *bd, int dynamic) {
   }
 
   ldap_pvt_thread_mutex_destroy(&bd->be_pcl_mutex);
+  ch_free(bd->be_latency);
 
   if (dynamic) {
     free(bd);
@@ -479,6 +480,7 @@ int backend_destroy(void) {
       free(bd->be_rootpw.bv_val);
     }
     acl_destroy(bd->be_acl);
+    ch_free(bd->be_latency);
     frontendDB = NULL;
   }
 
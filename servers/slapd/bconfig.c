@@ -156,8 +156,10 @@ static ConfigDriver config_tls_config;
 
 extern ConfigDriver config_syncrepl;
 extern ConfigDriver config_quorum;
+extern ConfigDriver config_opclass;
 static ConfigDriver config_biglock;
 static ConfigDriver config_reopenldap;
+static ConfigDriver config_threadsteal;
 extern ConfigDriver config_keepalive;
 
 enum {
@@ -215,6 +217,8 @@ enum {
   CFG_IX_HASH64,
   CFG_DISABLED,
   CFG_THREADQS,
+  CFG_LOGASYNC,
+  CFG_BINLOG,
   CFG_TLS_ECNAME,
   CFG_TLS_CACERT,
   CFG_TLS_CERT,
@@ -383,11 +387,28 @@ static ConfigTable config_back_cf_table[] = {
      "EQUALITY caseIgnoreMatch "
      "SYNTAX OMsDirectoryString SINGLE-VALUE X-ORDERED 'SIBLINGS' )",
      NULL, NULL},
+    {"binlog", "directory", 2, 2, 0, ARG_STRING | ARG_MAGIC | CFG_BINLOG,
+     &config_generic,
+     "( OLcfgGlAt:109 NAME 'olcBinlog' "
+     "SYNTAX OMsDirectoryString SINGLE-VALUE )",
+     NULL, NULL},
+    {"binlog-keep", "segments", 2, 2, 0, ARG_INT, &slap_binlog_keep,
+     "( OLcfgGlAt:110 NAME 'olcBinlogKeep' "
+     "SYNTAX OMsInteger SINGLE-VALUE )",
+     NULL, NULL},
+    {"binlog-size", "bytes", 2, 2, 0, ARG_ULONG, &slap_binlog_size,
+     "( OLcfgGlAt:111 NAME 'olcBinlogSize' "
+     "SYNTAX OMsInteger SINGLE-VALUE )",
+     NULL, NULL},
     {"concurrency", "level", 2, 2, 0, ARG_INT | ARG_MAGIC | CFG_CONCUR,
      &config_generic,
      "( OLcfgGlAt:10 NAME 'olcConcurrency' "
      "SYNTAX OMsInteger SINGLE-VALUE )",
      NULL, NULL},
+    {"conn_max_executing", "max", 2, 2, 0, ARG_INT, &slap_conn_max_executing,
+     "( OLcfgGlAt:113 NAME 'olcConnMaxExecuting' "
+     "SYNTAX OMsInteger SINGLE-VALUE )",
+     NULL, NULL},
     {"conn_max_pending", "max", 2, 2, 0, ARG_INT, &slap_conn_max_pending,
      "( OLcfgGlAt:11 NAME 'olcConnMaxPending' "
      "SYNTAX OMsInteger SINGLE-VALUE )",
@@ -470,6 +491,11 @@ static ConfigTable config_back_cf_table[] = {
      "( OLcfgGlAt:23 NAME 'olcIndexSubstrAnyStep' "
      "SYNTAX OMsInteger SINGLE-VALUE )",
      NULL, NULL},
+    {"index_hash64", "on|off", 2, 2, 0, ARG_ON_OFF | ARG_MAGIC | CFG_IX_HASH64,
+     &config_generic,
+     "( OLcfgGlAt:104 NAME 'olcIndexHash64' "
+     "SYNTAX OMsBoolean SINGLE-VALUE )",
+     NULL, NULL},
     {"index_intlen", "len", 2, 2, 0, ARG_UINT | ARG_MAGIC | CFG_IX_INTLEN,
      &config_generic,
      "( OLcfgGlAt:84 NAME 'olcIndexIntLen' "
@@ -507,6 +533,11 @@ static ConfigTable config_back_cf_table[] = {
      "( OLcfgGlAt:26 NAME 'olcLocalSSF' "
      "SYNTAX OMsInteger SINGLE-VALUE )",
      NULL, NULL},
+    {"logasync", "bytes", 2, 2, 0, ARG_INT | ARG_MAGIC | CFG_LOGASYNC,
+     &config_generic,
+     "( OLcfgGlAt:108 NAME 'olcLogAsync' "
+     "SYNTAX OMsInteger SINGLE-VALUE )",
+     NULL, NULL},
     {"logfile", "file", 2, 2, 0, ARG_STRING | ARG_MAGIC | CFG_LOGFILE,
      &config_generic,
      "( OLcfgGlAt:27 NAME 'olcLogFile' "
@@ -575,6 +606,17 @@ static ConfigTable config_back_cf_table[] = {
      "( OLcfgGlAt:35 NAME 'olcPasswordCryptSaltFormat' "
      "SYNTAX OMsDirectoryString SINGLE-VALUE )",
      NULL, NULL},
+    {"opclass", "name> <selectors", 2, 0, 0,
+#ifdef NO_THREADS
+     ARG_IGNORED, NULL,
+#else
+     ARG_MAGIC, &config_opclass,
+#endif
+     "( OLcfgGlAt:107 NAME 'olcOpClass' "
+     "DESC 'Priority classes of operations' "
+     "EQUALITY caseIgnoreMatch "
+     "SYNTAX OMsDirectoryString X-ORDERED 'VALUES' )",
+     NULL, NULL},
     {"password-hash", "hash", 2, 0, 0, ARG_MAGIC, &config_passwd_hash,
      "( OLcfgGlAt:36 NAME 'olcPasswordHash' "
      "EQUALITY caseIgnoreMatch "
@@ -603,6 +645,10 @@ static ConfigTable config_back_cf_table[] = {
      "( OLcfgGlAt:39 NAME 'olcPluginLogFile' "
      "SYNTAX OMsDirectoryString SINGLE-VALUE )",
      NULL, NULL},
+    {"readahead", "bytes", 2, 2, 0, ARG_BER_LEN_T, &slap_readahead,
+     "( OLcfgGlAt:112 NAME 'olcReadahead' "
+     "SYNTAX OMsInteger SINGLE-VALUE )",
+     NULL, NULL},
     {"readonly", "on|off", 2, 2, 0,
      ARG_MAY_DB | ARG_ON_OFF | ARG_MAGIC | CFG_RO, &config_generic,
      "( OLcfgGlAt:40 NAME 'olcReadOnly' "
@@ -791,6 +837,25 @@ static ConfigTable config_back_cf_table[] = {
      "( OLcfgGlAt:66 NAME 'olcThreads' "
      "SYNTAX OMsInteger SINGLE-VALUE )",
      NULL, NULL},
+    {"threadqueues", "count", 2, 2, 0,
+#ifdef NO_THREADS
+     ARG_IGNORED, NULL,
+#else
+     ARG_INT | ARG_MAGIC | CFG_THREADQS, &config_generic,
+#endif
+     "( OLcfgGlAt:95 NAME 'olcThreadQueues' "
+     "SYNTAX OMsInteger SINGLE-VALUE )",
+     NULL, NULL},
+    {"threadsteal", "off|on|pin", 2, 2, 0,
+#ifdef NO_THREADS
+     ARG_IGNORED, NULL,
+#else
+     ARG_MAGIC, &config_threadsteal,
+#endif
+     "( OLcfgGlAt:106 NAME 'olcThreadSteal' "
+     "EQUALITY caseIgnoreMatch "
+     "SYNTAX OMsDirectoryString SINGLE-VALUE )",
+     NULL, NULL},
     {"timelimit", "limit", 2, 0, 0, ARG_MAY_DB | ARG_MAGIC, &config_timelimit,
      "( OLcfgGlAt:67 NAME 'olcTimeLimit' "
      "SYNTAX OMsDirectoryString SINGLE-VALUE )",
@@ -944,6 +1009,10 @@ static ConfigTable config_back_cf_table[] = {
      "( OLcfgGlAt:88 NAME 'olcWriteTimeout' "
      "SYNTAX OMsInteger SINGLE-VALUE )",
      NULL, NULL},
+    {"writebatch", "bytes", 2, 2, 0, ARG_BER_LEN_T, &slap_write_batch,
+     "( OLcfgGlAt:105 NAME 'olcWriteBatch' "
+     "SYNTAX OMsInteger SINGLE-VALUE )",
+     NULL, NULL},
 
     {"crash-backtrace", "on|off", 2, 2, 0,
      ARG_ON_OFF | ARG_MAGIC | CFG_BACKTRACE, &config_generic,
@@ -1030,26 +1099,31 @@ static ConfigOCs cf_ocs[] = {
      "SUP olcConfig STRUCTURAL "
      "MAY ( cn $ olcConfigFile $ olcConfigDir $ olcAllows $ olcArgsFile $ "
      "olcAttributeOptions $ olcAuthIDRewrite $ "
-     "olcAuthzPolicy $ olcAuthzRegexp $ olcConcurrency $ "
-     "olcConnMaxPending $ olcConnMaxPendingAuth $ "
+     "olcAuthzPolicy $ olcAuthzRegexp $ olcBinlog $ olcBinlogKeep $ "
+     "olcBinlogSize $ olcConcurrency $ "
+     "olcConnMaxExecuting $ olcConnMaxPending $ olcConnMaxPendingAuth $ "
      "olcDisallows $ olcGentleHUP $ olcIdleTimeout $ "
      "olcIndexSubstrIfMaxLen $ olcIndexSubstrIfMinLen $ "
      "olcIndexSubstrAnyLen $ olcIndexSubstrAnyStep $ olcIndexIntLen $ "
-     "olcListenerThreads $ olcLocalSSF $ olcLogFile $ olcLogLevel $ "
+     "olcIndexHash64 $ "
+     "olcListenerThreads $ olcLocalSSF $ olcLogAsync $ olcLogFile $ "
+     "olcLogLevel $ "
+     "olcOpClass $ "
      "olcPasswordCryptSaltFormat $ olcPasswordHash $ olcPidFile $ "
-     "olcPluginLogFile $ olcReadOnly $ olcReferral $ "
+     "olcPluginLogFile $ olcReadahead $ olcReadOnly $ olcReferral $ "
      "olcReplogFile $ olcRequires $ olcRestrict $ olcReverseLookup $ "
      "olcRootDSE $ "
      "olcSaslAuxprops $ olcSaslHost $ olcSaslRealm $ olcSaslSecProps $ "
      "olcSecurity $ olcServerID $ olcSizeLimit $ "
      "olcSockbufMaxIncoming $ olcSockbufMaxIncomingAuth $ "
      "olcTCPBuffer $ "
-     "olcThreads $ olcTimeLimit $ olcTLSCACertificateFile $ "
+     "olcThreads $ olcThreadQueues $ olcThreadSteal $ olcTimeLimit $ olcTLSCACertificateFile $ "
      "olcTLSCACertificatePath $ olcTLSCertificateFile $ "
      "olcTLSCertificateKeyFile $ olcTLSCipherSuite $ olcTLSCRLCheck $ "
      "olcTLSCACertificate $ olcTLSCertificate $ olcTLSCertificateKey $ "
      "olcTLSRandFile $ olcTLSVerifyClient $ olcTLSDHParamFile $ "
-     "olcTLSCRLFile $ olcTLSProtocolMin $ olcToolThreads $ olcWriteTimeout $ "
+     "olcTLSCRLFile $ olcTLSProtocolMin $ olcToolThreads $ olcWriteBatch $ "
+     "olcWriteTimeout $ "
      "olcObjectIdentifier $ olcAttributeTypes $ olcObjectClasses $ "
      "olcCrashBacktrace $ olcMemoryLimit $ olcCoredumpLimit $ olcReOpenLDAP $ "
      "olcDitContentRules $ olcLdapSyntaxes ) )",
@@ -1150,6 +1224,12 @@ static int config_generic(ConfigArgs *c) {
     case CFG_THREADS:
       c->value_int = connection_pool_max;
       break;
+    case CFG_THREADQS:
+      c->value_int = connection_pool_queues;
+      break;
+    case CFG_LOGASYNC:
+      c->value_int = slap_log_async;
+      break;
     case CFG_TTHREADS:
       c->value_int = slap_tool_thread_max;
       break;
@@ -1350,6 +1430,12 @@ static int config_generic(ConfigArgs *c) {
       else
         rc = 1;
       break;
+    case CFG_BINLOG:
+      if (slap_binlog_dir)
+        c->value_string = ch_strdup(slap_binlog_dir);
+      else
+        rc = 1;
+      break;
     case CFG_LASTMOD:
       c->value_int = (SLAP_NOLASTMOD(c->be) == 0);
       break;
@@ -1374,6 +1460,11 @@ static int config_generic(ConfigArgs *c) {
     case CFG_IX_INTLEN:
       c->value_int = index_intlen;
       break;
+    case CFG_IX_HASH64:
+      c->value_int = slap_hash64(-1);
+      if (!c->value_int)
+        rc = 1;
+      break;
     case CFG_SORTVALS: {
       ADlist *sv;
       rc = 1;
@@ -1457,6 +1548,7 @@ static int config_generic(ConfigArgs *c) {
     /* single-valued attrs, no-ops */
     case CFG_CONCUR:
     case CFG_THREADS:
+    case CFG_THREADQS:
     case CFG_TTHREADS:
     case CFG_LTHREADS:
     case CFG_RO:
@@ -1493,6 +1585,18 @@ static int config_generic(ConfigArgs *c) {
       passwd_salt = NULL;
       break;
 
+    case CFG_LOGASYNC:
+      if (slapMode & SLAP_SERVER_RUNNING)
+        ldap_debug_async(0);
+      slap_log_async = 0;
+      break;
+
+    case CFG_BINLOG:
+      slap_binlog_close();
+      ch_free(slap_binlog_dir);
+      slap_binlog_dir = NULL;
+      break;
+
     case CFG_LOGFILE:
       ch_free(logfileName);
       logfileName = NULL;
@@ -1528,6 +1632,15 @@ static int config_generic(ConfigArgs *c) {
       index_intlen_strlen = SLAP_INDEX_INTLEN_STRLEN(SLAP_INDEX_INTLEN_DEFAULT);
       break;
 
+    case CFG_IX_HASH64:
+      if (slap_hash64(-1)) {
+        snprintf(c->cr_msg, sizeof(c->cr_msg),
+                 "<%s> can not be changed online", c->argv[0]);
+        Debug(LDAP_DEBUG_ANY, "%s: %s\n", c->log, c->cr_msg);
+        rc = 1;
+      }
+      break;
+
     case CFG_ACL:
       if (c->valx < 0) {
         acl_destroy(c->be->be_acl);
@@ -1786,6 +1899,35 @@ static int config_generic(ConfigArgs *c) {
     connection_pool_max = c->value_int; /* save for reference */
     break;
 
+  case CFG_THREADQS:
+    if (c->value_int < 1) {
+      snprintf(c->cr_msg, sizeof(c->cr_msg),
+               "threadqueues=%d smaller than minimum value 1", c->value_int);
+      Debug(LDAP_DEBUG_ANY, "%s: %s.\n", c->log, c->cr_msg);
+      return ARG_BAD_CONF;
+    }
+    if (slapMode & SLAP_SERVER_MODE)
+      ldap_pvt_thread_pool_queues(&connection_pool, c->value_int);
+    connection_pool_queues = c->value_int; /* save for reference */
+    break;
+
+  case CFG_LOGASYNC:
+    if (c->value_int < 0) {
+      snprintf(c->cr_msg, sizeof(c->cr_msg), "invalid size %d", c->value_int);
+      Debug(LDAP_DEBUG_ANY, "%s: %s.\n", c->log, c->cr_msg);
+      return ARG_BAD_CONF;
+    }
+    /* the writer thread is started once the server is running, after the
+     * fork of lutil_detach() */
+    if ((slapMode & SLAP_SERVER_RUNNING) &&
+        ldap_debug_async(c->value_int) != 0) {
+      snprintf(c->cr_msg, sizeof(c->cr_msg), "unable to start the log writer");
+      Debug(LDAP_DEBUG_ANY, "%s: %s.\n", c->log, c->cr_msg);
+      return ARG_BAD_CONF;
+    }
+    slap_log_async = c->value_int;
+    break;
+
   case CFG_TTHREADS:
     if (slapMode & SLAP_TOOL_MODE)
       ldap_pvt_thread_pool_maxthreads(&connection_pool, c->value_int);
@@ -2014,6 +2156,17 @@ static int config_generic(ConfigArgs *c) {
     index_intlen_strlen = SLAP_INDEX_INTLEN_STRLEN(index_intlen);
     break;
 
+  case CFG_IX_HASH64:
+    /* keys already stored would no longer be found */
+    if (CONFIG_ONLINE_ADD(c) && c->value_int != slap_hash64(-1)) {
+      snprintf(c->cr_msg, sizeof(c->cr_msg),
+               "<%s> can not be changed online", c->argv[0]);
+      Debug(LDAP_DEBUG_ANY, "%s: %s\n", c->log, c->cr_msg);
+      return 1;
+    }
+    slap_hash64(c->value_int);
+    break;
+
   case CFG_SORTVALS: {
     ADlist *svnew = NULL, *svtail = NULL, *sv = NULL;
 
@@ -2178,6 +2331,25 @@ static int config_generic(ConfigArgs *c) {
     if (c->argc > 2)
       ldap_free_urldesc(lud);
   } break;
+  case CFG_BINLOG:
+    if (access(c->value_string, W_OK | X_OK) != 0) {
+      snprintf(c->cr_msg, sizeof(c->cr_msg), "<%s> %s: %s", c->argv[0],
+               c->value_string, STRERROR(errno));
+      Debug(LDAP_DEBUG_ANY, "%s: %s\n", c->log, c->cr_msg);
+      ch_free(c->value_string);
+      return ARG_BAD_CONF;
+    }
+    ch_free(slap_binlog_dir);
+    slap_binlog_dir = c->value_string;
+    c->value_string = NULL;
+    if ((slapMode & SLAP_SERVER_RUNNING) && slap_binlog_open() != 0) {
+      snprintf(c->cr_msg, sizeof(c->cr_msg), "<%s> unable to open the binlog",
+               c->argv[0]);
+      Debug(LDAP_DEBUG_ANY, "%s: %s\n", c->log, c->cr_msg);
+      return ARG_BAD_CONF;
+    }
+    break;
+
   case CFG_LOGFILE: {
     if (logfileName)
       ch_free(logfileName);
@@ -3366,6 +3538,42 @@ static int config_reopenldap(ConfigArgs *c) {
   return 0;
 }
 
+static int config_threadsteal(ConfigArgs *c) {
+  static const slap_verbmasks steal_ops[] = {
+      {BER_BVC("off"), 0},
+      {BER_BVC("on"), LDAP_PVT_THREAD_POOL_STEAL},
+      {BER_BVC("pin"), LDAP_PVT_THREAD_POOL_STEAL | LDAP_PVT_THREAD_POOL_PIN},
+      {BER_BVNULL, 0}};
+  struct berval bv;
+  int i;
+
+  if (c->op == SLAP_CONFIG_EMIT) {
+    if (enum_to_verb(steal_ops, connection_pool_sched, &bv) < 1)
+      return 1;
+    value_add_one(&c->rvalue_vals, &bv);
+    return 0;
+  } else if (c->op == LDAP_MOD_DELETE) {
+    i = 0;
+  } else {
+    i = verb_to_mask(c->argv[1], steal_ops);
+    if (BER_BVISNULL(&steal_ops[i].word)) {
+      snprintf(c->cr_msg, sizeof(c->cr_msg), "<%s> unknown mode", c->argv[0]);
+      Debug(LDAP_DEBUG_ANY, "%s: %s \"%s\"\n", c->log, c->cr_msg, c->argv[1]);
+      return ARG_BAD_CONF;
+    }
+    i = steal_ops[i].mask;
+  }
+  if ((slapMode & SLAP_SERVER_MODE) &&
+      ldap_pvt_thread_pool_sched(&connection_pool, i)) {
+    snprintf(c->cr_msg, sizeof(c->cr_msg),
+             "<%s> thread pinning is not supported", c->argv[0]);
+    Debug(LDAP_DEBUG_ANY, "%s: %s\n", c->log, c->cr_msg);
+    return ARG_BAD_CONF;
+  }
+  connection_pool_sched = i;
+  return 0;
+}
+
 static int config_rootdn(ConfigArgs *c) {
   if (c->op == SLAP_CONFIG_EMIT) {
     if (!BER_BVISNULL(&c->be->be_rootdn)) {
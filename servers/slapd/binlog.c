@@ -0,0 +1,315 @@
+/* $ReOpenLDAP$ */
+/* Copyright 2018 ReOpenLDAP AUTHORS: please see AUTHORS file.
+ * All rights reserved.
+ *
+ * This file is part of ReOpenLDAP.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+/* binlog.c - structured access log
+ *
+ * A fixed size record per operation, for the tools to filter and
+ * aggregate without parsing the stats log. The records are appended to
+ * a memory mapped segment file: a writer reserves its space by an atomic
+ * add to the segment offset and fills it in without further locking.
+ * The writer which passes the mark near the end of the segment switches
+ * to a new one, under the write lock which waits for the others to
+ * finish their records. Should the new segment fail, the tail of the
+ * current one takes the records meanwhile and the switch is retried a
+ * second later; the records which find it full are lost. */
+
+#include "reldap.h"
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/mman.h>
+
+#include <ac/errno.h>
+#include <ac/string.h>
+#include <ac/time.h>
+#include <ac/unistd.h>
+
+#include "slap.h"
+
+#define BINLOG_SIZE_MIN (1ul << 20)
+#define BINLOG_TEXT_MAX 0xffff
+#define BINLOG_RETRY_NS 1000000000ull
+
+char *slap_binlog_dir;
+unsigned long slap_binlog_size = 64ul << 20;
+int slap_binlog_keep;
+
+typedef struct binlog_seg {
+  char *bs_base;
+  size_t bs_size;
+  size_t bs_mark; /* past it a new segment is started */
+  size_t bs_tail; /* the end of the records, once one did not fit */
+  volatile size_t bs_off;
+  volatile uint64_t bs_retry; /* when to try for a new segment again */
+  int bs_fd;
+} binlog_seg;
+
+static binlog_seg *binlog_cur;
+static ldap_pvt_thread_rdwr_t binlog_rwlock;
+static unsigned binlog_seq;
+
+static binlog_seg *binlog_seg_open(void) {
+  char path[MAXPATHLEN];
+  slap_binlog_hdr *bh;
+  binlog_seg *bs;
+  struct timeval tv;
+  struct tm tm;
+  size_t size = slap_binlog_size;
+  int fd, rc;
+
+  if (size < BINLOG_SIZE_MIN)
+    size = BINLOG_SIZE_MIN;
+  size = (size + 4095) & ~(size_t)4095;
+
+  gettimeofday(&tv, NULL);
+  gmtime_r(&tv.tv_sec, &tm);
+  do {
+    snprintf(path, sizeof(path),
+             "%s/" SLAP_BINLOG_PREFIX "%04d%02d%02d%02d%02d%02d-%06u",
+             slap_binlog_dir, tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+             tm.tm_hour, tm.tm_min, tm.tm_sec, ++binlog_seq);
+    fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+  } while (fd < 0 && errno == EEXIST);
+  if (fd < 0) {
+    rc = errno;
+    goto fail;
+  }
+
+  /* allocate the blocks now, a store to a hole of a full disk
+   * would be a SIGBUS */
+  rc = posix_fallocate(fd, 0, size);
+  if (rc == 0) {
+    bs = ch_malloc(sizeof(binlog_seg));
+    bs->bs_base =
+        mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (bs->bs_base != MAP_FAILED) {
+      bs->bs_size = size;
+      bs->bs_mark = size - size / 8;
+      bs->bs_tail = size;
+      bs->bs_off = sizeof(slap_binlog_hdr);
+      bs->bs_retry = 0;
+      bs->bs_fd = fd;
+      bh = (slap_binlog_hdr *)bs->bs_base;
+      memcpy(bh->bh_magic, SLAP_BINLOG_MAGIC, sizeof(bh->bh_magic));
+      bh->bh_version = SLAP_BINLOG_VERSION;
+      bh->bh_recsize = sizeof(slap_binlog_rec);
+      bh->bh_time = tv.tv_sec * 1000000ull + tv.tv_usec;
+      return bs;
+    }
+    rc = errno;
+    ch_free(bs);
+  }
+  close(fd);
+  unlink(path);
+
+fail:
+  Debug(LDAP_DEBUG_ANY, "binlog: unable to create segment \"%s\": %s (%d)\n",
+        path, STRERROR(rc), rc);
+  return NULL;
+}
+
+/* Cut the unused tail off and unmap. The caller holds the write lock. */
+static void binlog_seg_close(binlog_seg *bs) {
+  size_t used = bs->bs_off;
+
+  if (used > bs->bs_tail)
+    used = bs->bs_tail;
+  munmap(bs->bs_base, bs->bs_size);
+  if (ftruncate(bs->bs_fd, used) != 0)
+    Debug(LDAP_DEBUG_ANY, "binlog: truncate failed: %s\n", STRERROR(errno));
+  close(bs->bs_fd);
+  ch_free(bs);
+}
+
+static int binlog_cmp(const void *a, const void *b) {
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/* Remove the oldest segments beyond slap_binlog_keep, the names sort
+ * in the order of creation. */
+static void binlog_prune(void) {
+  char path[MAXPATHLEN], **names = NULL;
+  struct dirent *de;
+  int i, n = 0, max = 0;
+  DIR *dir;
+
+  if (slap_binlog_keep <= 0 || (dir = opendir(slap_binlog_dir)) == NULL)
+    return;
+  while ((de = readdir(dir)) != NULL) {
+    if (strncmp(de->d_name, SLAP_BINLOG_PREFIX, STRLENOF(SLAP_BINLOG_PREFIX)))
+      continue;
+    if (n == max) {
+      max = max ? max * 2 : 64;
+      names = ch_realloc(names, max * sizeof(char *));
+    }
+    names[n++] = ch_strdup(de->d_name);
+  }
+  closedir(dir);
+
+  qsort(names, n, sizeof(char *), binlog_cmp);
+  for (i = 0; i < n; i++) {
+    if (i < n - slap_binlog_keep) {
+      snprintf(path, sizeof(path), "%s/%s", slap_binlog_dir, names[i]);
+      unlink(path);
+    }
+    ch_free(names[i]);
+  }
+  ch_free(names);
+}
+
+/* Switch from the segment to a new one, if it is still the current one.
+ * Without the new one the records go on to the old one. */
+static void binlog_rotate(binlog_seg *old) {
+  binlog_seg *bs;
+
+  ldap_pvt_thread_rdwr_wlock(&binlog_rwlock);
+  if (binlog_cur == old) {
+    bs = binlog_seg_open();
+    if (bs) {
+      binlog_cur = bs;
+      binlog_seg_close(old);
+      binlog_prune();
+    } else {
+      Debug(LDAP_DEBUG_ANY,
+            "binlog: no new segment, %s, retrying in a second\n",
+            old->bs_off < old->bs_size ? "going on with the current one"
+                                       : "records are lost");
+    }
+  }
+  ldap_pvt_thread_rdwr_wunlock(&binlog_rwlock);
+}
+
+void slap_binlog_init(void) { ldap_pvt_thread_rdwr_init(&binlog_rwlock); }
+
+void slap_binlog_destroy(void) {
+  slap_binlog_close();
+  ldap_pvt_thread_rdwr_destroy(&binlog_rwlock);
+}
+
+int slap_binlog_open(void) {
+  int rc = 0;
+
+  ldap_pvt_thread_rdwr_wlock(&binlog_rwlock);
+  if (binlog_cur) {
+    binlog_seg_close(binlog_cur);
+    binlog_cur = NULL;
+  }
+  if (slap_binlog_dir) {
+    binlog_cur = binlog_seg_open();
+    if (binlog_cur)
+      binlog_prune();
+    else
+      rc = -1;
+  }
+  ldap_pvt_thread_rdwr_wunlock(&binlog_rwlock);
+  return rc;
+}
+
+void slap_binlog_close(void) {
+  ldap_pvt_thread_rdwr_wlock(&binlog_rwlock);
+  if (binlog_cur) {
+    binlog_seg_close(binlog_cur);
+    binlog_cur = NULL;
+  }
+  ldap_pvt_thread_rdwr_wunlock(&binlog_rwlock);
+}
+
+static uint32_t binlog_us(uint64_t ns) {
+  ns /= 1000;
+  return ns > UINT32_MAX ? UINT32_MAX : ns;
+}
+
+/* Append the record of an operation, once: from send_ldap_response()
+ * for the final response, or at the end of connection_operation() for
+ * those without a response. rs is NULL in the latter case. */
+void slap_binlog_put(Operation *op, SlapReply *rs) {
+  struct berval base = BER_BVNULL, filter = BER_BVNULL;
+  slap_binlog_rec rec;
+  binlog_seg *bs;
+  uint64_t now, run;
+  struct timeval tv;
+  size_t len;
+
+  if (!binlog_cur || !op->o_start_ns)
+    return;
+
+  now = ldap_now_steady_ns();
+  run = now - op->o_start_ns;
+  gettimeofday(&tv, NULL);
+
+  memset(&rec, 0, sizeof(rec));
+  rec.br_op = slap_req2op(op->o_tag);
+  rec.br_scope = 0xff;
+  rec.br_time = tv.tv_sec * 1000000ull + tv.tv_usec;
+  rec.br_connid = op->o_connid;
+  rec.br_opid = op->o_opid;
+  rec.br_result = rs ? rs->sr_err : -1;
+  rec.br_queue_us = binlog_us(op->o_start_ns - op->o_stamp_ns);
+  rec.br_exec_us = binlog_us(run > op->o_send_ns ? run - op->o_send_ns : 0);
+  rec.br_send_us = binlog_us(op->o_send_ns);
+
+  if (op->o_req_dn.bv_val)
+    base = op->o_req_dn;
+  if (op->o_tag == LDAP_REQ_SEARCH) {
+    rec.br_scope = op->ors_scope;
+    if (rs)
+      rec.br_nentries = rs->sr_nentries;
+    if (op->ors_filterstr.bv_val)
+      filter = op->ors_filterstr;
+  }
+  if (base.bv_len > BINLOG_TEXT_MAX)
+    base.bv_len = BINLOG_TEXT_MAX;
+  if (filter.bv_len > BINLOG_TEXT_MAX)
+    filter.bv_len = BINLOG_TEXT_MAX;
+  rec.br_baselen = base.bv_len;
+  rec.br_filterlen = filter.bv_len;
+  len = (sizeof(rec) + base.bv_len + filter.bv_len + 7) & ~(size_t)7;
+
+  ldap_pvt_thread_rdwr_rlock(&binlog_rwlock);
+  bs = binlog_cur;
+  while (bs != NULL) {
+    size_t off = __sync_fetch_and_add(&bs->bs_off, len);
+    uint64_t retry = bs->bs_retry;
+    int written = 0;
+
+    if (off + len <= bs->bs_size) {
+      char *ptr = bs->bs_base + off;
+
+      memcpy(ptr, &rec, sizeof(rec));
+      memcpy(ptr + sizeof(rec), base.bv_val, base.bv_len);
+      memcpy(ptr + sizeof(rec) + base.bv_len, filter.bv_val, filter.bv_len);
+      __sync_synchronize();
+      ((slap_binlog_rec *)ptr)->br_len = len;
+      written = 1;
+    } else if (off < bs->bs_size) {
+      /* the one reservation across the end, no record goes past it */
+      bs->bs_tail = off;
+    }
+
+    /* past the mark, one writer a second goes for a new segment */
+    if (off + len <= bs->bs_mark || now < retry ||
+        !__sync_bool_compare_and_swap(&bs->bs_retry, retry,
+                                      now + BINLOG_RETRY_NS))
+      break;
+    ldap_pvt_thread_rdwr_runlock(&binlog_rwlock);
+    binlog_rotate(bs);
+    ldap_pvt_thread_rdwr_rlock(&binlog_rwlock);
+    bs = written ? NULL : binlog_cur;
+  }
+  ldap_pvt_thread_rdwr_runlock(&binlog_rwlock);
+
+  op->o_start_ns = 0;
+}
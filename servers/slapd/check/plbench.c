@@ -0,0 +1,122 @@
+/* $ReOpenLDAP$ */
+/* Copyright 2018 ReOpenLDAP AUTHORS: please see AUTHORS file.
+ * All rights reserved.
+ *
+ * This file is part of ReOpenLDAP.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+/* Benchmark of the syncrepl present list.
+ *
+ * usage: plbench [entries]
+ *
+ * The present phase of a refresh is replayed twice, with time-based
+ * UUIDs which differ in a few octets only, then with random ones: the
+ * UUIDs of <entries> entries (1M by default) are inserted, then those of
+ * 1% more entries are looked up and the present ones deleted, the way
+ * syncrepl_del_nonpresent() goes through the database. The time of both
+ * steps and the peak RSS of the process are reported. */
+
+#define CH_FREE 1 /* the stubs below use free() */
+#include "reldap.h"
+
+#include <stdio.h>
+#include <ac/stdlib.h>
+#include <ac/string.h>
+#include <ac/time.h>
+#include <sys/resource.h>
+
+#include "slap.h"
+#include "presentlist.h"
+
+void *ch_calloc(ber_len_t nelem, ber_len_t size) {
+  void *p = calloc(nelem, size);
+  if (!p)
+    abort();
+  return p;
+}
+
+void ch_free(void *p) { free(p); }
+
+/* time_low counts up, the rest of the UUID stays */
+static void uuid_time(char *uuid, size_t i) {
+  uint32_t tl = (uint32_t)(i * 7 + 12345);
+
+  memcpy(uuid, &tl, 4);
+  memset(uuid + 4, 0x11, UUIDLEN - 6);
+  uuid[14] = 0x42;
+  uuid[15] = 0x24;
+}
+
+static void uuid_random(char *uuid, size_t i) {
+  uint64_t x = i * UINT64_C(0x9E3779B97F4A7C15) + 1, y;
+
+  x ^= x >> 31;
+  x *= UINT64_C(0xBF58476D1CE4E5B9);
+  x ^= x >> 29;
+  y = x * UINT64_C(0x94D049BB133111EB);
+  y ^= y >> 32;
+  memcpy(uuid, &x, 8);
+  memcpy(uuid + 8, &y, 8);
+}
+
+static double now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int run(const char *name, void (*gen)(char *, size_t), size_t n) {
+  presentlist_t list;
+  struct rusage ru;
+  char uuid[UUIDLEN];
+  struct berval bv = {UUIDLEN, uuid};
+  size_t i, added = 0, hits = 0;
+  double t0, t1, t2;
+
+  memset(&list, 0, sizeof(list));
+  t0 = now();
+  for (i = 0; i < n; i++) {
+    gen(uuid, i);
+    added += presentlist_insert(&list, &bv);
+  }
+  t1 = now();
+  for (i = 0; i < n + n / 100; i++) {
+    gen(uuid, i);
+    if (presentlist_find(&list, &bv)) {
+      presentlist_delete(&list, &bv);
+      hits++;
+    }
+  }
+  t2 = now();
+  getrusage(RUSAGE_SELF, &ru);
+
+  printf("%-6s %zu entries: insert %.2fs, lookup+delete %.2fs, "
+         "peak RSS %ld MB\n",
+         name, n, t1 - t0, t2 - t1, ru.ru_maxrss / 1024);
+  if (added != n || hits != n || !presentlist_empty(&list)) {
+    printf("%zu inserted, %zu found of %zu\n", added, hits, n);
+    return 1;
+  }
+  presentlist_free(&list);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+  int fail;
+
+  fail = run("time", uuid_time, n);
+  fail |= run("random", uuid_random, n);
+
+  printf("%s\n", fail ? "FAILED" : "ok");
+  return fail ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -66,6 +66,10 @@ struct berval default_search_nbase = BER_BVNULL;
 ber_len_t sockbuf_max_incoming = SLAP_SB_MAX_INCOMING_DEFAULT;
 ber_len_t sockbuf_max_incoming_auth = SLAP_SB_MAX_INCOMING_AUTH;
 
+ber_len_t slap_write_batch = SLAP_WRITE_BATCH_DEFAULT;
+ber_len_t slap_readahead;
+
+int slap_conn_max_executing;
 int slap_conn_max_pending = SLAP_CONN_MAX_PENDING_DEFAULT;
 int slap_conn_max_pending_auth = SLAP_CONN_MAX_PENDING_AUTH;
 
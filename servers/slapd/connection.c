@@ -37,7 +37,10 @@
 #include "slapi/slapi.h"
 #endif
 
-/* protected by connections_mutex */
+/* protected by connections_mutex.
+ * c_struct_state only changes with both connections_mutex and the
+ * connection's c_mutex held, so either lock is enough to read it;
+ * the per-PDU path in connection_get() takes c_mutex alone. */
 static ldap_pvt_thread_mutex_t connections_mutex;
 static Connection *connections = NULL;
 
@@ -72,15 +75,17 @@ typedef struct conn_readinfo {
   ldap_pvt_thread_start_t *func;
   void *arg;
   void *ctx;
-  int nullop;
 } conn_readinfo;
 
 static int connection_input(Connection *c, conn_readinfo *cri);
 static void connection_close(Connection *c);
 
 static int connection_op_activate(Operation *op);
+static void connection_op_drop(Connection *conn, Operation *op);
 static void connection_op_queue(Operation *op);
 static int connection_resched(Connection *conn);
+static int connection_pipeline(Connection *conn);
+static Operation *connection_op_next(Connection *conn);
 static void connection_abandon(Connection *conn);
 static void connection_destroy(Connection *c);
 
@@ -144,6 +149,7 @@ int connections_destroy(void) {
   for (i = 0; i < dtblsize; i++) {
     if (connections[i].c_struct_state != SLAP_C_UNINITIALIZED) {
       ber_sockbuf_free(connections[i].c_sb);
+      ch_free(connections[i].c_outbuf.bv_val);
       ldap_pvt_thread_mutex_destroy(&connections[i].c_mutex);
       ldap_pvt_thread_mutex_destroy(&connections[i].c_write1_mutex);
       ldap_pvt_thread_mutex_destroy(&connections[i].c_write2_mutex);
@@ -298,7 +304,6 @@ static Connection *connection_get(ber_socket_t s) {
   if (c != NULL) {
     ldap_pvt_thread_mutex_lock(&c->c_mutex);
 
-    ldap_pvt_thread_mutex_lock(&connections_mutex);
     assert(c->c_struct_state != SLAP_C_UNINITIALIZED);
     if (c->c_struct_state != SLAP_C_USED) {
       /* connection must have been closed due to resched */
@@ -306,7 +311,6 @@ static Connection *connection_get(ber_socket_t s) {
       Debug(LDAP_DEBUG_CONNS, "connection_get(%d): connection not used\n", s);
       assert(c->c_conn_state == SLAP_C_INVALID);
       assert(c->c_sd == AC_SOCKET_INVALID);
-      ldap_pvt_thread_mutex_unlock(&connections_mutex);
 
       ldap_pvt_thread_mutex_unlock(&c->c_mutex);
       return NULL;
@@ -327,7 +331,6 @@ static Connection *connection_get(ber_socket_t s) {
     {
       c->c_activitytime = ldap_now_steady();
     }
-    ldap_pvt_thread_mutex_unlock(&connections_mutex);
   }
 
   return c;
@@ -494,6 +497,8 @@ Connection *connection_init(
   c->c_n_ops_executing = 0;
   c->c_n_ops_pending = 0;
   c->c_n_ops_completed = 0;
+  c->c_n_runners = 0;
+  c->c_barrier = 0;
 
   c->c_n_get = 0;
   c->c_n_read = 0;
@@ -539,6 +544,14 @@ Connection *connection_init(
                        (void *)&sfd);
   }
 
+  if (slap_readahead && !(flags & CONN_IS_UDP)) {
+    /* requests are decoded in place from the receive ring */
+    ber_len_t size = slap_readahead;
+    ber_sockbuf_add_io(c->c_sb, &ber_sockbuf_io_readahead,
+                       LBER_SBIOD_LEVEL_PROVIDER, NULL);
+    ber_sockbuf_ctrl(c->c_sb, LBER_SB_OPT_SET_READAHEAD_RING, &size);
+  }
+
 #ifdef LDAP_DEBUG
   ber_sockbuf_add_io(c->c_sb, &ber_sockbuf_io_debug, INT_MAX, (void *)"ldap_");
 #endif
@@ -682,6 +695,12 @@ static void connection_destroy(Connection *c) {
     c->c_currentber = NULL;
   }
 
+  assert(c->c_batch_op == NULL);
+  ch_free(c->c_outbuf.bv_val);
+  BER_BVZERO(&c->c_outbuf);
+  c->c_outsize = 0;
+  c->c_outpdus = 0;
+
 #ifdef LDAP_SLAPI
   /* call destructors, then constructors; avoids unnecessary allocation */
   if (slapi_plugins_used) {
@@ -782,6 +801,7 @@ static void connection_abandon(Connection *c) {
     o->o_conn = NULL;
     slap_op_free(o, NULL);
   }
+  c->c_n_ops_pending = 0;
 }
 
 static int connection_wake_writers(Connection *c) {
@@ -858,14 +878,14 @@ static void connection_close(Connection *c) {
   connection_wake_writers(c);
 
   if (!LDAP_STAILQ_EMPTY(&c->c_ops) || !LDAP_STAILQ_EMPTY(&c->c_pending_ops) ||
-      c->c_writing) {
+      c->c_writing || c->c_n_runners) {
     Debug(LDAP_DEBUG_CONNS,
           "connection_close: deferring conn=%lu sd=%d (c_ops %s, c_pending_ops "
-          "%s, writers %d, writing %d)\n",
+          "%s, writers %d, writing %d, runners %d)\n",
           c->c_connid, c->c_sd,
           LDAP_STAILQ_EMPTY(&c->c_ops) ? "empty" : "still",
           LDAP_STAILQ_EMPTY(&c->c_pending_ops) ? "empty" : "still",
-          c->c_writers, c->c_writing);
+          c->c_writers, c->c_writing, c->c_n_runners);
     return;
   }
 
@@ -978,30 +998,19 @@ void connection_done(Connection *c) {
  */
 
 #ifdef SLAPD_MONITOR
-/* FIXME: returns 0 in case of failure */
 #define INCR_OP_INITIATED(index)                                               \
-  do {                                                                         \
-    ldap_pvt_thread_mutex_lock(&op->o_counters->sc_mutex);                     \
-    ldap_pvt_mp_add_ulong(op->o_counters->sc_ops_initiated_[(index)], 1);      \
-    ldap_pvt_thread_mutex_unlock(&op->o_counters->sc_mutex);                   \
-  } while (0)
+  slap_counters_add(op->o_counters, sc_ops_initiated_[(index)], 1)
 #define INCR_OP_COMPLETED(index)                                               \
   do {                                                                         \
-    ldap_pvt_thread_mutex_lock(&op->o_counters->sc_mutex);                     \
-    ldap_pvt_mp_add_ulong(op->o_counters->sc_ops_completed, 1);                \
-    ldap_pvt_mp_add_ulong(op->o_counters->sc_ops_completed_[(index)], 1);      \
-    ldap_pvt_thread_mutex_unlock(&op->o_counters->sc_mutex);                   \
+    slap_counters_add(op->o_counters, sc_ops_completed, 1);                    \
+    slap_counters_add(op->o_counters, sc_ops_completed_[(index)], 1);          \
   } while (0)
 #else /* !SLAPD_MONITOR */
 #define INCR_OP_INITIATED(index)                                               \
   do {                                                                         \
   } while (0)
 #define INCR_OP_COMPLETED(index)                                               \
-  do {                                                                         \
-    ldap_pvt_thread_mutex_lock(&op->o_counters->sc_mutex);                     \
-    ldap_pvt_mp_add_ulong(op->o_counters->sc_ops_completed, 1);                \
-    ldap_pvt_thread_mutex_unlock(&op->o_counters->sc_mutex);                   \
-  } while (0)
+  slap_counters_add(op->o_counters, sc_ops_completed, 1)
 #endif /* !SLAPD_MONITOR */
 
 /*
@@ -1014,74 +1023,47 @@ static BI_op_func *opfun[] = {do_bind,    do_unbind,   do_search, do_compare,
 /* Counters are per-thread, not per-connection.
  */
 static void conn_counter_destroy(void *key, void *data) {
-  slap_counters_t **prev, *sc;
-
-  ldap_pvt_thread_mutex_lock(&slap_counters.sc_mutex);
-  for (prev = &slap_counters.sc_next, sc = slap_counters.sc_next; sc;
-       prev = &sc->sc_next, sc = sc->sc_next) {
-    if (sc == data) {
-      int i;
-
-      *prev = sc->sc_next;
-      /* Copy data to main counter */
-      ldap_pvt_mp_add(slap_counters.sc_bytes, sc->sc_bytes);
-      ldap_pvt_mp_add(slap_counters.sc_pdu, sc->sc_pdu);
-      ldap_pvt_mp_add(slap_counters.sc_entries, sc->sc_entries);
-      ldap_pvt_mp_add(slap_counters.sc_refs, sc->sc_refs);
-      ldap_pvt_mp_add(slap_counters.sc_ops_initiated, sc->sc_ops_initiated);
-      ldap_pvt_mp_add(slap_counters.sc_ops_completed, sc->sc_ops_completed);
-#ifdef SLAPD_MONITOR
-      for (i = 0; i < SLAP_OP_LAST; i++) {
-        ldap_pvt_mp_add(slap_counters.sc_ops_initiated_[i],
-                        sc->sc_ops_initiated_[i]);
-        ldap_pvt_mp_add(slap_counters.sc_ops_initiated_[i],
-                        sc->sc_ops_completed_[i]);
-      }
-#endif /* SLAPD_MONITOR */
-      slap_counters_destroy(sc);
-      ber_memfree_x(data, NULL);
-      break;
-    }
-  }
-  ldap_pvt_thread_mutex_unlock(&slap_counters.sc_mutex);
+  slap_counters_free(data);
 }
 
 static void conn_counter_init(Operation *op, void *ctx) {
-  slap_counters_t *sc;
   void *vsc = NULL;
 
   if (ldap_pvt_thread_pool_getkey(ctx, (void *)conn_counter_init, &vsc, NULL) ||
       !vsc) {
-    vsc = ch_malloc(sizeof(slap_counters_t));
-    sc = vsc;
-    slap_counters_init(sc);
+    vsc = slap_counters_alloc();
     ldap_pvt_thread_pool_setkey(ctx, (void *)conn_counter_init, vsc,
                                 conn_counter_destroy, NULL, NULL);
-
-    ldap_pvt_thread_mutex_lock(&slap_counters.sc_mutex);
-    sc->sc_next = slap_counters.sc_next;
-    slap_counters.sc_next = sc;
-    ldap_pvt_thread_mutex_unlock(&slap_counters.sc_mutex);
   }
   op->o_counters = vsc;
 }
 
-static void *connection_operation(void *ctx, void *arg_v) {
+/* Per-connection limit of the operations executing at once */
+static int connection_max_executing(void) {
+  int max = connection_pool_max / 2;
+
+  if (slap_conn_max_executing > 0 && slap_conn_max_executing < max)
+    max = slap_conn_max_executing;
+  return max > 0 ? max : 1;
+}
+
+/* Execute the op, and return the next one of its connection to
+ * execute in the same thread, if any */
+static Operation *connection_op_execute(void *ctx, Operation *op) {
   int rc = LDAP_OTHER, cancel;
-  Operation *op = arg_v;
   SlapReply rs = {REP_RESULT};
+  Operation *next = NULL;
   ber_tag_t tag = op->o_tag;
   slap_op_t opidx = SLAP_OP_LAST;
   Connection *conn = op->o_conn;
   void *memctx = NULL;
   void *memctx_null = NULL;
   ber_len_t memsiz;
+  uint64_t start_ns = ldap_now_steady_ns();
 
   conn_counter_init(op, ctx);
-  ldap_pvt_thread_mutex_lock(&op->o_counters->sc_mutex);
-  /* FIXME: returns 0 in case of failure */
-  ldap_pvt_mp_add_ulong(op->o_counters->sc_ops_initiated, 1);
-  ldap_pvt_thread_mutex_unlock(&op->o_counters->sc_mutex);
+  op->o_start_ns = start_ns;
+  slap_counters_add(op->o_counters, sc_ops_initiated, 1);
 
   op->o_threadctx = ctx;
   op->o_tid = ldap_pvt_thread_pool_tid(ctx);
@@ -1111,6 +1093,12 @@ static void *connection_operation(void *ctx, void *arg_v) {
     goto operations_error;
   }
 
+  if (op->o_shed) {
+    send_ldap_error(op, &rs, LDAP_BUSY, "server is busy");
+    rc = LDAP_BUSY;
+    goto operations_error;
+  }
+
   if (slap_tsan__read_char(&conn->c_sasl_bind_in_progress) &&
       tag != LDAP_REQ_BIND) {
     Debug(LDAP_DEBUG_ANY,
@@ -1157,7 +1145,11 @@ static void *connection_operation(void *ctx, void *arg_v) {
   opidx = slap_req2op(tag);
   assert(opidx != SLAP_OP_LAST);
   INCR_OP_INITIATED(opidx);
+  if (tag == LDAP_REQ_SEARCH)
+    send_ldap_batch(op, 1);
   rc = (*(opfun[opidx]))(op, &rs);
+  if (tag == LDAP_REQ_SEARCH)
+    send_ldap_batch(op, 0);
 
 operations_error:
   if (rc == SLAPD_DISCONNECT) {
@@ -1168,6 +1160,11 @@ operations_error:
      * only if operation was initiated
      * and rc != SLAPD_DISCONNECT */
     INCR_OP_COMPLETED(opidx);
+#ifdef SLAPD_MONITOR
+    slap_latency_add(op, opidx, start_ns);
+#endif /* SLAPD_MONITOR */
+    /* unbind, abandon or a search abandoned, nothing was sent */
+    slap_binlog_put(op, NULL);
   }
 
   ldap_pvt_thread_mutex_lock(&conn->c_mutex);
@@ -1204,6 +1201,8 @@ operations_error:
   op->o_conn = NULL;
   conn->c_n_ops_executing--;
   conn->c_n_ops_completed++;
+  if (op->o_barrier)
+    conn->c_barrier = 0;
 
   switch (tag) {
   case LBER_ERROR:
@@ -1214,9 +1213,41 @@ operations_error:
     break;
   }
 
-  connection_resched(conn);
+  /* Go on with the pipelined ops while we hold the lock anyway, unless
+   * this thread runs a class of its own or the pool wants to pause */
+  if (!op->o_opclass && !ldap_pvt_thread_pool_pausing(&connection_pool))
+    next = connection_op_next(conn);
+  if (connection_resched(conn))
+    next = connection_op_next(conn);
   ldap_pvt_thread_mutex_unlock(&conn->c_mutex);
   slap_op_free(op, ctx);
+  return next;
+}
+
+static void *connection_operation(void *ctx, void *arg_v) {
+  Operation *op = arg_v;
+
+  do {
+    op = connection_op_execute(ctx, op);
+  } while (op != NULL);
+  return NULL;
+}
+
+/* A task started for the ops waiting in c_pending_ops of a connection,
+ * it stays with the connection while there are more of them */
+static void *connection_runner(void *ctx, void *arg) {
+  Connection *conn = arg;
+  Operation *op;
+
+  ldap_pvt_thread_mutex_lock(&conn->c_mutex);
+  conn->c_n_runners--;
+  op = connection_op_next(conn);
+  if (op == NULL)
+    connection_resched(conn);
+  ldap_pvt_thread_mutex_unlock(&conn->c_mutex);
+
+  if (op != NULL)
+    connection_operation(ctx, op);
   return NULL;
 }
 
@@ -1276,7 +1307,7 @@ static int connection_read(ber_socket_t s, conn_readinfo *cri);
 
 static void *connection_read_thread(void *ctx, void *argv) {
   int rc;
-  conn_readinfo cri = {NULL, NULL, NULL, NULL, 0};
+  conn_readinfo cri = {NULL, NULL, NULL, NULL};
   ber_socket_t s = (long)argv;
 
   /*
@@ -1289,8 +1320,9 @@ static void *connection_read_thread(void *ctx, void *argv) {
     return (void *)(long)rc;
   }
 
-  /* execute a single queued request in the same thread */
-  if (cri.op && !cri.nullop) {
+  /* execute the first request in the same thread, and the pipelined
+   * ones which may follow */
+  if (cri.op) {
     rc = (long)connection_operation(ctx, cri.op);
   } else if (cri.func) {
     rc = (long)cri.func(ctx, cri.arg);
@@ -1363,6 +1395,21 @@ static int connection_read(ber_socket_t s, conn_readinfo *cri) {
   Debug(LDAP_DEBUG_TRACE, "connection_read(%d): checking for input on id=%lu\n",
         s, c->c_connid);
 
+  /* what the daemon has received meanwhile goes first */
+  rc = slapd_recv_take(s, c->c_sb);
+  if (rc > 0) {
+    slapd_set_read(s, 1);
+    connection_return(c);
+    return 0;
+  }
+  if (rc < 0) {
+    /* c_mutex is locked */
+    connection_closing(c, conn_lost_str);
+    connection_close(c);
+    connection_return(c);
+    return 0;
+  }
+
 #ifdef WITH_TLS
   if (c->c_is_tls && c->c_needs_tls_accept) {
     rc = ldap_pvt_tls_accept(c->c_sb, slap_tls_ctx);
@@ -1480,12 +1527,36 @@ static int connection_read(ber_socket_t s, conn_readinfo *cri) {
     slapd_set_write(s, 0);
   }
 
-  slapd_set_read(s, 1);
+  /* put the runners on the requests pipelined by this read, or run the
+   * first one here if the pool takes none */
+  if (c->c_conn_state == SLAP_C_ACTIVE && !c->c_writewaiter &&
+      connection_pipeline(c) && !cri->op && !cri->func)
+    cri->op = connection_op_next(c);
+
+  slapd_set_read_sb(s, c->c_sb, 1);
   connection_return(c);
 
   return 0;
 }
 
+/* StartTLS changes the stream under the ops around it, so it has to
+ * run alone on its connection. */
+static int connection_op_barrier(Operation *op) {
+  struct berval oid;
+  BerElement *ber;
+  ber_len_t len;
+  int rc = 0;
+
+  ber = ber_dup(op->o_ber);
+  if (ber == NULL)
+    return 0;
+  if (ber_skip_tag(ber, &len) == LDAP_REQ_EXTENDED &&
+      ber_get_stringbv(ber, &oid, LBER_BV_NOTERM) != LBER_ERROR)
+    rc = bvmatch(&oid, &slap_EXOP_START_TLS);
+  ber_free(ber, 0);
+  return rc;
+}
+
 static int connection_input(Connection *conn, conn_readinfo *cri) {
   Operation *op;
   ber_tag_t tag;
@@ -1498,6 +1569,7 @@ static int connection_input(Connection *conn, conn_readinfo *cri) {
   char *cdn = NULL;
 #endif
   char *defer = NULL;
+  int pipe = 0;
   void *ctx;
 
   if (conn->c_currentber == NULL &&
@@ -1659,13 +1731,18 @@ static int connection_input(Connection *conn, conn_readinfo *cri) {
 #endif /* LDAP_CONNECTIONLESS */
 
   rc = 0;
+  op->o_opclass = slap_opclass_select(op);
+  if (tag == LDAP_REQ_EXTENDED)
+    op->o_barrier = connection_op_barrier(op);
 
   /* Don't process requests when the conn is in the middle of a
-   * Bind, or if it's closing. Also, don't let any single conn
-   * use up all the available threads, and don't execute if we're
-   * currently blocked on output. And don't execute if there are
-   * already pending ops, let them go first.  Abandon operations
-   * get exceptions to some, but not all, cases.
+   * Bind or StartTLS, or if it's closing, and don't execute if
+   * we're currently blocked on output. The requests which follow
+   * the first one of a read, or other pending ops, or which would
+   * exceed the per-connection limit of executing ops are pipelined:
+   * queued to c_pending_ops for the runners of the connection to pick
+   * up in order. Abandon operations get exceptions to some, but not
+   * all, cases.
    */
   switch (tag) {
   default:
@@ -1676,15 +1753,19 @@ static int connection_input(Connection *conn, conn_readinfo *cri) {
     } else if (conn->c_writewaiter) {
       defer = "awaiting write";
       break;
-    } else if (conn->c_n_ops_pending) {
-      defer = "pending operations";
+    } else if (conn->c_barrier) {
+      defer = "StartTLS in progress";
+      break;
+    } else if (conn->c_n_ops_pending || (cri->op && !op->o_opclass) ||
+               (op->o_barrier && conn->c_n_ops_executing)) {
+      pipe = 1;
       break;
     }
     /* FALLTHRU */
   case LDAP_REQ_ABANDON:
     /* Unbind is exempt from these checks */
-    if (conn->c_n_ops_executing >= connection_pool_max / 2) {
-      defer = "too many executing";
+    if (conn->c_n_ops_executing >= connection_max_executing()) {
+      pipe = 1;
       break;
     } else if (conn->c_conn_state == SLAP_C_BINDING) {
       defer = "binding";
@@ -1695,13 +1776,14 @@ static int connection_input(Connection *conn, conn_readinfo *cri) {
     break;
   }
 
-  if (defer) {
+  if (defer || pipe) {
     int max =
         conn->c_dn.bv_len ? slap_conn_max_pending_auth : slap_conn_max_pending;
 
-    Debug(LDAP_DEBUG_ANY,
-          "connection_input: conn=%lu deferring operation: %s\n",
-          conn->c_connid, defer);
+    if (defer)
+      Debug(LDAP_DEBUG_ANY,
+            "connection_input: conn=%lu deferring operation: %s\n",
+            conn->c_connid, defer);
     LDAP_ASSERT(op->o_conn == conn);
     conn->c_n_ops_pending++;
     LDAP_STAILQ_INSERT_TAIL(&conn->c_pending_ops, op, o_next);
@@ -1710,23 +1792,32 @@ static int connection_input(Connection *conn, conn_readinfo *cri) {
   } else {
     conn->c_n_ops_executing++;
 
+    /* Its class is over its limits: refuse the op right away, from
+     * this thread, instead of queueing it. */
+    if (op->o_opclass &&
+        ldap_pvt_thread_pool_admit(&connection_pool, op->o_opclass)) {
+      op->o_opclass = 0;
+      op->o_shed = 1;
+    }
+
     /*
      * The first op will be processed in the same thread context,
-     * as long as there is only one op total.
-     * Subsequent ops will be submitted to the pool by
+     * unless it has a class to queue in, and so the pipelined ones
+     * after it, see connection_op_next().
+     * Classed ops, Abandon and Unbind are submitted to the pool by
      * calling connection_op_activate()
      */
-    if (cri->op == NULL) {
+    if (cri->op == NULL && !op->o_opclass) {
       /* the first incoming request */
       connection_op_queue(op);
       cri->op = op;
-    } else {
-      if (!cri->nullop) {
-        cri->nullop = 1;
-        rc = ldap_pvt_thread_pool_submit(&connection_pool, connection_operation,
-                                         (void *)cri->op);
+    } else if (connection_op_activate(op)) {
+      if (cri->op == NULL) {
+        cri->op = op;
+      } else {
+        connection_op_drop(conn, op);
+        rc = -1;
       }
-      connection_op_activate(op);
     }
   }
 
@@ -1742,8 +1833,6 @@ static int connection_input(Connection *conn, conn_readinfo *cri) {
 }
 
 static int connection_resched(Connection *conn) {
-  Operation *op;
-
   if (conn->c_writewaiter)
     return 0;
 
@@ -1761,9 +1850,21 @@ static int connection_resched(Connection *conn) {
     return 0;
   }
 
+  return connection_pipeline(conn);
+}
+
+/* Take the next pending op of the connection to execute, if it may
+ * start now. Ops of a class are submitted to their queue instead.
+ * c_mutex is locked. */
+static Operation *connection_op_next(Connection *conn) {
+  Operation *op;
+
   while ((op = LDAP_STAILQ_FIRST(&conn->c_pending_ops)) != NULL) {
     LDAP_ASSERT(conn == op->o_conn);
-    if (conn->c_n_ops_executing > connection_pool_max / 2)
+    if (conn->c_writewaiter || conn->c_conn_state != SLAP_C_ACTIVE ||
+        conn->c_barrier ||
+        conn->c_n_ops_executing >= connection_max_executing() ||
+        (op->o_barrier && conn->c_n_ops_executing))
       break;
 
     LDAP_STAILQ_REMOVE_HEAD(&conn->c_pending_ops, o_next);
@@ -1775,10 +1876,49 @@ static int connection_resched(Connection *conn) {
     conn->c_n_ops_pending--;
     conn->c_n_ops_executing++;
 
-    connection_op_activate(op);
+    if (op->o_opclass &&
+        ldap_pvt_thread_pool_admit(&connection_pool, op->o_opclass)) {
+      op->o_opclass = 0;
+      op->o_shed = 1;
+    }
+    if (!op->o_opclass) {
+      connection_op_queue(op);
+      return op;
+    }
+    /* run it here if the pool won't take it */
+    if (connection_op_activate(op))
+      return op;
+  }
+  return NULL;
+}
+
+/* Submit runners for the pending ops of the connection, as many as
+ * may execute along with those already executing. Returns -1 if the
+ * pool took none while nothing of the connection executes or waits to
+ * run, so that no completion would come to pick the ops up: the caller
+ * then runs the next one itself. c_mutex is locked. */
+static int connection_pipeline(Connection *conn) {
+  Operation *op = LDAP_STAILQ_FIRST(&conn->c_pending_ops);
+  int n;
+
+  if (op == NULL || conn->c_barrier ||
+      (op->o_barrier && conn->c_n_ops_executing))
+    return 0;
 
-    if (conn->c_conn_state == SLAP_C_BINDING)
+  n = connection_max_executing() - conn->c_n_ops_executing;
+  if (n > conn->c_n_ops_pending)
+    n = conn->c_n_ops_pending;
+  for (n -= conn->c_n_runners; n > 0; n--) {
+    if (ldap_pvt_thread_pool_submit(&connection_pool, connection_runner,
+                                    (void *)conn)) {
+      Debug(LDAP_DEBUG_ANY,
+            "connection_pipeline: submit failed for conn=%lu\n",
+            conn->c_connid);
+      if (!conn->c_n_ops_executing && !conn->c_n_runners)
+        return -1;
       break;
+    }
+    conn->c_n_runners++;
   }
   return 0;
 }
@@ -1871,6 +2011,8 @@ static void connection_op_queue(Operation *op) {
     op->o_callback = sc;
     op->o_conn->c_conn_state = SLAP_C_BINDING;
   }
+  if (op->o_barrier)
+    op->o_conn->c_barrier = 1;
 
   if (!op->o_dn.bv_len) {
     op->o_authz = op->o_conn->c_authz;
@@ -1902,24 +2044,49 @@ static void connection_op_queue(Operation *op) {
   LDAP_STAILQ_INSERT_TAIL(&op->o_conn->c_ops, op, o_next);
 }
 
+/* Hand an op to the pool. On failure the op stays queued in c_ops and
+ * counted as executing: the caller runs it in the current thread, or
+ * takes it back with connection_op_drop(). c_mutex is locked. */
 static int connection_op_activate(Operation *op) {
   int rc;
 
   connection_op_queue(op);
 
-  rc = ldap_pvt_thread_pool_submit(&connection_pool, connection_operation,
-                                   (void *)op);
+  rc = ldap_pvt_thread_pool_submit_class(&connection_pool, op->o_opclass,
+                                         connection_operation, (void *)op,
+                                         NULL);
+  if (rc != 0 && op->o_opclass) {
+    /* the class filled up after it admitted the op, answer the op
+     * as busy then, like those admit turned down */
+    op->o_opclass = 0;
+    op->o_shed = 1;
+    rc = ldap_pvt_thread_pool_submit(&connection_pool, connection_operation,
+                                     (void *)op);
+  }
 
   if (rc != 0) {
     Debug(LDAP_DEBUG_ANY,
           "connection_op_activate: submit failed (%d) for conn=%lu\n", rc,
           op->o_connid);
-    /* should move op to pending list */
   }
 
   return rc;
 }
 
+/* Take back an op connection_op_activate() failed to submit, which the
+ * current thread cannot run either; the connection has to be closed
+ * then, the op goes unanswered. c_mutex is locked. */
+static void connection_op_drop(Connection *conn, Operation *op) {
+  LDAP_ASSERT(conn == op->o_conn);
+  LDAP_STAILQ_REMOVE(&conn->c_ops, op, Operation, o_next);
+  LDAP_STAILQ_NEXT(op, o_next) = NULL;
+  op->o_conn = NULL;
+  conn->c_n_ops_executing--;
+  if (op->o_barrier)
+    conn->c_barrier = 0;
+  slap_op_free(op, NULL);
+}
+
 int connection_write(ber_socket_t s) {
   Connection *c;
   Operation *op;
@@ -1962,9 +2129,10 @@ int connection_write(ber_socket_t s) {
    */
   while ((op = LDAP_STAILQ_FIRST(&c->c_pending_ops)) != NULL) {
     LDAP_ASSERT(c == op->o_conn);
-    if (!c->c_writewaiter)
+    if (!c->c_writewaiter || c->c_barrier)
       break;
-    if (c->c_n_ops_executing > connection_pool_max / 2)
+    if (c->c_n_ops_executing >= connection_max_executing() ||
+        (op->o_barrier && c->c_n_ops_executing))
       break;
 
     LDAP_STAILQ_REMOVE_HEAD(&c->c_pending_ops, o_next);
@@ -1976,7 +2144,11 @@ int connection_write(ber_socket_t s) {
     c->c_n_ops_pending--;
     c->c_n_ops_executing++;
 
-    connection_op_activate(op);
+    if (connection_op_activate(op)) {
+      connection_op_drop(c, op);
+      connection_closing(c, "server is busy");
+      connection_close(c);
+    }
 
     break;
   }
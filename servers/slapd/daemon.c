@@ -38,6 +38,11 @@
 
 #if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_EPOLL)
 #include <sys/epoll.h>
+#ifdef HAVE_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif /* HAVE_IO_URING */
 #elif defined(SLAP_X_DEVPOLL) && defined(HAVE_SYS_DEVPOLL_H) &&                \
     defined(HAVE_DEVPOLL)
 #include <sys/types.h>
@@ -57,6 +62,10 @@ int deny_severity = LOG_NOTICE;
 #define LDAPI_MOD_URLEXT "x-mod"
 #endif /* LDAP_PF_LOCAL */
 
+#ifdef SO_REUSEPORT
+#define REUSEPORT_URLEXT "x-reuseport"
+#endif /* SO_REUSEPORT */
+
 #ifdef LDAP_PF_INET6
 int slap_inet4or6 = AF_UNSPEC;
 #else  /* ! INETv6 */
@@ -92,7 +101,16 @@ static ldap_pvt_thread_t *listener_tid;
 #define SLAPD_LISTEN_BACKLOG 1024
 #endif /* ! SLAPD_LISTEN_BACKLOG */
 
-#define DAEMON_ID(fd) (fd & slapd_daemon_mask)
+/* Descriptors are spread over the daemon threads by their number,
+ * except for the sockets of a sharded listener and the connections
+ * accepted on them, which stay with the thread of the shard. For these
+ * daemon_ids[] holds the thread plus one, zero for the others. */
+static unsigned char *daemon_ids;
+#define DAEMON_ID_DEFAULT(fd) ((fd) & slapd_daemon_mask)
+#define DAEMON_ID(fd)                                                          \
+  (daemon_ids[fd] ? daemon_ids[fd] - 1 : DAEMON_ID_DEFAULT(fd))
+#define DAEMON_ID_SET(fd, id)                                                  \
+  (daemon_ids[fd] = (id) != DAEMON_ID_DEFAULT(fd) ? (id) + 1 : 0)
 
 static ber_socket_t wake_sds[SLAPD_MAX_DAEMON_THREADS][2];
 static int emfile;
@@ -167,6 +185,9 @@ typedef struct slap_daemon_st {
   struct epoll_event *sd_epolls;
   int *sd_index;
   int sd_epfd;
+#ifdef HAVE_IO_URING
+  struct slap_uring *sd_uring; /* NULL when epoll itself is used */
+#endif
 #elif defined(SLAP_X_DEVPOLL) && defined(HAVE_DEVPOLL)
   /* eXperimental */
   struct pollfd *sd_pollfd;
@@ -199,6 +220,40 @@ static slap_daemon_st slap_daemon[SLAPD_MAX_DAEMON_THREADS];
  ***************************************/
 #define SLAP_EVENT_FNAME "epoll"
 #define SLAP_EVENTS_ARE_INDEXED 0
+
+#ifdef HAVE_IO_URING
+/* The same interest sets and event list, with the polling done
+ * through an io_uring instead when one could be set up */
+static int slap_uring_init(int t);
+static void slap_uring_destroy(int t);
+static int slap_uring_ctl(int t, int op, ber_socket_t s,
+                          struct epoll_event *ep);
+static int slap_uring_wait(int t, struct epoll_event *revents, int max,
+                           slap_time_t *tvp);
+
+#define SLAP_EPOLL_CTL(t, op, s, ep)                                           \
+  (slap_daemon[t].sd_uring ? slap_uring_ctl(t, (op), (s), (ep))                \
+                           : epoll_ctl(slap_daemon[t].sd_epfd, (op), (s), (ep)))
+#define SLAP_EPOLL_WAIT(t, revents, tvp)                                       \
+  (slap_daemon[t].sd_uring                                                     \
+       ? slap_uring_wait(t, (revents), dtblsize, (tvp))                        \
+       : epoll_wait(slap_daemon[t].sd_epfd, (revents), dtblsize,               \
+                    (tvp) ? ldap_to_milliseconds(*(tvp)) : -1))
+#define SLAP_URING_INIT(t)                                                     \
+  do {                                                                         \
+    if (slapd_io_uring && slap_uring_init(t) != 0)                             \
+      slapd_io_uring = 0;                                                      \
+  } while (0)
+#define SLAP_URING_DESTROY(t) slap_uring_destroy(t)
+#else
+#define SLAP_EPOLL_CTL(t, op, s, ep)                                           \
+  epoll_ctl(slap_daemon[t].sd_epfd, (op), (s), (ep))
+#define SLAP_EPOLL_WAIT(t, revents, tvp)                                       \
+  epoll_wait(slap_daemon[t].sd_epfd, (revents), dtblsize,                      \
+             (tvp) ? ldap_to_milliseconds(*(tvp)) : -1)
+#define SLAP_URING_INIT(t)
+#define SLAP_URING_DESTROY(t)
+#endif /* HAVE_IO_URING */
 #define SLAP_EPOLL_SOCK_IX(t, s) (slap_daemon[t].sd_index[(s)])
 #define SLAP_EPOLL_SOCK_EP(t, s)                                               \
   (slap_daemon[t].sd_epolls[SLAP_EPOLL_SOCK_IX(t, s)])
@@ -214,8 +269,7 @@ static slap_daemon_st slap_daemon[SLAPD_MAX_DAEMON_THREADS];
   do {                                                                         \
     if ((SLAP_EPOLL_SOCK_EV(t, s) & (mode)) != (mode)) {                       \
       SLAP_EPOLL_SOCK_EV(t, s) |= (mode);                                      \
-      epoll_ctl(slap_daemon[t].sd_epfd, EPOLL_CTL_MOD, (s),                    \
-                &SLAP_EPOLL_SOCK_EP(t, s));                                    \
+      SLAP_EPOLL_CTL(t, EPOLL_CTL_MOD, (s), &SLAP_EPOLL_SOCK_EP(t, s));        \
     }                                                                          \
   } while (0)
 
@@ -223,8 +277,7 @@ static slap_daemon_st slap_daemon[SLAPD_MAX_DAEMON_THREADS];
   do {                                                                         \
     if ((SLAP_EPOLL_SOCK_EV(t, s) & (mode))) {                                 \
       SLAP_EPOLL_SOCK_EV(t, s) &= ~(mode);                                     \
-      epoll_ctl(slap_daemon[t].sd_epfd, EPOLL_CTL_MOD, s,                      \
-                &SLAP_EPOLL_SOCK_EP(t, s));                                    \
+      SLAP_EPOLL_CTL(t, EPOLL_CTL_MOD, (s), &SLAP_EPOLL_SOCK_EP(t, s));        \
     }                                                                          \
   } while (0)
 
@@ -257,8 +310,7 @@ static slap_daemon_st slap_daemon[SLAPD_MAX_DAEMON_THREADS];
     SLAP_EPOLL_SOCK_EP(t, (s)).data.ptr =                                      \
         (l) ? (l) : (void *)(&SLAP_EPOLL_SOCK_IX(t, s));                       \
     SLAP_EPOLL_SOCK_EV(t, (s)) = EPOLLIN;                                      \
-    rc = epoll_ctl(slap_daemon[t].sd_epfd, EPOLL_CTL_ADD, (s),                 \
-                   &SLAP_EPOLL_SOCK_EP(t, (s)));                               \
+    rc = SLAP_EPOLL_CTL(t, EPOLL_CTL_ADD, (s), &SLAP_EPOLL_SOCK_EP(t, (s)));   \
     if (rc == 0) {                                                             \
       slap_daemon[t].sd_nfds++;                                                \
     } else {                                                                   \
@@ -285,8 +337,7 @@ static slap_daemon_st slap_daemon[SLAPD_MAX_DAEMON_THREADS];
     int fd, rc, index = SLAP_EPOLL_SOCK_IX(t, (s));                            \
     if (index < 0)                                                             \
       break;                                                                   \
-    rc = epoll_ctl(slap_daemon[t].sd_epfd, EPOLL_CTL_DEL, (s),                 \
-                   &SLAP_EPOLL_SOCK_EP(t, (s)));                               \
+    rc = SLAP_EPOLL_CTL(t, EPOLL_CTL_DEL, (s), &SLAP_EPOLL_SOCK_EP(t, (s)));   \
     if (rc) {                                                                  \
       Debug(LDAP_DEBUG_ANY,                                                    \
             "daemon: epoll_ctl(epfd=%d,DEL,fd=%d) failed, errno=%d, shutting " \
@@ -326,6 +377,7 @@ static slap_daemon_st slap_daemon[SLAPD_MAX_DAEMON_THREADS];
     slap_daemon[t].sd_epfd = epoll_create(dtblsize / slapd_daemon_threads);    \
     for (j = 0; j < dtblsize; j++)                                             \
       slap_daemon[t].sd_index[j] = -1;                                         \
+    SLAP_URING_INIT(t);                                                        \
   } while (0)
 
 #define SLAP_SOCK_DESTROY(t)                                                   \
@@ -335,6 +387,7 @@ static slap_daemon_st slap_daemon[SLAPD_MAX_DAEMON_THREADS];
       slap_daemon[t].sd_epolls = NULL;                                         \
       slap_daemon[t].sd_index = NULL;                                          \
       close(slap_daemon[t].sd_epfd);                                           \
+      SLAP_URING_DESTROY(t);                                                   \
     }                                                                          \
   } while (0)
 
@@ -347,8 +400,7 @@ static slap_daemon_st slap_daemon[SLAPD_MAX_DAEMON_THREADS];
 
 #define SLAP_EVENT_WAIT(t, tvp, nsp)                                           \
   do {                                                                         \
-    *(nsp) = epoll_wait(slap_daemon[t].sd_epfd, revents, dtblsize,             \
-                        (tvp) ? ldap_to_milliseconds(*tvp) : -1);              \
+    *(nsp) = SLAP_EPOLL_WAIT(t, revents, tvp);                                 \
   } while (0)
 
 #elif defined(SLAP_X_DEVPOLL) && defined(HAVE_DEVPOLL)
@@ -641,6 +693,586 @@ static slap_daemon_st slap_daemon[SLAPD_MAX_DAEMON_THREADS];
   } while (0)
 #endif /* ! epoll && ! /dev/poll */
 
+#ifdef HAVE_IO_URING
+/*****************************************************
+ * io_uring(7) in place of epoll_ctl() / epoll_wait() *
+ *****************************************************/
+/* Each descriptor gets a one-shot IORING_OP_POLL_ADD for its current
+ * interest set, which the kernel checks at submission, so the polls
+ * report the same level-triggered readiness epoll does. A poll that
+ * fired is armed again within the io_uring_enter() call that waits for
+ * the next events, unless its interest set was cleared meanwhile, as
+ * it is for a connection whose read has been handed to a worker. That
+ * saves the epoll_ctl() calls for clearing and setting the interest.
+ *
+ * Input is read on the ring itself where that is possible, in place of
+ * polling for it:
+ * - a listener gets an IORING_OP_ACCEPT, and slap_listener() takes the
+ *   descriptor it accepted (slap_uring_accepted());
+ * - a connection whose worker is done reading lends the free space of
+ *   its readahead ring (slapd_set_read_sb()) to an IORING_OP_RECV, and
+ *   the next worker accounts for what was received before it decodes
+ *   (slapd_recv_take()).
+ * Connections without the readahead ring, or with TLS or SASL layers
+ * that read on their own, are polled. Such an accept or receive stays
+ * in flight while the read interest is cleared and is reported once it
+ * is set again; only removing the descriptor cancels it, and its memory
+ * is held until the kernel is done with it.
+ *
+ * Changes made by other threads are submitted right away, under
+ * sd_mutex like the rest of the ring state; only the daemon thread
+ * reaps completions. The user_data of a poll carries a per-descriptor
+ * generation, so completions of polls that were replaced or removed
+ * are told apart from current ones; that of an accept or receive is
+ * the address of its slap_uring_op, tagged by the low bit. */
+
+int slapd_io_uring = 0;
+
+#define SLAP_URING_ENTRIES 256
+#define SLAP_URING_IGNORE (~(uint64_t)0)
+#define SLAP_URING_POLL_UD(ur, s)                                              \
+  ((uint64_t)((ur)->ur_gen[s] & 0x7fffffff) << 33 | (uint64_t)(s) << 1)
+#define SLAP_URING_OP_UD(uo) ((uint64_t)(uintptr_t)(uo) | 1)
+
+/* ur_flags */
+#define SLAP_URING_ARMED 1 /* a poll is in flight */
+#define SLAP_URING_READY 2 /* on ur_ready */
+
+typedef struct slap_uring_op {
+  ber_socket_t uo_sd;
+  short uo_accept; /* IORING_OP_ACCEPT, otherwise IORING_OP_RECV */
+  short uo_state;
+#define SLAP_URING_OP_IDLE 0
+#define SLAP_URING_OP_BUSY 1 /* owned by the kernel */
+#define SLAP_URING_OP_DONE 2
+#define SLAP_URING_OP_DEAD 3 /* detached, freed on completion */
+  int uo_res;
+  struct berval uo_buf; /* lent by the readahead ring */
+  void *uo_token;
+  Sockaddr uo_from;
+  socklen_t uo_fromlen;
+} slap_uring_op;
+
+typedef struct slap_uring {
+  int ur_fd;
+  unsigned ur_sq_mask, ur_sq_entries;
+  unsigned *ur_sq_head, *ur_sq_tail;
+  unsigned ur_cq_mask;
+  unsigned *ur_cq_head, *ur_cq_tail;
+  struct io_uring_sqe *ur_sqes;
+  struct io_uring_cqe *ur_cqes;
+  void *ur_sq_ring, *ur_cq_ring;
+  size_t ur_sq_size, ur_cq_size;
+  unsigned *ur_gen;          /* per descriptor */
+  unsigned char *ur_flags;   /* per descriptor */
+  slap_uring_op **ur_ops;    /* per descriptor */
+  ber_socket_t *ur_rearm;    /* to be armed again in the next round */
+  int ur_nrearm;
+  ber_socket_t *ur_ready;    /* completed reads to report */
+  int ur_nready;
+  int ur_noaccept, ur_norecv; /* the kernel turned them down */
+} slap_uring;
+
+static int slap_uring_enter(slap_uring *ur, unsigned submit, unsigned wait,
+                            unsigned flags, void *arg, size_t argsz) {
+  return syscall(__NR_io_uring_enter, ur->ur_fd, submit, wait, flags, arg,
+                 argsz);
+}
+
+/* Hand all queued entries to the kernel, sd_mutex held */
+static void slap_uring_submit(slap_uring *ur) {
+  while (*ur->ur_sq_tail != __atomic_load_n(ur->ur_sq_head, __ATOMIC_ACQUIRE))
+    if (slap_uring_enter(ur, ur->ur_sq_entries, 0, 0, NULL, 0) < 0 &&
+        errno != EINTR && errno != EAGAIN)
+      break;
+}
+
+static struct io_uring_sqe *slap_uring_sqe(slap_uring *ur) {
+  unsigned tail = *ur->ur_sq_tail;
+  struct io_uring_sqe *sqe;
+
+  if (tail - __atomic_load_n(ur->ur_sq_head, __ATOMIC_ACQUIRE) >=
+      ur->ur_sq_entries)
+    slap_uring_submit(ur);
+  sqe = &ur->ur_sqes[tail & ur->ur_sq_mask];
+  memset(sqe, 0, sizeof(*sqe));
+  return sqe;
+}
+
+static void slap_uring_push(slap_uring *ur) {
+  __atomic_store_n(ur->ur_sq_tail, *ur->ur_sq_tail + 1, __ATOMIC_RELEASE);
+}
+
+static slap_uring_op *slap_uring_op_new(ber_socket_t s) {
+  slap_uring_op *uo = ch_calloc(1, sizeof(slap_uring_op));
+
+  uo->uo_sd = s;
+  uo->uo_res = -1;
+  return uo;
+}
+
+static void slap_uring_op_free(slap_uring_op *uo) {
+  if (uo->uo_token)
+    ber_sockbuf_ring_return(uo->uo_token);
+  /* accepted, but nobody took it */
+  if (uo->uo_accept && uo->uo_res >= 0)
+    tcp_close(uo->uo_res);
+  ch_free(uo);
+}
+
+static void slap_uring_op_submit(slap_uring *ur, slap_uring_op *uo) {
+  struct io_uring_sqe *sqe = slap_uring_sqe(ur);
+
+  sqe->fd = uo->uo_sd;
+  if (uo->uo_accept) {
+    uo->uo_fromlen = sizeof(uo->uo_from);
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->addr = (uintptr_t)&uo->uo_from;
+    sqe->addr2 = (uintptr_t)&uo->uo_fromlen;
+  } else {
+    sqe->opcode = IORING_OP_RECV;
+    sqe->addr = (uintptr_t)uo->uo_buf.bv_val;
+    sqe->len = uo->uo_buf.bv_len;
+  }
+  sqe->user_data = SLAP_URING_OP_UD(uo);
+  slap_uring_push(ur);
+  uo->uo_state = SLAP_URING_OP_BUSY;
+}
+
+static int slap_uring_is_listener(int t, ber_socket_t s) {
+  void *ptr = SLAP_EPOLL_SOCK_EP(t, s).data.ptr;
+
+  if (!SLAP_EPOLL_EV_LISTENER(t, ptr))
+    return 0;
+#ifdef LDAP_CONNECTIONLESS
+  if (((Listener *)ptr)->sl_is_udp)
+    return 0;
+#endif
+  return 1;
+}
+
+static void slap_uring_arm(int t, ber_socket_t s) {
+  slap_uring *ur = slap_daemon[t].sd_uring;
+  slap_uring_op *uo = ur->ur_ops[s];
+  struct io_uring_sqe *sqe;
+  uint32_t events;
+
+  if (SLAP_SOCK_NOT_ACTIVE(t, s))
+    return;
+  events = SLAP_EPOLL_SOCK_EV(t, s) & (EPOLLIN | EPOLLOUT);
+  if ((events & EPOLLIN) && !uo && !ur->ur_noaccept &&
+      slap_uring_is_listener(t, s)) {
+    uo = ur->ur_ops[s] = slap_uring_op_new(s);
+    uo->uo_accept = 1;
+  }
+  if (uo) {
+    /* reads in place of a poll for input */
+    if ((events & EPOLLIN) && uo->uo_state == SLAP_URING_OP_IDLE)
+      slap_uring_op_submit(ur, uo);
+    events &= ~EPOLLIN;
+  }
+  if ((ur->ur_flags[s] & SLAP_URING_ARMED) || !events)
+    return;
+  sqe = slap_uring_sqe(ur);
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = s;
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  events = events << 16 | events >> 16;
+#endif
+  sqe->poll32_events = events;
+  sqe->user_data = SLAP_URING_POLL_UD(ur, s);
+  slap_uring_push(ur);
+  ur->ur_flags[s] |= SLAP_URING_ARMED;
+}
+
+static void slap_uring_disarm(int t, ber_socket_t s) {
+  slap_uring *ur = slap_daemon[t].sd_uring;
+  struct io_uring_sqe *sqe;
+
+  if (ur->ur_flags[s] & SLAP_URING_ARMED) {
+    sqe = slap_uring_sqe(ur);
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->addr = SLAP_URING_POLL_UD(ur, s);
+    sqe->user_data = SLAP_URING_IGNORE;
+    slap_uring_push(ur);
+    ur->ur_flags[s] &= ~SLAP_URING_ARMED;
+  }
+  ur->ur_gen[s]++;
+}
+
+/* Drop the accept or receive of s, cancelling it if it is in flight */
+static void slap_uring_detach(slap_uring *ur, ber_socket_t s) {
+  slap_uring_op *uo = ur->ur_ops[s];
+  struct io_uring_sqe *sqe;
+
+  if (!uo)
+    return;
+  ur->ur_ops[s] = NULL;
+  if (uo->uo_state == SLAP_URING_OP_BUSY) {
+    sqe = slap_uring_sqe(ur);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = SLAP_URING_OP_UD(uo);
+    sqe->user_data = SLAP_URING_IGNORE;
+    slap_uring_push(ur);
+    uo->uo_state = SLAP_URING_OP_DEAD;
+  } else {
+    slap_uring_op_free(uo);
+  }
+}
+
+/* Report the completed read of s in the next round */
+static void slap_uring_ready(slap_uring *ur, ber_socket_t s) {
+  if (!(ur->ur_flags[s] & SLAP_URING_READY)) {
+    ur->ur_flags[s] |= SLAP_URING_READY;
+    ur->ur_ready[ur->ur_nready++] = s;
+  }
+}
+
+/* epoll_ctl() work-alike, sd_mutex held */
+static int slap_uring_ctl(int t, int op, ber_socket_t s,
+                          struct epoll_event *ep) {
+  slap_uring *ur = slap_daemon[t].sd_uring;
+  slap_uring_op *uo;
+
+  switch (op) {
+  case EPOLL_CTL_ADD:
+    /* s may still sit on ur_ready from its previous use */
+    ur->ur_flags[s] &= SLAP_URING_READY;
+    ur->ur_gen[s]++;
+    slap_uring_arm(t, s);
+    break;
+  case EPOLL_CTL_MOD:
+    slap_uring_disarm(t, s);
+    slap_uring_arm(t, s);
+    uo = ur->ur_ops[s];
+    if (uo && uo->uo_state == SLAP_URING_OP_DONE &&
+        (SLAP_EPOLL_SOCK_EV(t, s) & EPOLLIN))
+      slap_uring_ready(ur, s);
+    break;
+  case EPOLL_CTL_DEL:
+    /* the poll and the reads hold a reference to the socket,
+     * they have to be gone before the socket is closed */
+    slap_uring_disarm(t, s);
+    slap_uring_detach(ur, s);
+    break;
+  }
+  slap_uring_submit(ur);
+  return 0;
+}
+
+/* epoll_wait() work-alike, called by the daemon thread */
+static int slap_uring_wait(int t, struct epoll_event *revents, int max,
+                           slap_time_t *tvp) {
+  slap_uring *ur = slap_daemon[t].sd_uring;
+  struct io_uring_getevents_arg arg;
+  struct __kernel_timespec ts;
+  unsigned head, tail;
+  int i, rc, err = 0, n = 0;
+
+  memset(&arg, 0, sizeof(arg));
+  if (tvp) {
+    ts.tv_sec = tvp->ns / 1000000000;
+    ts.tv_nsec = tvp->ns % 1000000000;
+    arg.ts = (uintptr_t)&ts;
+  }
+
+  ldap_pvt_thread_mutex_lock(&slap_daemon[t].sd_mutex);
+  for (i = 0; i < ur->ur_nrearm; i++)
+    slap_uring_arm(t, ur->ur_rearm[i]);
+  ur->ur_nrearm = 0;
+  for (i = 0; i < ur->ur_nready; i++) {
+    ber_socket_t s = ur->ur_ready[i];
+    slap_uring_op *uo = ur->ur_ops[s];
+
+    ur->ur_flags[s] &= ~SLAP_URING_READY;
+    if (n < max && uo && uo->uo_state == SLAP_URING_OP_DONE &&
+        SLAP_SOCK_IS_ACTIVE(t, s) && (SLAP_EPOLL_SOCK_EV(t, s) & EPOLLIN)) {
+      revents[n].events = EPOLLIN;
+      revents[n].data = SLAP_EPOLL_SOCK_EP(t, s).data;
+      n++;
+    }
+  }
+  ur->ur_nready = 0;
+  ldap_pvt_thread_mutex_unlock(&slap_daemon[t].sd_mutex);
+
+  /* submits the new polls and waits in one call; anything queued
+   * meanwhile by other threads goes along. With reads to report
+   * already, it only submits. */
+  if (n)
+    rc = slap_uring_enter(ur, ur->ur_sq_entries, 0, 0, NULL, 0);
+  else
+    rc = slap_uring_enter(ur, ur->ur_sq_entries, 1,
+                          IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg,
+                          sizeof(arg));
+  if (rc < 0)
+    err = errno;
+
+  ldap_pvt_thread_mutex_lock(&slap_daemon[t].sd_mutex);
+  head = *ur->ur_cq_head;
+  tail = __atomic_load_n(ur->ur_cq_tail, __ATOMIC_ACQUIRE);
+  for (; head != tail && n < max; head++) {
+    struct io_uring_cqe *cqe = &ur->ur_cqes[head & ur->ur_cq_mask];
+    ber_socket_t s;
+    uint32_t events;
+
+    if (cqe->user_data == SLAP_URING_IGNORE)
+      continue;
+
+    if (cqe->user_data & 1) {
+      slap_uring_op *uo = (slap_uring_op *)(uintptr_t)(cqe->user_data & ~1);
+
+      uo->uo_res = cqe->res;
+      if (uo->uo_state == SLAP_URING_OP_DEAD) {
+        slap_uring_op_free(uo);
+        continue;
+      }
+      s = uo->uo_sd;
+      if (cqe->res == -ECANCELED) {
+        /* the thread that submitted it has exited */
+        uo->uo_res = -1;
+        uo->uo_state = SLAP_URING_OP_IDLE;
+        ur->ur_rearm[ur->ur_nrearm++] = s;
+        continue;
+      }
+      if (cqe->res == -EINVAL || cqe->res == -EOPNOTSUPP) {
+        /* not supported by this kernel, poll instead */
+        Debug(LDAP_DEBUG_ANY, "daemon: io_uring %s failed (%d), polling\n",
+              uo->uo_accept ? "accept" : "recv", -cqe->res);
+        if (uo->uo_accept)
+          ur->ur_noaccept = 1;
+        else
+          ur->ur_norecv = 1;
+        slap_uring_detach(ur, s);
+        ur->ur_rearm[ur->ur_nrearm++] = s;
+        continue;
+      }
+      uo->uo_state = SLAP_URING_OP_DONE;
+      if (!(SLAP_EPOLL_SOCK_EV(t, s) & EPOLLIN))
+        continue; /* reported once it is wanted */
+      revents[n].events = EPOLLIN;
+      revents[n].data = SLAP_EPOLL_SOCK_EP(t, s).data;
+      n++;
+      continue;
+    }
+
+    s = (ber_socket_t)((uint32_t)cqe->user_data >> 1);
+    if (s >= dtblsize ||
+        (unsigned)(cqe->user_data >> 33) != (ur->ur_gen[s] & 0x7fffffff) ||
+        SLAP_SOCK_NOT_ACTIVE(t, s))
+      continue;
+
+    ur->ur_flags[s] &= ~SLAP_URING_ARMED;
+    events = SLAP_EPOLL_SOCK_EV(t, s);
+    if (cqe->res == -ECANCELED) {
+      /* the thread that submitted the poll has exited */
+      ur->ur_rearm[ur->ur_nrearm++] = s;
+      continue;
+    }
+    if (cqe->res < 0) {
+      revents[n].events = EPOLLERR;
+    } else {
+      revents[n].events = cqe->res & (events | EPOLLERR | EPOLLHUP);
+    }
+    /* like EPOLLET, report a hangup only once */
+    if (!(events & EPOLLET) || !revents[n].events)
+      ur->ur_rearm[ur->ur_nrearm++] = s;
+    if (revents[n].events) {
+      revents[n].data = SLAP_EPOLL_SOCK_EP(t, s).data;
+      n++;
+    }
+  }
+  __atomic_store_n(ur->ur_cq_head, head, __ATOMIC_RELEASE);
+  ldap_pvt_thread_mutex_unlock(&slap_daemon[t].sd_mutex);
+
+  if (!n && err && err != ETIME) {
+    errno = err;
+    return -1;
+  }
+  return n;
+}
+
+/* Lend the readahead ring of sb to a receive on s, sd_mutex held */
+static void slap_uring_lend(int t, ber_socket_t s, Sockbuf *sb) {
+  slap_uring *ur = slap_daemon[t].sd_uring;
+  slap_uring_op *uo;
+  struct berval space;
+  void *token;
+
+  if (ur->ur_norecv || ur->ur_ops[s] || SLAP_SOCK_NOT_ACTIVE(t, s) ||
+      ber_sockbuf_ring_lend(sb, &space, &token))
+    return;
+  uo = ur->ur_ops[s] = slap_uring_op_new(s);
+  uo->uo_buf = space;
+  uo->uo_token = token;
+  if (SLAP_EPOLL_SOCK_EV(t, s) & EPOLLIN) {
+    /* no change of the interest follows to submit it */
+    slap_uring_disarm(t, s);
+    slap_uring_arm(t, s);
+    slap_uring_submit(ur);
+  }
+}
+
+/* Account for the completed receive of s in sb, sd_mutex held.
+ * Returns 1 when it is still in flight, -1 when it failed. */
+static int slap_uring_take(int t, ber_socket_t s, Sockbuf *sb) {
+  slap_uring *ur = slap_daemon[t].sd_uring;
+  slap_uring_op *uo = ur->ur_ops[s];
+  struct berval data;
+  int rc = 0;
+
+  if (!uo || uo->uo_accept)
+    return 0;
+  if (uo->uo_state == SLAP_URING_OP_BUSY)
+    return 1;
+  ur->ur_ops[s] = NULL;
+  if (uo->uo_state == SLAP_URING_OP_DONE) {
+    if (uo->uo_res > 0) {
+      data.bv_val = uo->uo_buf.bv_val;
+      data.bv_len = uo->uo_res;
+      if (ber_sockbuf_ring_fill(sb, uo->uo_token, &data))
+        rc = -1;
+    }
+    /* on end of input or an error the worker reads the socket
+     * and sees it for itself */
+  }
+  slap_uring_op_free(uo);
+  return rc;
+}
+
+/* Take the descriptor accepted on the listener sl, if any.
+ * Returns 0 with nothing accepted, 1 with *sd set, or errno on failure. */
+static int slap_uring_accepted(Listener *sl, ber_socket_t *sd, Sockaddr *from,
+                               ber_socklen_t *len) {
+  int t = DAEMON_ID(sl->sl_sd);
+  slap_uring *ur;
+  slap_uring_op *uo;
+  int rc = 0, err = 0;
+
+  ldap_pvt_thread_mutex_lock(&slap_daemon[t].sd_mutex);
+  ur = slap_daemon[t].sd_uring;
+  if (ur && (uo = ur->ur_ops[sl->sl_sd]) &&
+      uo->uo_state == SLAP_URING_OP_DONE) {
+    if (uo->uo_res < 0) {
+      *sd = AC_SOCKET_INVALID;
+      err = -uo->uo_res;
+    } else {
+      *sd = uo->uo_res;
+      memcpy(from, &uo->uo_from,
+                uo->uo_fromlen < *len ? uo->uo_fromlen : *len);
+      *len = uo->uo_fromlen;
+    }
+    uo->uo_res = -1;
+    uo->uo_state = SLAP_URING_OP_IDLE;
+    /* the daemon may not get to change the interest of the listener
+     * meanwhile, accept the next one right away */
+    slap_uring_arm(t, sl->sl_sd);
+    slap_uring_submit(ur);
+    rc = 1;
+  }
+  ldap_pvt_thread_mutex_unlock(&slap_daemon[t].sd_mutex);
+  if (err)
+    errno = err;
+  return rc;
+}
+
+static int slap_uring_init(int t) {
+  struct io_uring_params p;
+  slap_uring *ur;
+  unsigned cq;
+  int fd;
+
+  memset(&p, 0, sizeof(p));
+  for (cq = 2 * SLAP_URING_ENTRIES; cq < 2 * (unsigned)dtblsize; cq <<= 1)
+    ;
+  p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_CLAMP;
+  p.cq_entries = cq;
+  fd = syscall(__NR_io_uring_setup, SLAP_URING_ENTRIES, &p);
+  if (fd < 0) {
+    Debug(LDAP_DEBUG_ANY, "daemon: io_uring_setup failed errno=%d (%s)\n",
+          errno, sock_errstr(errno));
+    return -1;
+  }
+  if (!(p.features & IORING_FEAT_NODROP) ||
+      !(p.features & IORING_FEAT_EXT_ARG)) {
+    Debug(LDAP_DEBUG_ANY, "daemon: io_uring lacks features (0x%x)\n",
+          p.features);
+    close(fd);
+    return -1;
+  }
+
+  ur = ch_calloc(1, sizeof(slap_uring));
+  ur->ur_fd = fd;
+  ur->ur_sq_entries = p.sq_entries;
+  ur->ur_sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  ur->ur_cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  ur->ur_sq_ring = mmap(NULL, ur->ur_sq_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  ur->ur_cq_ring = mmap(NULL, ur->ur_cq_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+  ur->ur_sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+                     PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                     IORING_OFF_SQES);
+  if (ur->ur_sq_ring == MAP_FAILED || ur->ur_cq_ring == MAP_FAILED ||
+      ur->ur_sqes == MAP_FAILED) {
+    Debug(LDAP_DEBUG_ANY, "daemon: io_uring mmap failed errno=%d\n", errno);
+    slap_daemon[t].sd_uring = ur;
+    slap_uring_destroy(t);
+    return -1;
+  }
+  ur->ur_sq_mask = *(unsigned *)((char *)ur->ur_sq_ring + p.sq_off.ring_mask);
+  ur->ur_sq_head = (unsigned *)((char *)ur->ur_sq_ring + p.sq_off.head);
+  ur->ur_sq_tail = (unsigned *)((char *)ur->ur_sq_ring + p.sq_off.tail);
+  ur->ur_cq_mask = *(unsigned *)((char *)ur->ur_cq_ring + p.cq_off.ring_mask);
+  ur->ur_cq_head = (unsigned *)((char *)ur->ur_cq_ring + p.cq_off.head);
+  ur->ur_cq_tail = (unsigned *)((char *)ur->ur_cq_ring + p.cq_off.tail);
+  ur->ur_cqes =
+      (struct io_uring_cqe *)((char *)ur->ur_cq_ring + p.cq_off.cqes);
+  {
+    unsigned *array = (unsigned *)((char *)ur->ur_sq_ring + p.sq_off.array);
+    unsigned i;
+
+    for (i = 0; i < p.sq_entries; i++)
+      array[i] = i;
+  }
+
+  ur->ur_gen = ch_calloc(dtblsize, sizeof(unsigned));
+  ur->ur_flags = ch_calloc(dtblsize, sizeof(unsigned char));
+  ur->ur_ops = ch_calloc(dtblsize, sizeof(slap_uring_op *));
+  /* a poll and a read per descriptor */
+  ur->ur_rearm = ch_calloc(2 * dtblsize, sizeof(ber_socket_t));
+  ur->ur_ready = ch_calloc(dtblsize, sizeof(ber_socket_t));
+  slap_daemon[t].sd_uring = ur;
+  return 0;
+}
+
+static void slap_uring_destroy(int t) {
+  slap_uring *ur = slap_daemon[t].sd_uring;
+  int i;
+
+  if (!ur)
+    return;
+  slap_daemon[t].sd_uring = NULL;
+  if (ur->ur_sqes && ur->ur_sqes != MAP_FAILED)
+    munmap(ur->ur_sqes, ur->ur_sq_entries * sizeof(struct io_uring_sqe));
+  if (ur->ur_cq_ring && ur->ur_cq_ring != MAP_FAILED)
+    munmap(ur->ur_cq_ring, ur->ur_cq_size);
+  if (ur->ur_sq_ring && ur->ur_sq_ring != MAP_FAILED)
+    munmap(ur->ur_sq_ring, ur->ur_sq_size);
+  close(ur->ur_fd);
+  /* the kernel may still be writing into the buffers of those
+   * in flight until the ring is torn down, leave them be */
+  for (i = 0; ur->ur_ops && i < dtblsize; i++)
+    if (ur->ur_ops[i] && ur->ur_ops[i]->uo_state != SLAP_URING_OP_BUSY)
+      slap_uring_op_free(ur->ur_ops[i]);
+  ch_free(ur->ur_gen);
+  ch_free(ur->ur_flags);
+  ch_free(ur->ur_ops);
+  ch_free(ur->ur_rearm);
+  ch_free(ur->ur_ready);
+  ch_free(ur);
+}
+#endif /* HAVE_IO_URING */
+
 #ifdef HAVE_SLP
 /*
  * SLP related functions
@@ -764,6 +1396,8 @@ static void slapd_slp_dereg(void) {
 static void slapd_add(ber_socket_t s, int isactive, Listener *sl, int id) {
   if (id < 0)
     id = DAEMON_ID(s);
+  else
+    DAEMON_ID_SET(s, id);
   ldap_pvt_thread_mutex_lock(&slap_daemon[id].sd_mutex);
 
   assert(SLAP_SOCK_NOT_ACTIVE(id, s));
@@ -817,6 +1451,8 @@ void slapd_remove(ber_socket_t s, Sockbuf *sb, int wasactive, int wake,
     slap_daemon[id].sd_nwriters--;
 
   SLAP_SOCK_DEL(id, s);
+  /* before the descriptor can be reused */
+  daemon_ids[s] = 0;
 
   if (sb)
     ber_sockbuf_free(sb);
@@ -923,6 +1559,36 @@ void slapd_set_read(ber_socket_t s, int wake) {
     WAKE_LISTENER(id, wake);
 }
 
+/* slapd_set_read() for a connection whose worker is done reading from
+ * sb, letting the daemon receive its next input into the readahead ring
+ * when it runs on io_uring. */
+void slapd_set_read_sb(ber_socket_t s, Sockbuf *sb, int wake) {
+#ifdef HAVE_IO_URING
+  int id = DAEMON_ID(s);
+  ldap_pvt_thread_mutex_lock(&slap_daemon[id].sd_mutex);
+  if (slap_daemon[id].sd_uring)
+    slap_uring_lend(id, s, sb);
+  ldap_pvt_thread_mutex_unlock(&slap_daemon[id].sd_mutex);
+#endif /* HAVE_IO_URING */
+  slapd_set_read(s, wake);
+}
+
+/* Called by the worker before it reads from sb: accounts for what the
+ * daemon has received into it since slapd_set_read_sb(). Returns 1 when
+ * the receive is still in flight and there is nothing to read yet, -1
+ * when the received data could not be kept. */
+int slapd_recv_take(ber_socket_t s, Sockbuf *sb) {
+  int rc = 0;
+#ifdef HAVE_IO_URING
+  int id = DAEMON_ID(s);
+  ldap_pvt_thread_mutex_lock(&slap_daemon[id].sd_mutex);
+  if (slap_daemon[id].sd_uring)
+    rc = slap_uring_take(id, s, sb);
+  ldap_pvt_thread_mutex_unlock(&slap_daemon[id].sd_mutex);
+#endif /* HAVE_IO_URING */
+  return rc;
+}
+
 slap_time_t slapd_get_writetime() {
   slap_time_t cur;
   ldap_pvt_thread_mutex_lock(&slap_daemon[0].sd_mutex);
@@ -1026,6 +1692,36 @@ static int get_url_perms(char **exts, mode_t *perms, int *crit) {
 }
 #endif /* LDAP_PF_LOCAL || SLAP_X_LISTENER_MOD */
 
+#ifdef SO_REUSEPORT
+/* x-reuseport=<n> opens n sockets on the address, each polled by its
+ * own daemon thread. Returns the number of the other extensions, or -1
+ * if the value is bad. */
+static int get_url_shards(char **exts, int *shards) {
+  int i, n = 0;
+
+  for (i = 0; exts[i]; i++) {
+    char *type = exts[i], *next;
+    unsigned long v;
+
+    if (type[0] == '!')
+      type++;
+
+    if (strncasecmp(type, REUSEPORT_URLEXT "=",
+                    STRLENOF(REUSEPORT_URLEXT "=")) != 0) {
+      n++;
+      continue;
+    }
+
+    v = strtoul(type + STRLENOF(REUSEPORT_URLEXT "="), &next, 10);
+    if (*next || v < 1 || v > SLAPD_MAX_DAEMON_THREADS)
+      return -1;
+    *shards = v;
+  }
+
+  return n;
+}
+#endif /* SO_REUSEPORT */
+
 /* port = 0 indicates AF_LOCAL */
 static int slap_get_listener_addresses(const char *host, unsigned short port,
                                        struct sockaddr ***sal) {
@@ -1176,8 +1872,8 @@ static int slap_open_listener(const char *url, int *listeners, int *cur) {
   Listener *li = NULL;
   LDAPURLDesc *lud;
   unsigned short port;
-  int err, addrlen = 0;
-  struct sockaddr **sal = NULL, **psal;
+  int err, addrlen = 0, nexts = 1;
+  struct sockaddr **sal = NULL, **psal, **ssal = NULL;
   int socktype = SOCK_STREAM; /* default to COTS */
   ber_socket_t s;
 
@@ -1201,6 +1897,9 @@ static int slap_open_listener(const char *url, int *listeners, int *cur) {
   l.sl_url.bv_val = NULL;
   l.sl_mute = 1;
   l.sl_busy = 0;
+  l.sl_shard = 0;
+  l.sl_shards = 1;
+  l.sl_accepted = 0;
 
 #ifndef WITH_TLS
   if (ldap_pvt_url_scheme2tls(lud->lud_scheme)) {
@@ -1254,14 +1953,32 @@ static int slap_open_listener(const char *url, int *listeners, int *cur) {
   l.sl_is_udp = (tmp == LDAP_PROTO_UDP);
 #endif /* LDAP_CONNECTIONLESS */
 
+#ifdef SO_REUSEPORT
+  if (lud->lud_exts)
+    nexts = get_url_shards(lud->lud_exts, &l.sl_shards);
+#endif /* SO_REUSEPORT */
+
 #if defined(LDAP_PF_LOCAL) || defined(SLAP_X_LISTENER_MOD)
-  if (lud->lud_exts) {
+  if (lud->lud_exts && nexts) {
     err = get_url_perms(lud->lud_exts, &l.sl_perms, &crit);
   } else {
     l.sl_perms = S_IRWXU | S_IRWXO;
   }
 #endif /* LDAP_PF_LOCAL || SLAP_X_LISTENER_MOD */
 
+#ifdef SO_REUSEPORT
+  if (nexts < 0) {
+    Debug(LDAP_DEBUG_ANY, "daemon: bad " REUSEPORT_URLEXT " in URL \"%s\"\n",
+          url);
+    err = -1;
+  } else if (l.sl_shards > 1 &&
+             (tmp == LDAP_PROTO_IPC || tmp == LDAP_PROTO_UDP)) {
+    Debug(LDAP_DEBUG_ANY,
+          "daemon: " REUSEPORT_URLEXT " ignored for %s, TCP only\n", url);
+    l.sl_shards = 1;
+  }
+#endif /* SO_REUSEPORT */
+
   ldap_free_urldesc(lud);
   if (err) {
     slap_free_listener_addresses(sal);
@@ -1269,6 +1986,19 @@ static int slap_open_listener(const char *url, int *listeners, int *cur) {
   }
 
   psal = sal;
+  if (l.sl_shards > 1) {
+    /* every address once for each shard */
+    int i, n;
+
+    for (n = 0; sal[n] != NULL; n++)
+      ;
+    ssal = ch_malloc((n * l.sl_shards + 1) * sizeof(struct sockaddr *));
+    for (i = 0; i < n * l.sl_shards; i++)
+      ssal[i] = psal[i / l.sl_shards];
+    ssal[i] = NULL;
+    sal = ssal;
+  }
+
   while (*sal != NULL) {
     char *af;
     switch ((*sal)->sa_family) {
@@ -1304,6 +2034,7 @@ static int slap_open_listener(const char *url, int *listeners, int *cur) {
       continue;
     }
     l.sl_sd = s;
+    l.sl_shard = ssal ? (int)(sal - ssal) % l.sl_shards : 0;
 
     if (l.sl_sd >= dtblsize) {
       Debug(LDAP_DEBUG_ANY,
@@ -1332,6 +2063,21 @@ static int slap_open_listener(const char *url, int *listeners, int *cur) {
               (long)l.sl_sd, err, sock_errstr(err));
       }
 #endif /* SO_REUSEADDR */
+#ifdef SO_REUSEPORT
+      if (l.sl_shards > 1) {
+        /* let the shards bind the same address */
+        tmp = 1;
+        rc = setsockopt(s, SOL_SOCKET, SO_REUSEPORT, (char *)&tmp,
+                        sizeof(tmp));
+        if (rc == AC_SOCKET_ERROR) {
+          int err = sock_errno();
+          Debug(LDAP_DEBUG_ANY,
+                "slapd(%ld): "
+                "setsockopt(SO_REUSEPORT) failed errno=%d (%s)\n",
+                (long)l.sl_sd, err, sock_errstr(err));
+        }
+      }
+#endif /* SO_REUSEPORT */
     }
 
     switch ((*sal)->sa_family) {
@@ -1469,6 +2215,8 @@ static int slap_open_listener(const char *url, int *listeners, int *cur) {
     sal++;
   }
 
+  if (ssal)
+    ch_free(ssal);
   slap_free_listener_addresses(psal);
 
   if (li == NULL) {
@@ -1508,6 +2256,8 @@ int slapd_daemon_init(const char *urls) {
   dtblsize = FD_SETSIZE;
 #endif /* ! HAVE_SYSCONF && ! HAVE_GETDTABLESIZE */
 
+  daemon_ids = ch_calloc(dtblsize, sizeof(daemon_ids[0]));
+
   /* open a pipe (or something equivalent connected to itself).
    * we write a byte on this fd whenever we catch a signal. The main
    * loop will be select'ing on this socket, and will wake up when
@@ -1611,6 +2361,8 @@ int slapd_daemon_destroy(void) {
       SLAP_SOCK_DESTROY(i);
     }
     daemon_inited = 0;
+    ch_free(daemon_ids);
+    daemon_ids = NULL;
 #ifdef HAVE_TCPD
     ldap_pvt_thread_mutex_destroy(&sd_tcpd_mutex);
 #endif /* TCP Wrappers */
@@ -1698,7 +2450,10 @@ static int slap_listener(Listener *sl) {
   from.sa_un_addr.sun_path[0] = '\0';
 #endif /* LDAP_PF_LOCAL */
 
-  s = accept(sl->sl_sd, (struct sockaddr *)&from, &len);
+#ifdef HAVE_IO_URING
+  if (!slap_uring_accepted(sl, &s, &from, &len))
+#endif /* HAVE_IO_URING */
+    s = accept(sl->sl_sd, (struct sockaddr *)&from, &len);
 
   /* Resume the listener FD to allow concurrent-processing of
    * additional incoming connections.
@@ -1745,15 +2500,15 @@ static int slap_listener(Listener *sl) {
     ldap_pvt_thread_yield();
     return 0;
   }
-  tid = DAEMON_ID(s);
+  __sync_fetch_and_add(&sl->sl_accepted, 1);
+  /* a shard keeps its connections on its own thread */
+  tid = sl->sl_shards > 1 ? DAEMON_ID(sl->sl_sd) : DAEMON_ID_DEFAULT(s);
 
 #ifdef LDAP_DEBUG
   ldap_pvt_thread_mutex_lock(&slap_daemon[tid].sd_mutex);
   /* newly accepted stream should not be in any of the FD SETS */
   assert(SLAP_SOCK_NOT_ACTIVE(tid, s));
   ldap_pvt_thread_mutex_unlock(&slap_daemon[tid].sd_mutex);
-#else
-  (void)tid;
 #endif /* LDAP_DEBUG */
 
 #ifdef LDAP_PF_LOCAL
@@ -1912,6 +2667,7 @@ static int slap_listener(Listener *sl) {
   if (sl->sl_is_tls)
     cflag |= CONN_IS_TLS;
 #endif
+  DAEMON_ID_SET(s, tid);
   c = connection_init(
       s, sl, dnsname != NULL ? dnsname : SLAP_STRING_UNKNOWN, peername, cflag,
       ssf, authid.bv_val ? &authid : NULL LDAP_PF_LOCAL_SENDMSG_ARG(&peerbv));
@@ -1922,6 +2678,7 @@ static int slap_listener(Listener *sl) {
   if (!c) {
     Debug(LDAP_DEBUG_ANY, "daemon: connection_init(%ld, %s, %s) failed.\n",
           (long)s, peername, sl->sl_name.bv_val);
+    daemon_ids[s] = 0;
     slapd_close(s);
   }
 
@@ -2162,7 +2919,10 @@ static void *slapd_daemon_task(void *ptr) {
       return (void *)-1;
     }
 
-    slapd_add(slap_listeners[l]->sl_sd, 0, slap_listeners[l], -1);
+    slapd_add(slap_listeners[l]->sl_sd, 0, slap_listeners[l],
+              slap_listeners[l]->sl_shards > 1
+                  ? slap_listeners[l]->sl_shard % slapd_daemon_threads
+                  : -1);
   }
 
 loop:
@@ -2670,14 +3430,21 @@ static int connectionless_init(void) {
 int slapd_daemon(void) {
   int i, rc;
 
-  Debug(LDAP_DEBUG_ANY, "daemon: using " SLAP_EVENT_FNAME "\n");
+#ifdef HAVE_IO_URING
+  if (slap_daemon[0].sd_uring)
+    Debug(LDAP_DEBUG_ANY, "daemon: using io_uring\n");
+  else
+#endif /* HAVE_IO_URING */
+    Debug(LDAP_DEBUG_ANY, "daemon: using " SLAP_EVENT_FNAME "\n");
 
 #ifdef LDAP_CONNECTIONLESS
   connectionless_init();
 #endif /* LDAP_CONNECTIONLESS */
 
-  if (slapd_daemon_threads > SLAPD_MAX_DAEMON_THREADS)
+  if (slapd_daemon_threads > SLAPD_MAX_DAEMON_THREADS) {
     slapd_daemon_threads = SLAPD_MAX_DAEMON_THREADS;
+    slapd_daemon_mask = SLAPD_MAX_DAEMON_THREADS - 1;
+  }
 
   listener_tid = ch_malloc(slapd_daemon_threads * sizeof(ldap_pvt_thread_t));
 
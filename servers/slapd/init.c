@@ -53,9 +53,13 @@ BerVarray default_referral = NULL;
  */
 ldap_pvt_thread_pool_t connection_pool;
 int connection_pool_max = SLAP_MAX_WORKER_THREADS;
+int connection_pool_queues = 1;
+int connection_pool_sched;
 int slap_tool_thread_max = 1;
+int slap_log_async;
 
 slap_counters_t slap_counters, *slap_counters_list;
+static ldap_pvt_thread_mutex_t slap_counters_mutex;
 
 static const char *slap_name = NULL;
 int slapMode = SLAP_UNDEFINED_MODE;
@@ -114,7 +118,8 @@ int slap_init(int mode, const char *name) {
 
     ldap_pvt_thread_pool_init(&connection_pool, connection_pool_max, 0);
 
-    slap_counters_init(&slap_counters);
+    ldap_pvt_thread_mutex_init(&slap_counters_mutex);
+    slap_binlog_init();
 
     ldap_pvt_thread_mutex_init(&slapd_rq.rq_mutex);
     LDAP_STAILQ_INIT(&slapd_rq.task_list);
@@ -173,14 +178,25 @@ int slap_startup(Backend *be) {
   Debug(LDAP_DEBUG_TRACE, "%s startup: initiated.\n", slap_name);
 
   rc = backend_startup(be);
-  if (!rc && (slapMode & SLAP_SERVER_MODE))
+  if (!rc && (slapMode & SLAP_SERVER_MODE)) {
     slapMode |= SLAP_SERVER_RUNNING;
+    if (slap_log_async && ldap_debug_async(slap_log_async) != 0)
+      Debug(LDAP_DEBUG_ANY, "%s startup: unable to start the log writer.\n",
+            slap_name);
+    if (slap_binlog_dir && slap_binlog_open() != 0)
+      Debug(LDAP_DEBUG_ANY, "%s startup: unable to open the binlog.\n",
+            slap_name);
+  }
   return rc;
 }
 
 int slap_shutdown(Backend *be) {
   Debug(LDAP_DEBUG_TRACE, "%s shutdown: initiated\n", slap_name);
 
+  /* no operations are left to log */
+  if (be == NULL)
+    slap_binlog_close();
+
   /* let backends do whatever cleanup they need to do */
   return backend_shutdown(be);
 }
@@ -209,7 +225,12 @@ int slap_destroy(void) {
   switch (slapMode & SLAP_MODE) {
   case SLAP_SERVER_MODE:
   case SLAP_TOOL_MODE:
-    slap_counters_destroy(&slap_counters);
+    ldap_pvt_thread_mutex_destroy(&slap_counters_mutex);
+    slap_binlog_destroy();
+#ifdef SLAPD_MONITOR
+    ch_free(slap_counters.sc_latency);
+    slap_counters.sc_latency = NULL;
+#endif /* SLAPD_MONITOR */
     break;
 
   default:
@@ -227,42 +248,229 @@ int slap_destroy(void) {
   return rc;
 }
 
-void slap_counters_init(slap_counters_t *sc) {
-  int i;
+/* Allocate a counters share for the calling thread */
+slap_counters_t *slap_counters_alloc(void) {
+  char *ptr = ch_calloc(1, sizeof(slap_counters_t) + CACHELINE_SIZE - 1);
+  slap_counters_t *sc =
+      (slap_counters_t *)(((size_t)ptr + CACHELINE_SIZE - 1) &
+                          ~(size_t)(CACHELINE_SIZE - 1));
 
-  ldap_pvt_thread_mutex_init(&sc->sc_mutex);
-  ldap_pvt_mp_init(sc->sc_bytes);
-  ldap_pvt_mp_init(sc->sc_pdu);
-  ldap_pvt_mp_init(sc->sc_entries);
-  ldap_pvt_mp_init(sc->sc_refs);
+  sc->sc_free = ptr;
+#ifdef SLAPD_MONITOR
+  sc->sc_latency =
+      ch_calloc(SLAP_OP_LAST * SLAP_LAT_LAST, sizeof(slap_histo_t));
+#endif /* SLAPD_MONITOR */
+  ldap_pvt_thread_mutex_lock(&slap_counters_mutex);
+  sc->sc_next = slap_counters.sc_next;
+  slap_counters.sc_next = sc;
+  ldap_pvt_thread_mutex_unlock(&slap_counters_mutex);
+  return sc;
+}
 
-  ldap_pvt_mp_init(sc->sc_ops_initiated);
-  ldap_pvt_mp_init(sc->sc_ops_completed);
+/* Fold a share into slap_counters and release it */
+void slap_counters_free(slap_counters_t *sc) {
+  slap_counters_t **prev;
+  int i;
 
+  ldap_pvt_thread_mutex_lock(&slap_counters_mutex);
+  for (prev = &slap_counters.sc_next; *prev; prev = &(*prev)->sc_next) {
+    if (*prev == sc) {
+      *prev = sc->sc_next;
+      break;
+    }
+  }
+  slap_counters_add(&slap_counters, sc_bytes, sc->sc_bytes);
+  slap_counters_add(&slap_counters, sc_pdu, sc->sc_pdu);
+  slap_counters_add(&slap_counters, sc_entries, sc->sc_entries);
+  slap_counters_add(&slap_counters, sc_refs, sc->sc_refs);
+  slap_counters_add(&slap_counters, sc_ops_initiated, sc->sc_ops_initiated);
+  slap_counters_add(&slap_counters, sc_ops_completed, sc->sc_ops_completed);
 #ifdef SLAPD_MONITOR
   for (i = 0; i < SLAP_OP_LAST; i++) {
-    ldap_pvt_mp_init(sc->sc_ops_initiated_[i]);
-    ldap_pvt_mp_init(sc->sc_ops_completed_[i]);
+    slap_counters_add(&slap_counters, sc_ops_initiated_[i],
+                      sc->sc_ops_initiated_[i]);
+    slap_counters_add(&slap_counters, sc_ops_completed_[i],
+                      sc->sc_ops_completed_[i]);
+  }
+  if (sc->sc_latency) {
+    if (!slap_counters.sc_latency)
+      slap_counters.sc_latency =
+          ch_calloc(SLAP_OP_LAST * SLAP_LAT_LAST, sizeof(slap_histo_t));
+    for (i = 0; i < SLAP_OP_LAST * SLAP_LAT_LAST; i++)
+      slap_histo_merge(&slap_counters.sc_latency[i], &sc->sc_latency[i]);
+    ch_free(sc->sc_latency);
   }
 #endif /* SLAPD_MONITOR */
+  ldap_pvt_thread_mutex_unlock(&slap_counters_mutex);
+  ch_free(sc->sc_free);
 }
 
-void slap_counters_destroy(slap_counters_t *sc) {
+/* Sum up slap_counters and the shares of all running threads */
+void slap_counters_sum(slap_counters_t *sum) {
+  slap_counters_t *sc;
   int i;
 
-  ldap_pvt_thread_mutex_destroy(&sc->sc_mutex);
-  ldap_pvt_mp_clear(sc->sc_bytes);
-  ldap_pvt_mp_clear(sc->sc_pdu);
-  ldap_pvt_mp_clear(sc->sc_entries);
-  ldap_pvt_mp_clear(sc->sc_refs);
-
-  ldap_pvt_mp_clear(sc->sc_ops_initiated);
-  ldap_pvt_mp_clear(sc->sc_ops_completed);
+  memset(sum, 0, sizeof(*sum));
+  ldap_pvt_thread_mutex_lock(&slap_counters_mutex);
+  for (sc = &slap_counters; sc; sc = sc->sc_next) {
+    sum->sc_bytes += sc->sc_bytes;
+    sum->sc_pdu += sc->sc_pdu;
+    sum->sc_entries += sc->sc_entries;
+    sum->sc_refs += sc->sc_refs;
+    sum->sc_ops_initiated += sc->sc_ops_initiated;
+    sum->sc_ops_completed += sc->sc_ops_completed;
+#ifdef SLAPD_MONITOR
+    for (i = 0; i < SLAP_OP_LAST; i++) {
+      sum->sc_ops_initiated_[i] += sc->sc_ops_initiated_[i];
+      sum->sc_ops_completed_[i] += sc->sc_ops_completed_[i];
+    }
+#endif /* SLAPD_MONITOR */
+  }
+  ldap_pvt_thread_mutex_unlock(&slap_counters_mutex);
+}
 
 #ifdef SLAPD_MONITOR
-  for (i = 0; i < SLAP_OP_LAST; i++) {
-    ldap_pvt_mp_clear(sc->sc_ops_initiated_[i]);
-    ldap_pvt_mp_clear(sc->sc_ops_completed_[i]);
+static unsigned slap_histo_index(uint64_t us) {
+  unsigned e;
+
+  if (us < 1u << SLAP_HISTO_SUB_BITS)
+    return us;
+  if (us > UINT32_MAX)
+    us = UINT32_MAX;
+  e = 31 - __builtin_clz((uint32_t)us);
+  return ((e - SLAP_HISTO_SUB_BITS + 1) << SLAP_HISTO_SUB_BITS) +
+         ((us >> (e - SLAP_HISTO_SUB_BITS)) &
+          ((1u << SLAP_HISTO_SUB_BITS) - 1));
+}
+
+/* The highest value counted by a bucket */
+static uint64_t slap_histo_upper(unsigned i) {
+  unsigned shift;
+
+  if (i < 1u << SLAP_HISTO_SUB_BITS)
+    return i;
+  shift = (i >> SLAP_HISTO_SUB_BITS) - 1;
+  return ((uint64_t)((1u << SLAP_HISTO_SUB_BITS) |
+                     (i & ((1u << SLAP_HISTO_SUB_BITS) - 1)))
+          << shift) +
+         ((uint64_t)1 << shift) - 1;
+}
+
+void slap_histo_add(slap_histo_t *h, uint64_t us) {
+  uint64_t max;
+
+  __sync_fetch_and_add(&h->sh_bucket[slap_histo_index(us)], 1);
+  __sync_fetch_and_add(&h->sh_count, 1);
+  __sync_fetch_and_add(&h->sh_sum, us);
+  while ((max = h->sh_max) < us &&
+         !__sync_bool_compare_and_swap(&h->sh_max, max, us))
+    ;
+}
+
+void slap_histo_merge(slap_histo_t *sum, const slap_histo_t *h) {
+  int i;
+
+  sum->sh_count += h->sh_count;
+  sum->sh_sum += h->sh_sum;
+  if (sum->sh_max < h->sh_max)
+    sum->sh_max = h->sh_max;
+  for (i = 0; i < SLAP_HISTO_BUCKETS; i++)
+    sum->sh_bucket[i] += h->sh_bucket[i];
+}
+
+/* Clear a histogram, samples added meanwhile may be half counted */
+void slap_histo_reset(slap_histo_t *h) {
+  int i;
+
+  __sync_lock_test_and_set(&h->sh_count, 0);
+  __sync_lock_test_and_set(&h->sh_sum, 0);
+  __sync_lock_test_and_set(&h->sh_max, 0);
+  for (i = 0; i < SLAP_HISTO_BUCKETS; i++)
+    __sync_lock_test_and_set(&h->sh_bucket[i], 0);
+}
+
+/* The value at or below which the given per mille of the samples are */
+uint64_t slap_histo_quantile(const slap_histo_t *h, unsigned permille) {
+  uint64_t rank, seen = 0, v;
+  int i;
+
+  rank = (h->sh_count * permille + 999) / 1000;
+  if (!rank)
+    return 0;
+  for (i = 0; i < SLAP_HISTO_BUCKETS; i++) {
+    seen += h->sh_bucket[i];
+    if (seen >= rank) {
+      v = slap_histo_upper(i);
+      return v < h->sh_max ? v : h->sh_max;
+    }
   }
-#endif /* SLAPD_MONITOR */
+  return h->sh_max;
 }
+
+/* Account a completed operation started at start_ns to the histograms
+ * of its type and of the database that sent its result */
+void slap_latency_add(Operation *op, slap_op_t opidx, uint64_t start_ns) {
+  uint64_t us[SLAP_LAT_LAST], run = ldap_now_steady_ns() - start_ns;
+  slap_histo_t *h;
+  BackendDB *bd;
+  int i;
+
+  us[SLAP_LAT_QUEUE] = (start_ns - op->o_stamp_ns) / 1000;
+  us[SLAP_LAT_EXEC] = (run > op->o_send_ns ? run - op->o_send_ns : 0) / 1000;
+  us[SLAP_LAT_SEND] = op->o_send_ns / 1000;
+
+  h = op->o_counters->sc_latency;
+  if (h)
+    for (i = 0; i < SLAP_LAT_LAST; i++)
+      slap_histo_add(&h[opidx * SLAP_LAT_LAST + i], us[i]);
+
+  bd = op->o_result_bd;
+  if (!bd && op->o_bd)
+    bd = op->o_bd->bd_self;
+  if (!bd)
+    return;
+  h = bd->be_latency;
+  if (!h) {
+    h = ch_calloc(SLAP_LAT_LAST, sizeof(slap_histo_t));
+    if (!__sync_bool_compare_and_swap(&bd->be_latency, NULL, h)) {
+      ch_free(h);
+      h = bd->be_latency;
+    }
+  }
+  for (i = 0; i < SLAP_LAT_LAST; i++)
+    slap_histo_add(&h[i], us[i]);
+}
+
+/* Sum up the histogram of a phase of an operation type, or of all
+ * types for SLAP_OP_LAST, over slap_counters and all threads' shares */
+void slap_latency_sum(slap_op_t opidx, slap_lat_t phase, slap_histo_t *sum) {
+  slap_counters_t *sc;
+  int i;
+
+  memset(sum, 0, sizeof(*sum));
+  ldap_pvt_thread_mutex_lock(&slap_counters_mutex);
+  for (sc = &slap_counters; sc; sc = sc->sc_next) {
+    if (!sc->sc_latency)
+      continue;
+    for (i = 0; i < SLAP_OP_LAST; i++)
+      if (opidx == SLAP_OP_LAST || opidx == i)
+        slap_histo_merge(sum, &sc->sc_latency[i * SLAP_LAT_LAST + phase]);
+  }
+  ldap_pvt_thread_mutex_unlock(&slap_counters_mutex);
+}
+
+void slap_latency_reset(slap_op_t opidx, slap_lat_t phase) {
+  slap_counters_t *sc;
+  int i;
+
+  ldap_pvt_thread_mutex_lock(&slap_counters_mutex);
+  for (sc = &slap_counters; sc; sc = sc->sc_next) {
+    if (!sc->sc_latency)
+      continue;
+    for (i = 0; i < SLAP_OP_LAST; i++)
+      if (opidx == SLAP_OP_LAST || opidx == i)
+        slap_histo_reset(&sc->sc_latency[i * SLAP_LAT_LAST + phase]);
+  }
+  ldap_pvt_thread_mutex_unlock(&slap_counters_mutex);
+}
+#endif /* SLAPD_MONITOR */
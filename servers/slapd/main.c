@@ -50,7 +50,7 @@ static void wait4child(int sig);
 
 typedef int(MainFunc)(int argc, char *argv[]);
 extern MainFunc slapadd, slapcat, slapdn, slapindex, slappasswd, slaptest,
-    slapauth, slapacl, slapschema;
+    slapauth, slapacl, slapschema, slaplog;
 
 static struct {
   char *name;
@@ -64,6 +64,7 @@ static struct {
              {"slaptest", slaptest},
              {"slapauth", slapauth},
              {"slapacl", slapacl},
+             {"slaplog", slaplog},
              /* NOTE: new tools must be added in chronological order,
               * not in alphabetical order, because for backwards
               * compatibility name[4] is used to identify the
@@ -119,6 +120,27 @@ static int slapd_opt_slp(const char *val, void *arg) {
 #endif
 }
 
+static int slapd_opt_io_uring(const char *val, void *arg) {
+#ifdef HAVE_IO_URING
+  if (val == NULL || strcasecmp(val, "on") == 0) {
+    slapd_io_uring = 1;
+
+  } else if (strcasecmp(val, "off") == 0) {
+    slapd_io_uring = 0;
+
+  } else {
+    fprintf(stderr, "unrecognized value \"%s\" for io_uring option\n", val);
+    return -1;
+  }
+
+  return 0;
+
+#else
+  fputs("slapd: io_uring support is not available\n", stderr);
+  return 0;
+#endif
+}
+
 /*
  * Option helper structure:
  *
@@ -140,6 +162,8 @@ struct option_helper {
 } option_helpers[] = {
     {BER_BVC("slp"), slapd_opt_slp, NULL,
      "slp[={on|off|(attrs)}] enable/disable SLP using (attrs)"},
+    {BER_BVC("io_uring"), slapd_opt_io_uring, NULL,
+     "io_uring[={on|off}] poll sockets through io_uring instead of epoll"},
     {BER_BVNULL, 0, NULL, NULL}};
 
 #ifdef LDAP_SYSLOG
@@ -272,7 +296,7 @@ static void usage(char *name) {
 #endif
           "\t-4\t\tIPv4 only\n"
           "\t-6\t\tIPv6 only\n"
-          "\t-T {acl|add|auth|cat|dn|index|passwd|test}\n"
+          "\t-T {acl|add|auth|cat|dn|index|log|passwd|test}\n"
           "\t\t\tRun in Tool mode\n"
           "\t-c cookie\tSync cookie of consumer\n"
           "\t-d level\tDebug level"
@@ -971,6 +995,7 @@ destroy:
   entry_info_destroy();
 
 stop:
+  ldap_debug_async(0);
   Debug(LDAP_DEBUG_ANY, "slapd stopped.\n");
 
 #ifdef LOG_DEBUG
@@ -0,0 +1,397 @@
+/* $ReOpenLDAP$ */
+/* Copyright 2018 ReOpenLDAP AUTHORS: please see AUTHORS file.
+ * All rights reserved.
+ *
+ * This file is part of ReOpenLDAP.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+/* opclass.c - priority classes of client operations
+ *
+ * Each "opclass" line defines a class of operations, selected by the
+ * identity bound to the connection, the peer address and the type of
+ * the operation. Classes map to the priority classes of
+ * connection_pool in the order they are configured: class 0 is kept
+ * for the server's own tasks (replication consumers among them) and
+ * for Bind, Unbind and Abandon, then come the configured classes, and
+ * last the operations no class selects. A class may be limited to a
+ * share of the threads and a number of waiting operations, and may
+ * shed load with LDAP_BUSY while its operations wait too long. */
+
+#include "reldap.h"
+
+#include <stdio.h>
+
+#include <ac/ctype.h>
+#include <ac/regex.h>
+#include <ac/string.h>
+
+#include "slap.h"
+#include "slapconfig.h"
+
+/* the server's tasks and the class of unselected operations */
+#define OPCLASS_MAX (LDAP_PVT_THREAD_POOL_MAX_CLASSES - 2)
+
+enum {
+  OPCLASS_DN_ANY = 0,
+  OPCLASS_DN_EXACT,
+  OPCLASS_DN_SUBTREE,
+  OPCLASS_DN_REGEX,
+  OPCLASS_DN_ANONYMOUS,
+  OPCLASS_DN_USERS
+};
+
+static const struct berval dnstyles[] = {
+    BER_BVNULL, BER_BVC("exact"), BER_BVC("subtree"), BER_BVC("regex"),
+    BER_BVC("anonymous"), BER_BVC("users")};
+
+static const slap_verbmasks opclass_ops[] = {
+    {BER_BVC("add"), 1 << SLAP_OP_ADD},
+    {BER_BVC("compare"), 1 << SLAP_OP_COMPARE},
+    {BER_BVC("delete"), 1 << SLAP_OP_DELETE},
+    {BER_BVC("extended"), 1 << SLAP_OP_EXTENDED},
+    {BER_BVC("modify"), 1 << SLAP_OP_MODIFY},
+    {BER_BVC("modrdn"), 1 << SLAP_OP_MODRDN},
+    {BER_BVC("search"), 1 << SLAP_OP_SEARCH},
+    {BER_BVNULL, 0}};
+
+typedef struct slap_opclass {
+  struct berval oc_name;
+  ldap_pvt_thread_pool_class_t oc_pool;
+  int oc_dnstyle;
+  struct berval oc_dn; /* normalized DN, or regex */
+  regex_t oc_dnre;
+  struct berval oc_peer; /* regex */
+  regex_t oc_peerre;
+  slap_mask_t oc_ops; /* 0 for all */
+} slap_opclass;
+
+static slap_opclass opclasses[OPCLASS_MAX];
+static int nopclasses;
+
+static int opclass_match(slap_opclass *oc, Connection *conn, slap_op_t opidx) {
+  if (oc->oc_ops && !(oc->oc_ops & (1 << opidx)))
+    return 0;
+
+  switch (oc->oc_dnstyle) {
+  case OPCLASS_DN_EXACT:
+    if (!dn_match(&conn->c_ndn, &oc->oc_dn))
+      return 0;
+    break;
+  case OPCLASS_DN_SUBTREE:
+    if (BER_BVISEMPTY(&conn->c_ndn) || !dnIsSuffix(&conn->c_ndn, &oc->oc_dn))
+      return 0;
+    break;
+  case OPCLASS_DN_REGEX:
+    if (BER_BVISEMPTY(&conn->c_ndn) ||
+        regexec(&oc->oc_dnre, conn->c_ndn.bv_val, 0, NULL, 0))
+      return 0;
+    break;
+  case OPCLASS_DN_ANONYMOUS:
+    if (!BER_BVISEMPTY(&conn->c_ndn))
+      return 0;
+    break;
+  case OPCLASS_DN_USERS:
+    if (BER_BVISEMPTY(&conn->c_ndn))
+      return 0;
+    break;
+  }
+
+  if (!BER_BVISNULL(&oc->oc_peer) &&
+      (BER_BVISNULL(&conn->c_peer_name) ||
+       regexec(&oc->oc_peerre, conn->c_peer_name.bv_val, 0, NULL, 0)))
+    return 0;
+
+  return 1;
+}
+
+/* The connection_pool class of an operation, 0 if there are none */
+int slap_opclass_select(Operation *op) {
+  slap_op_t opidx;
+  int i;
+
+  if (!nopclasses)
+    return 0;
+
+  switch (op->o_tag) {
+  case LDAP_REQ_BIND:
+  case LDAP_REQ_UNBIND:
+  case LDAP_REQ_ABANDON:
+    return 0;
+  }
+  opidx = slap_req2op(op->o_tag);
+  if (opidx == SLAP_OP_LAST)
+    return 0;
+
+  for (i = 0; i < nopclasses; i++)
+    if (opclass_match(&opclasses[i], op->o_conn, opidx))
+      return i + 1;
+  return nopclasses + 1;
+}
+
+static void opclass_apply(void) {
+  ldap_pvt_thread_pool_class_t classes[LDAP_PVT_THREAD_POOL_MAX_CLASSES];
+  int i;
+
+  if (!(slapMode & SLAP_SERVER_MODE))
+    return;
+
+  memset(classes, 0, sizeof(classes));
+  classes[0].ltc_share = 100;
+  for (i = 0; i < nopclasses; i++)
+    classes[i + 1] = opclasses[i].oc_pool;
+  classes[i + 1].ltc_share = 100;
+  ldap_pvt_thread_pool_classes(&connection_pool, nopclasses ? i + 2 : 0,
+                               classes);
+}
+
+static void opclass_free(slap_opclass *oc) {
+  ch_free(oc->oc_name.bv_val);
+  if (oc->oc_dnstyle == OPCLASS_DN_REGEX)
+    regfree(&oc->oc_dnre);
+  ch_free(oc->oc_dn.bv_val);
+  if (!BER_BVISNULL(&oc->oc_peer))
+    regfree(&oc->oc_peerre);
+  ch_free(oc->oc_peer.bv_val);
+  memset(oc, 0, sizeof(*oc));
+}
+
+static int opclass_regcomp(ConfigArgs *c, regex_t *re, const char *pat) {
+  int rc = regcomp(re, pat, REG_EXTENDED | REG_ICASE | REG_NOSUB);
+
+  if (rc) {
+    char buf[SLAP_TEXT_BUFLEN];
+
+    regerror(rc, re, buf, sizeof(buf));
+    snprintf(c->cr_msg, sizeof(c->cr_msg), "<%s> bad regex \"%s\": %s",
+             c->argv[0], pat, buf);
+    Debug(LDAP_DEBUG_ANY, "%s: %s\n", c->log, c->cr_msg);
+    return ARG_BAD_CONF;
+  }
+  return 0;
+}
+
+static int opclass_parse(ConfigArgs *c, slap_opclass *oc) {
+  int i, j, rc;
+
+  memset(oc, 0, sizeof(*oc));
+  oc->oc_pool.ltc_share = 100;
+  ber_str2bv(c->argv[1], 0, 1, &oc->oc_name);
+
+  for (i = 2; i < c->argc; i++) {
+    char *arg = c->argv[i], *val = strchr(arg, '='), *next;
+    unsigned long num;
+
+    if (!strcasecmp(arg, "anonymous") || !strcasecmp(arg, "users")) {
+      if (oc->oc_dnstyle)
+        goto dup;
+      oc->oc_dnstyle = strcasecmp(arg, "users") ? OPCLASS_DN_ANONYMOUS
+                                                : OPCLASS_DN_USERS;
+      continue;
+    }
+    if (!val || val == arg)
+      goto bad;
+    val++;
+
+    if (!strncasecmp(arg, "share=", STRLENOF("share=")) ||
+        !strncasecmp(arg, "pending=", STRLENOF("pending=")) ||
+        !strncasecmp(arg, "target=", STRLENOF("target=")) ||
+        !strncasecmp(arg, "interval=", STRLENOF("interval="))) {
+      num = strtoul(val, &next, 10);
+      if (next == val || *next || num > INT_MAX)
+        goto bad;
+      switch (TOLOWER(*arg)) {
+      case 's':
+        if (num < 1 || num > 100)
+          goto bad;
+        oc->oc_pool.ltc_share = num;
+        break;
+      case 'p':
+        oc->oc_pool.ltc_pending = num;
+        break;
+      case 't':
+        oc->oc_pool.ltc_target = num;
+        break;
+      case 'i':
+        oc->oc_pool.ltc_interval = num;
+        break;
+      }
+
+    } else if (!strncasecmp(arg, "dn.", STRLENOF("dn."))) {
+      struct berval style, pat;
+
+      if (oc->oc_dnstyle)
+        goto dup;
+      style.bv_val = arg + STRLENOF("dn.");
+      style.bv_len = val - 1 - style.bv_val;
+      for (j = OPCLASS_DN_EXACT; j <= OPCLASS_DN_REGEX; j++)
+        if (ber_bvstrcasecmp(&style, &dnstyles[j]) == 0)
+          break;
+      if (j > OPCLASS_DN_REGEX)
+        goto bad;
+      oc->oc_dnstyle = j;
+      ber_str2bv(val, 0, 0, &pat);
+      if (j == OPCLASS_DN_REGEX) {
+        rc = opclass_regcomp(c, &oc->oc_dnre, val);
+        if (rc) {
+          oc->oc_dnstyle = OPCLASS_DN_ANY;
+          goto fail;
+        }
+        ber_dupbv(&oc->oc_dn, &pat);
+      } else if (dnNormalize(0, NULL, NULL, &pat, &oc->oc_dn, NULL) !=
+                 LDAP_SUCCESS) {
+        goto bad;
+      }
+
+    } else if (!strncasecmp(arg, "peername.regex=",
+                            STRLENOF("peername.regex="))) {
+      if (!BER_BVISNULL(&oc->oc_peer))
+        goto dup;
+      rc = opclass_regcomp(c, &oc->oc_peerre, val);
+      if (rc)
+        goto fail;
+      ber_str2bv(val, 0, 1, &oc->oc_peer);
+
+    } else if (!strncasecmp(arg, "op=", STRLENOF("op="))) {
+      char **ops = ldap_str2charray(val, ",");
+
+      for (j = 0; ops && ops[j]; j++) {
+        int k = verb_to_mask(ops[j], opclass_ops);
+        if (BER_BVISNULL(&opclass_ops[k].word)) {
+          ldap_charray_free(ops);
+          goto bad;
+        }
+        oc->oc_ops |= opclass_ops[k].mask;
+      }
+      ldap_charray_free(ops);
+
+    } else {
+      goto bad;
+    }
+    continue;
+
+  dup:
+    snprintf(c->cr_msg, sizeof(c->cr_msg), "<%s> more than one DN selector",
+             c->argv[0]);
+    Debug(LDAP_DEBUG_ANY, "%s: %s \"%s\"\n", c->log, c->cr_msg, arg);
+    rc = ARG_BAD_CONF;
+    goto fail;
+
+  bad:
+    snprintf(c->cr_msg, sizeof(c->cr_msg), "<%s> invalid parameter",
+             c->argv[0]);
+    Debug(LDAP_DEBUG_ANY, "%s: %s \"%s\"\n", c->log, c->cr_msg, arg);
+    rc = ARG_BAD_CONF;
+    goto fail;
+  }
+
+  if (oc->oc_pool.ltc_target && !oc->oc_pool.ltc_interval)
+    oc->oc_pool.ltc_interval = 100;
+  return 0;
+
+fail:
+  opclass_free(oc);
+  return rc;
+}
+
+static void opclass_unparse(slap_opclass *oc, int idx, struct berval *bv) {
+  char buf[SLAP_TEXT_BUFLEN], *ptr = buf, *end = buf + sizeof(buf);
+  struct berval ops = BER_BVNULL;
+  int n;
+
+  n = snprintf(ptr, end - ptr, SLAP_X_ORDERED_FMT "%s", idx,
+               oc->oc_name.bv_val);
+  ptr += n;
+  if (oc->oc_pool.ltc_share != 100 && ptr < end)
+    ptr += snprintf(ptr, end - ptr, " share=%d", oc->oc_pool.ltc_share);
+  if (oc->oc_pool.ltc_pending && ptr < end)
+    ptr += snprintf(ptr, end - ptr, " pending=%d", oc->oc_pool.ltc_pending);
+  if (oc->oc_pool.ltc_target && ptr < end)
+    ptr += snprintf(ptr, end - ptr, " target=%d interval=%d",
+                    oc->oc_pool.ltc_target, oc->oc_pool.ltc_interval);
+  if (ptr < end) {
+    switch (oc->oc_dnstyle) {
+    case OPCLASS_DN_EXACT:
+    case OPCLASS_DN_SUBTREE:
+    case OPCLASS_DN_REGEX:
+      ptr += snprintf(ptr, end - ptr, " dn.%s=\"%s\"",
+                      dnstyles[oc->oc_dnstyle].bv_val, oc->oc_dn.bv_val);
+      break;
+    case OPCLASS_DN_ANONYMOUS:
+    case OPCLASS_DN_USERS:
+      ptr += snprintf(ptr, end - ptr, " %s", dnstyles[oc->oc_dnstyle].bv_val);
+      break;
+    }
+  }
+  if (!BER_BVISNULL(&oc->oc_peer) && ptr < end)
+    ptr += snprintf(ptr, end - ptr, " peername.regex=\"%s\"",
+                    oc->oc_peer.bv_val);
+  if (oc->oc_ops && ptr < end &&
+      mask_to_verbstring(opclass_ops, oc->oc_ops, ',', &ops) == 0) {
+    ptr += snprintf(ptr, end - ptr, " op=%s", ops.bv_val);
+    ch_free(ops.bv_val);
+  }
+  if (ptr >= end)
+    ptr = end - 1;
+  bv->bv_len = ptr - buf;
+  bv->bv_val = ch_malloc(bv->bv_len + 1);
+  memcpy(bv->bv_val, buf, bv->bv_len + 1);
+}
+
+int config_opclass(ConfigArgs *c) {
+  slap_opclass oc;
+  int i, rc;
+
+  if (c->op == SLAP_CONFIG_EMIT) {
+    struct berval bv;
+
+    if (!nopclasses)
+      return 1;
+    for (i = 0; i < nopclasses; i++) {
+      opclass_unparse(&opclasses[i], i, &bv);
+      ber_bvarray_add(&c->rvalue_vals, &bv);
+    }
+    return 0;
+
+  } else if (c->op == LDAP_MOD_DELETE) {
+    if (c->valx < 0) {
+      for (i = 0; i < nopclasses; i++)
+        opclass_free(&opclasses[i]);
+      nopclasses = 0;
+    } else if (c->valx < nopclasses) {
+      opclass_free(&opclasses[c->valx]);
+      for (i = c->valx; i < nopclasses - 1; i++)
+        opclasses[i] = opclasses[i + 1];
+      nopclasses--;
+    }
+    opclass_apply();
+    return 0;
+  }
+
+  if (nopclasses >= OPCLASS_MAX) {
+    snprintf(c->cr_msg, sizeof(c->cr_msg), "<%s> at most %d classes",
+             c->argv[0], OPCLASS_MAX);
+    Debug(LDAP_DEBUG_ANY, "%s: %s\n", c->log, c->cr_msg);
+    return ARG_BAD_CONF;
+  }
+  rc = opclass_parse(c, &oc);
+  if (rc)
+    return rc;
+
+  i = nopclasses;
+  if (c->valx >= 0 && c->valx < nopclasses) {
+    for (i = nopclasses; i > c->valx; i--)
+      opclasses[i] = opclasses[i - 1];
+  }
+  opclasses[i] = oc;
+  nopclasses++;
+  opclass_apply();
+  return 0;
+}
@@ -176,6 +176,7 @@ Operation *slap_op_alloc(BerElement *ber, ber_int_t msgid, ber_tag_t tag,
 
   slap_op_time(&op->o_time, &op->o_tincr);
   op->o_opid = id;
+  op->o_stamp_ns = ldap_now_steady_ns();
 
 #if defined(LDAP_SLAPI)
   if (slapi_plugins_used) {
@@ -29,6 +29,7 @@
 #include "slap.h"
 #include "slapconfig.h"
 #include "ldap_rq.h"
+#include "slog.h"
 
 /* A modify request on a particular entry */
 typedef struct modinst {
@@ -135,6 +136,26 @@ typedef struct syncmatches {
   syncops *sm_op;
 } syncmatches;
 
+/* A persistent search to be matched against a write */
+typedef struct matchcand {
+  syncops *mc_so; /* held by OS_REF_OP_MATCH */
+  int mc_fscope;
+  int mc_found;
+  int mc_mode; /* the response to queue, if any */
+} matchcand;
+
+/* The filter result of a write for the persistent searches which
+ * test the same filter on the same scope with the same rights */
+typedef struct matchgroup {
+  struct matchgroup *mg_next;
+  int mg_scope;
+  Connection *mg_conn; /* NULL unless the ACLs look at the connection */
+  struct berval mg_base;
+  struct berval mg_filter;
+  struct berval mg_ndn;
+  int mg_rc;
+} matchgroup;
+
 /* Session log data */
 typedef struct slog_entry {
   struct slog_entry *se_next;
@@ -151,9 +172,17 @@ typedef struct sessionlog {
   int sl_playing;
   slog_entry *sl_head;
   slog_entry *sl_tail;
+  const mdb_extra_t *sl_mdb; /* log kept in the backend, if set */
+  BackendDB *sl_be;
+  unsigned sl_dbi;
   ldap_pvt_thread_mutex_t sl_mutex;
 } sessionlog;
 
+/* Name of the sub-database of a persistent sessionlog */
+#define SLOG_DBNAME "syncprov.slog"
+/* The part of a CSN slap_csn_compare_ts() looks at first */
+#define SLOG_SEEK_LEN 29
+
 /* The main state for this overlay */
 typedef struct syncprov_info_t {
   syncops *si_ops;
@@ -171,12 +200,17 @@ typedef struct syncprov_info_t {
   time_t si_chklast;  /* time of last checkpoint */
   Avlnode *si_mods;   /* entries being modified */
   sessionlog *si_logs;
+  char si_logpersist; /* keep the sessionlog in the backend */
   volatile int si_psearches;
   volatile int si_prefresh;
   ldap_pvt_thread_rdwr_t si_csn_rwlock;
   ldap_pvt_thread_mutex_t si_ops_mutex;
   ldap_pvt_thread_mutex_t si_mods_mutex;
   ldap_pvt_thread_mutex_t si_resp_mutex;
+  /* Turns of the writers to queue responses, see syncprov_resp_turn() */
+  unsigned long si_resp_next;
+  unsigned long si_resp_done;
+  ldap_pvt_thread_cond_t si_resp_cond;
 } syncprov_info_t;
 
 typedef struct opcookie {
@@ -188,9 +222,13 @@ typedef struct opcookie {
   struct berval sndn;
   struct berval suuid; /* UUID of entry */
   struct berval sctxcsn;
-  short osid;       /* sid of op csn */
-  short rsid;       /* sid of relay */
-  short sreference; /* Is the entry a reference? */
+  unsigned long sturn; /* turn to queue the responses in */
+  short sturned;       /* sturn is taken and not done yet */
+  slog_hook_t shook;   /* to store the log record with the change */
+  short sstored;       /* the log record was stored */
+  short osid;          /* sid of op csn */
+  short rsid;          /* sid of relay */
+  short sreference;    /* Is the entry a reference? */
   reslink srl;
 } opcookie;
 
@@ -1313,7 +1351,9 @@ static void syncprov_qresp(opcookie *opc, syncops *so, int mode) {
     so->s_flags ^= PS_WROTE_BASE;
     so->s_flags |= PS_FIND_BASE;
   }
-  if ((so->s_flags & (PS_IS_DETACHED | PS_TASK_QUEUED)) == PS_IS_DETACHED) {
+  /* An unlinked op frees its queue when the last hold is dropped */
+  if ((so->s_flags & (PS_IS_DETACHED | PS_TASK_QUEUED)) == PS_IS_DETACHED &&
+      so->s_next != so) {
     syncprov_playback_enqueue(so);
   }
   ldap_pvt_thread_mutex_unlock(&so->s_mutex);
@@ -1388,7 +1428,111 @@ static int syncprov_op_abandon(Operation *op, SlapReply *rs) {
   return SLAP_CB_CONTINUE;
 }
 
+/* Whether the ACLs of be look at more than the identity of the user,
+ * so that a filter may match differently on two of its connections */
+static int syncprov_acl_byconn(BackendDB *be) {
+  AccessControl *a;
+  Access *b;
+  int i;
+
+  for (i = 0; i < 2; i++) {
+    for (a = i ? frontendDB->be_acl : be->be_acl; a; a = a->acl_next) {
+      for (b = a->acl_access; b; b = b->a_next) {
+        if (!BER_BVISEMPTY(&b->a_peername_pat) ||
+            !BER_BVISEMPTY(&b->a_sockname_pat) ||
+            !BER_BVISEMPTY(&b->a_domain_pat) ||
+            !BER_BVISEMPTY(&b->a_sockurl_pat) ||
+            !BER_BVISEMPTY(&b->a_set_pat) ||
+            !BER_BVISEMPTY(&b->a_realdn_pat) || b->a_realdn_at ||
+            b->a_realdn_self || b->a_authz.sai_ssf ||
+            b->a_authz.sai_transport_ssf || b->a_authz.sai_tls_ssf ||
+            b->a_authz.sai_sasl_ssf)
+          return 1;
+#ifdef SLAP_DYNACL
+        if (b->a_dynacl)
+          return 1;
+#endif /* SLAP_DYNACL */
+      }
+    }
+  }
+  return 0;
+}
+
+static matchgroup *syncprov_matchgroup_find(matchgroup *mg, syncops *so,
+                                            Connection *conn) {
+  Operation *sop = so->s_op_safe;
+
+  for (; mg; mg = mg->mg_next) {
+    if (mg->mg_scope == sop->ors_scope && mg->mg_conn == conn &&
+        ber_bvcmp(&mg->mg_filter, &so->s_filterstr) == 0 &&
+        ber_bvcmp(&mg->mg_ndn, &sop->o_ndn) == 0 &&
+        dn_match(&mg->mg_base, &so->s_base))
+      break;
+  }
+  return mg;
+}
+
+static void syncprov_matchgroup_add(Operation *op, matchgroup **groups,
+                                    syncops *so, Connection *conn, int rc) {
+  matchgroup *mg = op->o_tmpalloc(sizeof(matchgroup), op->o_tmpmemctx);
+
+  mg->mg_scope = so->s_op_safe->ors_scope;
+  mg->mg_conn = conn;
+  ber_dupbv_x(&mg->mg_base, &so->s_base, op->o_tmpmemctx);
+  ber_dupbv_x(&mg->mg_filter, &so->s_filterstr, op->o_tmpmemctx);
+  ber_dupbv_x(&mg->mg_ndn, &so->s_op_safe->o_ndn, op->o_tmpmemctx);
+  mg->mg_rc = rc;
+  mg->mg_next = *groups;
+  *groups = mg;
+}
+
 /* Find which persistent searches are affected by this operation */
+/* Consumers must get the changes in the order the contextCSN moved,
+ * which is the order writers take their turns under si_resp_mutex.
+ * A writer may drop the mutex after taking its turn, to test the
+ * filters, then waits for the turns before its own to be done before
+ * it queues. An op takes one turn at most, which is done at the end of
+ * syncprov_op_response() whatever way it got there, and nowhere else.
+ * Enter with si_resp_mutex locked. */
+static void syncprov_resp_turn(syncprov_info_t *si, opcookie *opc) {
+  if (!opc->sturned) {
+    opc->sturn = si->si_resp_next++;
+    opc->sturned = 1;
+  }
+}
+
+static void syncprov_resp_wait(syncprov_info_t *si, opcookie *opc) {
+  assert(opc->sturned);
+  while (si->si_resp_done != opc->sturn)
+    ldap_pvt_thread_cond_wait(&si->si_resp_cond, &si->si_resp_mutex);
+}
+
+static void syncprov_resp_done(syncprov_info_t *si, opcookie *opc) {
+  if (opc->sturned) {
+    syncprov_resp_wait(si, opc);
+    opc->sturned = 0;
+    si->si_resp_done++;
+    ldap_pvt_thread_cond_broadcast(&si->si_resp_cond);
+  }
+}
+
+/* Queue the responses picked by syncprov_matchops() in turn */
+static void syncprov_matchops_queue(opcookie *opc, matchcand *mc, int nmc) {
+  syncprov_info_t *si = opc->son->on_bi.bi_private;
+  int i;
+
+  ldap_pvt_thread_mutex_lock(&si->si_resp_mutex);
+  syncprov_resp_wait(si, opc);
+  for (i = 0; i < nmc; i++) {
+    if (mc[i].mc_mode)
+      syncprov_qresp(opc, mc[i].mc_so, mc[i].mc_mode);
+  }
+  ldap_pvt_thread_mutex_unlock(&si->si_resp_mutex);
+}
+
+/* With saveit the matches are saved before the write. Otherwise the
+ * responses are queued in the turn the caller took in opc->sturn,
+ * the filters are tested before. */
 static void syncprov_matchops(Operation *op, opcookie *opc, int saveit) {
   slap_overinst *on = opc->son;
   syncprov_info_t *si = on->on_bi.bi_private;
@@ -1428,6 +1572,8 @@ static void syncprov_matchops(Operation *op, opcookie *opc, int saveit) {
     }
     if (rc) {
       op->o_bd = b0;
+      if (!saveit)
+        syncprov_matchops_queue(opc, NULL, 0);
       return;
     }
   } else {
@@ -1453,10 +1599,18 @@ static void syncprov_matchops(Operation *op, opcookie *opc, int saveit) {
     ber_dupbv_x(&opc->sndn, &e->e_nname, op->o_tmpmemctx);
   }
 
-  ldap_pvt_thread_mutex_lock(&si->si_ops_mutex);
+  /* Pick the affected searches under si_ops_mutex, but test the filters
+   * and queue the responses after, so writers do not wait on each other
+   * for that. The picked searches are held by OS_REF_OP_MATCH meanwhile,
+   * a found one by the hold taken when its match was saved. */
+  matchcand *mc = NULL;
+  matchgroup *mg, *groups = NULL;
   syncops *so, *snext;
+  syncmatches *sm;
+  int i, nmc = 0, maxmc = 0, byconn;
+
+  ldap_pvt_thread_mutex_lock(&si->si_ops_mutex);
   for (so = si->si_ops; so; so = snext) {
-    syncmatches *sm;
     int found = 0;
     snext = so->s_next;
 
@@ -1493,7 +1647,6 @@ static void syncprov_matchops(Operation *op, opcookie *opc, int saveit) {
     if (rc != LDAP_SUCCESS) {
       ldap_pvt_thread_mutex_lock(&so->s_mutex);
       so->s_flags |= PS_DEAD | PS_LOST_BASE;
-    kill_locked:
       switch (so->s_flags & (PS_TASK_QUEUED | PS_IS_DETACHED)) {
       default:
         LDAP_BUG();
@@ -1540,83 +1693,136 @@ static void syncprov_matchops(Operation *op, opcookie *opc, int saveit) {
           break;
         }
       }
+    } else if (!fc.fscope) {
+      continue;
+    }
+
+    if (!found) {
+      ldap_pvt_thread_mutex_lock(&so->s_mutex);
+      if (++so->s_matchops_inuse == 1) {
+        assert(!(so->s_flags & OS_REF_OP_MATCH));
+        so->s_flags |= OS_REF_OP_MATCH;
+      }
+      ldap_pvt_thread_mutex_unlock(&so->s_mutex);
+    }
+
+    if (nmc == maxmc) {
+      maxmc = maxmc ? maxmc * 2 : 16;
+      mc = op->o_tmprealloc(mc, maxmc * sizeof(matchcand), op->o_tmpmemctx);
     }
+    mc[nmc].mc_so = so;
+    mc[nmc].mc_fscope = fc.fscope;
+    mc[nmc].mc_found = found;
+    mc[nmc].mc_mode = 0;
+    nmc++;
+  }
+  ldap_pvt_thread_mutex_unlock(&si->si_ops_mutex);
+
+  /* Searches with the same base, scope, filter and user share the
+   * result, as replicas binding with one DN do. If the ACLs look at
+   * the connection, only the searches of one connection share it. */
+  byconn = nmc > 1 && syncprov_acl_byconn(op->o_bd);
+
+  for (i = 0; i < nmc; i++) {
+    so = mc[i].mc_so;
+    rc = LDAP_SUCCESS;
+    mg = NULL;
+
+    if (mc[i].mc_fscope) {
+      Connection *conn;
+      int share;
 
-    if (fc.fscope) {
       ldap_pvt_thread_mutex_lock(&so->s_mutex);
-      if (unlikely(is_syncops_abandoned(so))) {
-        rc = SLAPD_ABANDON;
-        goto kill_locked;
+      /* Left to the unlink that is on its way */
+      if (unlikely(is_syncops_abandoned(so) || (so->s_flags & PS_DEAD))) {
+        ldap_pvt_thread_mutex_unlock(&so->s_mutex);
+        continue;
       }
       assert(so->s_flags & OS_REF_OP_SEARCH);
-      Operation op2;
-      slap_op_copy(so->s_op_safe, &op2, NULL, NULL);
-      Opheader oh = *op->o_hdr;
-      oh.oh_conn = so->s_op->o_conn;
-      oh.oh_connid = so->s_op->o_connid;
-      op2.o_bd = op->o_bd->bd_self;
-      op2.o_hdr = &oh;
-      op2.o_extra = op->o_extra;
-
-      if (so->s_flags & PS_FIX_FILTER) {
-        /* Skip the AND/GE clause that we stuck on in front. We
-           would lose deletes/mods that happen during the refresh
-           phase otherwise (ITS#6555) */
-        op2.ors_filter = op2.ors_filter->f_and->f_next;
-      }
-      rc = test_filter(&op2, e, op2.ors_filter);
+      conn = byconn ? so->s_op->o_conn : NULL;
+      share = nmc > 1 && !(so->s_flags & OS_REF_PREPARE) &&
+              !BER_BVISNULL(&so->s_filterstr);
+      if (share)
+        mg = syncprov_matchgroup_find(groups, so, conn);
+      if (mg) {
+        rc = mg->mg_rc;
+      } else {
+        Operation op2;
+        slap_op_copy(so->s_op_safe, &op2, NULL, NULL);
+        Opheader oh = *op->o_hdr;
+        oh.oh_conn = so->s_op->o_conn;
+        oh.oh_connid = so->s_op->o_connid;
+        op2.o_bd = op->o_bd->bd_self;
+        op2.o_hdr = &oh;
+        op2.o_extra = op->o_extra;
+
+        if (so->s_flags & PS_FIX_FILTER) {
+          /* Skip the AND/GE clause that we stuck on in front. We
+             would lose deletes/mods that happen during the refresh
+             phase otherwise (ITS#6555) */
+          op2.ors_filter = op2.ors_filter->f_and->f_next;
+        }
+        rc = test_filter(&op2, e, op2.ors_filter);
+        if (share)
+          syncprov_matchgroup_add(op, &groups, so, conn, rc);
+      }
       ldap_pvt_thread_mutex_unlock(&so->s_mutex);
     }
 
-    Debug(LDAP_DEBUG_TRACE, "syncprov_matchops: sid 0x%03x fscope %d rc %d\n",
-          so->s_sid, fc.fscope, rc);
+    Debug(LDAP_DEBUG_TRACE,
+          "syncprov_matchops: sid 0x%03x fscope %d rc %d%s\n", so->s_sid,
+          mc[i].mc_fscope, rc, mg ? " (shared)" : "");
 
     assert(rc != SLAPD_ABANDON);
     /* check if current o_req_dn is in scope and matches filter */
-    if (fc.fscope && rc == LDAP_COMPARE_TRUE) {
+    if (mc[i].mc_fscope && rc == LDAP_COMPARE_TRUE) {
       if (saveit) {
-        ldap_pvt_thread_mutex_lock(&so->s_mutex);
-        assert(so->s_flags & OS_REF_OP_SEARCH);
-        if (++so->s_matchops_inuse == 1) {
-          assert(!(so->s_flags & OS_REF_OP_MATCH));
-          so->s_flags |= OS_REF_OP_MATCH;
-        }
-        ldap_pvt_thread_mutex_unlock(&so->s_mutex);
-
+        /* The match takes over the hold */
         sm = op->o_tmpalloc(sizeof(syncmatches), op->o_tmpmemctx);
         sm->sm_next = opc->smatches;
         sm->sm_op = so;
         opc->smatches = sm;
+        mc[i].mc_so = NULL;
       } else {
         /* if found send UPDATE else send ADD */
-        if (found)
+        if (mc[i].mc_found)
           assert(op->o_tag == LDAP_REQ_MODIFY ||
                  op->o_tag == LDAP_REQ_EXTENDED || op->o_tag == LDAP_REQ_MODDN);
         else
           assert(op->o_tag == LDAP_REQ_ADD);
-        syncprov_qresp(opc, so, found ? LDAP_SYNC_MODIFY : LDAP_SYNC_ADD);
+        mc[i].mc_mode = mc[i].mc_found ? LDAP_SYNC_MODIFY : LDAP_SYNC_ADD;
       }
-    } else if (!saveit && found) {
+    } else if (!saveit && mc[i].mc_found) {
       /* send DELETE */
       assert(op->o_tag == LDAP_REQ_DELETE);
-      syncprov_qresp(opc, so, LDAP_SYNC_DELETE);
+      mc[i].mc_mode = LDAP_SYNC_DELETE;
     } else if (!saveit) {
-      assert((!fc.fscope && rc == LDAP_SUCCESS) ||
-             (fc.fscope && rc != LDAP_COMPARE_TRUE && rc != LDAP_SUCCESS));
+      assert((!mc[i].mc_fscope && rc == LDAP_SUCCESS) ||
+             (mc[i].mc_fscope && rc != LDAP_COMPARE_TRUE &&
+              rc != LDAP_SUCCESS));
       assert(op->o_tag == LDAP_REQ_MODIFY || op->o_tag == LDAP_REQ_EXTENDED ||
              op->o_tag == LDAP_REQ_ADD);
-      syncprov_qresp(opc, so, LDAP_SYNC_NEW_COOKIE);
+      mc[i].mc_mode = LDAP_SYNC_NEW_COOKIE;
     }
+  }
 
-    if (!saveit && found) {
-      /* Decrement s_inuse, was incremented when called
-       * with saveit == TRUE
-       */
-      syncprov_unlink_syncop(so, OS_REF_OP_MATCH, SO_LOCKED_SIOP);
-      continue;
-    }
+  while ((mg = groups) != NULL) {
+    groups = mg->mg_next;
+    op->o_tmpfree(mg->mg_base.bv_val, op->o_tmpmemctx);
+    op->o_tmpfree(mg->mg_filter.bv_val, op->o_tmpmemctx);
+    op->o_tmpfree(mg->mg_ndn.bv_val, op->o_tmpmemctx);
+    op->o_tmpfree(mg, op->o_tmpmemctx);
   }
-  ldap_pvt_thread_mutex_unlock(&si->si_ops_mutex);
+  if (!saveit)
+    syncprov_matchops_queue(opc, mc, nmc);
+
+  /* Drop the holds, also those of the matches saved before */
+  for (i = 0; i < nmc; i++) {
+    if (mc[i].mc_so)
+      syncprov_unlink_syncop(mc[i].mc_so, OS_REF_OP_MATCH, SO_LOCKED_NONE);
+  }
+  if (mc)
+    op->o_tmpfree(mc, op->o_tmpmemctx);
 
   if (op->o_tag != LDAP_REQ_ADD && e) {
     if (!SLAP_ISOVERLAY(op->o_bd)) {
@@ -1650,6 +1856,8 @@ static int syncprov_op_cleanup(Operation *op, SlapReply *rs) {
    * lock-order reversal (deadlock) with checkpoint()
    * and mdb's internal write-locking. */
   LDAP_ENSURE(__sync_fetch_and_sub(&si->si_active, 1) > 0);
+  /* syncprov_op_response() is done with the turn */
+  assert(!opc->sturned);
 
   for (sm = opc->smatches; sm; sm = snext) {
     snext = sm->sm_next;
@@ -1685,6 +1893,8 @@ static int syncprov_op_cleanup(Operation *op, SlapReply *rs) {
       ch_free(mt);
     }
   }
+  if (opc->shook.sh_oe.oe_key)
+    LDAP_SLIST_REMOVE(&op->o_extra, &opc->shook.sh_oe, OpExtra, oe_next);
   if (!BER_BVISNULL(&opc->suuid))
     op->o_tmpfree(opc->suuid.bv_val, op->o_tmpmemctx);
   if (!BER_BVISNULL(&opc->sndn))
@@ -1767,6 +1977,106 @@ static void syncprov_checkpoint(Operation *op, slap_overinst *on) {
   slap_biglock_release(bl);
 }
 
+/* The log no longer covers the change with this csn,
+ * enter with sl->sl_mutex locked */
+static void syncprov_slog_forget(sessionlog *sl, int sid, struct berval *csn) {
+  int i;
+
+  for (i = 0; i < sl->sl_cookie.numcsns; i++)
+    if (sl->sl_cookie.sids[i] >= sid)
+      break;
+  if (i == sl->sl_cookie.numcsns || sl->sl_cookie.sids[i] != sid) {
+    slap_insert_csn_sids(&sl->sl_cookie, i, sid, csn);
+  } else if (slap_csn_compare_ts(&sl->sl_cookie.ctxcsn[i], csn) < 0) {
+    ber_bvreplace(&sl->sl_cookie.ctxcsn[i], csn);
+  }
+}
+
+static int syncprov_slog_trimmed(void *arg, struct berval *key,
+                                 struct berval *data) {
+  sessionlog *sl = arg;
+  char cbuf[LDAP_PVT_CSNSTR_BUFSIZE];
+  struct berval csn;
+
+  if (key->bv_len >= sizeof(cbuf))
+    return 0;
+  csn.bv_val = cbuf;
+  csn.bv_len = key->bv_len;
+  memcpy(cbuf, key->bv_val, key->bv_len);
+  cbuf[csn.bv_len] = '\0';
+
+  ldap_pvt_thread_mutex_lock(&sl->sl_mutex);
+  syncprov_slog_forget(sl, slap_csn_get_sid(&csn), &csn);
+  ldap_pvt_thread_mutex_unlock(&sl->sl_mutex);
+  return 0;
+}
+
+/* Store a record of the op in the write txn of the change, called by
+ * the backend before that txn is committed. Records dropped to keep
+ * the log in size are forgotten at once, even if the commit fails
+ * after, which only leaves the log covering less than it could. */
+static void syncprov_slog_hook(Operation *op, slog_hook_t *sh, void *txn) {
+  opcookie *opc = (opcookie *)((char *)sh - offsetof(opcookie, shook));
+  syncprov_info_t *si = opc->son->on_bi.bi_private;
+  sessionlog *sl = si->si_logs;
+  char buf[1 + UUID_LEN];
+  struct berval data;
+  size_t num;
+
+  /* Adds are not played back, the consumer finds them by entryCSN */
+  if (op->o_tag == LDAP_REQ_ADD || BER_BVISEMPTY(&op->o_csn) ||
+      opc->suuid.bv_len != UUID_LEN)
+    return;
+
+  ldap_pvt_thread_mutex_lock(&sl->sl_mutex);
+  if (!sl->sl_num && !sl->sl_cookie.ctxcsn) {
+    sl->sl_cookie.numcsns = 1;
+    sl->sl_cookie.ctxcsn = ch_malloc(2 * sizeof(struct berval));
+    sl->sl_cookie.sids = ch_malloc(sizeof(int));
+    sl->sl_cookie.sids[0] = slap_csn_get_sid(&op->o_csn);
+    ber_dupbv(sl->sl_cookie.ctxcsn, &op->o_csn);
+    BER_BVZERO(&sl->sl_cookie.ctxcsn[1]);
+  }
+  ldap_pvt_thread_mutex_unlock(&sl->sl_mutex);
+
+  buf[0] = (unsigned char)op->o_tag;
+  memcpy(buf + 1, opc->suuid.bv_val, UUID_LEN);
+  data.bv_val = buf;
+  data.bv_len = sizeof(buf);
+  if (sl->sl_mdb->slog_put(sl->sl_be, txn, sl->sl_dbi, &op->o_csn, &data,
+                           sl->sl_size, syncprov_slog_trimmed, sl,
+                           &num) == 0) {
+    ldap_pvt_thread_mutex_lock(&sl->sl_mutex);
+    sl->sl_num = num;
+    ldap_pvt_thread_mutex_unlock(&sl->sl_mutex);
+    opc->sstored = 1;
+  }
+}
+
+/* Empty the log kept in the backend. If that fails, the log is left
+ * covering no change up to the current contextCSN. */
+static void syncprov_clear_slog(syncprov_info_t *si, sessionlog *sl) {
+  struct sync_cookie cookie;
+  int i;
+
+  if (sl->sl_mdb->slog_clear(sl->sl_be, sl->sl_dbi) == 0) {
+    ldap_pvt_thread_mutex_lock(&sl->sl_mutex);
+    sl->sl_num = 0;
+    ldap_pvt_thread_mutex_unlock(&sl->sl_mutex);
+    return;
+  }
+
+  ldap_pvt_thread_rdwr_rlock(&si->si_csn_rwlock);
+  slap_cookie_copy(&cookie, &si->si_cookie);
+  ldap_pvt_thread_rdwr_runlock(&si->si_csn_rwlock);
+
+  ldap_pvt_thread_mutex_lock(&sl->sl_mutex);
+  for (i = 0; i < cookie.numcsns; i++)
+    syncprov_slog_forget(sl, cookie.sids[i], &cookie.ctxcsn[i]);
+  ldap_pvt_thread_mutex_unlock(&sl->sl_mutex);
+  slap_cookie_free(&cookie, 0);
+}
+
 static void syncprov_add_slog(Operation *op) {
   opcookie *opc = op->o_callback->sc_private;
   slap_overinst *on = opc->son;
@@ -1780,6 +2090,10 @@ static void syncprov_add_slog(Operation *op) {
      * state with respect to such operations, so we ignore them and
      * wipe out anything in the log if we see them.
      */
+    if (sl->sl_mdb) {
+      syncprov_clear_slog(si, sl);
+      return;
+    }
     ldap_pvt_thread_mutex_lock(&sl->sl_mutex);
     if (!sl->sl_playing) {
       /* can only do this if no one else is reading the log at the moment */
@@ -1794,6 +2108,16 @@ static void syncprov_add_slog(Operation *op) {
     return;
   }
 
+  if (sl->sl_mdb) {
+    /* A change missing from the log is one it no longer covers */
+    if (op->o_tag != LDAP_REQ_ADD && !opc->sstored) {
+      ldap_pvt_thread_mutex_lock(&sl->sl_mutex);
+      syncprov_slog_forget(sl, slap_csn_get_sid(&op->o_csn), &op->o_csn);
+      ldap_pvt_thread_mutex_unlock(&sl->sl_mutex);
+    }
+    return;
+  }
+
   /* Allocate a record. UUIDs are not NUL-terminated. */
   se = ch_malloc(sizeof(slog_entry) + opc->suuid.bv_len + op->o_csn.bv_len + 1);
   se->se_next = NULL;
@@ -1840,18 +2164,9 @@ static void syncprov_add_slog(Operation *op) {
   sl->sl_num++;
   if (!sl->sl_playing) {
     while (sl->sl_num > sl->sl_size) {
-      int i;
       se = sl->sl_head;
       sl->sl_head = se->se_next;
-      for (i = 0; i < sl->sl_cookie.numcsns; i++)
-        if (sl->sl_cookie.sids[i] >= se->se_sid)
-          break;
-      if (i == sl->sl_cookie.numcsns || sl->sl_cookie.sids[i] != se->se_sid) {
-        slap_insert_csn_sids(&sl->sl_cookie, i, se->se_sid, &se->se_csn);
-      } else if (slap_csn_compare_ts(&sl->sl_cookie.ctxcsn[i], &se->se_csn) <
-                 0) {
-        ber_bvreplace(&sl->sl_cookie.ctxcsn[i], &se->se_csn);
-      }
+      syncprov_slog_forget(sl, se->se_sid, &se->se_csn);
       ch_free(se);
       sl->sl_num--;
     }
@@ -1867,7 +2182,88 @@ static int playlog_cb(Operation *op, SlapReply *rs) {
   return rs->sr_err;
 }
 
-/* enter with sl->sl_mutex locked, release before returning */
+/* Changes a consumer missed, picked from the session log */
+typedef struct playlog {
+  Operation *pl_op;
+  sync_control *pl_srs;
+  BerVarray pl_ctxcsn;
+  int pl_numcsns;
+  int *pl_sids;
+  char (*pl_dels)[UUID_LEN];
+  char (*pl_mods)[UUID_LEN];
+  int pl_ndel, pl_nmods, pl_maxdel, pl_maxmods;
+  struct berval pl_delcsn;
+} playlog;
+
+static void playlog_push(Operation *op, char (**vec)[UUID_LEN], int *num,
+                         int *max, const char *uuid) {
+  if (*num == *max) {
+    *max = *max ? *max * 2 : 64;
+    *vec = op->o_tmprealloc(*vec, *max * UUID_LEN, op->o_tmpmemctx);
+  }
+  memcpy((*vec)[(*num)++], uuid, UUID_LEN);
+}
+
+/* Returns non-zero once past the csn the consumer will be given */
+static int syncprov_playlog_pick(playlog *pl, struct berval *csn, int sid,
+                                 ber_tag_t tag, const char *uuid) {
+  sync_control *srs = pl->pl_srs;
+  int k, ndel;
+
+  Debug(LDAP_DEBUG_SYNC, "log csn %s\n", csn->bv_val);
+  ndel = 1;
+  for (k = 0; k < srs->sr_state.numcsns; k++) {
+    if (sid == srs->sr_state.sids[k]) {
+      ndel = slap_csn_compare_ts(csn, &srs->sr_state.ctxcsn[k]);
+      break;
+    }
+  }
+  if (ndel <= 0) {
+    Debug(LDAP_DEBUG_SYNC, "cmp %d, too old\n", ndel);
+    return 0;
+  }
+  ndel = 0;
+  for (k = 0; k < pl->pl_numcsns; k++) {
+    if (sid == pl->pl_sids[k]) {
+      ndel = slap_csn_compare_ts(csn, &pl->pl_ctxcsn[k]);
+      break;
+    }
+  }
+  if (ndel > 0) {
+    Debug(LDAP_DEBUG_SYNC, "cmp %d, too new\n", ndel);
+    return 1;
+  }
+  if (tag == LDAP_REQ_DELETE) {
+    playlog_push(pl->pl_op, &pl->pl_dels, &pl->pl_ndel, &pl->pl_maxdel, uuid);
+    memcpy(pl->pl_delcsn.bv_val, csn->bv_val, csn->bv_len);
+    pl->pl_delcsn.bv_len = csn->bv_len;
+    pl->pl_delcsn.bv_val[csn->bv_len] = '\0';
+  } else if (tag != LDAP_REQ_ADD) {
+    playlog_push(pl->pl_op, &pl->pl_mods, &pl->pl_nmods, &pl->pl_maxmods,
+                 uuid);
+  }
+  return 0;
+}
+
+/* Feed a record kept in the backend to syncprov_playlog_pick() */
+static int syncprov_playlog_rec(void *arg, struct berval *key,
+                                struct berval *data) {
+  char cbuf[LDAP_PVT_CSNSTR_BUFSIZE];
+  struct berval csn;
+
+  if (key->bv_len >= sizeof(cbuf) || data->bv_len != 1 + UUID_LEN)
+    return 0;
+  csn.bv_val = cbuf;
+  csn.bv_len = key->bv_len;
+  memcpy(cbuf, key->bv_val, key->bv_len);
+  cbuf[csn.bv_len] = '\0';
+  return syncprov_playlog_pick(arg, &csn, slap_csn_get_sid(&csn),
+                               (unsigned char)data->bv_val[0],
+                               data->bv_val + 1);
+}
+
+/* enter with sl->sl_mutex locked, release before returning.
+ * Returns LDAP_UNAVAILABLE if the log could not be read. */
 static int syncprov_playlog(Operation *op, sessionlog *sl, sync_control *srs,
                             BerVarray ctxcsn, int numcsns, int *sids) {
   slap_overinst *on = (slap_overinst *)op->o_bd->bd_info;
@@ -1876,6 +2272,7 @@ static int syncprov_playlog(Operation *op, sessionlog *sl, sync_control *srs,
   char cbuf[LDAP_PVT_CSNSTR_BUFSIZE];
   BerVarray uuids;
   struct berval delcsn[2];
+  playlog pl = {0};
   int rc = LDAP_SUCCESS;
 
   if (!sl->sl_num) {
@@ -1883,75 +2280,75 @@ static int syncprov_playlog(Operation *op, sessionlog *sl, sync_control *srs,
     return rc;
   }
 
-  num = sl->sl_num;
-  i = 0;
-  nmods = 0;
-  sl->sl_playing++;
-  ldap_pvt_thread_mutex_unlock(&sl->sl_mutex);
-
-  uuids = op->o_tmpalloc((num + 1) * sizeof(struct berval) + num * UUID_LEN,
-                         op->o_tmpmemctx);
-  uuids[0].bv_val = (char *)(uuids + num + 1);
-
-  delcsn[0].bv_len = 0;
-  delcsn[0].bv_val = cbuf;
-  BER_BVZERO(&delcsn[1]);
+  pl.pl_op = op;
+  pl.pl_srs = srs;
+  pl.pl_ctxcsn = ctxcsn;
+  pl.pl_numcsns = numcsns;
+  pl.pl_sids = sids;
+  pl.pl_delcsn.bv_val = cbuf;
 
   /* Make a copy of the relevant UUIDs. Put the Deletes up front
    * and everything else at the end. Do this first so we can
    * unlock the list mutex.
    */
   Debug(LDAP_DEBUG_SYNC, "srs csn %s\n", srs->sr_state.ctxcsn[0].bv_val);
-  for (se = sl->sl_head; se; se = se->se_next) {
-    int k;
-    Debug(LDAP_DEBUG_SYNC, "log csn %s\n", se->se_csn.bv_val);
-    ndel = 1;
-    for (k = 0; k < srs->sr_state.numcsns; k++) {
-      if (se->se_sid == srs->sr_state.sids[k]) {
-        ndel = slap_csn_compare_ts(&se->se_csn, &srs->sr_state.ctxcsn[k]);
+  if (sl->sl_mdb) {
+    struct berval from, *fromp = NULL;
+
+    ldap_pvt_thread_mutex_unlock(&sl->sl_mutex);
+    /* Records older than all of the consumer's csns are too old for
+     * it, unless it doesn't know some sid yet */
+    for (i = 0; i < numcsns; i++) {
+      for (j = 0; j < srs->sr_state.numcsns; j++)
+        if (sids[i] == srs->sr_state.sids[j])
+          break;
+      if (j == srs->sr_state.numcsns)
         break;
-      }
     }
-    if (ndel <= 0) {
-      Debug(LDAP_DEBUG_SYNC, "cmp %d, too old\n", ndel);
-      continue;
+    if (i == numcsns) {
+      for (j = 0; j < srs->sr_state.numcsns; j++)
+        if (!fromp ||
+            slap_csn_compare_ts(&srs->sr_state.ctxcsn[j], fromp) < 0)
+          fromp = &srs->sr_state.ctxcsn[j];
     }
-    ndel = 0;
-    for (k = 0; k < numcsns; k++) {
-      if (se->se_sid == sids[k]) {
-        ndel = slap_csn_compare_ts(&se->se_csn, &ctxcsn[k]);
-        break;
-      }
+    if (fromp) {
+      from.bv_val = fromp->bv_val;
+      from.bv_len = SLOG_SEEK_LEN;
+      fromp = &from;
     }
-    if (ndel > 0) {
-      Debug(LDAP_DEBUG_SYNC, "cmp %d, too new\n", ndel);
-      break;
+    if (sl->sl_mdb->slog_scan(op, sl->sl_be, sl->sl_dbi, fromp,
+                              syncprov_playlog_rec, &pl)) {
+      op->o_tmpfree(pl.pl_dels, op->o_tmpmemctx);
+      op->o_tmpfree(pl.pl_mods, op->o_tmpmemctx);
+      return LDAP_UNAVAILABLE;
     }
-    if (se->se_tag == LDAP_REQ_DELETE) {
-      j = i;
-      i++;
-      memcpy(cbuf, se->se_csn.bv_val, se->se_csn.bv_len);
-      delcsn[0].bv_len = se->se_csn.bv_len;
-      delcsn[0].bv_val[delcsn[0].bv_len] = '\0';
-    } else {
-      if (se->se_tag == LDAP_REQ_ADD)
-        continue;
-      nmods++;
-      j = num - nmods;
+  } else {
+    sl->sl_playing++;
+    ldap_pvt_thread_mutex_unlock(&sl->sl_mutex);
+    for (se = sl->sl_head; se; se = se->se_next) {
+      if (syncprov_playlog_pick(&pl, &se->se_csn, se->se_sid, se->se_tag,
+                                se->se_uuid.bv_val))
+        break;
     }
-    uuids[j].bv_val = uuids[0].bv_val + (j * UUID_LEN);
-    memcpy(uuids[j].bv_val, se->se_uuid.bv_val, UUID_LEN);
-    uuids[j].bv_len = UUID_LEN;
+    ldap_pvt_thread_mutex_lock(&sl->sl_mutex);
+    sl->sl_playing--;
+    ldap_pvt_thread_mutex_unlock(&sl->sl_mutex);
   }
-  ldap_pvt_thread_mutex_lock(&sl->sl_mutex);
-  sl->sl_playing--;
-  ldap_pvt_thread_mutex_unlock(&sl->sl_mutex);
-
-  ndel = i;
 
-  /* Zero out unused slots */
-  for (i = ndel; i < num - nmods; i++)
-    uuids[i].bv_len = 0;
+  ndel = pl.pl_ndel;
+  nmods = pl.pl_nmods;
+  num = ndel + nmods;
+  uuids = op->o_tmpalloc((num + 1) * sizeof(struct berval), op->o_tmpmemctx);
+  for (i = 0; i < ndel; i++) {
+    uuids[i].bv_val = pl.pl_dels[i];
+    uuids[i].bv_len = UUID_LEN;
+  }
+  for (i = 0; i < nmods; i++) {
+    uuids[num - 1 - i].bv_val = pl.pl_mods[i];
+    uuids[num - 1 - i].bv_len = UUID_LEN;
+  }
+  delcsn[0] = pl.pl_delcsn;
+  BER_BVZERO(&delcsn[1]);
 
   /* Mods must be validated to see if they belong in this delete set. */
 
@@ -2040,6 +2437,8 @@ static int syncprov_playlog(Operation *op, sessionlog *sl, sync_control *srs,
     }
   }
   op->o_tmpfree(uuids, op->o_tmpmemctx);
+  op->o_tmpfree(pl.pl_dels, op->o_tmpmemctx);
+  op->o_tmpfree(pl.pl_mods, op->o_tmpmemctx);
   return rc;
 }
 
@@ -2061,6 +2460,8 @@ static int syncprov_new_ctxcsn_and_mayrwunlock(opcookie *opc,
     si->si_numops++;
     ldap_pvt_thread_rdwr_wunlock(&si->si_csn_rwlock);
 
+    syncprov_resp_turn(si, opc);
+    syncprov_resp_wait(si, opc);
     ldap_pvt_thread_mutex_lock(&si->si_ops_mutex);
     for (syncops *ss = si->si_ops; ss; ss = ss->s_next) {
       /* Send the updated csn to all syncrepl consumers,
@@ -2075,6 +2476,13 @@ static int syncprov_new_ctxcsn_and_mayrwunlock(opcookie *opc,
   return csn_changed;
 }
 
+/* A contextCSN update made by syncrepl */
+static int syncprov_ctxcsn_update(Operation *op) {
+  return SLAPD_SYNC_IS_SYNCCONN(op->o_connid) && op->o_tag == LDAP_REQ_MODIFY &&
+         op->orm_modlist && op->orm_modlist->sml_op == LDAP_MOD_REPLACE &&
+         op->orm_modlist->sml_desc == slap_schema.si_ad_contextCSN;
+}
+
 static int syncprov_op_response(Operation *op, SlapReply *rs) {
   opcookie *opc = op->o_callback->sc_private;
   slap_overinst *on = opc->son;
@@ -2141,6 +2549,15 @@ static int syncprov_op_response(Operation *op, SlapReply *rs) {
         entry_csn ? entry_csn->bv_val : NULL,
         entry_uuid ? entry_uuid->bv_val : NULL);
 
+  /* The log kept in the backend already has the record of the op, or
+   * is to forget it, before the contextCSN moves past the op, so that no
+   * consumer is given that contextCSN while the log claims to cover the
+   * op without the record. Clearing it may wait for other writers, so
+   * no mutex is held. */
+  if (si->si_logs && si->si_logs->sl_mdb && !op->o_dont_replicate &&
+      !syncprov_ctxcsn_update(op))
+    syncprov_add_slog(op);
+
   ldap_pvt_thread_mutex_lock(&si->si_resp_mutex);
   ldap_pvt_thread_rdwr_wlock(&si->si_csn_rwlock);
 
@@ -2177,9 +2594,7 @@ static int syncprov_op_response(Operation *op, SlapReply *rs) {
   }
 
   /* Don't do any processing for consumer contextCSN updates */
-  if (SLAPD_SYNC_IS_SYNCCONN(op->o_connid) && op->o_tag == LDAP_REQ_MODIFY &&
-      op->orm_modlist && op->orm_modlist->sml_op == LDAP_MOD_REPLACE &&
-      op->orm_modlist->sml_desc == slap_schema.si_ad_contextCSN) {
+  if (syncprov_ctxcsn_update(op)) {
     /* Catch contextCSN updates from syncrepl. We have to look at
      * all the attribute values, as there may be more than one csn
      * that changed, and only one can be passed in the csn queue. */
@@ -2232,12 +2647,19 @@ skip_unlock:
     case LDAP_REQ_MODIFY:
     case LDAP_REQ_MODRDN:
     case LDAP_REQ_EXTENDED:
+      /* Other writers may go on while the filters are tested,
+       * the responses are queued in turn */
+      syncprov_resp_turn(si, opc);
+      ldap_pvt_thread_mutex_unlock(&si->si_resp_mutex);
       syncprov_matchops(op, opc, 0);
+      ldap_pvt_thread_mutex_lock(&si->si_resp_mutex);
       break;
     case LDAP_REQ_DELETE:
       /* for each match in opc->smatches:
        *   send DELETE msg
        */
+      syncprov_resp_turn(si, opc);
+      syncprov_resp_wait(si, opc);
       for (sm = opc->smatches; sm; sm = sm->sm_next) {
         syncprov_qresp(opc, sm->sm_op, LDAP_SYNC_DELETE);
       }
@@ -2245,11 +2667,12 @@ skip_unlock:
     }
   }
 
-  /* Add any log records */
-  if (si->si_logs)
+  /* Add any log records kept in memory */
+  if (si->si_logs && !si->si_logs->sl_mdb)
     syncprov_add_slog(op);
 
 leave:
+  syncprov_resp_done(si, opc);
   ldap_pvt_thread_mutex_unlock(&si->si_resp_mutex);
   return SLAP_CB_CONTINUE;
 }
@@ -2499,6 +2922,14 @@ static int syncprov_op_mod(Operation *op, SlapReply *rs) {
   if ((have_psearches || si->si_logs) && op->o_tag != LDAP_REQ_ADD)
     syncprov_matchops(op, opc, 1);
 
+  if (si->si_logs && si->si_logs->sl_mdb && op->o_tag != LDAP_REQ_ADD &&
+      !syncprov_ctxcsn_update(op)) {
+    opc->shook.sh_oe.oe_key = (void *)si->si_logs->sl_mdb;
+    opc->shook.sh_be = si->si_logs->sl_be;
+    opc->shook.sh_func = syncprov_slog_hook;
+    LDAP_SLIST_INSERT_HEAD(&op->o_extra, &opc->shook.sh_oe, oe_next);
+  }
+
   return SLAP_CB_CONTINUE;
 }
 
@@ -3102,9 +3533,12 @@ static int syncprov_op_search(Operation *op, SlapReply *rs) {
           do_play = 1;
       }
       if (do_play) {
-        do_present = 0;
         /* mutex is unlocked in playlog */
         rs->sr_err = syncprov_playlog(op, sl, srs, ctxcsn, numcsns, sids);
+        if (rs->sr_err == LDAP_UNAVAILABLE)
+          rs->sr_err = LDAP_SUCCESS;
+        else
+          do_present = 0;
       } else {
         ldap_pvt_thread_mutex_unlock(&sl->sl_mutex);
       }
@@ -3342,7 +3776,14 @@ static int syncprov_operational(Operation *op, SlapReply *rs) {
   return SLAP_CB_CONTINUE;
 }
 
-enum { SP_CHKPT = 1, SP_SESSL, SP_NOPRES, SP_USEHINT, SP_SHOWSTATUS };
+enum {
+  SP_CHKPT = 1,
+  SP_SESSL,
+  SP_NOPRES,
+  SP_USEHINT,
+  SP_SHOWSTATUS,
+  SP_SLPERSIST
+};
 
 static ConfigDriver sp_cf_gen;
 
@@ -3378,6 +3819,12 @@ static ConfigTable spcfg[] = {
      "EQUALITY caseIgnoreMatch "
      "SYNTAX OMsDirectoryString SINGLE-VALUE )",
      NULL, NULL},
+    {"syncprov-sessionlog-persist", NULL, 2, 2, 0,
+     ARG_ON_OFF | ARG_MAGIC | SP_SLPERSIST, sp_cf_gen,
+     "( OLcfgOvAt:1.10 NAME 'olcSpSessionlogPersist' "
+     "DESC 'Keep the session log in the underlying MDB database' "
+     "SYNTAX OMsBoolean SINGLE-VALUE )",
+     NULL, NULL},
     {NULL, NULL, 0, 0, 0, ARG_IGNORED}};
 
 static ConfigOCs spocs[] = {{"( OLcfgOvOc:1.1 "
@@ -3389,6 +3836,7 @@ static ConfigOCs spocs[] = {{"( OLcfgOvOc:1.1 "
                              "$ olcSpNoPresent "
                              "$ olcSpReloadHint "
                              "$ olcSpShowStatus "
+                             "$ olcSpSessionlogPersist "
                              ") )",
                              Cft_Overlay, spcfg},
                             {NULL, 0, NULL}};
@@ -3455,6 +3903,13 @@ static int sp_cf_gen(ConfigArgs *c) {
         break;
       }
       break;
+    case SP_SLPERSIST:
+      if (si->si_logpersist) {
+        c->value_int = 1;
+      } else {
+        rc = 1;
+      }
+      break;
     }
     return rc;
   } else if (c->op == LDAP_MOD_DELETE) {
@@ -3475,6 +3930,9 @@ static int sp_cf_gen(ConfigArgs *c) {
     case SP_SHOWSTATUS:
       si->si_showstatus = SS_NONE;
       break;
+    case SP_SLPERSIST:
+      si->si_logpersist = 0;
+      break;
     }
     return rc;
   }
@@ -3527,6 +3985,9 @@ static int sp_cf_gen(ConfigArgs *c) {
   case SP_USEHINT:
     si->si_usehint = c->value_int;
     break;
+  case SP_SLPERSIST:
+    si->si_logpersist = c->value_int;
+    break;
   case SP_SHOWSTATUS:
     if (strcasecmp(c->value_string, "none") == 0)
       si->si_showstatus = SS_NONE;
@@ -3545,6 +4006,74 @@ static int sp_cf_gen(ConfigArgs *c) {
   return rc;
 }
 
+/* Take over the sessionlog the last run kept in the backend, unless
+ * the database was changed since or the log was not closed.
+ */
+static void syncprov_slog_open(Operation *op, slap_overinst *on) {
+  syncprov_info_t *si = on->on_bi.bi_private;
+  sessionlog *sl = si->si_logs;
+  BackendInfo *bi = on->on_info->oi_orig;
+  const mdb_extra_t *mdb = bi->bi_extra;
+  struct berval state, ctx = BER_BVNULL;
+  struct sync_cookie cookie;
+  char *eol;
+  size_t num;
+
+  if (strcmp(bi->bi_type, "mdb") != 0 || !mdb) {
+    Debug(LDAP_DEBUG_ANY,
+          "syncprov_db_open: sessionlog can only be kept in an mdb "
+          "database, keeping it in memory\n");
+    return;
+  }
+  sl->sl_be = op->o_bd->bd_self;
+  if (mdb->slog_open(sl->sl_be, SLOG_DBNAME, &sl->sl_dbi, &num, &state))
+    return;
+
+  sl->sl_num = 0;
+  if (num) {
+    slap_cookie_compose(&ctx, si->si_cookie.ctxcsn, 0, -1, NULL);
+    eol = BER_BVISNULL(&state) ? NULL : strchr(state.bv_val, '\n');
+    if (eol && strcmp(eol + 1, ctx.bv_val) == 0) {
+      struct berval bv;
+
+      bv.bv_val = state.bv_val;
+      bv.bv_len = eol - state.bv_val;
+      slap_cookie_init(&cookie);
+      if (slap_cookie_parse(&cookie, &bv, NULL) == LDAP_SUCCESS) {
+        slap_cookie_free(&sl->sl_cookie, 0);
+        slap_cookie_move(&sl->sl_cookie, &cookie);
+        sl->sl_num = num;
+      }
+    }
+    if (!sl->sl_num && mdb->slog_clear(sl->sl_be, sl->sl_dbi))
+      mdb = NULL;
+    ch_free(ctx.bv_val);
+  }
+  ch_free(state.bv_val);
+
+  sl->sl_mdb = mdb;
+  Debug(LDAP_DEBUG_SYNC, "syncprov_db_open: sessionlog of %d records %s\n",
+        sl->sl_num, mdb ? "kept in the database" : "kept in memory");
+}
+
+/* Save what the log covers, and the contextCSN it ends at */
+static void syncprov_slog_close(syncprov_info_t *si) {
+  sessionlog *sl = si->si_logs;
+  struct berval state = BER_BVNULL, ctx = BER_BVNULL;
+
+  slap_cookie_compose(&state, sl->sl_cookie.ctxcsn, 0, -1, NULL);
+  slap_cookie_compose(&ctx, si->si_cookie.ctxcsn, 0, -1, NULL);
+  state.bv_val = ch_realloc(state.bv_val, state.bv_len + ctx.bv_len + 2);
+  state.bv_val[state.bv_len++] = '\n';
+  memcpy(state.bv_val + state.bv_len, ctx.bv_val, ctx.bv_len + 1);
+  state.bv_len += ctx.bv_len;
+
+  sl->sl_mdb->slog_close(sl->sl_be, sl->sl_dbi, &state);
+  sl->sl_mdb = NULL;
+  ch_free(ctx.bv_val);
+  ch_free(state.bv_val);
+}
+
 /* ITS#3456 we cannot run this search on the main thread, must use a
  * child thread in order to insure we have a big enough stack.
  */
@@ -3668,6 +4197,8 @@ static int syncprov_db_open(BackendDB *be, ConfigReply *cr) {
 
 out:
   op->o_bd->bd_info = (BackendInfo *)on;
+  if (rc == 0 && si->si_logs && si->si_logpersist)
+    syncprov_slog_open(op, on);
   return rc;
 }
 
@@ -3694,6 +4225,8 @@ static int syncprov_db_close(BackendDB *be, ConfigReply *cr) {
     op->o_ndn = be->be_rootndn;
     syncprov_checkpoint(op, on);
   }
+  if (si->si_logs && si->si_logs->sl_mdb)
+    syncprov_slog_close(si);
 
 #ifdef SLAP_CONFIG_DELETE
   if (!slapd_shutdown) {
@@ -3745,6 +4278,7 @@ static int syncprov_db_init(BackendDB *be, ConfigReply *cr) {
   ldap_pvt_thread_mutex_init(&si->si_ops_mutex);
   ldap_pvt_thread_mutex_init(&si->si_mods_mutex);
   ldap_pvt_thread_mutex_init(&si->si_resp_mutex);
+  ldap_pvt_thread_cond_init(&si->si_resp_cond);
 
   csn_anlist[0].an_desc = slap_schema.si_ad_entryCSN;
   csn_anlist[0].an_name = slap_schema.si_ad_entryCSN->ad_cname;
@@ -3801,6 +4335,7 @@ static int syncprov_db_destroy(BackendDB *be, ConfigReply *cr) {
     }
     slap_cookie_free(&si->si_cookie, 0);
 
+    ldap_pvt_thread_cond_destroy(&si->si_resp_cond);
     ldap_pvt_thread_mutex_destroy(&si->si_resp_mutex);
     ldap_pvt_thread_mutex_destroy(&si->si_mods_mutex);
     ldap_pvt_thread_mutex_destroy(&si->si_ops_mutex);
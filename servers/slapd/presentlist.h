@@ -0,0 +1,43 @@
+/* $ReOpenLDAP$ */
+/* Copyright 2018 ReOpenLDAP AUTHORS: please see AUTHORS file.
+ * All rights reserved.
+ *
+ * This file is part of ReOpenLDAP.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+#ifndef SLAP_PRESENTLIST_H_
+#define SLAP_PRESENTLIST_H_
+
+#include <ldap_cdefs.h>
+
+LDAP_BEGIN_DECL
+
+#define UUIDLEN 16
+
+/* The set of entryUUIDs the provider reported as present during the
+ * present phase of a refresh, see presentlist.c */
+typedef struct presentlist {
+  char (*pl_uuids)[UUIDLEN];
+  size_t pl_mask; /* a power of two less one */
+  size_t pl_used;
+  size_t pl_gone;
+  int pl_marks; /* see presentlist_mark() */
+} presentlist_t;
+
+LDAP_SLAPD_F(int) presentlist_insert(presentlist_t *list, struct berval *uuid);
+LDAP_SLAPD_F(void) presentlist_delete(presentlist_t *list, struct berval *uuid);
+LDAP_SLAPD_F(char *) presentlist_find(presentlist_t *list, struct berval *uuid);
+LDAP_SLAPD_F(int) presentlist_empty(presentlist_t *list);
+LDAP_SLAPD_F(void) presentlist_free(presentlist_t *list);
+
+LDAP_END_DECL
+
+#endif
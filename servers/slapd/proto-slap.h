@@ -435,6 +435,19 @@ LDAP_SLAPD_F(void) overlay_unregister_control(BackendDB *be, const char *oid);
 LDAP_SLAPD_F(int)
 overlay_callback_after_backover(Operation *op, slap_callback *sc, int append);
 
+/*
+ * binlog.c
+ */
+LDAP_SLAPD_V(char *) slap_binlog_dir;
+LDAP_SLAPD_V(unsigned long) slap_binlog_size;
+LDAP_SLAPD_V(int) slap_binlog_keep;
+
+LDAP_SLAPD_F(void) slap_binlog_init(void);
+LDAP_SLAPD_F(void) slap_binlog_destroy(void);
+LDAP_SLAPD_F(int) slap_binlog_open(void);
+LDAP_SLAPD_F(void) slap_binlog_close(void);
+LDAP_SLAPD_F(void) slap_binlog_put(Operation *op, SlapReply *rs);
+
 /*
  * bconfig.c
  */
@@ -775,6 +788,8 @@ LDAP_SLAPD_F(void) slapd_set_write(ber_socket_t s, int wake);
 LDAP_SLAPD_F(void) slapd_clr_write(ber_socket_t s, int wake);
 LDAP_SLAPD_F(void) slapd_set_read(ber_socket_t s, int wake);
 LDAP_SLAPD_F(int) slapd_clr_read(ber_socket_t s, int wake);
+LDAP_SLAPD_F(void) slapd_set_read_sb(ber_socket_t s, Sockbuf *sb, int wake);
+LDAP_SLAPD_F(int) slapd_recv_take(ber_socket_t s, Sockbuf *sb);
 LDAP_SLAPD_F(void) slapd_clr_writetime(slap_time_t old);
 LDAP_SLAPD_F(slap_time_t) slapd_get_writetime(void);
 
@@ -819,6 +834,9 @@ LDAP_SLAPD_V(const char *) slapd_slp_attrs;
 LDAP_SLAPD_V(slap_ssf_t) local_ssf;
 LDAP_SLAPD_V(struct runqueue_s) slapd_rq;
 LDAP_SLAPD_V(int) slapd_daemon_threads;
+#ifdef HAVE_IO_URING
+LDAP_SLAPD_V(int) slapd_io_uring;
+#endif
 LDAP_SLAPD_V(int) slapd_daemon_mask;
 #ifdef LDAP_TCP_BUFFER
 LDAP_SLAPD_V(int) slapd_tcp_rmem;
@@ -1055,8 +1073,21 @@ LDAP_SLAPD_F(int) slap_init(int mode, const char *name);
 LDAP_SLAPD_F(int) slap_startup(Backend *be);
 LDAP_SLAPD_F(int) slap_shutdown(Backend *be);
 LDAP_SLAPD_F(int) slap_destroy(void);
-LDAP_SLAPD_F(void) slap_counters_init(slap_counters_t *sc);
-LDAP_SLAPD_F(void) slap_counters_destroy(slap_counters_t *sc);
+LDAP_SLAPD_F(slap_counters_t *) slap_counters_alloc(void);
+LDAP_SLAPD_F(void) slap_counters_free(slap_counters_t *sc);
+LDAP_SLAPD_F(void) slap_counters_sum(slap_counters_t *sum);
+#ifdef SLAPD_MONITOR
+LDAP_SLAPD_F(void) slap_histo_add(slap_histo_t *h, uint64_t us);
+LDAP_SLAPD_F(void) slap_histo_merge(slap_histo_t *sum, const slap_histo_t *h);
+LDAP_SLAPD_F(void) slap_histo_reset(slap_histo_t *h);
+LDAP_SLAPD_F(uint64_t)
+slap_histo_quantile(const slap_histo_t *h, unsigned permille);
+LDAP_SLAPD_F(void)
+slap_latency_add(Operation *op, slap_op_t opidx, uint64_t start_ns);
+LDAP_SLAPD_F(void)
+slap_latency_sum(slap_op_t opidx, slap_lat_t phase, slap_histo_t *sum);
+LDAP_SLAPD_F(void) slap_latency_reset(slap_op_t opidx, slap_lat_t phase);
+#endif /* SLAPD_MONITOR */
 
 LDAP_SLAPD_V(const char *) slap_known_controls[];
 
@@ -1128,6 +1159,11 @@ slap_cookie_compare_csnset(struct sync_cookie *base, BerVarray next);
 LDAP_SLAPD_F(int)
 slap_cookie_is_sid_here(const struct sync_cookie *cookie, int sid);
 
+/*
+ * opclass.c
+ */
+LDAP_SLAPD_F(int) slap_opclass_select(Operation *op);
+
 /*
  * limits.c
  */
@@ -1481,6 +1517,7 @@ rs_entry2modifiable(Operation *op, SlapReply *rs, slap_overinst *on);
 LDAP_SLAPD_F(void) slap_send_ldap_result(Operation *op, SlapReply *rs);
 LDAP_SLAPD_F(void) send_ldap_sasl(Operation *op, SlapReply *rs);
 LDAP_SLAPD_F(void) send_ldap_disconnect(Operation *op, SlapReply *rs);
+LDAP_SLAPD_F(void) send_ldap_batch(Operation *op, int on);
 LDAP_SLAPD_F(void) slap_send_ldap_extended(Operation *op, SlapReply *rs);
 LDAP_SLAPD_F(void) slap_send_ldap_intermediate(Operation *op, SlapReply *rs);
 LDAP_SLAPD_F(void) slap_send_search_result(Operation *op, SlapReply *rs);
@@ -1620,6 +1657,7 @@ mods_structural_class(Modifications *mods, struct berval *oc, const char **text,
 LDAP_SLAPD_V(int) schema_init_done;
 LDAP_SLAPD_F(int) slap_schema_init(void);
 LDAP_SLAPD_F(void) schema_destroy(void);
+LDAP_SLAPD_F(int) slap_hash64(int onoff);
 
 LDAP_SLAPD_F(slap_mr_indexer_func) octetStringIndexer;
 LDAP_SLAPD_F(slap_mr_filter_func) octetStringFilter;
@@ -1795,6 +1833,9 @@ LDAP_SLAPD_V(unsigned int) index_intlen_strlen;
 
 LDAP_SLAPD_V(ber_len_t) sockbuf_max_incoming;
 LDAP_SLAPD_V(ber_len_t) sockbuf_max_incoming_auth;
+LDAP_SLAPD_V(ber_len_t) slap_write_batch;
+LDAP_SLAPD_V(ber_len_t) slap_readahead;
+LDAP_SLAPD_V(int) slap_conn_max_executing;
 LDAP_SLAPD_V(int) slap_conn_max_pending;
 LDAP_SLAPD_V(int) slap_conn_max_pending_auth;
 
@@ -1824,7 +1865,10 @@ LDAP_SLAPD_V(slap_time_t) starttime;
 
 LDAP_SLAPD_V(ldap_pvt_thread_pool_t) connection_pool;
 LDAP_SLAPD_V(int) connection_pool_max;
+LDAP_SLAPD_V(int) connection_pool_queues;
+LDAP_SLAPD_V(int) connection_pool_sched;
 LDAP_SLAPD_V(int) slap_tool_thread_max;
+LDAP_SLAPD_V(int) slap_log_async;
 
 LDAP_SLAPD_V(ldap_pvt_thread_mutex_t) entry2str_mutex;
 
@@ -300,36 +300,76 @@ static void
 send_ldap_ber__update_counters(Operation *op, int bytes,
                                enum counters_send_update_mode crutch) {
   assert(bytes > 0);
-  ldap_pvt_thread_mutex_lock(&op->o_counters->sc_mutex);
-  ldap_pvt_mp_add_ulong(op->o_counters->sc_bytes, (unsigned long)bytes);
+  slap_counters_add(op->o_counters, sc_bytes, bytes);
   switch (crutch) {
   case crutch_ldap_response:
-    ldap_pvt_mp_add_ulong(op->o_counters->sc_pdu, 1);
+    slap_counters_add(op->o_counters, sc_pdu, 1);
     break;
   case crutch_search_entry:
-    ldap_pvt_mp_add_ulong(op->o_counters->sc_entries, 1);
-    ldap_pvt_mp_add_ulong(op->o_counters->sc_pdu, 1);
+    slap_counters_add(op->o_counters, sc_entries, 1);
+    slap_counters_add(op->o_counters, sc_pdu, 1);
     break;
   case crutch_search_reference:
-    ldap_pvt_mp_add_ulong(op->o_counters->sc_refs, 1);
-    ldap_pvt_mp_add_ulong(op->o_counters->sc_pdu, 1);
+    slap_counters_add(op->o_counters, sc_refs, 1);
+    slap_counters_add(op->o_counters, sc_pdu, 1);
     break;
   }
-  ldap_pvt_thread_mutex_unlock(&op->o_counters->sc_mutex);
 }
 
-static long send_ldap_ber(Operation *op, BerElement *ber,
-                          enum counters_send_update_mode crutch) {
+/* Append an encoded PDU to the connection's output queue,
+ * c_write1_mutex must be held. */
+static int send_ldap_ber_queue(Connection *conn, BerElement *ber) {
+  struct berval bv;
+
+  if (ber_flatten2(ber, &bv, 0) < 0)
+    return -1;
+  if (conn->c_outbuf.bv_len + bv.bv_len > conn->c_outsize) {
+    ber_len_t size = conn->c_outbuf.bv_len + bv.bv_len;
+
+    if (size < slap_write_batch + SLAP_TEXT_BUFLEN)
+      size = slap_write_batch + SLAP_TEXT_BUFLEN;
+    conn->c_outbuf.bv_val = ch_realloc(conn->c_outbuf.bv_val, size);
+    conn->c_outsize = size;
+  }
+  memcpy(conn->c_outbuf.bv_val + conn->c_outbuf.bv_len, bv.bv_val, bv.bv_len);
+  conn->c_outbuf.bv_len += bv.bv_len;
+  conn->c_outpdus++;
+  return 0;
+}
+
+/* Empty the output queue, releasing the buffer unless a search still
+ * batches, c_write1_mutex must be held. */
+static void send_ldap_ber_reset(Connection *conn) {
+  conn->c_outbuf.bv_len = 0;
+  conn->c_outpdus = 0;
+  if (!conn->c_batch_op && conn->c_outsize) {
+    ch_free(conn->c_outbuf.bv_val);
+    conn->c_outbuf.bv_val = NULL;
+    conn->c_outsize = 0;
+  }
+}
+
+/* Send a PDU, or with ber == NULL just flush the output queue.
+ *
+ * Entries and references of the connection's batching search are
+ * queued and written together once slap_write_batch bytes or
+ * SLAP_WRITE_BATCH_PDUS are pending. Any other PDU is written behind
+ * what is queued, so the order on the wire is kept. */
+static long send_ldap_ber_write(Operation *op, BerElement *ber,
+                                enum counters_send_update_mode crutch) {
   Connection *conn = op->o_conn;
-  ber_len_t bytes;
+  BerElementBuffer berbuf;
+  BerElement *wber = ber;
+  ber_len_t bytes = 0;
   long ret = -1;
 
-  ber_get_option(ber, LBER_OPT_BER_BYTES_TO_WRITE, &bytes);
+  if (ber)
+    ber_get_option(ber, LBER_OPT_BER_BYTES_TO_WRITE, &bytes);
 
   ldap_pvt_thread_mutex_lock(&conn->c_mutex);
   ldap_pvt_thread_mutex_lock(&conn->c_write1_mutex);
 
-  if ((slap_get_op_abandon(op) && !slap_get_op_cancel(op)) ||
+  if ((ber && slap_get_op_abandon(op) && !slap_get_op_cancel(op)) ||
       !connection_valid(conn) || conn->c_writers < 0) {
     ldap_pvt_thread_mutex_unlock(&conn->c_write1_mutex);
     ldap_pvt_thread_mutex_unlock(&conn->c_mutex);
@@ -357,13 +397,41 @@ static long send_ldap_ber(Operation *op, BerElement *ber,
   /* Our turn */
   conn->c_writing = 1;
 
+  if (ber && (conn->c_outbuf.bv_len ||
+              (conn->c_batch_op == op && crutch != crutch_ldap_response))) {
+    if (send_ldap_ber_queue(conn, ber) == 0) {
+      ret = bytes;
+      send_ldap_ber__update_counters(op, bytes, crutch);
+      if (conn->c_batch_op == op && crutch != crutch_ldap_response &&
+          conn->c_outbuf.bv_len < slap_write_batch &&
+          conn->c_outpdus < SLAP_WRITE_BATCH_PDUS)
+        goto done;
+    }
+    ber = NULL;
+  } else if (!ber) {
+    ret = 0;
+  }
+
+  if (!ber) {
+    if (!conn->c_outbuf.bv_len)
+      goto done;
+    /* write out the whole queue */
+    wber = (BerElement *)&berbuf;
+    ber_init2(wber, &conn->c_outbuf, LBER_USE_DER);
+    ber_set_option(wber, LBER_OPT_BER_BYTES_TO_WRITE, &conn->c_outbuf.bv_len);
+  }
+
   /* write the pdu */
   while (conn->c_conn_state >= SLAP_C_ACTIVE) {
     int err;
 
-    if (ber_flush2(conn->c_sb, ber, LBER_FLUSH_FREE_NEVER) == 0) {
-      ret = bytes;
-      send_ldap_ber__update_counters(op, bytes, crutch);
+    if (ber_flush2(conn->c_sb, wber, LBER_FLUSH_FREE_NEVER) == 0) {
+      if (ber) {
+        ret = bytes;
+        send_ldap_ber__update_counters(op, bytes, crutch);
+      } else {
+        send_ldap_ber_reset(conn);
+      }
       break;
     }
 
@@ -408,6 +476,7 @@ static long send_ldap_ber(Operation *op, BerElement *ber,
     }
   }
 
+done:
   conn->c_writing = 0;
   if (conn->c_writers < 0) {
     conn->c_writers++;
@@ -422,6 +491,55 @@ static long send_ldap_ber(Operation *op, BerElement *ber,
   return ret;
 }
 
+/* send_ldap_ber_write(), accounting the time it takes to the operation */
+static long send_ldap_ber(Operation *op, BerElement *ber,
+                          enum counters_send_update_mode crutch) {
+  uint64_t start_ns = ldap_now_steady_ns();
+  long ret = send_ldap_ber_write(op, ber, crutch);
+
+  op->o_send_ns += ldap_now_steady_ns() - start_ns;
+  return ret;
+}
+
+/* Let a search queue its entries on the connection (on != 0), or end
+ * that and write out whatever is still queued. */
+void send_ldap_batch(Operation *op, int on) {
+  Connection *conn = op->o_conn;
+  int pending = 0;
+
+  if (on) {
+    if (!slap_write_batch
+#ifdef LDAP_CONNECTIONLESS
+        || conn->c_is_udp
+#endif
+    )
+      return;
+    ldap_pvt_thread_mutex_lock(&conn->c_write1_mutex);
+    if (!conn->c_batch_op)
+      conn->c_batch_op = op;
+    ldap_pvt_thread_mutex_unlock(&conn->c_write1_mutex);
+    return;
+  }
+
+  ldap_pvt_thread_mutex_lock(&conn->c_write1_mutex);
+  if (conn->c_batch_op == op) {
+    conn->c_batch_op = NULL;
+    if (!conn->c_writing) {
+      /* an abandoned search doesn't get the rest */
+      if (!conn->c_outbuf.bv_len ||
+          (slap_get_op_abandon(op) && !slap_get_op_cancel(op)))
+        send_ldap_ber_reset(conn);
+      else
+        pending = 1;
+    } else if (conn->c_outbuf.bv_len)
+      pending = 1;
+  }
+  ldap_pvt_thread_mutex_unlock(&conn->c_write1_mutex);
+
+  if (pending)
+    send_ldap_ber(op, NULL, crutch_ldap_response);
+}
+
 static int send_ldap_control(BerElement *ber, LDAPControl *c) {
   int rc;
 
@@ -707,6 +825,11 @@ static int send_ldap_response(Operation *op, SlapReply *rs) {
   }
 
   /* send BER */
+#ifdef SLAPD_MONITOR
+  /* the frontend restores o_bd before the operation completes */
+  if (op->o_bd)
+    op->o_result_bd = op->o_bd->bd_self;
+#endif /* SLAPD_MONITOR */
   bytes = send_ldap_ber(op, ber, crutch_ldap_response);
 #ifdef LDAP_CONNECTIONLESS
   if (!op->o_conn || op->o_conn->c_is_udp == 0)
@@ -714,6 +837,8 @@ static int send_ldap_response(Operation *op, SlapReply *rs) {
   {
     ber_free_buf(ber);
   }
+  if (rs->sr_type != REP_INTERMEDIATE)
+    slap_binlog_put(op, rs);
 
   if (bytes < 0) {
     Debug(LDAP_DEBUG_ANY, "send_ldap_response: ber write failed\n");
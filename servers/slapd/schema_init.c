@@ -106,11 +106,18 @@
 
 #include "lutil.h"
 #include "lutil_hash.h"
-#define HASH_BYTES LUTIL_HASH_BYTES
+
+/* index keys are 32-bit FNV-1 unless index_hash64 is on */
+static int hash64;
+
+#define HASH_BYTES LUTIL_HASH64_BYTES
+#define HASH_LEN (hash64 ? LUTIL_HASH64_BYTES : LUTIL_HASH_BYTES)
 #define HASH_CONTEXT lutil_HASH_CTX
-#define HASH_Init(c) lutil_HASHInit(c)
-#define HASH_Update(c, buf, len) lutil_HASHUpdate(c, buf, len)
-#define HASH_Final(d, c) lutil_HASHFinal(d, c)
+#define HASH_Init(c) (hash64 ? lutil_HASH64Init(c) : lutil_HASHInit(c))
+#define HASH_Update(c, buf, len)                                               \
+  (hash64 ? lutil_HASH64Update(c, buf, len) : lutil_HASHUpdate(c, buf, len))
+#define HASH_Final(d, c)                                                       \
+  (hash64 ? lutil_HASH64Final(d, c) : lutil_HASHFinal(d, c))
 
 /* approx matching rules */
 #define directoryStringApproxMatchOID "1.3.6.1.4.1.4203.666.4.4"
@@ -628,6 +635,14 @@ int octetStringOrderingMatch(int *matchp, slap_mask_t flags, Syntax *syntax,
   return LDAP_SUCCESS;
 }
 
+/* Select the width of index hash keys, or with onoff < 0 return it:
+ * nonzero when keys are 64-bit */
+int slap_hash64(int onoff) {
+  if (onoff >= 0)
+    hash64 = onoff ? 1 : 0;
+  return hash64;
+}
+
 /* Initialize HASHcontext from match type and schema info */
 static void hashPreset(HASH_CONTEXT *HASHcontext, struct berval *prefix,
                        char pre, Syntax *syntax, MatchingRule *mr) {
@@ -661,7 +676,7 @@ int octetStringIndexer(slap_mask_t use, slap_mask_t flags, Syntax *syntax,
   unsigned char HASHdigest[HASH_BYTES];
   struct berval digest;
   digest.bv_val = (char *)HASHdigest;
-  digest.bv_len = sizeof(HASHdigest);
+  digest.bv_len = HASH_LEN;
 
   for (i = 0; !BER_BVISNULL(&values[i]); i++) {
     /* just count them */
@@ -696,7 +711,7 @@ int octetStringFilter(slap_mask_t use, slap_mask_t flags, Syntax *syntax,
   struct berval *value = (struct berval *)assertedValue;
   struct berval digest;
   digest.bv_val = (char *)HASHdigest;
-  digest.bv_len = sizeof(HASHdigest);
+  digest.bv_len = HASH_LEN;
 
   keys = slap_sl_malloc(sizeof(struct berval) * 2, ctx);
 
@@ -840,7 +855,7 @@ static int octetStringSubstringsIndexer(slap_mask_t use, slap_mask_t flags,
   unsigned char HASHdigest[HASH_BYTES];
   struct berval digest;
   digest.bv_val = (char *)HASHdigest;
-  digest.bv_len = sizeof(HASHdigest);
+  digest.bv_len = HASH_LEN;
 
   nkeys = 0;
 
@@ -986,7 +1001,7 @@ static int octetStringSubstringsFilter(slap_mask_t use, slap_mask_t flags,
   }
 
   digest.bv_val = (char *)HASHdigest;
-  digest.bv_len = sizeof(HASHdigest);
+  digest.bv_len = HASH_LEN;
 
   keys = slap_sl_malloc(sizeof(struct berval) * (nkeys + 1), ctx);
   nkeys = 0;
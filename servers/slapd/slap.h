@@ -131,6 +131,10 @@ LDAP_BEGIN_DECL
 #define SLAP_CONN_MAX_PENDING_DEFAULT 100
 #define SLAP_CONN_MAX_PENDING_AUTH 1000
 
+/* search entries queued per connection before they are written */
+#define SLAP_WRITE_BATCH_DEFAULT (1 << 16)
+#define SLAP_WRITE_BATCH_PDUS 256
+
 #define SLAP_TEXT_BUFLEN (256)
 
 /* pseudo error code indicating abandoned operation */
@@ -1807,6 +1811,7 @@ struct BackendDB {
 
 #define be_extended bd_info->bi_extended
 #define be_cancel bd_info->bi_op_cancel
+#define be_txn bd_info->bi_op_txn
 
 #define be_chk_referrals bd_info->bi_chk_referrals
 #define be_chk_controls bd_info->bi_chk_controls
@@ -1972,6 +1977,7 @@ struct BackendDB {
   slap_biglock_t *bd_biglock;   /* mutex for synchronization, etc */
   volatile int bd_quorum_cache; /* support for syncrepl quorum */
   slap_quorum_t *bd_quorum;
+  struct slap_histo_t *be_latency; /* per phase, see slap_latency_add() */
 
   /* Replica Information */
   struct berval be_update_ndn; /* allowed to make changes (in replicas) */
@@ -2187,6 +2193,15 @@ typedef BI_op_func BI_op_delete;
 typedef BI_op_func BI_op_abandon;
 typedef BI_op_func BI_op_extended;
 typedef BI_op_func BI_op_cancel;
+
+/* Keep one write transaction of the backend open for several ops on the
+ * same Operation, and commit or abort them at once. The ops find it in
+ * o_extra; *ptr holds it between the calls. */
+struct OpExtra;
+typedef int(BI_op_txn)(Operation *op, int txnop, struct OpExtra **ptr);
+#define SLAP_TXN_BEGIN 1
+#define SLAP_TXN_COMMIT 2
+#define SLAP_TXN_ABORT 3
 typedef BI_op_func BI_chk_referrals;
 typedef BI_op_func BI_chk_controls;
 typedef int(BI_entry_release_rw)(Operation *op, Entry *e, int rw);
@@ -2306,6 +2321,7 @@ struct BackendInfo {
   BI_access_allowed *bi_access_allowed;
   BI_acl_group *bi_acl_group;
   BI_acl_attribute *bi_acl_attribute;
+  BI_op_txn *bi_op_txn;
 
   BI_connection_init *bi_connection_init;
   BI_connection_destroy *bi_connection_destroy;
@@ -2521,21 +2537,83 @@ typedef enum {
   SLAP_OP_LAST
 } slap_op_t;
 
+/* Phases of an operation's latency: waiting for a thread since the
+ * request arrived, running the operation, and writing its responses */
+typedef enum slap_lat_e {
+  SLAP_LAT_QUEUE = 0,
+  SLAP_LAT_EXEC,
+  SLAP_LAT_SEND,
+  SLAP_LAT_LAST
+} slap_lat_t;
+
+/* HDR style histogram of microseconds: a bucket per value below 8,
+ * then 8 buckets per power of two up to 2^32, so no bucket is wider
+ * than an eighth of its lower bound. Only updated with atomics. */
+#define SLAP_HISTO_SUB_BITS 3
+#define SLAP_HISTO_BUCKETS                                                     \
+  ((32 - SLAP_HISTO_SUB_BITS + 1) << SLAP_HISTO_SUB_BITS)
+
+typedef struct slap_histo_t {
+  uint64_t sh_count;
+  uint64_t sh_sum; /* microseconds */
+  uint64_t sh_max;
+  uint64_t sh_bucket[SLAP_HISTO_BUCKETS];
+} slap_histo_t;
+
+/* Structured access log (binlog.c), a directory of segment files. A
+ * segment starts with the header, then records follow, each padded to
+ * 8 bytes; a zero br_len ends the segment. */
+#define SLAP_BINLOG_MAGIC "ReLDAPbl"
+#define SLAP_BINLOG_VERSION 1
+#define SLAP_BINLOG_PREFIX "binlog-"
+
+typedef struct slap_binlog_hdr {
+  char bh_magic[8];
+  uint32_t bh_version;
+  uint32_t bh_recsize; /* sizeof(slap_binlog_rec) */
+  uint64_t bh_time;    /* creation, microseconds since the epoch */
+} slap_binlog_hdr;
+
+typedef struct slap_binlog_rec {
+  uint32_t br_len;   /* of the whole record, stored last */
+  uint8_t br_op;     /* slap_op_t */
+  uint8_t br_scope;  /* of a search, 0xff otherwise */
+  uint16_t br_baselen;
+  uint64_t br_time;  /* completion, microseconds since the epoch */
+  uint64_t br_connid;
+  uint32_t br_opid;
+  int32_t br_result; /* -1 when no result was sent */
+  uint32_t br_nentries;
+  uint32_t br_filterlen;
+  uint32_t br_queue_us;
+  uint32_t br_exec_us;
+  uint32_t br_send_us;
+  uint32_t br_pad;
+  /* the base (request DN) and the search filter follow */
+} slap_binlog_rec;
+
+/* Each worker thread counts into its own cache line aligned share,
+ * the monitor backend sums them up when it is read. slap_counters
+ * holds what exited threads and fake operations counted. */
 typedef struct slap_counters_t {
   struct slap_counters_t *sc_next;
-  ldap_pvt_thread_mutex_t sc_mutex;
-  ldap_pvt_mp_t sc_bytes;
-  ldap_pvt_mp_t sc_pdu;
-  ldap_pvt_mp_t sc_entries;
-  ldap_pvt_mp_t sc_refs;
-
-  ldap_pvt_mp_t sc_ops_completed;
-  ldap_pvt_mp_t sc_ops_initiated;
+  void *sc_free; /* what to pass to ch_free() */
+  uint64_t sc_bytes;
+  uint64_t sc_pdu;
+  uint64_t sc_entries;
+  uint64_t sc_refs;
+
+  uint64_t sc_ops_completed;
+  uint64_t sc_ops_initiated;
 #ifdef SLAPD_MONITOR
-  ldap_pvt_mp_t sc_ops_completed_[SLAP_OP_LAST];
-  ldap_pvt_mp_t sc_ops_initiated_[SLAP_OP_LAST];
+  uint64_t sc_ops_completed_[SLAP_OP_LAST];
+  uint64_t sc_ops_initiated_[SLAP_OP_LAST];
+  slap_histo_t *sc_latency; /* [SLAP_OP_LAST][SLAP_LAT_LAST] */
 #endif /* SLAPD_MONITOR */
-} slap_counters_t;
+} __cache_aligned slap_counters_t;
+
+#define slap_counters_add(sc, field, n)                                        \
+  ((void)__sync_fetch_and_add(&(sc)->field, (n)))
 
 /*
  * represents an operation pending from an ldap client
@@ -2555,6 +2633,10 @@ typedef struct Opheader {
   const BerMemoryFunctions *oh_tmpmfuncs;
 
   slap_counters_t *oh_counters;
+  uint64_t oh_stamp_ns;    /* when the request arrived */
+  uint64_t oh_send_ns;     /* time spent in send_ldap_ber() */
+  uint64_t oh_start_ns;    /* when a thread took it, 0 once in the binlog */
+  BackendDB *oh_result_bd; /* database that sent the result */
 
   char oh_log_prefix[/* sizeof("conn= op=") + 2*LDAP_PVT_INTTYPE_CHARS(unsigned
                         long) */
@@ -2605,6 +2687,10 @@ struct Operation {
 #define o_tmpmemctx o_hdr->oh_tmpmemctx
 #define o_tmpmfuncs o_hdr->oh_tmpmfuncs
 #define o_counters o_hdr->oh_counters
+#define o_stamp_ns o_hdr->oh_stamp_ns
+#define o_send_ns o_hdr->oh_send_ns
+#define o_start_ns o_hdr->oh_start_ns
+#define o_result_bd o_hdr->oh_result_bd
 
 #define o_tmpalloc o_tmpmfuncs->bmf_malloc
 #define o_tmpcalloc o_tmpmfuncs->bmf_calloc
@@ -2694,6 +2780,9 @@ struct Operation {
 #define get_no_schema_check(op) ((op)->o_no_schema_check)
   char o_no_subordinate_glue;
 #define get_no_subordinate_glue(op) ((op)->o_no_subordinate_glue)
+  char o_opclass; /* connection_pool priority class, see opclass.c */
+  char o_shed;    /* refused by the admission control of its class */
+  char o_barrier; /* StartTLS, runs alone on its connection */
 
 #define SLAP_CONTROL_NONE 0
 #define SLAP_CONTROL_IGNORED 1
@@ -2954,6 +3043,12 @@ struct Connection {
   int c_writers;            /* number of writers waiting */
   char c_writing;           /* someone is writing */
 
+  /* output queue of a bulk search, protected by c_write1_mutex */
+  struct berval c_outbuf; /* encoded PDUs not yet written */
+  ber_len_t c_outsize;    /* allocated size of c_outbuf */
+  int c_outpdus;          /* number of PDUs in c_outbuf */
+  Operation *c_batch_op;  /* the op whose entries are queued */
+
   char c_sasl_bind_in_progress; /* multi-op bind in progress */
   char c_writewaiter;           /* true if blocked on write */
   char c_gentle_kick;           /* connection is internal (e.g. syncrepl)
@@ -2994,6 +3089,8 @@ struct Connection {
   long c_n_ops_executing; /* num of ops currently executing */
   long c_n_ops_pending;   /* num of ops pending execution */
   long c_n_ops_completed; /* num of ops completed */
+  int c_n_runners;        /* pipeline tasks submitted but not started */
+  char c_barrier;         /* a barrier op is executing */
 
   long c_n_get;   /* num of get calls */
   long c_n_read;  /* num of read calls */
@@ -3041,6 +3138,9 @@ struct Listener {
 #endif
   int sl_mute; /* Listener is temporarily disabled due to emfile */
   int sl_busy; /* Listener is busy (accept thread activated) */
+  int sl_shard;  /* index among the SO_REUSEPORT sockets of the URL */
+  int sl_shards; /* number of these sockets, 1 if not sharded */
+  volatile unsigned long sl_accepted; /* connections accepted */
   ber_socket_t sl_sd;
   Sockaddr sl_sa;
 #define sl_addr sl_sa.sa_in_addr
@@ -0,0 +1,509 @@
+/* $ReOpenLDAP$ */
+/* Copyright 2018 ReOpenLDAP AUTHORS: please see AUTHORS file.
+ * All rights reserved.
+ *
+ * This file is part of ReOpenLDAP.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+/* slaplog.c - filter and aggregate the binlog segments */
+
+#include "reldap.h"
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <ac/stdlib.h>
+#include <ac/ctype.h>
+#include <ac/errno.h>
+#include <ac/string.h>
+#include <ac/time.h>
+#include <ac/unistd.h>
+
+#include <avl.h>
+
+#include "slap.h"
+
+enum { SL_QUEUE, SL_EXEC, SL_SEND, SL_LAST };
+
+/* in the order of slap_op_t */
+static const char *const slaplog_ops[] = {
+    "bind",  "unbind", "search", "compare", "modify",
+    "modrdn", "add",   "delete", "abandon", "extended"};
+
+static const char *const slaplog_keys[] = {"op", "conn", "err", "base",
+                                           "filter", NULL};
+enum { SK_OP, SK_CONN, SK_ERR, SK_BASE, SK_FILTER, SK_NONE };
+
+typedef struct slaplog_group {
+  struct berval sg_key;
+  unsigned long sg_count;
+  unsigned long sg_errors;
+  unsigned long sg_entries;
+  uint64_t sg_sum[SL_LAST];
+  uint64_t sg_max[SL_LAST];
+} slaplog_group;
+
+static struct {
+  int op;
+  int has_conn, has_err;
+  unsigned long long conn;
+  long err;
+  const char *base, *filter;
+  unsigned long min_us;
+  uint64_t from, until;
+  int json;
+  int key;
+} sl = {-1, 0, 0, 0, 0, NULL, NULL, 0, 0, UINT64_MAX, 0, SK_NONE};
+
+static Avlnode *slaplog_tree;
+static slaplog_group **slaplog_groups;
+static unsigned long slaplog_ngroups, slaplog_nrecords, slaplog_nmatched;
+
+static void usage(const char *s) {
+  fprintf(stderr,
+          "Usage: %s [options] <segment|directory>...\n"
+          "  -b text\tonly requests whose base DN contains text\n"
+          "  -c conn\tonly operations of the connection\n"
+          "  -e err\tonly results with the code, -1 for none sent\n"
+          "  -f text\tonly searches whose filter contains text\n"
+          "  -g key\taggregate by op, conn, err, base or filter\n"
+          "  -j\t\tJSON lines output\n"
+          "  -o op\t\tonly operations of the type (bind, search, ...)\n"
+          "  -s time\tonly operations completed at or after time\n"
+          "  -t usec\tonly operations taking at least usec in total\n"
+          "  -u time\tonly operations completed before time\n"
+          "  time is YYYYmmddHHMMSS (UTC)\n",
+          s);
+  exit(EXIT_FAILURE);
+}
+
+static uint64_t slaplog_time(const char *progname, const char *arg) {
+  struct tm tm;
+  char *end;
+
+  memset(&tm, 0, sizeof(tm));
+  end = strptime(arg, "%Y%m%d%H%M%S", &tm);
+  if (!end || *end)
+    usage(progname);
+  return timegm(&tm) * 1000000ull;
+}
+
+/* case insensitive search of a NUL terminated needle in a berval */
+static int slaplog_contains(const struct berval *bv, const char *needle) {
+  size_t n = strlen(needle), i, j;
+
+  for (i = 0; i + n <= bv->bv_len; i++) {
+    for (j = 0; j < n; j++)
+      if (TOLOWER((unsigned char)bv->bv_val[i + j]) !=
+          TOLOWER((unsigned char)needle[j]))
+        break;
+    if (j == n)
+      return 1;
+  }
+  return 0;
+}
+
+static void slaplog_json_str(const char *name, const struct berval *bv) {
+  ber_len_t i;
+
+  printf(",\"%s\":\"", name);
+  for (i = 0; i < bv->bv_len; i++) {
+    unsigned char c = bv->bv_val[i];
+    if (c == '"' || c == '\\')
+      printf("\\%c", c);
+    else if (c < 0x20)
+      printf("\\u%04x", c);
+    else
+      putchar(c);
+  }
+  putchar('"');
+}
+
+static const char *slaplog_opname(unsigned op) {
+  return op < sizeof(slaplog_ops) / sizeof(slaplog_ops[0]) ? slaplog_ops[op]
+                                                           : "unknown";
+}
+
+static void slaplog_print(const slap_binlog_rec *rec, struct berval *base,
+                          struct berval *filter) {
+  time_t t = rec->br_time / 1000000;
+  unsigned us = rec->br_time % 1000000;
+  char stamp[sizeof("YYYYmmddHHMMSS")];
+  struct tm tm;
+
+  gmtime_r(&t, &tm);
+  strftime(stamp, sizeof(stamp), "%Y%m%d%H%M%S", &tm);
+
+  if (sl.json) {
+    printf("{\"time\":\"%s.%06uZ\",\"conn\":%llu,\"op\":%u,\"type\":\"%s\"",
+           stamp, us, (unsigned long long)rec->br_connid, rec->br_opid,
+           slaplog_opname(rec->br_op));
+    slaplog_json_str("base", base);
+    if (rec->br_scope != 0xff) {
+      printf(",\"scope\":\"%s\"", ldap_pvt_scope2str(rec->br_scope));
+      slaplog_json_str("filter", filter);
+      printf(",\"nentries\":%u", rec->br_nentries);
+    }
+    printf(",\"err\":%d,\"queue\":%u,\"exec\":%u,\"send\":%u}\n",
+           rec->br_result, rec->br_queue_us, rec->br_exec_us,
+           rec->br_send_us);
+    return;
+  }
+
+  printf("%s.%06uZ conn=%llu op=%u %s base=\"%.*s\"", stamp, us,
+         (unsigned long long)rec->br_connid, rec->br_opid,
+         slaplog_opname(rec->br_op), (int)base->bv_len, base->bv_val);
+  if (rec->br_scope != 0xff)
+    printf(" scope=%s filter=\"%.*s\" nentries=%u",
+           ldap_pvt_scope2str(rec->br_scope), (int)filter->bv_len,
+           filter->bv_val, rec->br_nentries);
+  printf(" err=%d queue=%uus exec=%uus send=%uus\n", rec->br_result,
+         rec->br_queue_us, rec->br_exec_us, rec->br_send_us);
+}
+
+static int slaplog_group_cmp(const void *a, const void *b) {
+  const slaplog_group *ga = a, *gb = b;
+
+  return ber_bvcmp(&ga->sg_key, &gb->sg_key);
+}
+
+static void slaplog_add(const slap_binlog_rec *rec, struct berval *base,
+                        struct berval *filter) {
+  slaplog_group key, *sg;
+  uint32_t us[SL_LAST];
+  char buf[32];
+  int i;
+
+  switch (sl.key) {
+  case SK_OP:
+    ber_str2bv(slaplog_opname(rec->br_op), 0, 0, &key.sg_key);
+    break;
+  case SK_CONN:
+    key.sg_key.bv_val = buf;
+    key.sg_key.bv_len = snprintf(buf, sizeof(buf), "%llu",
+                                 (unsigned long long)rec->br_connid);
+    break;
+  case SK_ERR:
+    key.sg_key.bv_val = buf;
+    key.sg_key.bv_len = snprintf(buf, sizeof(buf), "%d", rec->br_result);
+    break;
+  case SK_BASE:
+    key.sg_key = *base;
+    break;
+  default:
+    key.sg_key = *filter;
+    break;
+  }
+
+  sg = avl_find(slaplog_tree, &key, slaplog_group_cmp);
+  if (!sg) {
+    sg = ch_calloc(1, sizeof(slaplog_group));
+    ber_dupbv(&sg->sg_key, &key.sg_key);
+    avl_insert(&slaplog_tree, sg, slaplog_group_cmp, avl_dup_error);
+    if ((slaplog_ngroups & (slaplog_ngroups - 1)) == 0)
+      slaplog_groups =
+          ch_realloc(slaplog_groups, (slaplog_ngroups ? slaplog_ngroups * 2
+                                                      : 1) *
+                                         sizeof(slaplog_group *));
+    slaplog_groups[slaplog_ngroups++] = sg;
+  }
+
+  us[SL_QUEUE] = rec->br_queue_us;
+  us[SL_EXEC] = rec->br_exec_us;
+  us[SL_SEND] = rec->br_send_us;
+  sg->sg_count++;
+  if (rec->br_result > 0)
+    sg->sg_errors++;
+  sg->sg_entries += rec->br_nentries;
+  for (i = 0; i < SL_LAST; i++) {
+    sg->sg_sum[i] += us[i];
+    if (sg->sg_max[i] < us[i])
+      sg->sg_max[i] = us[i];
+  }
+}
+
+static void slaplog_rec(const slap_binlog_rec *rec, const char *text) {
+  struct berval base, filter;
+
+  slaplog_nrecords++;
+  if (sl.op >= 0 && rec->br_op != sl.op)
+    return;
+  if (sl.has_conn && rec->br_connid != sl.conn)
+    return;
+  if (sl.has_err && rec->br_result != sl.err)
+    return;
+  if (rec->br_time < sl.from || rec->br_time >= sl.until)
+    return;
+  if (sl.min_us && (uint64_t)rec->br_queue_us + rec->br_exec_us +
+                           rec->br_send_us <
+                       sl.min_us)
+    return;
+
+  base.bv_val = (char *)text;
+  base.bv_len = rec->br_baselen;
+  filter.bv_val = (char *)text + rec->br_baselen;
+  filter.bv_len = rec->br_filterlen;
+  if (sl.base && !slaplog_contains(&base, sl.base))
+    return;
+  if (sl.filter && !slaplog_contains(&filter, sl.filter))
+    return;
+
+  slaplog_nmatched++;
+  if (sl.key != SK_NONE)
+    slaplog_add(rec, &base, &filter);
+  else
+    slaplog_print(rec, &base, &filter);
+}
+
+static int slaplog_segment(const char *path) {
+  const slap_binlog_hdr *bh;
+  struct stat st;
+  size_t off;
+  char *map;
+  int fd, rc = 0;
+
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    fprintf(stderr, "%s: %s\n", path, STRERROR(errno));
+    if (fd >= 0)
+      close(fd);
+    return 1;
+  }
+  if (st.st_size < (off_t)sizeof(slap_binlog_hdr)) {
+    close(fd);
+    return 0;
+  }
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    fprintf(stderr, "%s: %s\n", path, STRERROR(errno));
+    return 1;
+  }
+  madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+  bh = (const slap_binlog_hdr *)map;
+  if (memcmp(bh->bh_magic, SLAP_BINLOG_MAGIC, sizeof(bh->bh_magic)) ||
+      bh->bh_version != SLAP_BINLOG_VERSION ||
+      bh->bh_recsize < sizeof(slap_binlog_rec)) {
+    fprintf(stderr, "%s: not a binlog segment\n", path);
+    rc = 1;
+    goto done;
+  }
+
+  for (off = sizeof(*bh); off + bh->bh_recsize <= (size_t)st.st_size;) {
+    const slap_binlog_rec *rec = (const slap_binlog_rec *)(map + off);
+    uint32_t len = rec->br_len;
+
+    if (len == 0)
+      break;
+    if (len < bh->bh_recsize || len > st.st_size - off ||
+        bh->bh_recsize + rec->br_baselen + rec->br_filterlen > len) {
+      fprintf(stderr, "%s: broken record at offset %zu\n", path, off);
+      rc = 1;
+      break;
+    }
+    slaplog_rec(rec, map + off + bh->bh_recsize);
+    off += len;
+  }
+
+  /* zeroes are the unwritten tail of the last segment, anything else
+   * is a record being written, or one a crash cut short */
+  if (rc == 0) {
+    size_t end = off;
+    while (end < (size_t)st.st_size && map[end] == 0)
+      end++;
+    if (end < (size_t)st.st_size) {
+      fprintf(stderr, "%s: truncated record at offset %zu\n", path, off);
+      rc = 1;
+    }
+  }
+
+done:
+  munmap(map, st.st_size);
+  return rc;
+}
+
+static int slaplog_name_cmp(const void *a, const void *b) {
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static int slaplog_dir(const char *path) {
+  char name[MAXPATHLEN], **names = NULL;
+  int i, n = 0, max = 0, rc = 0;
+  struct dirent *de;
+  DIR *dir;
+
+  dir = opendir(path);
+  if (!dir) {
+    fprintf(stderr, "%s: %s\n", path, STRERROR(errno));
+    return 1;
+  }
+  while ((de = readdir(dir)) != NULL) {
+    if (strncmp(de->d_name, SLAP_BINLOG_PREFIX, STRLENOF(SLAP_BINLOG_PREFIX)))
+      continue;
+    if (n == max) {
+      max = max ? max * 2 : 64;
+      names = ch_realloc(names, max * sizeof(char *));
+    }
+    names[n++] = ch_strdup(de->d_name);
+  }
+  closedir(dir);
+
+  qsort(names, n, sizeof(char *), slaplog_name_cmp);
+  for (i = 0; i < n; i++) {
+    snprintf(name, sizeof(name), "%s/%s", path, names[i]);
+    rc |= slaplog_segment(name);
+    ch_free(names[i]);
+  }
+  ch_free(names);
+  return rc;
+}
+
+static int slaplog_count_cmp(const void *a, const void *b) {
+  const slaplog_group *ga = *(slaplog_group *const *)a,
+                      *gb = *(slaplog_group *const *)b;
+
+  if (ga->sg_count != gb->sg_count)
+    return ga->sg_count > gb->sg_count ? -1 : 1;
+  return ber_bvcmp(&ga->sg_key, &gb->sg_key);
+}
+
+static void slaplog_report(void) {
+  unsigned long i;
+
+  qsort(slaplog_groups, slaplog_ngroups, sizeof(slaplog_group *),
+        slaplog_count_cmp);
+  if (!sl.json)
+    printf("%10s %8s %10s %9s %9s %9s %10s  %s\n", "count", "errors",
+           "entries", "avg-queue", "avg-exec", "avg-send", "max-exec",
+           slaplog_keys[sl.key]);
+  for (i = 0; i < slaplog_ngroups; i++) {
+    slaplog_group *sg = slaplog_groups[i];
+    uint64_t n = sg->sg_count;
+
+    if (sl.json) {
+      printf("{\"count\":%lu,\"errors\":%lu,\"entries\":%lu", sg->sg_count,
+             sg->sg_errors, sg->sg_entries);
+      slaplog_json_str(slaplog_keys[sl.key], &sg->sg_key);
+      printf(",\"avg_queue\":%llu,\"avg_exec\":%llu,\"avg_send\":%llu",
+             (unsigned long long)(sg->sg_sum[SL_QUEUE] / n),
+             (unsigned long long)(sg->sg_sum[SL_EXEC] / n),
+             (unsigned long long)(sg->sg_sum[SL_SEND] / n));
+      printf(",\"max_queue\":%llu,\"max_exec\":%llu,\"max_send\":%llu}\n",
+             (unsigned long long)sg->sg_max[SL_QUEUE],
+             (unsigned long long)sg->sg_max[SL_EXEC],
+             (unsigned long long)sg->sg_max[SL_SEND]);
+    } else {
+      printf("%10lu %8lu %10lu %9llu %9llu %9llu %10llu  %.*s\n",
+             sg->sg_count, sg->sg_errors, sg->sg_entries,
+             (unsigned long long)(sg->sg_sum[SL_QUEUE] / n),
+             (unsigned long long)(sg->sg_sum[SL_EXEC] / n),
+             (unsigned long long)(sg->sg_sum[SL_SEND] / n),
+             (unsigned long long)sg->sg_max[SL_EXEC],
+             (int)sg->sg_key.bv_len, sg->sg_key.bv_val);
+    }
+  }
+}
+
+static void slaplog_group_free(void *arg) {
+  slaplog_group *sg = arg;
+
+  ch_free(sg->sg_key.bv_val);
+  ch_free(sg);
+}
+
+int slaplog(int argc, char **argv) {
+  const char *progname = "slaplog";
+  int i, rc = 0;
+  char *end;
+
+  while ((i = getopt(argc, argv, "b:c:e:f:g:jo:s:t:u:")) != EOF) {
+    switch (i) {
+    case 'b':
+      sl.base = optarg;
+      break;
+    case 'c':
+      sl.conn = strtoull(optarg, &end, 10);
+      if (*end)
+        usage(progname);
+      sl.has_conn = 1;
+      break;
+    case 'e':
+      sl.err = strtol(optarg, &end, 10);
+      if (*end)
+        usage(progname);
+      sl.has_err = 1;
+      break;
+    case 'f':
+      sl.filter = optarg;
+      break;
+    case 'g':
+      for (sl.key = 0; slaplog_keys[sl.key]; sl.key++)
+        if (strcasecmp(optarg, slaplog_keys[sl.key]) == 0)
+          break;
+      if (!slaplog_keys[sl.key])
+        usage(progname);
+      break;
+    case 'j':
+      sl.json = 1;
+      break;
+    case 'o':
+      for (sl.op = 0; sl.op < SLAP_OP_LAST; sl.op++)
+        if (strcasecmp(optarg, slaplog_ops[sl.op]) == 0)
+          break;
+      if (sl.op == SLAP_OP_LAST)
+        usage(progname);
+      break;
+    case 's':
+      sl.from = slaplog_time(progname, optarg);
+      break;
+    case 't':
+      sl.min_us = strtoul(optarg, &end, 10);
+      if (*end)
+        usage(progname);
+      break;
+    case 'u':
+      sl.until = slaplog_time(progname, optarg);
+      break;
+    default:
+      usage(progname);
+    }
+  }
+  if (optind == argc)
+    usage(progname);
+
+  for (i = optind; i < argc; i++) {
+    struct stat st;
+
+    if (stat(argv[i], &st) != 0) {
+      fprintf(stderr, "%s: %s\n", argv[i], STRERROR(errno));
+      rc = 1;
+    } else if (S_ISDIR(st.st_mode)) {
+      rc |= slaplog_dir(argv[i]);
+    } else {
+      rc |= slaplog_segment(argv[i]);
+    }
+  }
+
+  if (sl.key != SK_NONE) {
+    slaplog_report();
+    avl_free(slaplog_tree, slaplog_group_free);
+    ch_free(slaplog_groups);
+  }
+  if (!sl.json)
+    fprintf(stderr, "%lu of %lu records matched\n", slaplog_nmatched,
+            slaplog_nrecords);
+
+  return rc ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,60 @@
+/* $ReOpenLDAP$ */
+/* Copyright 2011-2018 ReOpenLDAP AUTHORS: please see AUTHORS file.
+ * All rights reserved.
+ *
+ * This file is part of ReOpenLDAP.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+#ifndef SLAP_SLOG_H_
+#define SLAP_SLOG_H_
+
+#include <ldap_cdefs.h>
+
+LDAP_BEGIN_DECL
+
+/* Session logs a backend keeps for overlays, exported through bi_extra.
+ * Only back-mdb does so, see back-mdb/slog.c. */
+
+/* Called for each record of a session log, stops the walk if non-zero */
+typedef int(mdb_slog_func)(void *arg, struct berval *csn, struct berval *data);
+
+typedef struct mdb_extra_t {
+  /* Session logs are sub-databases keyed by CSN. A log that was not
+   * closed by slog_close() is emptied when opened, and the state saved
+   * by slog_close() is handed back in *state and removed. */
+  int (*slog_open)(BackendDB *be, const char *name, unsigned *dbi,
+                   size_t *num, struct berval *state);
+  int (*slog_close)(BackendDB *be, unsigned dbi, struct berval *state);
+  /* Store a record, then drop the oldest ones beyond max, passing
+   * each to func. Both are done in txn, which the caller was handed
+   * by a slog_hook_t and which is committed along with the update. */
+  int (*slog_put)(BackendDB *be, void *txn, unsigned dbi, struct berval *csn,
+                  struct berval *data, size_t max, mdb_slog_func *func,
+                  void *arg, size_t *num);
+  /* Walk the records in CSN order, from the first not below from */
+  int (*slog_scan)(Operation *op, BackendDB *be, unsigned dbi,
+                   struct berval *from, mdb_slog_func *func, void *arg);
+  int (*slog_clear)(BackendDB *be, unsigned dbi);
+} mdb_extra_t;
+
+/* Put on op->o_extra of an update with oe_key set to the bi_extra of
+ * the backend. Once the update is done, the backend of sh_be calls
+ * sh_func with its write txn, before that txn is committed, so the
+ * records of the update are stored by the same commit. */
+typedef struct slog_hook {
+  OpExtra sh_oe;
+  BackendDB *sh_be;
+  void (*sh_func)(Operation *op, struct slog_hook *sh, void *txn);
+} slog_hook_t;
+
+LDAP_END_DECL
+
+#endif /* SLAP_SLOG_H_ */
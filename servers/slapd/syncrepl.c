@@ -29,22 +29,13 @@
 #include "slapconfig.h"
 
 #include "ldap_rq.h"
+#include "presentlist.h"
 
 #ifdef ENABLE_REWRITE
 #include "rewrite.h"
 #define SUFFIXM_CTX "<suffix massage>"
 #endif
 
-#define UUIDLEN 16
-#define HASHUUID 65003u /* LY: someone prime */
-typedef struct presentlist {
-  void *opacity;
-} presentlist_t;
-static int presentlist_insert(presentlist_t *list, struct berval *syncUUID);
-static void presentlist_delete(presentlist_t *list, struct berval *syncUUID);
-static char *presentlist_find(presentlist_t *list, struct berval *syncUUID);
-static void presentlist_free(presentlist_t *list);
-
 /* LY: This should be differ from any error-code in ldap.h,
  *	   the -42 seems good... */
 #define SYNC_PAUSED -42
@@ -81,6 +72,8 @@ typedef struct cookie_state {
 #define RETRYNUM_VALID(n) ((n) >= RETRYNUM_FOREVER) /* valid retrynum */
 #define RETRYNUM_FINITE(n) ((n) > RETRYNUM_FOREVER) /* not forever */
 
+#define SYNCREPL_BATCHTIME_DEFAULT 100 /* msec, see syncrepl_batch_begin() */
+
 typedef struct syncinfo_s {
   struct syncinfo_s *si_next;
   BackendDB *si_be;
@@ -111,6 +104,15 @@ typedef struct syncinfo_s {
   int si_cookieAge;
   int si_slimit;
   int si_tlimit;
+  int si_batch;     /* changes applied in one backend txn */
+  int si_batchtime; /* msec a batch waits for more changes */
+  int si_batch_count;
+  int si_batch_replay; /* changes to apply one by one after an abort */
+  uint64_t si_batch_deadline;
+  OpExtra *si_batch_txn;                /* the open batch, if any */
+  struct sync_cookie si_batch_cookie;   /* si_syncCookie at its begin */
+  struct sync_cookie si_batch_csstate;  /* and the si_cookieState */
+  int si_bootstrap; /* partitions of a parallel initial refresh */
   time_t si_refreshBeg;
   int si_got;
   ber_int_t si_msgid;
@@ -155,7 +157,8 @@ static int syncrepl_del_nonpresent(Operation *, syncinfo_t *,
                                    slap_biglock_t *bl, BerVarray syncUUIDs,
                                    struct sync_cookie *, int which);
 static int syncrepl_message_to_op(syncinfo_t *, Operation *, LDAPMessage *);
-static int syncrepl_message_to_entry(syncinfo_t *, Operation *, LDAPMessage *,
+static int syncrepl_message_to_entry(syncinfo_t *, LDAP *, Operation *,
+                                     LDAPMessage *,
                                      Modifications **, Entry **, int,
                                      struct berval *);
 static int syncrepl_entry(syncinfo_t *, Operation *, Entry *, Modifications **,
@@ -608,6 +611,464 @@ static int syncrepl_gentle_shutdown(LDAP *ld) {
   return slapd_gentle_shutdown != 0;
 }
 
+/* A parallel initial refresh of an empty replica. The content is split
+ * into entryUUID ranges, each pulled by a refreshOnly search of its own
+ * connection and added straight to the database. Helpers from the
+ * connection pool and the syncrepl task itself take the ranges in turn,
+ * so the bootstrap completes even when no helper gets a thread. The floor
+ * of the cookies the ranges end with is stored as the contextCSN, and the
+ * regular session then brings the changes made meanwhile. */
+typedef struct syncboot_s {
+  syncinfo_t *sb_si;
+  ldap_pvt_thread_mutex_t sb_mutex;
+  ldap_pvt_thread_cond_t sb_cond;
+  int sb_next;    /* the next range to take */
+  int sb_running; /* helper tasks still running */
+  int sb_rc;      /* first failure, stops the others */
+  int sb_cookies; /* ranges whose cookie is in sb_cookie */
+  struct sync_cookie sb_cookie;
+  struct syncboot_orphan *sb_orphans;
+} syncboot_t;
+
+/* An entry whose parent was not there yet */
+typedef struct syncboot_orphan {
+  struct syncboot_orphan *so_next;
+  Entry *so_e;
+} syncboot_orphan;
+
+/* Lower each CSN of dst to the one src has for the same SID, and drop the
+ * SIDs src doesn't know, so the result is not ahead of either cookie. */
+static void syncrepl_bootstrap_floor(struct sync_cookie *dst,
+                                     struct sync_cookie *src) {
+  int i, j, n = 0;
+
+  for (i = 0; i < dst->numcsns; i++) {
+    for (j = 0; j < src->numcsns && src->sids[j] != dst->sids[i]; j++)
+      ;
+    if (j == src->numcsns) {
+      ber_memfree(dst->ctxcsn[i].bv_val);
+      continue;
+    }
+    if (slap_csn_compare_ts(&src->ctxcsn[j], &dst->ctxcsn[i]) < 0)
+      ber_bvreplace(&dst->ctxcsn[i], &src->ctxcsn[j]);
+    dst->sids[n] = dst->sids[i];
+    dst->ctxcsn[n++] = dst->ctxcsn[i];
+  }
+  BER_BVZERO(&dst->ctxcsn[n]);
+  dst->numcsns = n;
+}
+
+static int syncrepl_bootstrap_add(syncinfo_t *si, Operation *op, Entry *e) {
+  slap_callback cb = {NULL};
+  SlapReply rs_add = {REP_RESULT};
+  slap_biglock_t *bl;
+  Attribute *a;
+
+  op->o_tag = LDAP_REQ_ADD;
+  op->o_bd = si->si_wbe;
+  op->o_req_dn = e->e_name;
+  op->o_req_ndn = e->e_nname;
+  op->ora_e = e;
+  cb.sc_response = syncrepl_null_callback;
+  cb.sc_private = si;
+  op->o_callback = &cb;
+
+  a = attr_find(e->e_attrs, slap_schema.si_ad_entryCSN);
+  if (a)
+    slap_op_csn_assign(op, &a->a_nvals[0]);
+  slap_op_time(&op->o_time, &op->o_tincr);
+
+  bl = slap_biglock_get(op->o_bd);
+  slap_biglock_acquire(bl);
+  op->o_bd->bd_info->bi_op_add(op, &rs_add);
+  slap_biglock_release(bl);
+  slap_op_csn_clean(op);
+  op->o_callback = NULL;
+
+  switch (rs_add.sr_err) {
+  case LDAP_NO_SUCH_OBJECT:
+    /* the caller keeps the entry for a later try */
+    return LDAP_NO_SUCH_OBJECT;
+  case LDAP_SUCCESS:
+  case LDAP_ALREADY_EXISTS:
+    if (op->ora_e == e)
+      be_entry_release_w(op, e);
+    return LDAP_SUCCESS;
+  default:
+    Debug(LDAP_DEBUG_ANY, "syncrepl_bootstrap: %s be_add %s failed (%d)\n",
+          si->si_ridtxt, e->e_name.bv_val, rs_add.sr_err);
+    if (op->ora_e == e)
+      be_entry_release_w(op, e);
+    return rs_add.sr_err;
+  }
+}
+
+/* Pull the entries of one entryUUID range, the first two octets of
+ * which are in [part * 65536 / parts, (part + 1) * 65536 / parts). */
+#define UUID_TAIL "0000-0000-0000-0000-000000000000"
+static int syncrepl_bootstrap_part(syncboot_t *sb, Operation *op, LDAP *ld,
+                                   int part, int parts) {
+  syncinfo_t *si = sb->sb_si;
+  BerElementBuffer berbuf;
+  BerElement *ber = (BerElement *)&berbuf;
+  LDAPControl c[3], *ctrls[4], **rctrls = NULL, *rctrlp;
+  LDAPMessage *msg = NULL;
+  syncboot_orphan *orphans = NULL, **tail = &orphans, *so;
+  struct sync_cookie cookie;
+  struct berval syncUUID[2], raw;
+  unsigned lo = part * 0x10000 / parts, hi = (part + 1) * 0x10000 / parts;
+  char *filter;
+  int rc, err, msgid, syncstate, n = 0;
+  ber_len_t len;
+
+  filter = ch_malloc(si->si_filterstr.bv_len + 128);
+  len = sprintf(filter, "(&%s", si->si_filterstr.bv_val);
+  if (lo)
+    len += sprintf(filter + len, "(entryUUID>=%04x" UUID_TAIL ")", lo);
+  if (hi < 0x10000)
+    len += sprintf(filter + len, "(!(entryUUID>=%04x" UUID_TAIL "))", hi);
+  strcpy(filter + len, ")");
+
+  ber_init2(ber, NULL, LBER_USE_DER);
+  ber_set_option(ber, LBER_OPT_BER_MEMCTX, &op->o_tmpmemctx);
+  ber_printf(ber, "{eb}", LDAP_SYNC_REFRESH_ONLY, 1);
+  if (ber_flatten2(ber, &c[0].ldctl_value, 0) == -1) {
+    ber_free_buf(ber);
+    ch_free(filter);
+    return LDAP_OTHER;
+  }
+  c[0].ldctl_oid = LDAP_CONTROL_SYNC;
+  c[0].ldctl_iscritical = 1;
+  ctrls[0] = &c[0];
+  c[1].ldctl_oid = LDAP_CONTROL_MANAGEDSAIT;
+  BER_BVZERO(&c[1].ldctl_value);
+  c[1].ldctl_iscritical = 1;
+  ctrls[1] = &c[1];
+  ctrls[2] = NULL;
+  if (!BER_BVISNULL(&si->si_bindconf.sb_authzId)) {
+    c[2].ldctl_oid = LDAP_CONTROL_PROXY_AUTHZ;
+    c[2].ldctl_value = si->si_bindconf.sb_authzId;
+    c[2].ldctl_iscritical = 1;
+    ctrls[2] = &c[2];
+    ctrls[3] = NULL;
+  }
+
+  Debug(LDAP_DEBUG_SYNC, "syncrepl_bootstrap: %s range %d/%d %s\n",
+        si->si_ridtxt, part + 1, parts, filter);
+  rc = ldap_search_ext(ld, si->si_base.bv_val, si->si_scope, filter,
+                       si->si_attrs, si->si_attrsonly, ctrls, NULL, NULL,
+                       si->si_slimit, &msgid);
+  ber_free_buf(ber);
+  ch_free(filter);
+  if (rc != LDAP_SUCCESS)
+    return rc;
+
+  slap_cookie_init(&cookie);
+  rc = LDAP_SUCCESS;
+  while (rc == LDAP_SUCCESS) {
+    if (sb->sb_rc != LDAP_SUCCESS || slapd_shutdown) {
+      ldap_abandon_ext(ld, msgid, NULL, NULL);
+      rc = LDAP_SERVER_DOWN;
+      break;
+    }
+    ldap_msgfree(msg);
+    msg = NULL;
+    if (ldap_result(ld, msgid, LDAP_MSG_ONE, NULL, &msg) <= 0) {
+      rc = LDAP_SERVER_DOWN;
+      break;
+    }
+    ldap_controls_free(rctrls);
+    rctrls = NULL;
+
+    switch (ldap_msgtype(msg)) {
+    case LDAP_RES_SEARCH_ENTRY: {
+      Modifications *modlist = NULL;
+      Entry *e = NULL;
+
+      rc = ldap_get_entry_controls(ld, msg, &rctrls);
+      if (rc)
+        break;
+      rctrlp = rctrls ? ldap_control_find(LDAP_CONTROL_SYNC_STATE, rctrls, NULL)
+                      : NULL;
+      if (rctrlp == NULL) {
+        rc = LDAP_PROTOCOL_ERROR;
+        break;
+      }
+      ber_init2(ber, &rctrlp->ldctl_value, LBER_USE_DER);
+      if (ber_scanf(ber, "{em" /*"}"*/, &syncstate, &syncUUID[0]) ==
+              LBER_ERROR ||
+          syncUUID[0].bv_len != UUIDLEN) {
+        rc = LDAP_PROTOCOL_ERROR;
+        break;
+      }
+      op->o_bd = si->si_be;
+      BER_BVZERO(&syncUUID[1]);
+      rc = syncrepl_message_to_entry(si, ld, op, msg, &modlist, &e,
+                                     LDAP_SYNC_ADD, syncUUID);
+      if (rc == LDAP_SUCCESS) {
+        if (!attr_find(e->e_attrs, slap_schema.si_ad_entryUUID))
+          attr_merge_one(e, slap_schema.si_ad_entryUUID, &syncUUID[1],
+                         syncUUID);
+        rc = syncrepl_bootstrap_add(si, op, e);
+        if (rc == LDAP_NO_SUCH_OBJECT) {
+          /* the parent is in a range not done yet */
+          so = ch_malloc(sizeof(syncboot_orphan));
+          so->so_e = e;
+          so->so_next = NULL;
+          *tail = so;
+          tail = &so->so_next;
+          rc = LDAP_SUCCESS;
+        }
+      } else if (e) {
+        entry_free(e);
+      }
+      slap_mods_free(modlist, 1);
+      if (!BER_BVISNULL(&syncUUID[1]))
+        slap_sl_free(syncUUID[1].bv_val, op->o_tmpmemctx);
+      n++;
+      ldap_pvt_thread_pool_pausecheck(&connection_pool);
+    } break;
+
+    case LDAP_RES_SEARCH_RESULT:
+      rc = ldap_parse_result(ld, msg, &err, NULL, NULL, NULL, &rctrls, 0);
+      if (rc == LDAP_SUCCESS)
+        rc = err;
+      if (rc != LDAP_SUCCESS)
+        goto done;
+      rctrlp = rctrls ? ldap_control_find(LDAP_CONTROL_SYNC_DONE, rctrls, NULL)
+                      : NULL;
+      BER_BVZERO(&raw);
+      if (rctrlp) {
+        ber_init2(ber, &rctrlp->ldctl_value, LBER_USE_DER);
+        if (ber_scanf(ber, "{" /*"}"*/) != LBER_ERROR &&
+            ber_peek_tag(ber, &len) == LDAP_TAG_SYNC_COOKIE)
+          ber_scanf(ber, "m", &raw);
+      }
+      if (BER_BVISNULL(&raw) || slap_cookie_parse(&cookie, &raw, NULL) ||
+          !cookie.numcsns) {
+        Debug(LDAP_DEBUG_ANY, "syncrepl_bootstrap: %s range %d/%d ended "
+              "without a cookie\n", si->si_ridtxt, part + 1, parts);
+        rc = LDAP_PROTOCOL_ERROR;
+        goto done;
+      }
+      ldap_pvt_thread_mutex_lock(&sb->sb_mutex);
+      if (sb->sb_cookies++)
+        syncrepl_bootstrap_floor(&sb->sb_cookie, &cookie);
+      else
+        slap_cookie_copy(&sb->sb_cookie, &cookie);
+      ldap_pvt_thread_mutex_unlock(&sb->sb_mutex);
+      goto done;
+
+    default:
+      /* the refreshOnly search of an empty cookie has nothing else */
+      break;
+    }
+  }
+
+done:
+  Debug(rc ? LDAP_DEBUG_ANY : LDAP_DEBUG_SYNC,
+        "syncrepl_bootstrap: %s range %d/%d, %d entries (%d)\n",
+        si->si_ridtxt, part + 1, parts, n, rc);
+  slap_cookie_free(&cookie, 0);
+  ldap_controls_free(rctrls);
+  ldap_msgfree(msg);
+
+  /* retry the orphans whose parents came later in the range, and leave
+   * the rest to syncrepl_bootstrap() */
+  while ((so = orphans) != NULL) {
+    orphans = so->so_next;
+    if (rc != LDAP_SUCCESS) {
+      entry_free(so->so_e);
+    } else if ((err = syncrepl_bootstrap_add(si, op, so->so_e)) ==
+               LDAP_NO_SUCH_OBJECT) {
+      ldap_pvt_thread_mutex_lock(&sb->sb_mutex);
+      so->so_next = sb->sb_orphans;
+      sb->sb_orphans = so;
+      ldap_pvt_thread_mutex_unlock(&sb->sb_mutex);
+      continue;
+    } else {
+      rc = err;
+    }
+    ch_free(so);
+  }
+  return rc;
+}
+
+/* Take the ranges in turn until none is left or one has failed */
+static int syncrepl_bootstrap_run(syncboot_t *sb, Operation *op) {
+  syncinfo_t *si = sb->sb_si;
+  LDAP *ld = NULL;
+  int part, rc = LDAP_SUCCESS;
+
+  for (;;) {
+    ldap_pvt_thread_mutex_lock(&sb->sb_mutex);
+    part = sb->sb_rc == LDAP_SUCCESS && sb->sb_next < si->si_bootstrap
+               ? sb->sb_next++
+               : -1;
+    ldap_pvt_thread_mutex_unlock(&sb->sb_mutex);
+    if (part < 0)
+      break;
+
+    if (!ld) {
+      rc = slap_client_connect(&ld, &si->si_bindconf);
+      if (rc != LDAP_SUCCESS) {
+        ld = NULL;
+      } else {
+        int deref = LDAP_DEREF_NEVER;
+        ldap_set_gentle_shutdown(ld, syncrepl_gentle_shutdown);
+        ldap_set_option(ld, LDAP_OPT_TIMELIMIT, &si->si_tlimit);
+        ldap_set_option(ld, LDAP_OPT_DEREF, &deref);
+        ldap_set_option(ld, LDAP_OPT_REFERRALS, LDAP_OPT_OFF);
+      }
+    }
+    if (rc == LDAP_SUCCESS)
+      rc = syncrepl_bootstrap_part(sb, op, ld, part, si->si_bootstrap);
+    if (rc != LDAP_SUCCESS) {
+      ldap_pvt_thread_mutex_lock(&sb->sb_mutex);
+      if (sb->sb_rc == LDAP_SUCCESS)
+        sb->sb_rc = rc;
+      ldap_pvt_thread_mutex_unlock(&sb->sb_mutex);
+      break;
+    }
+  }
+
+  if (ld)
+    ldap_unbind_ext(ld, NULL, NULL);
+  return rc;
+}
+
+static void *syncrepl_bootstrap_task(void *ctx, void *arg) {
+  syncboot_t *sb = arg;
+  syncinfo_t *si = sb->sb_si;
+  Connection conn = {0};
+  OperationBuffer opbuf;
+  Operation *op;
+
+  connection_fake_init(&conn, &opbuf, ctx);
+  op = &opbuf.ob_op;
+  conn.c_connid = op->o_connid = SLAPD_SYNC_RID2SYNCCONN(si->si_rid);
+  op->o_managedsait = SLAP_CONTROL_NONCRITICAL;
+  op->o_bd = si->si_wbe;
+  op->o_dn = op->o_bd->be_rootdn;
+  op->o_ndn = op->o_bd->be_rootndn;
+  op->o_protocol = LDAP_VERSION3;
+  if (!si->si_schemachecking)
+    op->o_no_schema_check = 1;
+
+  syncrepl_bootstrap_run(sb, op);
+
+  ldap_pvt_thread_mutex_lock(&sb->sb_mutex);
+  sb->sb_running--;
+  ldap_pvt_thread_cond_signal(&sb->sb_cond);
+  ldap_pvt_thread_mutex_unlock(&sb->sb_mutex);
+  return NULL;
+}
+
+static int syncboot_orphan_cmp(const void *a, const void *b) {
+  const syncboot_orphan *x = *(syncboot_orphan *const *)a;
+  const syncboot_orphan *y = *(syncboot_orphan *const *)b;
+
+  /* a parent DN is shorter than those of its children */
+  return (x->so_e->e_nname.bv_len > y->so_e->e_nname.bv_len) -
+         (x->so_e->e_nname.bv_len < y->so_e->e_nname.bv_len);
+}
+
+/* Called from syncrepl_start() before the first search of a consumer
+ * without a cookie. Does nothing unless the database is empty. */
+static int syncrepl_bootstrap(Operation *op, syncinfo_t *si) {
+  BackendDB *be = op->o_bd;
+  syncboot_t sb = {0};
+  syncboot_orphan *so, **sorted;
+  slap_biglock_t *bl;
+  Entry *e = NULL;
+  int i, n, rc;
+
+  if (si->si_bootstrap < 2 || si->si_syncdata ||
+      si->si_scope != LDAP_SCOPE_SUBTREE || si->si_has_syncprov ||
+      overlay_is_inst(si->si_wbe, "syncprov"))
+    return LDAP_SUCCESS;
+
+  op->o_bd = si->si_be;
+  rc = be_entry_get_rw(op, &si->si_be->be_nsuffix[0], NULL, NULL, 0, &e);
+  if (e)
+    be_entry_release_r(op, e);
+  op->o_bd = be;
+  if (rc != LDAP_NO_SUCH_OBJECT)
+    return LDAP_SUCCESS;
+
+  Debug(LDAP_DEBUG_SYNC, "syncrepl_bootstrap: %s %d ranges\n", si->si_ridtxt,
+        si->si_bootstrap);
+  sb.sb_si = si;
+  slap_cookie_init(&sb.sb_cookie);
+  ldap_pvt_thread_mutex_init(&sb.sb_mutex);
+  ldap_pvt_thread_cond_init(&sb.sb_cond);
+
+  for (i = 1; i < si->si_bootstrap; i++) {
+    ldap_pvt_thread_mutex_lock(&sb.sb_mutex);
+    if (ldap_pvt_thread_pool_submit(&connection_pool, syncrepl_bootstrap_task,
+                                    &sb) == 0)
+      sb.sb_running++;
+    ldap_pvt_thread_mutex_unlock(&sb.sb_mutex);
+  }
+
+  syncrepl_bootstrap_run(&sb, op);
+
+  ldap_pvt_thread_mutex_lock(&sb.sb_mutex);
+  while (sb.sb_running) {
+    /* don't hold a pause of the pool while the helpers finish */
+    ldap_pvt_thread_cond_timedwait(100, &sb.sb_cond, &sb.sb_mutex);
+    ldap_pvt_thread_mutex_unlock(&sb.sb_mutex);
+    ldap_pvt_thread_pool_pausecheck(&connection_pool);
+    ldap_pvt_thread_mutex_lock(&sb.sb_mutex);
+  }
+  ldap_pvt_thread_mutex_unlock(&sb.sb_mutex);
+  rc = sb.sb_rc;
+
+  for (n = 0, so = sb.sb_orphans; so; so = so->so_next)
+    n++;
+  if (n) {
+    sorted = ch_malloc(n * sizeof(syncboot_orphan *));
+    for (i = 0, so = sb.sb_orphans; so; so = so->so_next)
+      sorted[i++] = so;
+    qsort(sorted, n, sizeof(syncboot_orphan *), syncboot_orphan_cmp);
+    Debug(LDAP_DEBUG_SYNC, "syncrepl_bootstrap: %s %d orphans\n",
+          si->si_ridtxt, n);
+    for (i = 0; i < n; i++) {
+      so = sorted[i];
+      if (rc != LDAP_SUCCESS) {
+        entry_free(so->so_e);
+      } else if ((rc = syncrepl_bootstrap_add(si, op, so->so_e)) ==
+                 LDAP_NO_SUCH_OBJECT) {
+        /* the parent is out of the replicated content */
+        op->o_bd = si->si_wbe;
+        bl = slap_biglock_get(op->o_bd);
+        slap_biglock_acquire(bl);
+        rc = syncrepl_add_glue(op, so->so_e);
+        slap_biglock_release(bl);
+      }
+      ch_free(so);
+    }
+    ch_free(sorted);
+  }
+
+  if (rc == LDAP_SUCCESS) {
+    op->o_bd = si->si_wbe;
+    bl = slap_biglock_get(op->o_bd);
+    slap_biglock_acquire(bl);
+    rc = syncrepl_cookie_push(si, op, &sb.sb_cookie, 1);
+    slap_biglock_release(bl);
+  }
+  op->o_bd = be;
+  op->o_callback = NULL;
+
+  Debug(rc ? LDAP_DEBUG_ANY : LDAP_DEBUG_SYNC,
+        "syncrepl_bootstrap: %s done (%d)\n", si->si_ridtxt, rc);
+  slap_cookie_free(&sb.sb_cookie, 0);
+  ldap_pvt_thread_cond_destroy(&sb.sb_cond);
+  ldap_pvt_thread_mutex_destroy(&sb.sb_mutex);
+  return rc;
+}
+
 static int syncrepl_start(Operation *op, syncinfo_t *si) {
   int rc;
   int cmdline_cookie_found = 0;
@@ -703,6 +1164,12 @@ static int syncrepl_start(Operation *op, syncinfo_t *si) {
     ldap_pvt_thread_mutex_unlock(&slap_sync_cookie_mutex);
   }
 
+  if (!si->si_syncCookie.numcsns) {
+    rc = syncrepl_bootstrap(op, si);
+    if (rc != LDAP_SUCCESS)
+      return rc;
+  }
+
   /* whenever there are multiple data sources possible, advertise sid */
   si->si_syncCookie.sid =
       (SLAP_MULTIMASTER(si->si_be) || si->si_be != si->si_wbe ||
@@ -905,9 +1372,76 @@ static int syncrepl_eat_cookie(syncinfo_t *si, BerElement *ber,
   return LDAP_SUCCESS;
 }
 
+/* Apply the changes of consecutive search entries in one transaction of
+ * the backend, along with the cookie they bring. A batch holds the
+ * biglock while it waits for more changes, so it is never started without
+ * one. Neither is it with syncprov on the database, which would announce
+ * and remember the changes an aborted batch has not stored, nor while the
+ * changes of an aborted batch are replayed. */
+static void syncrepl_batch_begin(syncinfo_t *si, Operation *op,
+                                 slap_biglock_t *bl) {
+  BackendDB *be = op->o_bd;
+
+  if (si->si_batch < 2 || si->si_batch_txn || si->si_batch_replay > 0 || !bl ||
+      !si->si_wbe->be_txn || si->si_has_syncprov || overlay_is_inst(si->si_wbe, "syncprov"))
+    return;
+
+  op->o_bd = si->si_wbe;
+  if (op->o_bd->be_txn(op, SLAP_TXN_BEGIN, &si->si_batch_txn) ==
+      LDAP_SUCCESS) {
+    slap_cookie_copy(&si->si_batch_cookie, &si->si_syncCookie);
+    ldap_pvt_thread_mutex_lock(&si->si_cookieState->cs_mutex);
+    slap_cookie_copy(&si->si_batch_csstate, &si->si_cookieState->cs_cookie);
+    ldap_pvt_thread_mutex_unlock(&si->si_cookieState->cs_mutex);
+    si->si_batch_count = 0;
+    si->si_batch_deadline =
+        ldap_now_steady_ns() + si->si_batchtime * (uint64_t)1000000;
+  } else {
+    si->si_batch_txn = NULL;
+  }
+  op->o_bd = be;
+}
+
+/* Commit the open batch, or abort it and take back the cookie it has
+ * advanced, so that the provider sends its changes again. They are then
+ * applied one by one, so that the one that failed fails on its own and
+ * those before it are kept. */
+static int syncrepl_batch_end(syncinfo_t *si, Operation *op, int commit) {
+  BackendDB *be = op->o_bd;
+  int rc;
+
+  if (!si->si_batch_txn)
+    return LDAP_SUCCESS;
+
+  op->o_bd = si->si_wbe;
+  rc = op->o_bd->be_txn(op, commit ? SLAP_TXN_COMMIT : SLAP_TXN_ABORT,
+                        &si->si_batch_txn);
+  op->o_bd = be;
+  Debug(rc ? LDAP_DEBUG_ANY : LDAP_DEBUG_SYNC,
+        "syncrepl_batch_end: %s %s %d changes (%d)\n", si->si_ridtxt,
+        commit ? "commit" : "abort", si->si_batch_count, rc);
+
+  if (commit && rc == LDAP_SUCCESS) {
+    slap_cookie_free(&si->si_batch_cookie, 0);
+    slap_cookie_free(&si->si_batch_csstate, 0);
+  } else {
+    si->si_batch_replay = si->si_batch_count + 1;
+    slap_cookie_free(&si->si_syncCookie, 0);
+    slap_cookie_move(&si->si_syncCookie, &si->si_batch_cookie);
+    ldap_pvt_thread_mutex_lock(&si->si_cookieState->cs_mutex);
+    slap_cookie_free(&si->si_cookieState->cs_cookie, 0);
+    slap_cookie_move(&si->si_cookieState->cs_cookie, &si->si_batch_csstate);
+    si->si_cookieState->cs_age++;
+    si->si_cookieAge = si->si_cookieState->cs_age;
+    ldap_pvt_thread_mutex_unlock(&si->si_cookieState->cs_mutex);
+  }
+  return rc;
+}
+
 static int syncrepl_process(Operation *op, syncinfo_t *si) {
   static /* const */ struct timeval nowait = {0, 0};
   struct timeval *const wait_infinite = NULL;
+  struct timeval batchwait, *waitp;
 
   BerElementBuffer berbuf;
   BerElement *ber = (BerElement *)&berbuf;
@@ -943,25 +1477,48 @@ static int syncrepl_process(Operation *op, syncinfo_t *si) {
     }
 
     ldap_msgfree(msg);
-    rc = ldap_result(si->si_ld, si->si_msgid, LDAP_MSG_ONE,
-                     (abs(si->si_type) != LDAP_SYNC_REFRESH_AND_PERSIST ||
-                      !si->si_refreshDone)
-                         ? wait_infinite
-                         : &nowait,
-                     &msg);
+    waitp = (abs(si->si_type) != LDAP_SYNC_REFRESH_AND_PERSIST ||
+             !si->si_refreshDone)
+                ? wait_infinite
+                : &nowait;
+    if (si->si_batch_txn) {
+      /* an open batch waits for more changes until its deadline */
+      uint64_t now = ldap_now_steady_ns(), left = 0;
+      if (now < si->si_batch_deadline)
+        left = si->si_batch_deadline - now;
+      batchwait.tv_sec = left / 1000000000;
+      batchwait.tv_usec = left % 1000000000 / 1000;
+      waitp = &batchwait;
+    }
+    rc = ldap_result(si->si_ld, si->si_msgid, LDAP_MSG_ONE, waitp, &msg);
     if (slapd_shutdown)
       rc = LDAP_SERVER_DOWN;
+    if (rc == 0 && si->si_batch_txn) {
+      rc = syncrepl_batch_end(si, op, 1);
+      slap_biglock_release(bl);
+      bl = NULL;
+      if (rc)
+        goto done;
+      continue;
+    }
     if (rc <= 0)
       break;
 
     syncrepl_notify_quorum(si, QS_PROCESS);
-    assert(bl == NULL);
-    bl = slap_biglock_get(si->si_wbe);
-    /* LY: this is ugly solution, on other hand,
-     * it is reasonable and necessary.
-     * See https://github.com/leo-yuriev/ReOpenLDAP/issues/43
-     */
-    slap_biglock_acquire(bl);
+    /* an open batch keeps the biglock */
+    if (!si->si_batch_txn) {
+      assert(bl == NULL);
+      bl = slap_biglock_get(si->si_wbe);
+      /* LY: this is ugly solution, on other hand,
+       * it is reasonable and necessary.
+       * See https://github.com/leo-yuriev/ReOpenLDAP/issues/43
+       */
+      slap_biglock_acquire(bl);
+    } else if (ldap_msgtype(msg) != LDAP_RES_SEARCH_ENTRY) {
+      rc = syncrepl_batch_end(si, op, 1);
+      if (rc)
+        goto done;
+    }
 
     op->o_opid = ++si->si_opcnt;
     syncrepl_cookie_pull(op, si);
@@ -1048,6 +1605,7 @@ static int syncrepl_process(Operation *op, syncinfo_t *si) {
         goto done;
       }
       op->o_controls[slap_cids.sc_LDAPsync] = &syncCookie;
+      syncrepl_batch_begin(si, op, bl);
 
       if (si->si_syncdata && si->si_logstate == SYNCLOG_LOGBASED) {
         rc = syncrepl_message_to_op(si, op, msg);
@@ -1076,8 +1634,8 @@ static int syncrepl_process(Operation *op, syncinfo_t *si) {
           }
       } else {
         Modifications *modlist = NULL;
-        rc = syncrepl_message_to_entry(si, op, msg, &modlist, &entry, syncstate,
-                                       syncUUID);
+        rc = syncrepl_message_to_entry(si, si->si_ld, op, msg, &modlist,
+                                       &entry, syncstate, syncUUID);
         if (rc == LDAP_SUCCESS)
           rc = syncrepl_entry(si, op, entry, &modlist, syncstate, syncUUID,
                               &syncCookie);
@@ -1088,6 +1646,15 @@ static int syncrepl_process(Operation *op, syncinfo_t *si) {
 
       if (rc == SYNC_RETARDED)
         rc = LDAP_SUCCESS;
+      if (si->si_batch_txn) {
+        if (rc)
+          syncrepl_batch_end(si, op, 0);
+        else if (++si->si_batch_count >= si->si_batch ||
+                 ldap_now_steady_ns() >= si->si_batch_deadline)
+          rc = syncrepl_batch_end(si, op, 1);
+      } else if (rc == LDAP_SUCCESS && si->si_batch_replay > 0) {
+        si->si_batch_replay--;
+      }
       if (rc)
         goto done;
       break;
@@ -1385,11 +1952,16 @@ static int syncrepl_process(Operation *op, syncinfo_t *si) {
       break;
     }
 
-    slap_biglock_release(bl);
-    bl = NULL;
+    if (!si->si_batch_txn) {
+      slap_biglock_release(bl);
+      bl = NULL;
+    }
 
     if (ldap_pvt_thread_pool_pausing(&connection_pool)) {
-      rc = SYNC_PAUSED;
+      /* the changes of the open batch are all stored */
+      rc = syncrepl_batch_end(si, op, 1);
+      if (rc == LDAP_SUCCESS)
+        rc = SYNC_PAUSED;
       break;
     }
   }
@@ -1403,6 +1975,13 @@ static int syncrepl_process(Operation *op, syncinfo_t *si) {
   }
 
 done:
+  if (si->si_batch_txn) {
+    /* on an error the batch may hold a change applied in part,
+     * or one without the cookie it came with */
+    int err = syncrepl_batch_end(si, op, rc == LDAP_SUCCESS);
+    if (err)
+      rc = err;
+  }
   slap_biglock_release(bl);
 
   if (rc != LDAP_SUCCESS) {
@@ -2616,7 +3195,7 @@ static int check_for_retard(syncinfo_t *si, struct sync_cookie *sc,
   return rc;
 }
 
-static int syncrepl_message_to_entry(syncinfo_t *si, Operation *op,
+static int syncrepl_message_to_entry(syncinfo_t *si, LDAP *ld, Operation *op,
                                      LDAPMessage *msg, Modifications **modlist,
                                      Entry **entry, int syncstate,
                                      struct berval *syncUUID) {
@@ -2645,7 +3224,7 @@ static int syncrepl_message_to_entry(syncinfo_t *si, Operation *op,
 
   op->o_tag = LDAP_REQ_ADD;
 
-  rc = ldap_get_dn_ber(si->si_ld, msg, &ber, &bdn);
+  rc = ldap_get_dn_ber(ld, msg, &ber, &bdn);
   if (rc != LDAP_SUCCESS) {
     Debug(LDAP_DEBUG_ANY, "syncrepl_message_to_entry: %s dn get failed (%d)",
           si->si_ridtxt, rc);
@@ -2814,95 +3393,10 @@ done:
   return rc;
 }
 
-static void presentlist_free(presentlist_t *list) {
-  if (list->opacity) {
-#if HASHUUID
-    Avlnode **array = (Avlnode **)list->opacity;
-    int i = HASHUUID;
-
-    while (--i >= 0) {
-      if (array[i]) {
-        avl_free(array[i], ch_free);
-      }
-    }
-    ch_free(list->opacity);
-#else
-    avl_free(list->opacity, ch_free);
-#endif
-    list->opacity = NULL;
-  }
-}
-
-static int presentlist_empty(presentlist_t *list) {
-  if (list->opacity) {
-#if HASHUUID
-    Avlnode **array = (Avlnode **)list->opacity;
-    int i = HASHUUID;
-
-    while (--i >= 0) {
-      if (array[i]) {
-        return 0;
-      }
-    }
-#else
-    return 0;
-#endif
-  }
-  return 1;
-}
-
 static int syncuuid_cmp(const void *a, const void *b) {
   return memcmp(a, b, UUIDLEN);
 }
 
-static __inline Avlnode **presentlist_avl(presentlist_t *list,
-                                          struct berval *uuid) {
-#if HASHUUID
-  Avlnode **array = (Avlnode **)list->opacity;
-  unsigned *body = (unsigned *)(uuid->bv_val);
-  /* LY: malloc() always return aligned */
-  size_t i = body[0] % HASHUUID;
-  return &array[i];
-#else
-  return &list->opacity;
-#endif
-}
-
-/* return 1 if inserted, 0 otherwise */
-static int presentlist_insert(presentlist_t *list, struct berval *uuid) {
-  /* LY: sizeof block will be rounded up by malloc(),
-   * so there is no reason to request a couple of bytes smaller. */
-  char *copy = ch_malloc(UUIDLEN);
-  memcpy(copy, uuid->bv_val, UUIDLEN);
-
-#if HASHUUID
-  if (unlikely(!list->opacity))
-    list->opacity = ch_calloc(HASHUUID, sizeof(Avlnode *));
-#endif
-
-  if (avl_insert(presentlist_avl(list, uuid), copy, syncuuid_cmp,
-                 avl_dup_error)) {
-    ch_free(copy);
-    return 0;
-  }
-  return 1;
-}
-
-static char *presentlist_find(presentlist_t *list, struct berval *uuid) {
-  if (likely(list->opacity))
-    return avl_find(*presentlist_avl(list, uuid), uuid->bv_val, syncuuid_cmp);
-  return NULL;
-}
-
-static void presentlist_delete(presentlist_t *list, struct berval *uuid) {
-  if (likely(list->opacity)) {
-    void *p;
-    p = avl_delete(presentlist_avl(list, uuid), uuid->bv_val, syncuuid_cmp);
-    assert(p != NULL);
-    ch_free(p);
-  }
-}
-
 static struct berval generic_filterstr = BER_BVC("(objectclass=*)");
 
 /* During a refresh, we may get an LDAP_SYNC_ADD for an already existing
@@ -4976,6 +5470,9 @@ static int config_suffixm(ConfigArgs *c, syncinfo_t *si) {
 #define SUFFIXMSTR "suffixmassage"
 #define STRICT_REFRESH "strictrefresh"
 #define REQUIRE_PRESENT "requirecheckpresent"
+#define BATCHSTR "batch"
+#define BATCHTIMESTR "batchtime"
+#define BOOTSTRAPSTR "bootstrap"
 
 /* FIXME: undocumented */
 #define EXATTRSSTR "exattrs"
@@ -5435,6 +5932,33 @@ static int parse_syncrepl_line(ConfigArgs *c, syncinfo_t *si) {
       val = c->argv[i] + STRLENOF(SYNCDATASTR "=");
       si->si_syncdata = verb_to_mask(val, datamodes);
       si->si_got |= GOT_SYNCDATA;
+    } else if (!strncasecmp(c->argv[i], BATCHSTR "=",
+                            STRLENOF(BATCHSTR "="))) {
+      val = c->argv[i] + STRLENOF(BATCHSTR "=");
+      if (lutil_atoi(&si->si_batch, val) != 0 || si->si_batch < 0) {
+        snprintf(c->cr_msg, sizeof(c->cr_msg), "invalid batch value \"%s\".\n",
+                 val);
+        Debug(LDAP_DEBUG_ANY, "%s: %s.\n", c->log, c->cr_msg);
+        return 1;
+      }
+    } else if (!strncasecmp(c->argv[i], BATCHTIMESTR "=",
+                            STRLENOF(BATCHTIMESTR "="))) {
+      val = c->argv[i] + STRLENOF(BATCHTIMESTR "=");
+      if (lutil_atoi(&si->si_batchtime, val) != 0 || si->si_batchtime < 0) {
+        snprintf(c->cr_msg, sizeof(c->cr_msg),
+                 "invalid batchtime value \"%s\".\n", val);
+        Debug(LDAP_DEBUG_ANY, "%s: %s.\n", c->log, c->cr_msg);
+        return 1;
+      }
+    } else if (!strncasecmp(c->argv[i], BOOTSTRAPSTR "=",
+                            STRLENOF(BOOTSTRAPSTR "="))) {
+      val = c->argv[i] + STRLENOF(BOOTSTRAPSTR "=");
+      if (lutil_atoi(&si->si_bootstrap, val) != 0 || si->si_bootstrap < 0) {
+        snprintf(c->cr_msg, sizeof(c->cr_msg),
+                 "invalid bootstrap value \"%s\".\n", val);
+        Debug(LDAP_DEBUG_ANY, "%s: %s.\n", c->log, c->cr_msg);
+        return 1;
+      }
     } else if (!strncasecmp(c->argv[i], STRICT_REFRESH,
                             STRLENOF(STRICT_REFRESH))) {
       si->si_strict_refresh = 1;
@@ -5574,6 +6098,7 @@ static int add_syncrepl(ConfigArgs *c) {
   si->si_retrynum_init = NULL;
   si->si_retrynum = NULL;
   si->si_manageDSAit = 0;
+  si->si_batchtime = SYNCREPL_BATCHTIME_DEFAULT;
   si->si_tlimit = 0;
   si->si_slimit = 0;
 
@@ -5906,6 +6431,21 @@ static void syncrepl_unparse(syncinfo_t *si, struct berval *bv) {
     }
   }
 
+  if (si->si_batch) {
+    len = snprintf(ptr, WHATSLEFT, " " BATCHSTR "=%d " BATCHTIMESTR "=%d",
+                   si->si_batch, si->si_batchtime);
+    if (WHATSLEFT <= len)
+      return;
+    ptr += len;
+  }
+
+  if (si->si_bootstrap) {
+    len = snprintf(ptr, WHATSLEFT, " " BOOTSTRAPSTR "=%d", si->si_bootstrap);
+    if (WHATSLEFT <= len)
+      return;
+    ptr += len;
+  }
+
   if (si->si_strict_refresh) {
     len = snprintf(ptr, WHATSLEFT, " " STRICT_REFRESH);
     if (WHATSLEFT <= len)
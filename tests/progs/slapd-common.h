@@ -31,6 +31,7 @@ typedef enum {
   TESTER_MODRDN,
   TESTER_READ,
   TESTER_SEARCH,
+  TESTER_PIPELINE,
   TESTER_LAST
 } tester_t;
 
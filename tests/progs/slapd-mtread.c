@@ -22,6 +22,8 @@
  * This tool is a MT reader.  It behaves like slapd-read however
  * with one or more threads simultaneously using the same connection.
  * If -M is enabled, then M threads will also perform write operations.
+ * The overall rate is reported at the end; with -c and -m both high it
+ * measures how reads on many connections scale.
  */
 
 #include "reldap.h"
@@ -140,6 +142,8 @@ int main(int argc, char **argv) {
   char outstr[BUFSIZ];
   int ptpass;
   int testfail = 0;
+  unsigned long total = 0;
+  uint64_t start, elapsed;
 
   config = tester_init("slapd-mtread", TESTER_READ);
 
@@ -246,6 +250,8 @@ int main(int argc, char **argv) {
   snprintf(outstr, BUFSIZ, "Threads: RO: %d RW: %d", threads, rwthreads);
   tester_error(outstr);
 
+  start = ldap_now_steady_ns();
+
   /* Set up read only threads */
   for (i = 0; i < threads; i++) {
     ldap_pvt_thread_create(&rtid[i], 0, do_onethread, &rtid[i]);
@@ -267,6 +273,7 @@ int main(int argc, char **argv) {
   /* wait for read/write threads to complete */
   for (i = 0; i < rwthreads; i++)
     ldap_pvt_thread_join(rwtid[i], NULL);
+  elapsed = ldap_now_steady_ns() - start;
 
   for (i = 0; i < noconns; i++) {
     if (lds[i] != NULL) {
@@ -295,6 +302,13 @@ int main(int argc, char **argv) {
       testfail++;
     }
   }
+  for (i = 0; i < threads; i++)
+    total += rt_pass[i];
+  for (i = 0; i < rwthreads; i++)
+    total += rwt_pass[i];
+  snprintf(outstr, BUFSIZ, "MT Test rate: %lu ops in %.3f s, %.0f ops/s",
+           total, elapsed / 1e9, elapsed ? total * 1e9 / elapsed : 0.0);
+  tester_error(outstr);
   snprintf(outstr, BUFSIZ, "MT Test complete");
   tester_error(outstr);
 
@@ -0,0 +1,247 @@
+/* $ReOpenLDAP$ */
+/* Copyright 2018 ReOpenLDAP AUTHORS: please see AUTHORS file.
+ * All rights reserved.
+ *
+ * This file is part of ReOpenLDAP.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+/* Sends <loops> base searches of an entry over one connection without
+ * waiting for the responses, optionally followed by a StartTLS request,
+ * then reads them all. The filters are padded to a different length
+ * each, up to <maxpad> octets, so that the requests straddle the reads
+ * of the server in all the possible ways. Every search must return the
+ * entry, and the StartTLS response must come after the results of all
+ * the searches sent before it. */
+
+#include "reldap.h"
+
+#include <stdio.h>
+
+#include "ac/stdlib.h"
+
+#include "ac/ctype.h"
+#include "ac/param.h"
+#include "ac/socket.h"
+#include "ac/string.h"
+#include "ac/unistd.h"
+#include "ac/wait.h"
+
+#include "ldap.h"
+#include "lutil.h"
+
+#include "ldap_pvt.h"
+
+#include "slapd-common.h"
+
+#define MAXPAD 4096
+
+static void usage(char *name, int opt) {
+  if (opt) {
+    fprintf(stderr, "%s: unable to handle option \'%c\'\n\n", name, opt);
+  }
+
+  fprintf(stderr,
+          "usage: %s " TESTER_COMMON_HELP "-e <entry> "
+          "[-N] "
+          "[-s <maxpad>] "
+          "[-Z] "
+          "\n",
+          name);
+  exit(EXIT_FAILURE);
+}
+
+static int do_pipeline(struct tester_conn_args *config, char *entry,
+                       int nobind, int maxpad, int starttls) {
+  LDAP *ld = NULL;
+  LDAPMessage *res;
+  char *attrs[] = {"1.1", NULL};
+  char *filter;
+  int *msgids, *entries, *done;
+  int i, j, rc, err, tlsid = -1, ndone = 0, tlsdone = 0, fail = 0;
+
+  msgids = calloc(config->loops, sizeof(int));
+  entries = calloc(config->loops, sizeof(int));
+  done = calloc(config->loops, sizeof(int));
+  filter = malloc(maxpad + sizeof("(|(objectClass=*)(description=))"));
+  if (!msgids || !entries || !done || !filter) {
+    tester_error("out of memory");
+    exit(EXIT_FAILURE);
+  }
+
+  tester_init_ld(&ld, config, nobind);
+
+  fprintf(stderr, "PID=%ld - Pipeline(%d): entry=\"%s\"%s.\n", (long)pid,
+          config->loops, entry, starttls ? ", StartTLS" : "");
+
+  for (i = 0; i < config->loops; i++) {
+    int pad = maxpad ? (i * 997) % (maxpad + 1) : 0;
+
+    j = sprintf(filter, "(|(objectClass=*)(description=");
+    memset(filter + j, 'x', pad);
+    strcpy(filter + j + pad, "))");
+    rc = ldap_search_ext(ld, entry, LDAP_SCOPE_BASE, filter, attrs, 0, NULL,
+                         NULL, NULL, LDAP_NO_LIMIT, &msgids[i]);
+    if (rc != LDAP_SUCCESS) {
+      tester_ldap_error(ld, "ldap_search_ext", NULL);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  if (starttls) {
+    rc = ldap_extended_operation(ld, LDAP_EXOP_START_TLS, NULL, NULL, NULL,
+                                 &tlsid);
+    if (rc != LDAP_SUCCESS) {
+      tester_ldap_error(ld, "ldap_extended_operation", NULL);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  while (ndone < config->loops || (starttls && !tlsdone)) {
+    rc = ldap_result(ld, LDAP_RES_ANY, LDAP_MSG_ONE, NULL, &res);
+    if (rc <= 0) {
+      tester_ldap_error(ld, "ldap_result", NULL);
+      exit(EXIT_FAILURE);
+    }
+
+    if (ldap_msgid(res) == tlsid) {
+      rc = ldap_parse_result(ld, res, &err, NULL, NULL, NULL, NULL, 1);
+      if (rc != LDAP_SUCCESS || err != LDAP_SUCCESS) {
+        tester_ldap_error(ld, "StartTLS", NULL);
+        exit(EXIT_FAILURE);
+      }
+      if (ndone < config->loops) {
+        fprintf(stderr,
+                "PID=%ld - Pipeline: StartTLS answered with %d of %d "
+                "searches outstanding\n",
+                (long)pid, config->loops - ndone, config->loops);
+        fail = 1;
+      }
+      tlsdone = 1;
+      continue;
+    }
+
+    for (i = 0; i < config->loops && msgids[i] != ldap_msgid(res); i++)
+      ;
+    if (i == config->loops || done[i]) {
+      fprintf(stderr, "PID=%ld - Pipeline: unexpected message id %d\n",
+              (long)pid, ldap_msgid(res));
+      exit(EXIT_FAILURE);
+    }
+
+    switch (ldap_msgtype(res)) {
+    case LDAP_RES_SEARCH_ENTRY:
+      entries[i]++;
+      ldap_msgfree(res);
+      break;
+
+    case LDAP_RES_SEARCH_RESULT:
+      rc = ldap_parse_result(ld, res, &err, NULL, NULL, NULL, NULL, 1);
+      if (rc != LDAP_SUCCESS || err != LDAP_SUCCESS || entries[i] != 1) {
+        fprintf(stderr,
+                "PID=%ld - Pipeline: search %d: err=%d, %d entries\n",
+                (long)pid, i, rc != LDAP_SUCCESS ? rc : err, entries[i]);
+        fail = 1;
+      }
+      done[i] = 1;
+      ndone++;
+      break;
+
+    default:
+      ldap_msgfree(res);
+      break;
+    }
+  }
+
+  if (starttls && !fail) {
+    rc = ldap_install_tls(ld);
+    if (rc == LDAP_SUCCESS)
+      rc = ldap_search_ext_s(ld, entry, LDAP_SCOPE_BASE, NULL, attrs, 0,
+                             NULL, NULL, NULL, LDAP_NO_LIMIT, &res);
+    if (rc != LDAP_SUCCESS) {
+      tester_ldap_error(ld, "search over TLS", NULL);
+      fail = 1;
+    } else {
+      if (ldap_count_entries(ld, res) != 1) {
+        fprintf(stderr, "PID=%ld - Pipeline: %d entries over TLS\n",
+                (long)pid, ldap_count_entries(ld, res));
+        fail = 1;
+      }
+      ldap_msgfree(res);
+    }
+  }
+
+  fprintf(stderr, "  PID=%ld - Pipeline done (%d).\n", (long)pid, fail);
+
+  ldap_unbind_ext(ld, NULL, NULL);
+  free(filter);
+  free(done);
+  free(entries);
+  free(msgids);
+  return fail;
+}
+
+int main(int argc, char **argv) {
+  int i;
+  char *entry = NULL;
+  int maxpad = MAXPAD;
+  int starttls = 0;
+  int nobind = 0;
+  struct tester_conn_args *config;
+
+  config = tester_init("slapd-pipeline", TESTER_PIPELINE);
+
+  while ((i = getopt(argc, argv, TESTER_COMMON_OPTS "e:Ns:Z")) != EOF) {
+    switch (i) {
+    case 'N':
+      nobind = TESTER_INIT_ONLY;
+      break;
+
+    case 'e': /* DN to search for */
+      entry = strdup(optarg);
+      break;
+
+    case 's': /* the longest filter padding */
+      if (lutil_atoi(&maxpad, optarg) != 0 || maxpad < 0) {
+        usage(argv[0], i);
+      }
+      break;
+
+    case 'Z':
+      starttls++;
+      break;
+
+    default:
+      if (tester_config_opt(config, i, optarg) == LDAP_SUCCESS) {
+        break;
+      }
+      usage(argv[0], i);
+      break;
+    }
+  }
+
+  if (entry == NULL || *entry == '\0' || config->loops < 1)
+    usage(argv[0], 0);
+
+  tester_config_finish(config);
+
+  if (starttls) {
+    /* the ordering is checked here, not the certificates */
+    int never = LDAP_OPT_X_TLS_NEVER;
+    (void)ldap_set_option(NULL, LDAP_OPT_X_TLS_REQUIRE_CERT, &never);
+  }
+
+  for (i = 0; i < config->outerloops; i++) {
+    if (do_pipeline(config, entry, nobind, maxpad, starttls))
+      exit(EXIT_FAILURE);
+  }
+
+  exit(EXIT_SUCCESS);
+}
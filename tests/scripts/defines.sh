@@ -295,6 +295,7 @@ SLAPPASSWD="$TIMEOUT_S $VALGRIND_CMD $SLAPD_SLAPD -Tpasswd"
 
 unset DIFF_OPTIONS
 SLAPDMTREAD=$PROGDIR/slapd_mtread
+SLAPDPIPELINE="$TIMEOUT_S $VALGRIND_EX_CMD $PROGDIR/slapd_pipeline"
 LVL=${SLAPD_DEBUG-sync,stats,args,conns}
 LOCALHOST=${SLAPD_LOCALHOST:-localhost}
 LOCALIP=127.0.0.1